@@ -14,8 +14,6 @@ TEMPLATE = app
 
 DESTDIR = $$PWD
 
-QMAKE_CXXFLAGS += -fopenmp
-QMAKE_LFLAGS += -fopenmp
 QMAKE_LFLAGS += -no-pie
 
 # The following define makes your compiler emit warnings if you use
@@ -30,32 +28,19 @@ DEFINES += QT_DEPRECATED_WARNINGS
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 
+include(core.pri)
+
 SOURCES += main.cpp\
-    gl_objects/gl_buffer.cpp \
-    gl_objects/gl_plane.cpp \
-    gl_objects/gl_triangulated_shape.cpp \
     main_window.cpp \
-    my_opengl_widget.cpp  \
-    util.cpp
+    my_opengl_widget.cpp \
+    render_thread.cpp
 
 HEADERS  += \
-    gl_objects/gl_buffer.h \
-    gl_objects/gl_plane.h \
-    gl_objects/gl_shape.h \
-    gl_objects/gl_triangulated_shape.h \
     main_window.h \
-    my_opengl_widget.h  \
-    objects/light_source.h \
-    objects/material.h \
-    objects/scene.h \
-    objects/sphere.h \
-    util.h
+    my_opengl_widget.h \
+    render_thread.h
 
 FORMS    += \
     main_window.ui 
 
-DISTFILES += \
-    shaders/raytrace.frag \ \
-    shaders/raytrace.vert
-
 RESOURCES +=
@@ -0,0 +1,381 @@
+#include "bvh.h"
+#include "objects/scene_packing.h"
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <numeric>
+
+namespace {
+
+const int NUM_OF_BINS = 16;
+const float TRAVERSAL_COST = 1.0f;
+const float INTERSECTION_COST = 1.0f;
+// Each appended leaf is tested by every ray, so the tree is rebuilt when there are more.
+const int MAX_APPENDED_LEAVES = 16;
+
+struct AABB {
+    QVector3D min {std::numeric_limits<float>::max(),
+                   std::numeric_limits<float>::max(),
+                   std::numeric_limits<float>::max()};
+    QVector3D max {-std::numeric_limits<float>::max(),
+                   -std::numeric_limits<float>::max(),
+                   -std::numeric_limits<float>::max()};
+
+    void extend(const QVector3D &point) {
+        for (int i = 0; i < 3; i++) {
+            min[i] = std::min(min[i], point[i]);
+            max[i] = std::max(max[i], point[i]);
+        }
+    }
+
+    void extend(const AABB &box) {
+        extend(box.min);
+        extend(box.max);
+    }
+
+    bool isEmpty() const {
+        return min.x() > max.x();
+    }
+
+    float area() const {
+        if (isEmpty()) {
+            return 0.0f;
+        }
+        const auto d = max - min;
+        return 2.0f * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+    }
+};
+
+AABB sphereBounds(const Sphere &sphere) {
+    const auto r = static_cast<float>(sphere.radius);
+    AABB box;
+    box.min = sphere.position - QVector3D(r, r, r);
+    box.max = sphere.position + QVector3D(r, r, r);
+    return box;
+}
+
+AABB nodeBounds(const BVH::Node &node) {
+    AABB box;
+    box.min = node.min;
+    box.max = node.max;
+    return box;
+}
+
+struct Bin {
+    AABB bounds;
+    int count = 0;
+};
+
+struct BuildTask {
+    int begin;
+    int end;
+    int parent; // index of the parent node if this is a right child, -1 otherwise
+};
+
+}
+
+void BVH::build(const std::vector<Sphere> &spheres) {
+    std::vector<QVector3D> prim_min(spheres.size()), prim_max(spheres.size());
+    for (size_t i = 0; i < spheres.size(); i++) {
+        const auto box = sphereBounds(spheres[i]);
+        prim_min[i] = box.min;
+        prim_max[i] = box.max;
+    }
+    build(prim_min, prim_max);
+}
+
+void BVH::update(const std::vector<Sphere> &spheres, const DirtyRanges &changed) {
+    const auto num_of_indexed = static_cast<int>(indices.size());
+    const auto num_of_spheres = static_cast<int>(spheres.size());
+    if (num_of_spheres < num_of_indexed) {
+        build(spheres);
+        return;
+    }
+    refit(spheres, changed);
+    if (num_of_spheres > num_of_indexed && !append(spheres)) {
+        build(spheres);
+    }
+}
+
+void BVH::refit(const std::vector<Sphere> &spheres, const DirtyRanges &changed) {
+    const auto num_of_indexed = static_cast<int>(indices.size());
+    // Leaves of the changed spheres and all their ancestors.
+    std::vector<int> touched;
+    for (const auto &range: changed) {
+        for (int i = range.begin; i < std::min(range.end, num_of_indexed); i++) {
+            for (int node = leaves[i]; node >= 0; node = parents[node]) {
+                touched.push_back(node);
+            }
+        }
+    }
+    // Children follow their parent in depth-first order, so going down the indices visits them first.
+    std::sort(touched.begin(), touched.end(), std::greater<int>());
+    touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+    for (const auto i: touched) {
+        auto &node = nodes[i];
+        AABB box;
+        if (node.isLeaf()) {
+            for (int j = node.first_or_skip; j < node.first_or_skip + node.count; j++) {
+                box.extend(sphereBounds(spheres[indices[j]]));
+            }
+        } else {
+            const auto left = i + 1;
+            const auto right = nodes[left].skip(left);
+            box.extend(nodeBounds(nodes[left]));
+            box.extend(nodeBounds(nodes[right]));
+        }
+        node.min = box.min;
+        node.max = box.max;
+        changes.nodes.add(i);
+    }
+}
+
+bool BVH::append(const std::vector<Sphere> &spheres) {
+    const auto first_index = static_cast<int>(indices.size());
+    for (int i = first_index; i < static_cast<int>(spheres.size()); i++) {
+        const auto box = sphereBounds(spheres[i]);
+        const auto last = static_cast<int>(nodes.size()) - 1;
+        // The last leaf covers the end of the indices, so it can take the next one.
+        if (last >= tree_size && nodes[last].count < max_leaf_size) {
+            auto &leaf = nodes[last];
+            auto bounds = nodeBounds(leaf);
+            bounds.extend(box);
+            leaf.min = bounds.min;
+            leaf.max = bounds.max;
+            leaf.count++;
+            changes.nodes.add(last);
+        } else {
+            if (last + 1 - tree_size >= MAX_APPENDED_LEAVES) {
+                return false;
+            }
+            nodes.push_back(Node {box.min, box.max, static_cast<int>(indices.size()), 1});
+            // Appended leaves are not in the tree: nothing above them is refitted.
+            parents.push_back(-1);
+            changes.nodes.add(last + 1);
+        }
+        indices.push_back(i);
+        leaves.push_back(static_cast<int>(nodes.size()) - 1);
+    }
+    changes.indices.add(first_index, static_cast<int>(indices.size()));
+    return true;
+}
+
+void BVH::buildTriangles(const std::vector<QVector4D> &vertices, const std::vector<int> &triangles) {
+    const auto num_of_triangles = triangles.size() / scene_packing::INTS_PER_TRIANGLE;
+    std::vector<QVector3D> prim_min(num_of_triangles), prim_max(num_of_triangles);
+    for (size_t i = 0; i < num_of_triangles; i++) {
+        AABB box;
+        for (int v = 0; v < 3; v++) {
+            box.extend(vertices[triangles[scene_packing::INTS_PER_TRIANGLE * i + v]].toVector3D());
+        }
+        prim_min[i] = box.min;
+        prim_max[i] = box.max;
+    }
+    build(prim_min, prim_max);
+}
+
+void BVH::build(const std::vector<QVector3D> &prim_min, const std::vector<QVector3D> &prim_max) {
+    clear();
+
+    const auto num_of_prims = static_cast<int>(prim_min.size());
+    if (num_of_prims == 0) {
+        return;
+    }
+
+    std::vector<AABB> prim_bounds(num_of_prims);
+    std::vector<QVector3D> centroids(num_of_prims);
+    for (int i = 0; i < num_of_prims; i++) {
+        prim_bounds[i].min = prim_min[i];
+        prim_bounds[i].max = prim_max[i];
+        centroids[i] = 0.5f * (prim_min[i] + prim_max[i]);
+    }
+
+    indices.resize(num_of_prims);
+    std::iota(indices.begin(), indices.end(), 0);
+    nodes.reserve(2 * num_of_prims);
+
+    std::vector<int> right_child;
+    right_child.reserve(2 * num_of_prims);
+
+    // Nodes are emitted in depth-first order: left subtree is built right after its parent.
+    std::vector<BuildTask> tasks;
+    tasks.push_back(BuildTask {0, num_of_prims, -1});
+    while (!tasks.empty()) {
+        const auto task = tasks.back();
+        tasks.pop_back();
+
+        const auto node_index = static_cast<int>(nodes.size());
+        nodes.push_back(Node {});
+        right_child.push_back(-1);
+        if (task.parent >= 0) {
+            right_child[task.parent] = node_index;
+        }
+
+        AABB bounds, centroid_bounds;
+        for (int i = task.begin; i < task.end; i++) {
+            bounds.extend(prim_bounds[indices[i]]);
+            centroid_bounds.extend(centroids[indices[i]]);
+        }
+        nodes[node_index].min = bounds.min;
+        nodes[node_index].max = bounds.max;
+
+        const int count = task.end - task.begin;
+        int mid = -1;
+        if (count > 1) {
+            // Find the cheapest binned split over all axes.
+            float best_cost = std::numeric_limits<float>::max();
+            int best_axis = -1, best_bin = -1;
+            for (int axis = 0; axis < 3; axis++) {
+                const auto c_min = centroid_bounds.min[axis];
+                const auto extent = centroid_bounds.max[axis] - c_min;
+                if (extent <= 0.0f) {
+                    continue;
+                }
+                const auto scale = NUM_OF_BINS / extent;
+                Bin bins[NUM_OF_BINS];
+                for (int i = task.begin; i < task.end; i++) {
+                    const auto b = std::min(static_cast<int>((centroids[indices[i]][axis] - c_min) * scale), NUM_OF_BINS - 1);
+                    bins[b].bounds.extend(prim_bounds[indices[i]]);
+                    bins[b].count++;
+                }
+                float left_cost[NUM_OF_BINS - 1];
+                AABB left_box;
+                int left_count = 0;
+                for (int b = 0; b < NUM_OF_BINS - 1; b++) {
+                    left_box.extend(bins[b].bounds);
+                    left_count += bins[b].count;
+                    left_cost[b] = left_box.area() * left_count;
+                }
+                AABB right_box;
+                int right_count = 0;
+                for (int b = NUM_OF_BINS - 1; b > 0; b--) {
+                    right_box.extend(bins[b].bounds);
+                    right_count += bins[b].count;
+                    const auto cost = left_cost[b - 1] + right_box.area() * right_count;
+                    if (cost < best_cost) {
+                        best_cost = cost;
+                        best_axis = axis;
+                        best_bin = b;
+                    }
+                }
+            }
+
+            const auto area = bounds.area();
+            const auto split_cost = TRAVERSAL_COST + INTERSECTION_COST * best_cost / std::max(area, 1e-12f);
+            const auto leaf_cost = INTERSECTION_COST * count;
+            if (best_axis >= 0 && (split_cost < leaf_cost || count > max_leaf_size)) {
+                const auto c_min = centroid_bounds.min[best_axis];
+                const auto scale = NUM_OF_BINS / (centroid_bounds.max[best_axis] - c_min);
+                const auto it = std::partition(indices.begin() + task.begin, indices.begin() + task.end, [&](int index) {
+                    const auto b = std::min(static_cast<int>((centroids[index][best_axis] - c_min) * scale), NUM_OF_BINS - 1);
+                    return b < best_bin;
+                });
+                mid = static_cast<int>(it - indices.begin());
+            } else if (count > max_leaf_size) {
+                // All centroids coincide: split the range in halves.
+                mid = task.begin + count / 2;
+            }
+            if (mid == task.begin || mid == task.end) {
+                mid = (count > max_leaf_size ? task.begin + count / 2 : -1);
+            }
+        }
+
+        if (mid < 0) {
+            nodes[node_index].first_or_skip = task.begin;
+            nodes[node_index].count = count;
+        } else {
+            nodes[node_index].count = 0;
+            tasks.push_back(BuildTask {mid, task.end, node_index});
+            tasks.push_back(BuildTask {task.begin, mid, -1});
+        }
+    }
+
+    // Skip link of an internal node is the skip link of its right child.
+    for (int i = static_cast<int>(nodes.size()) - 1; i >= 0; i--) {
+        if (!nodes[i].isLeaf()) {
+            const auto right = right_child[i];
+            nodes[i].first_or_skip = nodes[right].skip(right);
+        }
+    }
+
+    tree_size = static_cast<int>(nodes.size());
+    initLinks();
+    markAllChanged();
+}
+
+void BVH::clear() {
+    nodes.clear();
+    indices.clear();
+    parents.clear();
+    leaves.clear();
+    tree_size = 0;
+    resetChanges();
+}
+
+void BVH::initLinks() {
+    const auto num_of_nodes = static_cast<int>(nodes.size());
+    const auto num_of_indices = static_cast<int>(indices.size());
+    parents.assign(num_of_nodes, -1);
+    leaves.assign(num_of_indices, -1);
+    // Unpacked nodes are checked only later (see MappedScene::toBVH), so links out of range are skipped.
+    for (int i = 0; i < num_of_nodes; i++) {
+        const auto &node = nodes[i];
+        if (node.isLeaf()) {
+            for (int j = std::max(node.first_or_skip, 0); j < std::min(node.first_or_skip + node.count, num_of_indices); j++) {
+                if (indices[j] >= 0 && indices[j] < num_of_indices) {
+                    leaves[indices[j]] = i;
+                }
+            }
+        } else if (i + 1 < tree_size) {
+            const auto left = i + 1;
+            const auto right = nodes[left].skip(left);
+            parents[left] = i;
+            if (right > i && right < tree_size) {
+                parents[right] = i;
+            }
+        }
+    }
+}
+
+void BVH::markAllChanged() {
+    resetChanges();
+    changes.nodes.add(0, static_cast<int>(nodes.size()));
+    changes.indices.add(0, static_cast<int>(indices.size()));
+}
+
+std::vector<QVector4D> BVH::packNodes() const {
+    return packNodes(0, static_cast<int>(nodes.size()));
+}
+
+std::vector<QVector4D> BVH::packNodes(int begin, int end) const {
+    std::vector<QVector4D> texels;
+    texels.reserve(2 * (end - begin));
+    for (int i = begin; i < end; i++) {
+        const auto &node = nodes[i];
+        texels.push_back(QVector4D(node.min, static_cast<float>(node.first_or_skip)));
+        texels.push_back(QVector4D(node.max, static_cast<float>(node.count)));
+    }
+    return texels;
+}
+
+void BVH::unpack(const QVector4D *packed_nodes, int num_of_nodes, const int *packed_indices, int num_of_indices) {
+    nodes.resize(num_of_nodes);
+    for (int i = 0; i < num_of_nodes; i++) {
+        const auto &min = packed_nodes[2 * i];
+        const auto &max = packed_nodes[2 * i + 1];
+        nodes[i] = Node {min.toVector3D(), max.toVector3D(), static_cast<int>(min.w()), static_cast<int>(max.w())};
+    }
+    indices.assign(packed_indices, packed_indices + num_of_indices);
+    tree_size = num_of_nodes;
+    initLinks();
+    markAllChanged();
+}
+
+void BVH::setMaxLeafSize(int size) {
+    max_leaf_size = std::max(size, 1);
+}
+
+int BVH::getMaxLeafSize() const {
+    return max_leaf_size;
+}
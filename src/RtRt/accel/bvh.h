@@ -0,0 +1,108 @@
+#pragma once
+
+#include "objects/sphere.h"
+#include "objects/dirty_range.h"
+
+#include <QVector3D>
+#include <QVector4D>
+
+#include <vector>
+
+/**
+ * Bounding volume hierarchy over spheres or triangles, built with the surface area heuristic (binned SAH).
+ * Nodes are stored in depth-first order, so the first child of an internal node is the next node,
+ * and each internal node keeps a skip link to the node following its subtree.
+ * This allows stackless traversal: go to the next node on hit, follow the skip link on miss.
+ * Traversal ends past the last node, so spheres appended by update() are added as leaves
+ * after the tree: the skip links ending the tree lead to them.
+ */
+class BVH {
+public:
+    struct Node {
+        QVector3D min;
+        QVector3D max;
+        int first_or_skip; // first primitive index for a leaf, skip link for an internal node
+        int count; // number of primitives for a leaf, 0 for an internal node
+
+        bool isLeaf() const {
+            return count > 0;
+        }
+        int skip(int index) const {
+            return isLeaf() ? index + 1 : first_or_skip;
+        }
+    };
+
+    // Nodes and indices changed since the last resetChanges().
+    struct Changes {
+        DirtyRanges nodes;
+        DirtyRanges indices;
+    };
+
+public:
+    BVH() {}
+
+    void build(const std::vector<Sphere> &spheres);
+    // Triangles are packed as (v0, v1, v2, material) into the vertices (see scene_packing).
+    void buildTriangles(const std::vector<QVector4D> &vertices, const std::vector<int> &triangles);
+    void clear();
+
+    // Brings the BVH over the spheres up to date after the changed ones were edited or appended:
+    // edited spheres refit their leaves and the ancestors of them, appended ones go to leaves after the tree.
+    // Rebuilds it when there are too many appended leaves or spheres were removed.
+    void update(const std::vector<Sphere> &spheres, const DirtyRanges &changed);
+
+    const Changes& getChanges() const {
+        return changes;
+    }
+
+    void resetChanges() {
+        changes = Changes();
+    }
+
+    bool empty() const {
+        return nodes.empty();
+    }
+
+    const std::vector<Node>& getNodes() const {
+        return nodes;
+    }
+
+    // Indices of primitives, referenced by leaves.
+    const std::vector<int>& getIndices() const {
+        return indices;
+    }
+
+    // Nodes packed as two texels each: (min, first_or_skip), (max, count).
+    // Integers are stored as floats, they are exact up to 2^24.
+    std::vector<QVector4D> packNodes() const;
+    // Packs the nodes [begin, end) only.
+    std::vector<QVector4D> packNodes(int begin, int end) const;
+    // Restores the hierarchy from packed nodes and indices (e.g. stored in a scene file).
+    void unpack(const QVector4D *packed_nodes, int num_of_nodes, const int *packed_indices, int num_of_indices);
+
+    void setMaxLeafSize(int size);
+    int getMaxLeafSize() const;
+
+private:
+    // Builds over primitive bounding boxes; boxes are split by their centers.
+    void build(const std::vector<QVector3D> &prim_min, const std::vector<QVector3D> &prim_max);
+    // Recomputes the bounds of the leaves of the changed spheres (of the same ones) and of their ancestors.
+    void refit(const std::vector<Sphere> &spheres, const DirtyRanges &changed);
+    // Adds leaves for the spheres past the indexed ones; returns false if there would be too many of them.
+    bool append(const std::vector<Sphere> &spheres);
+    // Parents and leaves of the nodes and indices as they are.
+    void initLinks();
+    void markAllChanged();
+
+private:
+    std::vector<Node> nodes;
+    std::vector<int> indices;
+    // Parent of each node, -1 for the root and the appended leaves.
+    std::vector<int> parents;
+    // Leaf of each primitive.
+    std::vector<int> leaves;
+    // Number of nodes in the tree, the rest are leaves appended after it.
+    int tree_size = 0;
+    int max_leaf_size = 4;
+    Changes changes;
+};
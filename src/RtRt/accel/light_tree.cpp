@@ -0,0 +1,100 @@
+#include "light_tree.h"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+
+namespace {
+
+// Lower bound of the squared distance, for points right at a light.
+const float MIN_DISTANCE_SQUARED = 1e-6f;
+
+float luminance(const QVector3D &color) {
+    return 0.2126f * color.x() + 0.7152f * color.y() + 0.0722f * color.z();
+}
+
+struct BuildTask {
+    int begin;
+    int end;
+    int parent; // index of the parent node if this is a second child, -1 otherwise
+};
+
+}
+
+float LightTree::Node::importance(const QVector3D &point) const {
+    const auto half_size = 0.5f * (max - min);
+    const auto distance_squared = (point - 0.5f * (min + max)).lengthSquared();
+    return power / std::max(std::max(distance_squared, half_size.lengthSquared()), MIN_DISTANCE_SQUARED);
+}
+
+void LightTree::build(const std::vector<LightSource> &lights) {
+    clear();
+
+    const auto num_of_lights = static_cast<int>(lights.size());
+    if (num_of_lights == 0) {
+        return;
+    }
+
+    std::vector<int> order(num_of_lights);
+    std::iota(order.begin(), order.end(), 0);
+    nodes.reserve(2 * num_of_lights - 1);
+
+    // Lights are split at the median along the longest axis of their bounds, so the tree is balanced.
+    std::vector<BuildTask> tasks;
+    tasks.push_back(BuildTask {0, num_of_lights, -1});
+    while (!tasks.empty()) {
+        const auto task = tasks.back();
+        tasks.pop_back();
+
+        const auto node_index = static_cast<int>(nodes.size());
+        if (task.parent >= 0) {
+            nodes[task.parent].link = node_index;
+        }
+
+        Node node;
+        node.min = QVector3D(std::numeric_limits<float>::max(),
+                             std::numeric_limits<float>::max(),
+                             std::numeric_limits<float>::max());
+        node.max = -node.min;
+        node.power = 0.0f;
+        for (int i = task.begin; i < task.end; i++) {
+            const auto &light = lights[order[i]];
+            for (int axis = 0; axis < 3; axis++) {
+                node.min[axis] = std::min(node.min[axis], light.position[axis]);
+                node.max[axis] = std::max(node.max[axis], light.position[axis]);
+            }
+            node.power += std::max(luminance(light.color), 0.0f);
+        }
+
+        if (task.end - task.begin == 1) {
+            node.link = -1 - order[task.begin];
+            nodes.push_back(node);
+            continue;
+        }
+        node.link = 0; // set when the second child is emitted
+        nodes.push_back(node);
+
+        const auto extent = node.max - node.min;
+        const int axis = (extent.x() > extent.y()) ? (extent.x() > extent.z() ? 0 : 2) : (extent.y() > extent.z() ? 1 : 2);
+        const int mid = task.begin + (task.end - task.begin) / 2;
+        std::nth_element(order.begin() + task.begin, order.begin() + mid, order.begin() + task.end, [&](int a, int b) {
+            return lights[a].position[axis] < lights[b].position[axis];
+        });
+        tasks.push_back(BuildTask {mid, task.end, node_index});
+        tasks.push_back(BuildTask {task.begin, mid, -1});
+    }
+}
+
+void LightTree::clear() {
+    nodes.clear();
+}
+
+std::vector<QVector4D> LightTree::packNodes() const {
+    std::vector<QVector4D> texels;
+    texels.reserve(2 * nodes.size());
+    for (const auto &node: nodes) {
+        texels.push_back(QVector4D(node.min, node.power));
+        texels.push_back(QVector4D(node.max, static_cast<float>(node.link)));
+    }
+    return texels;
+}
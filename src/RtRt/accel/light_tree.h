@@ -0,0 +1,57 @@
+#pragma once
+
+#include "objects/light_source.h"
+
+#include <QVector3D>
+#include <QVector4D>
+
+#include <vector>
+
+/**
+ * Hierarchy over point lights for picking a light at random instead of shading all of them.
+ * Each node keeps the bounds and the total power (luminance of the colors) of its lights.
+ * A light is picked by descending from the root and choosing a child with probability
+ * proportional to its importance at the shaded point (see Node::importance); the contribution
+ * of the light is divided by the probability of the path, so the estimate is unbiased.
+ * Nodes are stored in depth-first order: the first child of an internal node is the next node.
+ */
+class LightTree {
+public:
+    struct Node {
+        QVector3D min;
+        QVector3D max;
+        float power;
+        int link; // second child for an internal node, -1 - light index for a leaf
+
+        bool isLeaf() const {
+            return link < 0;
+        }
+        int lightIndex() const {
+            return -1 - link;
+        }
+
+        // Power over the squared distance to the center of the node; the distance is not less
+        // than the node size, so that the importance stays finite for points inside the node.
+        float importance(const QVector3D &point) const;
+    };
+
+public:
+    LightTree() {}
+
+    void build(const std::vector<LightSource> &lights);
+    void clear();
+
+    bool empty() const {
+        return nodes.empty();
+    }
+
+    const std::vector<Node>& getNodes() const {
+        return nodes;
+    }
+
+    // Nodes packed as two texels each: (min, power), (max, link).
+    std::vector<QVector4D> packNodes() const;
+
+private:
+    std::vector<Node> nodes;
+};
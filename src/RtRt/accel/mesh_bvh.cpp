@@ -0,0 +1,26 @@
+#include "mesh_bvh.h"
+#include "objects/scene_packing.h"
+
+#include <utility>
+
+void MeshBVH::build(const std::vector<TriangleMesh> &meshes) {
+    vertices = scene_packing::packMeshVertices(meshes);
+    triangles = scene_packing::packMeshTriangles(meshes);
+    bvh.buildTriangles(vertices, triangles);
+}
+
+void MeshBVH::assign(std::vector<QVector4D> vertices, std::vector<int> triangles, BVH bvh) {
+    this->vertices = std::move(vertices);
+    this->triangles = std::move(triangles);
+    this->bvh = std::move(bvh);
+}
+
+void MeshBVH::clear() {
+    vertices.clear();
+    triangles.clear();
+    bvh.clear();
+}
+
+int MeshBVH::getNumOfTriangles() const {
+    return static_cast<int>(triangles.size()) / scene_packing::INTS_PER_TRIANGLE;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "bvh.h"
+#include "objects/triangle_mesh.h"
+
+#include <QVector4D>
+
+#include <vector>
+
+/**
+ * Triangles of all the scene meshes packed into shared arrays (see scene_packing)
+ * and a BVH over them, in world space like the sphere BVH.
+ * Spheres and triangles have separate hierarchies: a ray traverses both.
+ */
+class MeshBVH {
+public:
+    MeshBVH() {}
+
+    void build(const std::vector<TriangleMesh> &meshes);
+    // Takes already packed triangles and their hierarchy (e.g. from a scene file).
+    void assign(std::vector<QVector4D> vertices, std::vector<int> triangles, BVH bvh);
+    void clear();
+
+    bool empty() const {
+        return triangles.empty();
+    }
+
+    int getNumOfTriangles() const;
+
+    // (position, 0) per vertex.
+    const std::vector<QVector4D>& getVertices() const {
+        return vertices;
+    }
+
+    // (v0, v1, v2, material) per triangle.
+    const std::vector<int>& getTriangles() const {
+        return triangles;
+    }
+
+    const BVH& getBVH() const {
+        return bvh;
+    }
+
+private:
+    std::vector<QVector4D> vertices;
+    std::vector<int> triangles;
+    BVH bvh;
+};
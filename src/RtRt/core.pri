@@ -0,0 +1,92 @@
+# Scene, acceleration structures and both ray tracers: everything that does not need a window.
+# Shared by the interactive application and the command line tools.
+
+INCLUDEPATH += $$PWD
+
+QMAKE_CXXFLAGS += -fopenmp
+QMAKE_LFLAGS += -fopenmp
+
+SOURCES += \
+    $$PWD/accel/bvh.cpp \
+    $$PWD/accel/light_tree.cpp \
+    $$PWD/accel/mesh_bvh.cpp \
+    $$PWD/cpu/cpu_ray_tracer.cpp \
+    $$PWD/gl_objects/gl_buffer.cpp \
+    $$PWD/gl_objects/gl_plane.cpp \
+    $$PWD/gl_objects/gl_scene_buffers.cpp \
+    $$PWD/gl_objects/gl_texture_buffer.cpp \
+    $$PWD/gl_objects/gl_triangulated_shape.cpp \
+    $$PWD/gpu/compute_kernel.cpp \
+    $$PWD/gpu/frame_capture.cpp \
+    $$PWD/gpu/gpu_ray_tracer.cpp \
+    $$PWD/gpu/offscreen_context.cpp \
+    $$PWD/gpu/scene_animator.cpp \
+    $$PWD/gpu/shader_source.cpp \
+    $$PWD/gpu/tiled_renderer.cpp \
+    $$PWD/gpu/wavefront_tracer.cpp \
+    $$PWD/io/frame_writer.cpp \
+    $$PWD/io/mapped_scene.cpp \
+    $$PWD/io/obj_loader.cpp \
+    $$PWD/io/scene_io.cpp \
+    $$PWD/io/tiled_image_writer.cpp \
+    $$PWD/objects/scene_packing.cpp \
+    $$PWD/objects/scenes.cpp \
+    $$PWD/profiling/frame_governor.cpp \
+    $$PWD/profiling/frame_profiler.cpp \
+    $$PWD/profiling/timing_export.cpp \
+    $$PWD/util.cpp
+
+HEADERS += \
+    $$PWD/accel/bvh.h \
+    $$PWD/accel/light_tree.h \
+    $$PWD/accel/mesh_bvh.h \
+    $$PWD/cpu/cpu_ray_tracer.h \
+    $$PWD/gl_objects/gl_buffer.h \
+    $$PWD/gl_objects/gl_plane.h \
+    $$PWD/gl_objects/gl_scene_buffers.h \
+    $$PWD/gl_objects/gl_shape.h \
+    $$PWD/gl_objects/gl_texture_buffer.h \
+    $$PWD/gl_objects/gl_triangulated_shape.h \
+    $$PWD/gpu/compute_kernel.h \
+    $$PWD/gpu/frame_capture.h \
+    $$PWD/gpu/gpu_ray_tracer.h \
+    $$PWD/gpu/offscreen_context.h \
+    $$PWD/gpu/scene_animator.h \
+    $$PWD/gpu/shader_source.h \
+    $$PWD/gpu/tiled_renderer.h \
+    $$PWD/gpu/wavefront_tracer.h \
+    $$PWD/io/frame_writer.h \
+    $$PWD/io/mapped_scene.h \
+    $$PWD/io/obj_loader.h \
+    $$PWD/io/scene_io.h \
+    $$PWD/io/tiled_image_writer.h \
+    $$PWD/objects/camera.h \
+    $$PWD/objects/dirty_range.h \
+    $$PWD/objects/light_source.h \
+    $$PWD/objects/material.h \
+    $$PWD/objects/scene.h \
+    $$PWD/objects/scene_packing.h \
+    $$PWD/objects/scenes.h \
+    $$PWD/objects/sphere.h \
+    $$PWD/objects/triangle_mesh.h \
+    $$PWD/profiling/frame_governor.h \
+    $$PWD/profiling/frame_profiler.h \
+    $$PWD/profiling/ring_buffer.h \
+    $$PWD/profiling/timing_export.h \
+    $$PWD/render_settings.h \
+    $$PWD/util.h
+
+DISTFILES += \
+    $$PWD/shaders/animate.comp \
+    $$PWD/shaders/camera.glsl \
+    $$PWD/shaders/denoise.frag \
+    $$PWD/shaders/display.frag \
+    $$PWD/shaders/impostor.frag \
+    $$PWD/shaders/impostor.vert \
+    $$PWD/shaders/raytrace.frag \
+    $$PWD/shaders/raytrace.vert \
+    $$PWD/shaders/sampler.glsl \
+    $$PWD/shaders/scene.glsl \
+    $$PWD/shaders/temporal.frag \
+    $$PWD/shaders/wavefront.comp \
+    $$PWD/shaders/wavefront_resolve.frag
@@ -0,0 +1,732 @@
+#include "cpu_ray_tracer.h"
+#include "accel/light_tree.h"
+#include "objects/scene_packing.h"
+#include "util.h"
+
+#include <QVector2D>
+#include <QVector4D>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <utility>
+
+namespace {
+
+const float EPSILON = 1e-3f;
+const float MAX_DISTANCE = 1e+8f;
+const QVector3D AMBIENT_LIGHT {0.05f, 0.05f, 0.05f};
+const int MAX_STACK_SIZE = 1024;
+
+struct IntersectionInfo {
+    int objectId;
+    QVector3D color;
+    QVector3D intersectionPoint;
+    QVector3D reflectedRay;
+    QVector3D refractedRay;
+    float refractionCoeff;
+};
+
+// Object ids are the same as in scene.glsl: -1 is no object, spheres are 0, 1, ..., triangle t is -2 - t.
+bool isTriangle(int object_id) {
+    return object_id < -1;
+}
+
+int triangleIndex(int object_id) {
+    return -2 - object_id;
+}
+
+// Ray prepared for the watertight ray-triangle test (see scene.glsl).
+struct TriangleRay {
+    QVector3D origin;
+    int kx, ky, kz;
+    float sx, sy, sz;
+};
+
+TriangleRay makeTriangleRay(const QVector3D &origin, const QVector3D &ray) {
+    const auto ax = std::abs(ray.x()), ay = std::abs(ray.y()), az = std::abs(ray.z());
+    TriangleRay r;
+    r.origin = origin;
+    r.kz = (ax > ay) ? (ax > az ? 0 : 2) : (ay > az ? 1 : 2);
+    r.kx = (r.kz + 1) % 3;
+    r.ky = (r.kx + 1) % 3;
+    if (ray[r.kz] < 0.0f) {
+        std::swap(r.kx, r.ky);
+    }
+    r.sx = ray[r.kx] / ray[r.kz];
+    r.sy = ray[r.ky] / ray[r.kz];
+    r.sz = 1.0f / ray[r.kz];
+    return r;
+}
+
+struct State {
+    QVector3D color;
+    QVector3D point;
+    QVector3D ray;
+    QVector3D coeff;
+    int depth;
+    int parent;
+    bool shootRay;
+};
+
+// Sample offsets: the same R2 sequence with per-pixel scrambling as in sampler.glsl.
+uint32_t hashUint(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+struct Scramble {
+    uint32_t x, y;
+};
+
+Scramble pixelScramble(int x, int y) {
+    const auto h = hashUint(static_cast<uint32_t>(x) ^ hashUint(static_cast<uint32_t>(y)));
+    return Scramble {h, hashUint(h)};
+}
+
+uint32_t floatBits(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+QVector2D sampleOffset(const Scramble &scramble, int index) {
+    const auto x = scramble.x + static_cast<uint32_t>(index) * 0xc13fa9a9u;
+    const auto y = scramble.y + static_cast<uint32_t>(index) * 0x91e10da6u;
+    // The top 24 bits are exact in a float.
+    return QVector2D(float(x >> 8) / 16777216.0f, float(y >> 8) / 16777216.0f);
+}
+
+// Per-thread tracing state; the functions mirror the ones from raytrace.frag.
+class Tracer {
+public:
+    Tracer(const Scene &scene, const BVH &bvh, const MeshBVH &mesh_bvh, const LightTree &light_tree,
+           const RenderSettings &settings, const QMatrix4x4 &cam_to_world, float fov_tangent, int width, int height) :
+        scene(scene), bvh(bvh), mesh_bvh(mesh_bvh), light_tree(light_tree), settings(settings),
+        background_color(util::colorToVec(settings.background_color)),
+        window_size(width, height),
+        cam_to_world(cam_to_world),
+        fov_tangent(fov_tangent)
+    {
+        // Two child rays may be pushed after the stack size check.
+        stack.resize(MAX_STACK_SIZE + 2);
+    }
+
+    QVector3D trace(float frag_x, float frag_y);
+
+    // Adaptive sampling (see raytrace.frag): the pilot pass returns the mean color and mean squared luminance
+    // of the first samples, the refinement pass traces the rest of them if the error estimated
+    // from the pilot moments around the pixel is above the threshold.
+    QVector4D tracePilot(float frag_x, float frag_y);
+    QVector3D traceRefine(float frag_x, float frag_y, const std::vector<QVector4D> &pilot, int &num_of_samples);
+
+private:
+    bool intersectSphere(const Sphere &sphere, const QVector3D &start_point, const QVector3D &ray, float &distance) const;
+    bool intersectTriangle(const TriangleRay &ray, int triangle, float &distance) const;
+    void intersectMeshes(const QVector3D &start_point, const QVector3D &ray, int &closest_object, float &min_distance) const;
+    int getIntersection(const QVector3D &start_point, const QVector3D &ray, QVector3D &closest_point) const;
+    int getObjectMaterial(int object_id) const;
+    QVector3D getShadingNormal(int object_id, const QVector3D &point, const QVector3D &ray, const Material &material) const;
+
+    void seedRandom(uint32_t seed);
+    float nextRandom();
+    int sampleLightTree(const QVector3D &point, float &probability);
+    int getNumOfShadowRays() const;
+    const LightSource& getShadowRayLight(int index, const QVector3D &point, float &weight);
+
+    bool getColorAtIntersection(const QVector3D &point, const QVector3D &ray, IntersectionInfo &info);
+
+    QVector3D getIlluminationFull(const QVector3D &point, const QVector3D &ray);
+    QVector3D getIlluminationReflectionOnly(const QVector3D &point, const QVector3D &ray);
+
+    QVector3D shoot(float frag_x, float frag_y, float aspect, const QVector3D &view_point);
+
+    QVector2D pixelSampleOffset(const Scramble &scramble, int k) const;
+    QVector3D traceSamples(float frag_x, float frag_y, int first, int last);
+    float pilotError(int x, int y, const std::vector<QVector4D> &pilot) const;
+
+private:
+    const Scene &scene;
+    const BVH &bvh;
+    const MeshBVH &mesh_bvh;
+    const LightTree &light_tree;
+    const RenderSettings &settings;
+    QVector3D background_color;
+
+    QVector2D window_size;
+    QMatrix4x4 cam_to_world;
+    float fov_tangent;
+
+    std::vector<State> stack;
+    int curr_stack_size = 0;
+
+    uint32_t random_state = 0;
+
+};
+
+bool Tracer::intersectSphere(const Sphere &sphere, const QVector3D &start_point, const QVector3D &ray, float &distance) const {
+    const auto v = start_point - sphere.position;
+    const auto d = QVector3D::dotProduct(v, ray);
+    const auto radius = static_cast<float>(sphere.radius);
+    const auto discriminant = d * d - (QVector3D::dotProduct(v, v) - radius * radius);
+    if (discriminant < 0) {
+        return false;
+    }
+
+    const auto sq = std::sqrt(discriminant);
+    const auto t1 = -d + sq;
+    const auto t2 = -d - sq;
+
+    float t = 0;
+    if (t1 < EPSILON) {
+        if (t2 < EPSILON) {
+            return false;
+        } else {
+            t = t2;
+        }
+    } else if (t2 < EPSILON) {
+        t = t1;
+    } else {
+        t = std::min(t1, t2);
+    }
+
+    distance = t;
+    return true;
+}
+
+bool intersectBox(const QVector3D &box_min, const QVector3D &box_max,
+                  const QVector3D &start_point, const QVector3D &inv_ray, float max_distance) {
+    float t_min = -MAX_DISTANCE, t_max = MAX_DISTANCE;
+    for (int i = 0; i < 3; i++) {
+        const auto t0 = (box_min[i] - start_point[i]) * inv_ray[i];
+        const auto t1 = (box_max[i] - start_point[i]) * inv_ray[i];
+        t_min = std::max(t_min, std::min(t0, t1));
+        t_max = std::min(t_max, std::max(t0, t1));
+    }
+    return t_max >= std::max(t_min, 0.0f) && t_min < max_distance;
+}
+
+bool Tracer::intersectTriangle(const TriangleRay &ray, int triangle, float &distance) const {
+    const auto *indices = mesh_bvh.getTriangles().data() + scene_packing::INTS_PER_TRIANGLE * triangle;
+    const auto &vertices = mesh_bvh.getVertices();
+    const auto a = vertices[indices[0]].toVector3D() - ray.origin;
+    const auto b = vertices[indices[1]].toVector3D() - ray.origin;
+    const auto c = vertices[indices[2]].toVector3D() - ray.origin;
+    const auto az = ray.sz * a[ray.kz], bz = ray.sz * b[ray.kz], cz = ray.sz * c[ray.kz];
+    const auto ax = a[ray.kx] - ray.sx * a[ray.kz], ay = a[ray.ky] - ray.sy * a[ray.kz];
+    const auto bx = b[ray.kx] - ray.sx * b[ray.kz], by = b[ray.ky] - ray.sy * b[ray.kz];
+    const auto cx = c[ray.kx] - ray.sx * c[ray.kz], cy = c[ray.ky] - ray.sy * c[ray.kz];
+    // Edge functions (scaled barycentric coordinates).
+    const auto u = cx * by - cy * bx;
+    const auto v = ax * cy - ay * cx;
+    const auto w = bx * ay - by * ax;
+    if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0)) {
+        return false;
+    }
+    const auto det = u + v + w;
+    if (det == 0) {
+        return false;
+    }
+    const auto t = (u * az + v * bz + w * cz) / det;
+    if (t < EPSILON) {
+        return false;
+    }
+    distance = t;
+    return true;
+}
+
+void Tracer::intersectMeshes(const QVector3D &start_point, const QVector3D &ray, int &closest_object, float &min_distance) const {
+    const auto triangle_ray = makeTriangleRay(start_point, ray);
+    const QVector3D inv_ray {1.0f / ray.x(), 1.0f / ray.y(), 1.0f / ray.z()};
+    const auto &nodes = mesh_bvh.getBVH().getNodes();
+    const auto &indices = mesh_bvh.getBVH().getIndices();
+    const auto num_of_nodes = static_cast<int>(nodes.size());
+    int index = 0;
+    while (index < num_of_nodes) {
+        const auto &node = nodes[index];
+        if (!intersectBox(node.min, node.max, start_point, inv_ray, min_distance)) {
+            index = node.skip(index);
+            continue;
+        }
+        if (node.isLeaf()) {
+            for (int i = node.first_or_skip; i < node.first_or_skip + node.count; i++) {
+                float distance;
+                if (intersectTriangle(triangle_ray, indices[i], distance) && distance < min_distance) {
+                    closest_object = -2 - indices[i];
+                    min_distance = distance;
+                }
+            }
+        }
+        index++;
+    }
+}
+
+int Tracer::getIntersection(const QVector3D &start_point, const QVector3D &ray, QVector3D &closest_point) const {
+    int closest_object = -1;
+    float min_distance = MAX_DISTANCE;
+    const QVector3D inv_ray {1.0f / ray.x(), 1.0f / ray.y(), 1.0f / ray.z()};
+    const auto &nodes = bvh.getNodes();
+    const auto &indices = bvh.getIndices();
+    const auto num_of_nodes = static_cast<int>(nodes.size());
+    // Stackless traversal: next node on hit, skip link on miss.
+    int index = 0;
+    while (index < num_of_nodes) {
+        const auto &node = nodes[index];
+        if (!intersectBox(node.min, node.max, start_point, inv_ray, min_distance)) {
+            index = node.skip(index);
+            continue;
+        }
+        if (node.isLeaf()) {
+            for (int i = node.first_or_skip; i < node.first_or_skip + node.count; i++) {
+                float distance;
+                if (intersectSphere(scene.objects[indices[i]], start_point, ray, distance)) {
+                    if (distance < min_distance) {
+                        closest_object = indices[i];
+                        min_distance = distance;
+                    }
+                }
+            }
+        }
+        index++;
+    }
+    // The closest sphere limits the mesh traversal.
+    intersectMeshes(start_point, ray, closest_object, min_distance);
+    if (closest_object != -1) {
+        closest_point = start_point + min_distance * ray;
+    }
+    return closest_object;
+}
+
+int Tracer::getObjectMaterial(int object_id) const {
+    if (isTriangle(object_id)) {
+        return mesh_bvh.getTriangles()[scene_packing::INTS_PER_TRIANGLE * triangleIndex(object_id) + 3];
+    }
+    return scene.objects[object_id].materialId;
+}
+
+// Opaque triangles face the viewer, refractive ones keep the front face normal (see scene.glsl).
+QVector3D Tracer::getShadingNormal(int object_id, const QVector3D &point, const QVector3D &ray,
+                                   const Material &material) const {
+    if (!isTriangle(object_id)) {
+        return (point - scene.objects[object_id].position).normalized();
+    }
+    const auto *indices = mesh_bvh.getTriangles().data() + scene_packing::INTS_PER_TRIANGLE * triangleIndex(object_id);
+    const auto &vertices = mesh_bvh.getVertices();
+    const auto v0 = vertices[indices[0]].toVector3D();
+    auto normal = QVector3D::crossProduct(vertices[indices[1]].toVector3D() - v0,
+                                          vertices[indices[2]].toVector3D() - v0).normalized();
+    if (material.refractionCoeff <= 0.0f && QVector3D::dotProduct(normal, ray) > 0.0f) {
+        normal = -normal;
+    }
+    return normal;
+}
+
+QVector3D shade(const Material &mat, const QVector3D &light_color, const QVector3D &normal,
+                const QVector3D &reflected, const QVector3D &to_light, const QVector3D &to_viewer) {
+    const auto diffuse_coeff = std::max(QVector3D::dotProduct(to_light, normal), 0.0f);
+    float specular_coeff = 0.0f;
+    if (diffuse_coeff > 0.0f && mat.shininess > 0.0f) {
+        specular_coeff = std::pow(std::max(QVector3D::dotProduct(reflected, to_viewer), 0.0f), mat.shininess);
+    }
+    return (mat.diffuse * diffuse_coeff + mat.specular * specular_coeff) * light_color;
+}
+
+// Random numbers for light sampling: the same hash chain as in sampler.glsl.
+void Tracer::seedRandom(uint32_t seed) {
+    random_state = hashUint(seed);
+}
+
+float Tracer::nextRandom() {
+    random_state = hashUint(random_state + 0x9e3779b9u);
+    return float(random_state >> 8) / 16777216.0f;
+}
+
+int Tracer::sampleLightTree(const QVector3D &point, float &probability) {
+    const auto &nodes = light_tree.getNodes();
+    int node = 0;
+    probability = 1.0f;
+    while (!nodes[node].isLeaf()) {
+        const auto first = nodes[node + 1].importance(point);
+        const auto second = nodes[nodes[node].link].importance(point);
+        const auto first_probability = (first + second > 0.0f) ? first / (first + second) : 0.5f;
+        if (nextRandom() < first_probability) {
+            probability *= first_probability;
+            node = node + 1;
+        } else {
+            probability *= 1.0f - first_probability;
+            node = nodes[node].link;
+        }
+    }
+    return nodes[node].lightIndex();
+}
+
+int Tracer::getNumOfShadowRays() const {
+    const auto num_of_lights = static_cast<int>(scene.lights.size());
+    return (settings.num_of_light_samples > 0 && num_of_lights > settings.num_of_light_samples) ?
+                settings.num_of_light_samples : num_of_lights;
+}
+
+const LightSource& Tracer::getShadowRayLight(int index, const QVector3D &point, float &weight) {
+    if (getNumOfShadowRays() == static_cast<int>(scene.lights.size())) {
+        weight = 1.0f;
+        return scene.lights[index];
+    }
+    float probability;
+    const auto light = sampleLightTree(point, probability);
+    weight = 1.0f / (probability * settings.num_of_light_samples);
+    return scene.lights[light];
+}
+
+bool Tracer::getColorAtIntersection(const QVector3D &point, const QVector3D &ray, IntersectionInfo &info) {
+    QVector3D color {0, 0, 0};
+    QVector3D intersection_point;
+    // Find an object we a looking at.
+    const int closest_object = getIntersection(point, ray, intersection_point);
+    if (closest_object == -1) {
+        info.objectId = closest_object;
+        info.color = background_color;
+        return false;
+    }
+
+    const auto &material = scene.getMaterial(getObjectMaterial(closest_object));
+
+    auto normal = getShadingNormal(closest_object, intersection_point, ray, material);
+    const auto to_viewer = -ray;
+    auto cos_theta_i = QVector3D::dotProduct(normal, to_viewer);
+    const auto reflected_ray = (2 * cos_theta_i * normal - to_viewer).normalized();
+
+    // Add illumination from each light (or from the lights sampled from the light tree).
+    const int num_of_shadow_rays = getNumOfShadowRays();
+    for (int i = 0; i < num_of_shadow_rays; i++) {
+        // Check if the point on the object is illuminated by this light (not obscured by an obstacle).
+        float light_weight;
+        const auto &light = getShadowRayLight(i, intersection_point, light_weight);
+        auto to_light = light.position - intersection_point;
+        const auto distance_to_light = to_light.length();
+        to_light.normalize();
+        QVector3D intersection_light_point;
+        int obstacle = getIntersection(intersection_point, to_light, intersection_light_point);
+        if (obstacle != -1) {
+            // Check if the light is closer then the intersected object.
+            const auto distance_to_obstacle = (intersection_light_point - intersection_point).length();
+            if (distance_to_obstacle > distance_to_light) {
+                obstacle = -1;
+            }
+        }
+        if (obstacle == -1) {
+            color += light_weight * shade(material, light.color, normal, reflected_ray, to_light, to_viewer);
+        }
+    }
+
+    // Apply ambient light.
+    color += AMBIENT_LIGHT * material.diffuse;
+
+    auto refraction_coeff = material.refractionCoeff;
+    QVector3D refracted_ray {0, 0, 0};
+    // Check for refraction.
+    if (refraction_coeff > 0) {
+        float nu = 1.0f / material.refractionIndex; // assume refraction index 1.0 for air
+        // Check if we hit object from inside.
+        if (cos_theta_i < 0) {
+            nu = 1.0f / nu;
+            normal = -normal;
+            cos_theta_i = -cos_theta_i;
+        }
+        auto cos_theta_t = 1.0f - (1.0f - cos_theta_i * cos_theta_i) * (nu * nu);
+        // Check for total internal reflection (no refraction).
+        if (cos_theta_t < 0) {
+            refraction_coeff = 0.0f;
+        } else {
+            cos_theta_t = std::sqrt(cos_theta_t);
+            refracted_ray = ((cos_theta_i * nu - cos_theta_t) * normal - to_viewer * nu).normalized();
+        }
+    }
+
+    info.objectId = closest_object;
+    info.intersectionPoint = intersection_point;
+    info.color = color;
+    info.reflectedRay = reflected_ray;
+    info.refractedRay = refracted_ray;
+    info.refractionCoeff = refraction_coeff;
+
+    return true;
+}
+
+QVector3D Tracer::getIlluminationFull(const QVector3D &point, const QVector3D &ray) {
+    State curr;
+    curr.color = QVector3D(0, 0, 0);
+    curr.point = point;
+    curr.ray = ray;
+    curr.coeff = QVector3D(1, 1, 1);
+    curr.depth = 1;
+    curr.parent = -1;
+    curr.shootRay = true;
+
+    QVector3D final_color {0, 0, 0};
+
+    curr_stack_size = 0;
+    stack[curr_stack_size++] = curr;
+
+    while (curr_stack_size > 0) {
+        curr = stack[--curr_stack_size];
+        if (!curr.shootRay) {
+            if (curr.parent >= 0) {
+                stack[curr.parent].color += curr.coeff * curr.color;
+            } else {
+                final_color += curr.coeff * curr.color;
+            }
+            continue;
+        }
+        IntersectionInfo info;
+        const bool has_intersection = getColorAtIntersection(curr.point, curr.ray, info);
+        // Add parent task.
+        State state = curr;
+        state.color = info.color;
+        state.shootRay = false;
+        const int parent = curr_stack_size;
+        stack[curr_stack_size++] = state;
+        // Add tasks for child rays.
+        if (has_intersection && curr.depth < settings.num_of_steps && curr_stack_size < MAX_STACK_SIZE) {
+            State new_state;
+            new_state.point = info.intersectionPoint;
+            new_state.color = QVector3D(0, 0, 0);
+            new_state.depth = curr.depth + 1;
+            new_state.parent = parent;
+            new_state.shootRay = true;
+            // Reflected ray.
+            const auto reflection_coeff = 1.0f - info.refractionCoeff;
+            if (reflection_coeff > EPSILON) {
+                const auto &material = scene.getMaterial(getObjectMaterial(info.objectId));
+                new_state.ray = info.reflectedRay;
+                new_state.coeff = reflection_coeff * material.specular;
+                stack[curr_stack_size++] = new_state;
+            }
+            // Refracted ray.
+            if (info.refractionCoeff > EPSILON) {
+                new_state.ray = info.refractedRay;
+                new_state.coeff = info.refractionCoeff * QVector3D(1, 1, 1);
+                stack[curr_stack_size++] = new_state;
+            }
+        }
+    }
+    return final_color;
+}
+
+QVector3D Tracer::getIlluminationReflectionOnly(const QVector3D &point, const QVector3D &ray) {
+    QVector3D total_color {0, 0, 0};
+    auto curr_point = point;
+    auto curr_ray = ray;
+    QVector3D curr_mult {1, 1, 1};
+
+    for (int n = 0; n < settings.num_of_steps; n++) {
+        IntersectionInfo info;
+        const bool has_intersection = getColorAtIntersection(curr_point, curr_ray, info);
+        total_color += curr_mult * info.color;
+        if (!has_intersection) {
+            break;
+        }
+        curr_point = info.intersectionPoint;
+        curr_ray = info.reflectedRay;
+        curr_mult *= scene.getMaterial(getObjectMaterial(info.objectId)).specular;
+    }
+    return total_color;
+}
+
+QVector3D Tracer::shoot(float frag_x, float frag_y, float aspect, const QVector3D &view_point) {
+    // Sample positions differ, so they seed the random numbers of the sample (frame index is 0).
+    seedRandom(floatBits(frag_x) ^ hashUint(floatBits(frag_y) ^ hashUint(0u)));
+    const auto px = (2 * (frag_x + 0.5f) / window_size.x() - 1) * fov_tangent * aspect;
+    const auto py = (2 * (frag_y + 0.5f) / window_size.y() - 1) * fov_tangent;
+    const auto pos_world = (cam_to_world * QVector4D(px, py, -1, 1)).toVector3D();
+    const auto ray = (pos_world - view_point).normalized();
+    return settings.transparency_enabled ?
+                getIlluminationFull(view_point, ray) :
+                getIlluminationReflectionOnly(view_point, ray);
+}
+
+QVector2D Tracer::pixelSampleOffset(const Scramble &scramble, int k) const {
+    auto offset = sampleOffset(scramble, k);
+    if (settings.sampling_mode == SM_MULTIJITTERED) {
+        const auto n = settings.num_of_samples;
+        const auto i = k % n;
+        const auto j = (k / n + i) % n;
+        offset = QVector2D((i + offset.x()) / n, (j + offset.y()) / n);
+    }
+    return offset;
+}
+
+QVector3D Tracer::traceSamples(float frag_x, float frag_y, int first, int last) {
+    const auto aspect = window_size.x() / window_size.y();
+    const auto view_point = (cam_to_world * QVector4D(0, 0, 0, 1)).toVector3D();
+    const auto scramble = pixelScramble(static_cast<int>(frag_x), static_cast<int>(frag_y));
+    QVector3D sum {0, 0, 0};
+    for (int k = first; k < last; k++) {
+        const auto offset = pixelSampleOffset(scramble, k);
+        sum += shoot(frag_x - 0.5f + offset.x(), frag_y - 0.5f + offset.y(), aspect, view_point);
+    }
+    return sum;
+}
+
+QVector3D Tracer::trace(float frag_x, float frag_y) {
+    if (settings.num_of_samples == 1) {
+        const auto aspect = window_size.x() / window_size.y();
+        const auto view_point = (cam_to_world * QVector4D(0, 0, 0, 1)).toVector3D();
+        return shoot(frag_x, frag_y, aspect, view_point);
+    }
+    const auto num_of_samples = settings.numOfPixelSamples();
+    return traceSamples(frag_x, frag_y, 0, num_of_samples) / num_of_samples;
+}
+
+float luminance(const QVector3D &color) {
+    return 0.2126f * color.x() + 0.7152f * color.y() + 0.0722f * color.z();
+}
+
+QVector4D Tracer::tracePilot(float frag_x, float frag_y) {
+    const auto aspect = window_size.x() / window_size.y();
+    const auto view_point = (cam_to_world * QVector4D(0, 0, 0, 1)).toVector3D();
+    const auto scramble = pixelScramble(static_cast<int>(frag_x), static_cast<int>(frag_y));
+    const auto num_of_pilot_samples = settings.numOfPilotSamples();
+    QVector3D sum {0, 0, 0};
+    float sum_of_squares = 0.0f;
+    for (int k = 0; k < num_of_pilot_samples; k++) {
+        const auto offset = pixelSampleOffset(scramble, k);
+        const auto color = shoot(frag_x - 0.5f + offset.x(), frag_y - 0.5f + offset.y(), aspect, view_point);
+        sum += color;
+        sum_of_squares += luminance(color) * luminance(color);
+    }
+    return QVector4D(sum / num_of_pilot_samples, sum_of_squares / num_of_pilot_samples);
+}
+
+float Tracer::pilotError(int x, int y, const std::vector<QVector4D> &pilot) const {
+    const int width = static_cast<int>(window_size.x());
+    const int height = static_cast<int>(window_size.y());
+    float max_variance = 0.0f;
+    for (int dy = -1; dy <= 1; dy++)
+    for (int dx = -1; dx <= 1; dx++) {
+        const auto nx = std::min(std::max(x + dx, 0), width - 1);
+        const auto ny = std::min(std::max(y + dy, 0), height - 1);
+        const auto &moments = pilot[ny * width + nx];
+        const auto mean = luminance(moments.toVector3D());
+        max_variance = std::max(max_variance, moments.w() - mean * mean);
+    }
+    const auto n = settings.numOfPilotSamples();
+    const auto variance = max_variance * n / std::max(n - 1, 1);
+    return std::sqrt(std::max(variance, 0.0f) / n);
+}
+
+QVector3D Tracer::traceRefine(float frag_x, float frag_y, const std::vector<QVector4D> &pilot, int &num_of_samples) {
+    const int x = static_cast<int>(frag_x);
+    const int y = static_cast<int>(frag_y);
+    const auto num_of_pilot_samples = settings.numOfPilotSamples();
+    auto color = pilot[y * static_cast<int>(window_size.x()) + x].toVector3D();
+    num_of_samples = num_of_pilot_samples;
+    if (pilotError(x, y, pilot) > settings.adaptive_threshold) {
+        const auto num_of_pixel_samples = settings.numOfPixelSamples();
+        color = (color * num_of_pilot_samples +
+                 traceSamples(frag_x, frag_y, num_of_pilot_samples, num_of_pixel_samples)) / num_of_pixel_samples;
+        num_of_samples = num_of_pixel_samples;
+    }
+    return color;
+}
+
+uchar toByte(float value) {
+    return static_cast<uchar>(std::lround(std::min(std::max(value, 0.0f), 1.0f) * 255.0f));
+}
+
+}
+
+void CPURayTracer::setTileSize(int size) {
+    tile_size = std::max(size, 1);
+}
+
+int CPURayTracer::getTileSize() const {
+    return tile_size;
+}
+
+void CPURayTracer::render(const Scene &scene, const BVH &bvh, const MeshBVH &mesh_bvh, const RenderSettings &settings,
+                          const QMatrix4x4 &cam_to_world, float fov_tangent,
+                          QImage &image) {
+    if (image.format() != QImage::Format_RGBA8888) {
+        image = QImage(image.size(), QImage::Format_RGBA8888);
+    }
+    const int width = image.width();
+    const int height = image.height();
+    num_of_traced_samples = 0;
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+
+    const int num_of_tiles_x = (width + tile_size - 1) / tile_size;
+    const int num_of_tiles_y = (height + tile_size - 1) / tile_size;
+    const int num_of_tiles = num_of_tiles_x * num_of_tiles_y;
+
+    // Light tree is needed only when lights are sampled; it is quick to build even for many lights.
+    LightTree light_tree;
+    if (settings.num_of_light_samples > 0 && static_cast<int>(scene.lights.size()) > settings.num_of_light_samples) {
+        light_tree.build(scene.lights);
+    }
+
+    // Calls the function for each pixel (in window coordinates), tiles are shared between the threads.
+    const auto for_each_pixel = [&](const std::function<void(Tracer&, int, int)> &function) {
+        #pragma omp parallel
+        {
+            Tracer tracer(scene, bvh, mesh_bvh, light_tree, settings, cam_to_world, fov_tangent, width, height);
+
+            #pragma omp for schedule(dynamic, 1)
+            for (int tile = 0; tile < num_of_tiles; tile++) {
+                const int x_start = (tile % num_of_tiles_x) * tile_size;
+                const int y_start = (tile / num_of_tiles_x) * tile_size;
+                const int x_end = std::min(x_start + tile_size, width);
+                const int y_end = std::min(y_start + tile_size, height);
+                for (int y = y_start; y < y_end; y++)
+                for (int x = x_start; x < x_end; x++) {
+                    function(tracer, x, y);
+                }
+            }
+        }
+    };
+
+    // Get raw pointer before going parallel: scanLine() may detach the image.
+    uchar *bits = image.bits();
+    const auto bytes_per_line = image.bytesPerLine();
+
+    const auto set_pixel = [&](int x, int y, const QVector3D &color) {
+        // Window coordinates start at the bottom row, as gl_FragCoord does.
+        uchar *pixel = bits + (height - 1 - y) * bytes_per_line + 4 * x;
+        pixel[0] = toByte(color.x());
+        pixel[1] = toByte(color.y());
+        pixel[2] = toByte(color.z());
+        pixel[3] = 255;
+    };
+
+    if (!settings.adaptiveSamplingActive()) {
+        for_each_pixel([&](Tracer &tracer, int x, int y) {
+            set_pixel(x, y, tracer.trace(x + 0.5f, y + 0.5f));
+        });
+        num_of_traced_samples = static_cast<long long>(width) * height * settings.numOfPixelSamples();
+        return;
+    }
+
+    std::vector<QVector4D> pilot(static_cast<size_t>(width) * height);
+    for_each_pixel([&](Tracer &tracer, int x, int y) {
+        pilot[static_cast<size_t>(y) * width + x] = tracer.tracePilot(x + 0.5f, y + 0.5f);
+    });
+
+    std::vector<int> pixel_samples(pilot.size());
+    for_each_pixel([&](Tracer &tracer, int x, int y) {
+        set_pixel(x, y, tracer.traceRefine(x + 0.5f, y + 0.5f, pilot, pixel_samples[static_cast<size_t>(y) * width + x]));
+    });
+    for (const auto num: pixel_samples) {
+        num_of_traced_samples += num;
+    }
+}
+
+long long CPURayTracer::getNumOfTracedSamples() const {
+    return num_of_traced_samples;
+}
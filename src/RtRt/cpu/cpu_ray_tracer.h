@@ -0,0 +1,39 @@
+#pragma once
+
+#include "objects/scene.h"
+#include "accel/bvh.h"
+#include "accel/mesh_bvh.h"
+#include "render_settings.h"
+
+#include <QImage>
+#include <QMatrix4x4>
+
+#include <vector>
+
+/**
+ * Native implementation of the ray tracer from shaders/raytrace.frag.
+ * Produces the same image as the shader for the same scene, camera and settings
+ * (sample offsets are computed by the same functions as in shaders/sampler.glsl).
+ * The image is split into square tiles which are traced on all cores (OpenMP, dynamic scheduling).
+ */
+class CPURayTracer {
+public:
+    CPURayTracer() {}
+
+    void setTileSize(int size);
+    int getTileSize() const;
+
+    // Renders the scene into the image (its size is the window size),
+    // the first row of the image is the top row of the window.
+    // BVH must be built over the scene objects, the mesh BVH over the scene meshes.
+    void render(const Scene &scene, const BVH &bvh, const MeshBVH &mesh_bvh, const RenderSettings &settings,
+                const QMatrix4x4 &cam_to_world, float fov_tangent,
+                QImage &image);
+
+    // Number of primary samples traced by the last render (fewer with adaptive sampling).
+    long long getNumOfTracedSamples() const;
+
+private:
+    int tile_size = 16;
+    long long num_of_traced_samples = 0;
+};
@@ -0,0 +1,110 @@
+#include "gl_scene_buffers.h"
+
+#include "objects/scene_packing.h"
+
+namespace {
+
+template <class T>
+std::vector<T> slice(const std::vector<T> &elems, const DirtyRange &range) {
+    return std::vector<T>(elems.begin() + range.begin, elems.begin() + range.end);
+}
+
+}
+
+void GLSceneBuffers::upload(const Scene &scene, const BVH &bvh, const MeshBVH &mesh_bvh) {
+    sphere_data.setData(scene_packing::packSpheres(scene.objects), GL_RGBA32F);
+    sphere_materials.setData(scene_packing::packSphereMaterials(scene.objects), GL_R32I);
+    light_data.setData(scene_packing::packLights(scene.lights), GL_RGBA32F);
+    material_data.setData(scene_packing::packMaterials(scene.materials), GL_RGBA32F);
+    bvh_nodes.setData(bvh.packNodes(), GL_RGBA32F);
+    bvh_indices.setData(bvh.getIndices(), GL_R32I);
+    mesh_vertices.setData(mesh_bvh.getVertices(), GL_RGBA32F);
+    mesh_triangles.setData(mesh_bvh.getTriangles(), GL_RGBA32I);
+    mesh_bvh_nodes.setData(mesh_bvh.getBVH().packNodes(), GL_RGBA32F);
+    mesh_bvh_indices.setData(mesh_bvh.getBVH().getIndices(), GL_R32I);
+    uploadLightTree(scene.lights);
+    num_of_lights = static_cast<int>(scene.lights.size());
+    num_of_bvh_nodes = static_cast<int>(bvh.getNodes().size());
+    num_of_mesh_bvh_nodes = static_cast<int>(mesh_bvh.getBVH().getNodes().size());
+}
+
+void GLSceneBuffers::upload(const MappedScene &scene) {
+    sphere_data.setData(scene.sphereData(), scene.getNumOfSpheres() * scene_packing::TEXELS_PER_SPHERE, GL_RGBA32F);
+    sphere_materials.setData(scene.sphereMaterials(), scene.getNumOfSpheres(), GL_R32I);
+    light_data.setData(scene.lightData(), scene.getNumOfLights() * scene_packing::TEXELS_PER_LIGHT, GL_RGBA32F);
+    material_data.setData(scene.materialData(), scene.getNumOfMaterials() * scene_packing::TEXELS_PER_MATERIAL, GL_RGBA32F);
+    bvh_nodes.setData(scene.bvhNodes(), 2 * scene.getNumOfBvhNodes(), GL_RGBA32F);
+    bvh_indices.setData(scene.bvhIndices(), scene.getNumOfBvhIndices(), GL_R32I);
+    mesh_vertices.setData(scene.meshVertices(), scene.getNumOfMeshVertices(), GL_RGBA32F);
+    mesh_triangles.setData(scene.meshTriangles(), scene.getNumOfMeshTriangles() * scene_packing::INTS_PER_TRIANGLE, GL_RGBA32I);
+    mesh_bvh_nodes.setData(scene.meshBvhNodes(), 2 * scene.getNumOfMeshBvhNodes(), GL_RGBA32F);
+    mesh_bvh_indices.setData(scene.meshBvhIndices(), scene.getNumOfMeshBvhIndices(), GL_R32I);
+    uploadLightTree(scene_packing::unpackLights(scene.lightData(), scene.getNumOfLights()));
+    num_of_lights = scene.getNumOfLights();
+    num_of_bvh_nodes = scene.getNumOfBvhNodes();
+    num_of_mesh_bvh_nodes = scene.getNumOfMeshBvhNodes();
+}
+
+void GLSceneBuffers::update(const Scene &scene, const BVH &bvh) {
+    const auto &changes = scene.getChanges();
+    for (const auto &range: changes.objects) {
+        const auto spheres = slice(scene.objects, range);
+        sphere_data.updateData(scene_packing::TEXELS_PER_SPHERE * range.begin, scene_packing::packSpheres(spheres));
+        sphere_materials.updateData(range.begin, scene_packing::packSphereMaterials(spheres));
+    }
+    if (!changes.lights.empty()) {
+        for (const auto &range: changes.lights) {
+            light_data.updateData(scene_packing::TEXELS_PER_LIGHT * range.begin, scene_packing::packLights(slice(scene.lights, range)));
+        }
+        uploadLightTree(scene.lights);
+    }
+    for (const auto &range: changes.materials) {
+        material_data.updateData(scene_packing::TEXELS_PER_MATERIAL * range.begin,
+                                 scene_packing::packMaterials(slice(scene.materials, range)));
+    }
+
+    const auto &bvh_changes = bvh.getChanges();
+    for (const auto &range: bvh_changes.nodes) {
+        bvh_nodes.updateData(2 * range.begin, bvh.packNodes(range.begin, range.end));
+    }
+    for (const auto &range: bvh_changes.indices) {
+        bvh_indices.updateData(range.begin, slice(bvh.getIndices(), range));
+    }
+
+    num_of_lights = static_cast<int>(scene.lights.size());
+    num_of_bvh_nodes = static_cast<int>(bvh.getNodes().size());
+}
+
+void GLSceneBuffers::uploadLightTree(const std::vector<LightSource> &lights) {
+    LightTree light_tree;
+    light_tree.build(lights);
+    light_tree_nodes.setData(light_tree.packNodes(), GL_RGBA32F);
+}
+
+void GLSceneBuffers::setSamplers(QOpenGLShaderProgram *program, int first_unit) {
+    program->setUniformValue(program->uniformLocation("sphereData"), first_unit);
+    program->setUniformValue(program->uniformLocation("sphereMaterials"), first_unit + 1);
+    program->setUniformValue(program->uniformLocation("lightData"), first_unit + 2);
+    program->setUniformValue(program->uniformLocation("materialData"), first_unit + 3);
+    program->setUniformValue(program->uniformLocation("bvhNodes"), first_unit + 4);
+    program->setUniformValue(program->uniformLocation("bvhIndices"), first_unit + 5);
+    program->setUniformValue(program->uniformLocation("meshVertices"), first_unit + 6);
+    program->setUniformValue(program->uniformLocation("meshTriangles"), first_unit + 7);
+    program->setUniformValue(program->uniformLocation("meshBvhNodes"), first_unit + 8);
+    program->setUniformValue(program->uniformLocation("meshBvhIndices"), first_unit + 9);
+    program->setUniformValue(program->uniformLocation("lightTree"), first_unit + 10);
+}
+
+void GLSceneBuffers::bind(int first_unit) {
+    sphere_data.bind(first_unit);
+    sphere_materials.bind(first_unit + 1);
+    light_data.bind(first_unit + 2);
+    material_data.bind(first_unit + 3);
+    bvh_nodes.bind(first_unit + 4);
+    bvh_indices.bind(first_unit + 5);
+    mesh_vertices.bind(first_unit + 6);
+    mesh_triangles.bind(first_unit + 7);
+    mesh_bvh_nodes.bind(first_unit + 8);
+    mesh_bvh_indices.bind(first_unit + 9);
+    light_tree_nodes.bind(first_unit + 10);
+}
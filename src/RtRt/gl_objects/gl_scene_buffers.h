@@ -0,0 +1,86 @@
+#pragma once
+
+#include "gl_texture_buffer.h"
+#include "objects/scene.h"
+#include "accel/bvh.h"
+#include "accel/mesh_bvh.h"
+#include "accel/light_tree.h"
+#include "io/mapped_scene.h"
+
+#include <QOpenGLShaderProgram>
+
+/**
+ * Scene and its BVH packed into buffer textures for raytrace.frag:
+ * sphereData - (position, radius) per sphere,
+ * sphereMaterials - material index per sphere,
+ * lightData - (position, 0), (color, 0) per light,
+ * materialData - (diffuse, shininess), (specular, refraction coeff), (refraction index, 0, 0, 0) per material,
+ * bvhNodes, bvhIndices - flattened BVH (see BVH::packNodes),
+ * meshVertices - (position, 0) per vertex of all the meshes,
+ * meshTriangles - (v0, v1, v2, material index) per triangle,
+ * meshBvhNodes, meshBvhIndices - flattened BVH over the triangles,
+ * lightTree - hierarchy over the lights for light sampling (see LightTree::packNodes), built on upload.
+ * Everything is in world space and is uploaded once per scene change: navigation only moves the camera.
+ * Small edits are uploaded by update() as the changed ranges only.
+ * Spheres and the BVH nodes over them may also be written on the GPU (see SceneAnimator).
+ * Arrays are packed by scene_packing; binary scene files have the same layout.
+ */
+class GLSceneBuffers {
+public:
+    static const int NUM_OF_TEXTURES = 11;
+
+public:
+    GLSceneBuffers() {}
+
+    void upload(const Scene &scene, const BVH &bvh, const MeshBVH &mesh_bvh);
+    // Uploads the arrays of a mapped scene file with its BVHs straight from the mapping, without copies.
+    void upload(const MappedScene &scene);
+    // Uploads the elements changed since the last upload (see Scene::getChanges and BVH::getChanges).
+    // Meshes are not updated: they need a full upload.
+    void update(const Scene &scene, const BVH &bvh);
+
+    // Assigns texture units (starting from the first unit) to samplers of the program.
+    void setSamplers(QOpenGLShaderProgram *program, int first_unit);
+    // Binds textures to the units (starting from the first unit).
+    void bind(int first_unit);
+
+    int getNumOfSpheres() const {
+        return sphere_data.size();
+    }
+
+    int getNumOfLights() const {
+        return num_of_lights;
+    }
+
+    int getNumOfBvhNodes() const {
+        return num_of_bvh_nodes;
+    }
+
+    int getNumOfMeshBvhNodes() const {
+        return num_of_mesh_bvh_nodes;
+    }
+
+    // Buffer objects of sphereData and bvhNodes, for kernels updating them in place.
+    GLuint getSphereBuffer() const {
+        return sphere_data.bufferId();
+    }
+
+    GLuint getBvhNodeBuffer() const {
+        return bvh_nodes.bufferId();
+    }
+
+private:
+    void uploadLightTree(const std::vector<LightSource> &lights);
+
+private:
+    GLTextureBuffer sphere_data, sphere_materials;
+    GLTextureBuffer light_data;
+    GLTextureBuffer material_data;
+    GLTextureBuffer bvh_nodes, bvh_indices;
+    GLTextureBuffer mesh_vertices, mesh_triangles;
+    GLTextureBuffer mesh_bvh_nodes, mesh_bvh_indices;
+    GLTextureBuffer light_tree_nodes;
+    int num_of_lights {0};
+    int num_of_bvh_nodes {0};
+    int num_of_mesh_bvh_nodes {0};
+};
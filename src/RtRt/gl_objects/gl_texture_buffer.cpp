@@ -0,0 +1,104 @@
+#include "gl_texture_buffer.h"
+
+#include <QOpenGLContext>
+
+#include <stdexcept>
+
+GLTextureBuffer::GLTextureBuffer() :
+    buffer(QOpenGLBuffer::VertexBuffer)
+{
+}
+
+GLTextureBuffer::~GLTextureBuffer() {
+    if (texture && QOpenGLContext::currentContext()) {
+        QOpenGLContext::currentContext()->functions()->glDeleteTextures(1, &texture);
+    }
+}
+
+QOpenGLFunctions_3_3_Core* GLTextureBuffer::functions() const {
+    auto *gl = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_3_Core>();
+    if (!gl || !gl->initializeOpenGLFunctions()) {
+        throw std::runtime_error("Buffer textures require OpenGL 3.3");
+    }
+    return gl;
+}
+
+void GLTextureBuffer::setData(const void *data, int size, GLenum format, QOpenGLBuffer::UsagePattern pattern) {
+    auto *gl = functions();
+
+    if (!buffer.isCreated()) {
+        buffer.create();
+        gl->glGenTextures(1, &texture);
+    }
+    buffer.setUsagePattern(pattern);
+    buffer.bind();
+    if (size > 0) {
+        buffer.allocate(data, size);
+        capacity = size;
+    } else {
+        // Keep the texture valid for an empty data set.
+        const float zeros[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        buffer.allocate(zeros, sizeof(zeros));
+        capacity = sizeof(zeros);
+    }
+    buffer.release();
+    texel_format = format;
+    data_size = size;
+
+    attachBuffer();
+}
+
+void GLTextureBuffer::updateData(int offset, const void *data, int size) {
+    if (size <= 0) {
+        return;
+    }
+    if (!buffer.isCreated()) {
+        setData(nullptr, 0, texel_format, QOpenGLBuffer::StaticDraw);
+    }
+    reserve(offset + size);
+    buffer.bind();
+    buffer.write(offset, data, size);
+    buffer.release();
+    data_size = std::max(data_size, offset + size);
+}
+
+void GLTextureBuffer::reserve(int size) {
+    if (size <= capacity) {
+        return;
+    }
+    auto *gl = functions();
+
+    const auto new_capacity = std::max(size, 2 * capacity);
+    QOpenGLBuffer grown(QOpenGLBuffer::VertexBuffer);
+    grown.create();
+    grown.setUsagePattern(buffer.usagePattern());
+    grown.bind();
+    grown.allocate(new_capacity);
+    grown.release();
+
+    if (data_size > 0) {
+        gl->glBindBuffer(GL_COPY_READ_BUFFER, buffer.bufferId());
+        gl->glBindBuffer(GL_COPY_WRITE_BUFFER, grown.bufferId());
+        gl->glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, data_size);
+        gl->glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        gl->glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    buffer.destroy();
+    buffer = grown;
+    capacity = new_capacity;
+    attachBuffer();
+}
+
+void GLTextureBuffer::attachBuffer() {
+    auto *gl = functions();
+    gl->glBindTexture(GL_TEXTURE_BUFFER, texture);
+    gl->glTexBuffer(GL_TEXTURE_BUFFER, texel_format, buffer.bufferId());
+    gl->glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+void GLTextureBuffer::bind(int unit) {
+    auto *gl = QOpenGLContext::currentContext()->functions();
+    gl->glActiveTexture(GL_TEXTURE0 + unit);
+    gl->glBindTexture(GL_TEXTURE_BUFFER, texture);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <QOpenGLBuffer>
+#include <QOpenGLFunctions_3_3_Core>
+
+#include <algorithm>
+#include <vector>
+
+/**
+ * Buffer object exposed to shaders as a buffer texture (samplerBuffer/isamplerBuffer).
+ */
+class GLTextureBuffer {
+public:
+    GLTextureBuffer();
+    ~GLTextureBuffer();
+
+    GLTextureBuffer(const GLTextureBuffer&) = delete;
+    GLTextureBuffer& operator=(const GLTextureBuffer&) = delete;
+
+    // Format is the internal format of texels (GL_RGBA32F, GL_R32I, ...).
+    template <class T>
+    void setData(const typename std::vector<T> &elems,
+                 GLenum format,
+                 QOpenGLBuffer::UsagePattern pattern = QOpenGLBuffer::StaticDraw)
+    {
+        setData(elems.data(), static_cast<int>(elems.size()), format, pattern);
+    }
+
+    // Uploads the array as is (e.g. straight from a mapped file).
+    template <class T>
+    void setData(const T *elems, int num,
+                 GLenum format,
+                 QOpenGLBuffer::UsagePattern pattern = QOpenGLBuffer::StaticDraw)
+    {
+        setData(static_cast<const void*>(elems), static_cast<int>(num * sizeof(T)), format, pattern);
+        num_of_elems = num;
+    }
+
+    // Replaces the elements starting from the first one (with glBufferSubData), keeping the rest.
+    // Elements past the end are appended: the buffer grows twice, so appending is cheap on average.
+    template <class T>
+    void updateData(int first, const typename std::vector<T> &elems) {
+        updateData(static_cast<int>(first * sizeof(T)), static_cast<const void*>(elems.data()),
+                   static_cast<int>(elems.size() * sizeof(T)));
+        num_of_elems = std::max(num_of_elems, first + static_cast<int>(elems.size()));
+    }
+
+    // Binds the texture to the given texture unit.
+    void bind(int unit);
+
+    int size() const {
+        return num_of_elems;
+    }
+
+    // Buffer object holding the texels, e.g. to be written by compute shaders.
+    // It changes when the buffer grows (see updateData).
+    GLuint bufferId() const {
+        return buffer.bufferId();
+    }
+
+private:
+    void setData(const void *data, int size, GLenum format, QOpenGLBuffer::UsagePattern pattern);
+    void updateData(int offset, const void *data, int size);
+    // Reallocates the buffer with the data kept if it is smaller than the size.
+    void reserve(int size);
+    void attachBuffer();
+
+    QOpenGLFunctions_3_3_Core* functions() const;
+
+private:
+    QOpenGLBuffer buffer;
+    GLuint texture {0};
+    GLenum texel_format {GL_RGBA32F};
+    int num_of_elems {0};
+    // Sizes in bytes.
+    int data_size {0};
+    int capacity {0};
+};
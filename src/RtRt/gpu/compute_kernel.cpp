@@ -0,0 +1,26 @@
+#include "compute_kernel.h"
+#include "shader_source.h"
+
+#include <stdexcept>
+#include <string>
+
+namespace compute_kernel {
+
+GLuint numOfGroups(int num_of_items) {
+    return static_cast<GLuint>((num_of_items + WORK_GROUP_SIZE - 1) / WORK_GROUP_SIZE);
+}
+
+std::shared_ptr<QOpenGLShaderProgram> load(const QString &file, const QString &kernel_define) {
+    auto prog = std::make_shared<QOpenGLShaderProgram>();
+    if (!prog->addShaderFromSourceCode(QOpenGLShader::Compute, shader_source::load(file, {kernel_define}))) {
+        throw std::runtime_error(std::string("Failed to load compute shader from ") + file.toStdString()
+                                 + " (" + kernel_define.toStdString() + "):\n" + prog->log().toStdString());
+    }
+    if (!prog->link()) {
+        throw std::runtime_error(std::string("Failed to link kernel ") + kernel_define.toStdString()
+                                 + ":\n" + prog->log().toStdString());
+    }
+    return prog;
+}
+
+}
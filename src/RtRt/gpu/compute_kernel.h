@@ -0,0 +1,20 @@
+#pragma once
+
+#include <QOpenGLShaderProgram>
+#include <QString>
+
+#include <memory>
+
+namespace compute_kernel {
+
+// local_size_x of the kernels (animate.comp, wavefront.comp).
+const int WORK_GROUP_SIZE = 64;
+
+// Work groups covering the items, one invocation per item.
+GLuint numOfGroups(int num_of_items);
+
+// Compiles and links one kernel of the file: the one selected by the define (see shader_source::load).
+// Throws std::runtime_error if it fails.
+std::shared_ptr<QOpenGLShaderProgram> load(const QString &file, const QString &kernel_define);
+
+}
@@ -0,0 +1,135 @@
+#include "frame_capture.h"
+
+#include <QOpenGLContext>
+
+#include <cstring>
+
+FrameCapture::FrameCapture() {
+}
+
+FrameCapture::~FrameCapture() {
+    // GL objects need the context, which may be gone by now: only the writer is stopped here.
+    writer.stop();
+}
+
+void FrameCapture::start(const QString &filename, CaptureFormat format, int frames_per_second) {
+    stop();
+
+    gl = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_3_Core>();
+    writer.start(filename, format, frames_per_second);
+
+    readbacks.resize(NUM_OF_READBACKS);
+    for (auto &readback: readbacks) {
+        gl->glGenBuffers(1, &readback.buffer);
+        readback.capacity = 0;
+        readback.fence = nullptr;
+    }
+    next_readback = 0;
+    frame_index = 0;
+    active = true;
+}
+
+void FrameCapture::stop() {
+    if (!active) {
+        return;
+    }
+    collect(true);
+    release();
+    writer.stop();
+    active = false;
+}
+
+bool FrameCapture::isActive() const {
+    return active;
+}
+
+void FrameCapture::release() {
+    for (auto &readback: readbacks) {
+        if (readback.fence) {
+            gl->glDeleteSync(readback.fence);
+        }
+        gl->glDeleteBuffers(1, &readback.buffer);
+    }
+    readbacks.clear();
+}
+
+void FrameCapture::capture(GLuint framebuffer, const QSize &size) {
+    if (!active) {
+        return;
+    }
+    collect(false);
+
+    const auto index = frame_index++;
+    auto &readback = readbacks[next_readback];
+    if (readback.fence) {
+        // The GPU has not copied the frame from a ring ago yet: waiting would stall the render loop.
+        writer.frameDropped();
+        return;
+    }
+
+    const auto num_of_bytes = static_cast<GLsizeiptr>(size.width()) * size.height() * 4;
+    gl->glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    if (readback.capacity != num_of_bytes) {
+        gl->glBufferData(GL_PIXEL_PACK_BUFFER, num_of_bytes, nullptr, GL_STREAM_READ);
+        readback.capacity = num_of_bytes;
+    }
+    gl->glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    // With a pack buffer bound the copy is queued and the call returns at once.
+    gl->glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    gl->glReadPixels(0, 0, size.width(), size.height(), GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    gl->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    readback.fence = gl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readback.size = size;
+    readback.index = index;
+    next_readback = (next_readback + 1) % NUM_OF_READBACKS;
+}
+
+void FrameCapture::collect(bool wait) {
+    // The oldest readback is the next one to be reused.
+    for (int i = 0; i < NUM_OF_READBACKS; i++) {
+        auto &readback = readbacks[(next_readback + i) % NUM_OF_READBACKS];
+        if (!readback.fence) {
+            continue;
+        }
+        const auto status = wait ?
+                    gl->glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED) :
+                    gl->glClientWaitSync(readback.fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+            // Later frames are not done either; frames are written in order.
+            break;
+        }
+        gl->glDeleteSync(readback.fence);
+        readback.fence = nullptr;
+
+        const auto num_of_bytes = static_cast<size_t>(readback.capacity);
+        auto pixels = writer.acquireBuffer(num_of_bytes);
+        if (!pixels) {
+            writer.frameDropped();
+            continue;
+        }
+        gl->glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        const auto *data = gl->glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, readback.capacity, GL_MAP_READ_BIT);
+        if (data) {
+            std::memcpy(pixels->data(), data, num_of_bytes);
+            gl->glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        gl->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        if (!data) {
+            writer.releaseBuffer(pixels);
+            writer.frameDropped();
+            continue;
+        }
+
+        CapturedFrame frame;
+        frame.index = readback.index;
+        frame.width = readback.size.width();
+        frame.height = readback.size.height();
+        frame.pixels = pixels;
+        writer.push(frame);
+    }
+}
+
+FrameWriter::Stats FrameCapture::getStats() const {
+    return writer.getStats();
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "io/frame_writer.h"
+
+#include <QOpenGLFunctions_3_3_Core>
+#include <QSize>
+
+#include <vector>
+
+/**
+ * Captures rendered frames without stalling the pipeline: glReadPixels goes into one of a ring
+ * of pixel buffer objects and returns at once, a fence marks when the copy is done, and the buffer
+ * is mapped only a few frames later, when its fence has been passed. Mapped pixels are handed
+ * to FrameWriter, which writes them to disk on its own thread.
+ * If all the pixel buffers are still in flight (or the writer is behind), the frame is dropped.
+ */
+class FrameCapture {
+public:
+    FrameCapture();
+    ~FrameCapture();
+
+    FrameCapture(const FrameCapture&) = delete;
+    FrameCapture& operator=(const FrameCapture&) = delete;
+
+    // The context must be current. Throws std::runtime_error if the output can't be created.
+    void start(const QString &filename, CaptureFormat format, int frames_per_second = 30);
+    // Waits for the frames in flight and for the writer; the context must be current.
+    void stop();
+    bool isActive() const;
+
+    // Starts reading the color buffer of the framebuffer back: call when the frame is drawn.
+    void capture(GLuint framebuffer, const QSize &size);
+
+    FrameWriter::Stats getStats() const;
+
+private:
+    struct Readback {
+        GLuint buffer = 0;
+        GLsizeiptr capacity = 0;
+        GLsync fence = nullptr;
+        QSize size;
+        long long index = 0;
+    };
+
+    // Hands the finished readbacks to the writer in order; waits for all of them if 'wait' is set.
+    void collect(bool wait);
+    void release();
+
+private:
+    // Frames in flight: the oldest one is usually done by the time the ring wraps around.
+    static const int NUM_OF_READBACKS = 3;
+
+    QOpenGLFunctions_3_3_Core *gl = nullptr;
+    std::vector<Readback> readbacks;
+    int next_readback = 0;
+    long long frame_index = 0;
+    bool active = false;
+
+    FrameWriter writer;
+};
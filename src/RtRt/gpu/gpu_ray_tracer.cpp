@@ -0,0 +1,802 @@
+#include "gpu_ray_tracer.h"
+#include "shader_source.h"
+#include "util.h"
+
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QOpenGLFunctions_3_3_Core>
+#include <QVector2D>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+
+// Sample offsets are computed in the shader (see sampler.glsl), so the scene buffers start from unit 0.
+const int SCENE_TEXTURE_UNIT = 0;
+const int HISTORY_TEXTURE_UNIT = SCENE_TEXTURE_UNIT + GLSceneBuffers::NUM_OF_TEXTURES;
+const int PILOT_TEXTURE_UNIT = HISTORY_TEXTURE_UNIT + 1;
+// Denoiser inputs: the image being filtered and the two G-buffer targets.
+const int DENOISE_IMAGE_TEXTURE_UNIT = PILOT_TEXTURE_UNIT + 1;
+const int GBUFFER_TEXTURE_UNIT = DENOISE_IMAGE_TEXTURE_UNIT + 1;
+// Temporal reprojection inputs: the new pass, the history and the previous G-buffer (the current one is above).
+const int TEMPORAL_PASS_TEXTURE_UNIT = GBUFFER_TEXTURE_UNIT + 2;
+const int TEMPORAL_HISTORY_TEXTURE_UNIT = TEMPORAL_PASS_TEXTURE_UNIT + 1;
+const int PREV_GBUFFER_TEXTURE_UNIT = TEMPORAL_HISTORY_TEXTURE_UNIT + 1;
+// Hybrid mode: primary hits of the spheres, rasterized before tracing.
+const int VISIBILITY_TEXTURE_UNIT = PREV_GBUFFER_TEXTURE_UNIT + 2;
+
+// Neighbours are compared by the normals and the distances stored in the G-buffer.
+const float DENOISE_NORMAL_POWER = 64.0f;
+const float DENOISE_DEPTH_SIGMA = 0.02f;
+
+// RGBA32F image sampled with linear filtering: it may be traced at a lower resolution than the window
+// and upscaled on display.
+std::shared_ptr<QOpenGLFramebufferObject> createImageBuffer(const QSize &size) {
+    QOpenGLFramebufferObjectFormat format;
+    format.setAttachment(QOpenGLFramebufferObject::NoAttachment);
+    format.setInternalTextureFormat(GL_RGBA32F);
+    auto buffer = std::make_shared<QOpenGLFramebufferObject>(size, format);
+    auto *gl = QOpenGLContext::currentContext()->functions();
+    gl->glBindTexture(GL_TEXTURE_2D, buffer->texture());
+    gl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    gl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    gl->glBindTexture(GL_TEXTURE_2D, 0);
+    return buffer;
+}
+
+}
+
+GPURayTracer::GPURayTracer() {
+}
+
+void GPURayTracer::init(const QString &shaders_dir) {
+    this->shaders_dir = shaders_dir;
+
+    display_program = loadProgram(shaders_dir + "/raytrace.vert", shaders_dir + "/display.frag");
+    initDisplayUniforms();
+
+    denoise_program = loadProgram(shaders_dir + "/raytrace.vert", shaders_dir + "/denoise.frag");
+    denoise_uniforms.step_size = denoise_program->uniformLocation("stepSize");
+    denoise_uniforms.color_sigma = denoise_program->uniformLocation("colorSigma");
+    denoise_program->bind();
+    denoise_program->setUniformValue(denoise_program->uniformLocation("image"), DENOISE_IMAGE_TEXTURE_UNIT);
+    denoise_program->setUniformValue(denoise_program->uniformLocation("normalDepth"), GBUFFER_TEXTURE_UNIT);
+    denoise_program->setUniformValue(denoise_program->uniformLocation("albedoId"), GBUFFER_TEXTURE_UNIT + 1);
+    denoise_program->setUniformValue(denoise_program->uniformLocation("normalPower"), DENOISE_NORMAL_POWER);
+    denoise_program->setUniformValue(denoise_program->uniformLocation("depthSigma"), DENOISE_DEPTH_SIGMA);
+    denoise_program->release();
+
+    temporal_program = loadProgram(shaders_dir + "/raytrace.vert", shaders_dir + "/temporal.frag");
+    initTemporalUniforms();
+
+    impostor_program = loadProgram(shaders_dir + "/impostor.vert", shaders_dir + "/impostor.frag");
+    initImpostorUniforms();
+    impostor_vao = std::make_shared<QOpenGLVertexArrayObject>();
+    impostor_vao->create();
+
+    plane = std::make_shared<GLPlane>(); // plane is in NDC already
+    plane->attachVertices(display_program.get(), "vertex");
+
+    // Compile the default variant now, so shader errors show up on init.
+    raytraceProgram(RenderSettings(), TP_FRAME, AP_NONE);
+}
+
+bool GPURayTracer::isInitialized() const {
+    return display_program != nullptr;
+}
+
+int GPURayTracer::getNumOfCachedPrograms() const {
+    return static_cast<int>(raytrace_programs.size());
+}
+
+QStringList GPURayTracer::variantDefines(const RenderSettings &settings, TracePass pass,
+                                         AdaptivePass adaptive_pass) const {
+    if (pass == TP_GBUFFER) {
+        return QStringList() << "GBUFFER 1" << "REFRACTION_ENABLED 0"
+                             << QString("HYBRID %1").arg(hybridPass(settings, pass) ? 1 : 0);
+    }
+    // Progressive and temporal passes need different sample positions each time.
+    const bool single_sample = (settings.num_of_samples == 1 && pass == TP_FRAME);
+    QStringList defines;
+    defines << QString("REFRACTION_ENABLED %1").arg(settings.transparency_enabled ? 1 : 0);
+    // Sampling mode does not matter when there is one sample at the pixel center.
+    defines << QString("SAMPLING_MODE %1").arg(single_sample ? 0 : int(settings.sampling_mode));
+    defines << QString("SINGLE_SAMPLE %1").arg(single_sample ? 1 : 0);
+    defines << QString("ACCUMULATE %1").arg(pass == TP_ACCUMULATE ? 1 : 0);
+    defines << QString("ADAPTIVE %1").arg(int(adaptive_pass));
+    defines << QString("HYBRID %1").arg(hybridPass(settings, pass) ? 1 : 0);
+    if (settings.num_of_steps <= MAX_SPECIALIZED_NUM_OF_STEPS) {
+        defines << QString("NUM_OF_STEPS %1").arg(settings.num_of_steps);
+    }
+    return defines;
+}
+
+bool GPURayTracer::hybridPass(const RenderSettings &settings, TracePass pass) const {
+    return settings.hybrid && (pass == TP_GBUFFER || (pass == TP_FRAME && settings.num_of_samples == 1));
+}
+
+GPURayTracer::RaytraceProgram& GPURayTracer::raytraceProgram(const RenderSettings &settings, TracePass pass,
+                                                             AdaptivePass adaptive_pass) {
+    const auto defines = variantDefines(settings, pass, adaptive_pass);
+    const auto key = defines.join(";");
+    auto it = raytrace_programs.find(key);
+    if (it != raytrace_programs.end()) {
+        return it->second;
+    }
+
+    RaytraceProgram variant;
+    variant.program = loadProgram(shaders_dir + "/raytrace.vert", shaders_dir + "/raytrace.frag", defines);
+
+    auto &program = variant.program;
+    auto &uniforms = variant.uniforms;
+    uniforms.num_of_samples = program->uniformLocation("numOfSamples");
+    uniforms.num_of_steps = program->uniformLocation("numOfSteps");
+    uniforms.frame_index = program->uniformLocation("frameIndex");
+    uniforms.num_of_pilot_samples = program->uniformLocation("numOfPilotSamples");
+    uniforms.adaptive_threshold = program->uniformLocation("adaptiveThreshold");
+    uniforms.num_of_light_sources = program->uniformLocation("numOfLightSources");
+    uniforms.num_of_light_samples = program->uniformLocation("numOfLightSamples");
+    uniforms.num_of_bvh_nodes = program->uniformLocation("numOfBvhNodes");
+    uniforms.num_of_mesh_bvh_nodes = program->uniformLocation("numOfMeshBvhNodes");
+    uniforms.background_color = program->uniformLocation("backgroundColor");
+    uniforms.cam_to_world = program->uniformLocation("camToWorld");
+    uniforms.window_size = program->uniformLocation("windowSize");
+    uniforms.camera_fov = program->uniformLocation("cameraFOV");
+    uniforms.fov_tangent = program->uniformLocation("fovTangent");
+    uniforms.tile_offset = program->uniformLocation("tileOffset");
+
+    // Texture units never change, so samplers are set once.
+    program->bind();
+    scene_buffers.setSamplers(program.get(), SCENE_TEXTURE_UNIT);
+    program->setUniformValue(program->uniformLocation("history"), HISTORY_TEXTURE_UNIT);
+    program->setUniformValue(program->uniformLocation("pilotSamples"), PILOT_TEXTURE_UNIT);
+    program->setUniformValue(program->uniformLocation("visibility"), VISIBILITY_TEXTURE_UNIT);
+    program->release();
+
+    return raytrace_programs.emplace(key, variant).first->second;
+}
+
+void GPURayTracer::initDisplayUniforms() {
+    display_uniforms.window_size = display_program->uniformLocation("windowSize");
+    display_uniforms.flip_y = display_program->uniformLocation("flipY");
+
+    display_program->bind();
+    display_program->setUniformValue(display_program->uniformLocation("image"), 0);
+    display_program->release();
+}
+
+void GPURayTracer::initTemporalUniforms() {
+    temporal_uniforms.cam_to_world = temporal_program->uniformLocation("camToWorld");
+    temporal_uniforms.fov_tangent = temporal_program->uniformLocation("fovTangent");
+    temporal_uniforms.window_size = temporal_program->uniformLocation("windowSize");
+    temporal_uniforms.prev_world_to_cam = temporal_program->uniformLocation("prevWorldToCam");
+    temporal_uniforms.prev_fov_tangent = temporal_program->uniformLocation("prevFovTangent");
+    temporal_uniforms.history_valid = temporal_program->uniformLocation("historyValid");
+
+    temporal_program->bind();
+    temporal_program->setUniformValue(temporal_program->uniformLocation("pass"), TEMPORAL_PASS_TEXTURE_UNIT);
+    temporal_program->setUniformValue(temporal_program->uniformLocation("history"), TEMPORAL_HISTORY_TEXTURE_UNIT);
+    temporal_program->setUniformValue(temporal_program->uniformLocation("normalDepth"), GBUFFER_TEXTURE_UNIT);
+    temporal_program->setUniformValue(temporal_program->uniformLocation("albedoId"), GBUFFER_TEXTURE_UNIT + 1);
+    temporal_program->setUniformValue(temporal_program->uniformLocation("prevNormalDepth"), PREV_GBUFFER_TEXTURE_UNIT);
+    temporal_program->setUniformValue(temporal_program->uniformLocation("prevAlbedoId"), PREV_GBUFFER_TEXTURE_UNIT + 1);
+    temporal_program->setUniformValue(temporal_program->uniformLocation("maxHistory"), MAX_TEMPORAL_HISTORY);
+    temporal_program->release();
+}
+
+void GPURayTracer::initImpostorUniforms() {
+    impostor_uniforms.world_to_cam = impostor_program->uniformLocation("worldToCam");
+    impostor_uniforms.cam_to_world = impostor_program->uniformLocation("camToWorld");
+    impostor_uniforms.fov_tangent = impostor_program->uniformLocation("fovTangent");
+    impostor_uniforms.window_size = impostor_program->uniformLocation("windowSize");
+    impostor_uniforms.tile_offset = impostor_program->uniformLocation("tileOffset");
+    impostor_uniforms.tile_size = impostor_program->uniformLocation("tileSize");
+
+    impostor_program->bind();
+    scene_buffers.setSamplers(impostor_program.get(), SCENE_TEXTURE_UNIT);
+    impostor_program->release();
+}
+
+void GPURayTracer::uploadScene(const Scene &scene, const BVH &bvh, const MeshBVH &mesh_bvh) {
+    scene_buffers.upload(scene, bvh, mesh_bvh);
+    if (scene_animator) {
+        scene_animator->sceneReplaced();
+    }
+    invalidateGBuffers();
+    resetAccumulation();
+}
+
+void GPURayTracer::uploadScene(const MappedScene &scene) {
+    scene_buffers.upload(scene);
+    if (scene_animator) {
+        scene_animator->sceneReplaced();
+    }
+    invalidateGBuffers();
+    resetAccumulation();
+}
+
+void GPURayTracer::updateScene(const Scene &scene, const BVH &bvh) {
+    scene_buffers.update(scene, bvh);
+    if (scene_animator) {
+        // The uploaded bounds are of the positions on the CPU, not of the moved spheres.
+        scene_buffers.bind(SCENE_TEXTURE_UNIT);
+        scene_animator->sceneEdited(scene_buffers);
+    }
+    invalidateGBuffers();
+    resetAccumulation();
+}
+
+GPURayTracer::RaytraceProgram& GPURayTracer::bindProgram(const RenderSettings &settings, const Camera &camera,
+                                                         const QSize &size, TracePass pass,
+                                                         AdaptivePass adaptive_pass, const QRect &tile) {
+    auto *gl = QOpenGLContext::currentContext()->functions();
+    ProfileScope scope(profiler, FS_UNIFORMS);
+
+    const auto viewport = tile.isNull() ? QRect(QPoint(0, 0), size) : tile;
+    gl->glViewport(0, 0, viewport.width(), viewport.height());
+
+    auto &variant = raytraceProgram(settings, pass, adaptive_pass);
+    auto &program = variant.program;
+    const auto &uniforms = variant.uniforms;
+    program->bind();
+
+    scene_buffers.bind(SCENE_TEXTURE_UNIT);
+
+    // Uniforms compiled into the variant as constants have no location and are skipped.
+    program->setUniformValue(uniforms.num_of_samples, settings.num_of_samples);
+    program->setUniformValue(uniforms.num_of_steps, settings.num_of_steps);
+    program->setUniformValue(uniforms.num_of_pilot_samples, settings.numOfPilotSamples());
+    program->setUniformValue(uniforms.adaptive_threshold, settings.adaptive_threshold);
+
+    program->setUniformValue(uniforms.num_of_light_sources, scene_buffers.getNumOfLights());
+    program->setUniformValue(uniforms.num_of_light_samples, settings.num_of_light_samples);
+    program->setUniformValue(uniforms.num_of_bvh_nodes, scene_buffers.getNumOfBvhNodes());
+    program->setUniformValue(uniforms.num_of_mesh_bvh_nodes, scene_buffers.getNumOfMeshBvhNodes());
+
+    program->setUniformValue(uniforms.background_color, util::colorToVec(settings.background_color));
+
+    program->setUniformValue(uniforms.cam_to_world, camera.camToWorld());
+    program->setUniformValue(uniforms.window_size, QVector2D(size.width(), size.height()));
+    program->setUniformValue(uniforms.camera_fov, camera.fov);
+    program->setUniformValue(uniforms.fov_tangent, camera.fovTangent());
+    program->setUniformValue(uniforms.tile_offset, QVector2D(viewport.x(), viewport.y()));
+
+    if (hybridPass(settings, pass)) {
+        gl->glActiveTexture(GL_TEXTURE0 + VISIBILITY_TEXTURE_UNIT);
+        gl->glBindTexture(GL_TEXTURE_2D, visibility_buffer->texture());
+    }
+
+    return variant;
+}
+
+void GPURayTracer::render(const RenderSettings &settings, const Camera &camera, const QSize &size) {
+    if (wavefront_enabled) {
+        traceWavefront(settings, camera, size, false, accumulated_frames, nullptr);
+        return;
+    }
+    renderTile(settings, camera, size, QRect(QPoint(0, 0), size));
+}
+
+void GPURayTracer::renderTile(const RenderSettings &settings, const Camera &camera, const QSize &size,
+                              const QRect &tile) {
+    auto *gl = QOpenGLContext::currentContext()->functions();
+
+    if (settings.adaptiveSamplingActive() && settings.num_of_samples > 1) {
+        renderAdaptive(settings, camera, size, tile);
+        return;
+    }
+
+    if (hybridPass(settings, TP_FRAME)) {
+        renderVisibility(camera, size, tile);
+    }
+    auto &variant = bindProgram(settings, camera, size, TP_FRAME, AP_NONE, tile);
+    {
+        ProfileScope scope(profiler, FS_TRACE);
+        plane->draw(gl);
+    }
+    variant.program->release();
+}
+
+void GPURayTracer::renderAdaptive(const RenderSettings &settings, const Camera &camera, const QSize &size,
+                                  const QRect &tile) {
+    auto *gl = QOpenGLContext::currentContext()->functions();
+
+    // Pixels at the edges of a tile compare their pilot errors with the neighbours inside the tile only.
+    initPilotBuffer(tile.size());
+
+    GLint prev_framebuffer = 0;
+    gl->glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_framebuffer);
+
+    pilot_buffer->bind();
+    auto &pilot = bindProgram(settings, camera, size, TP_FRAME, AP_PILOT, tile);
+    {
+        ProfileScope scope(profiler, FS_TRACE);
+        plane->draw(gl);
+    }
+    pilot.program->release();
+
+    gl->glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(prev_framebuffer));
+
+    auto &refine = bindProgram(settings, camera, size, TP_FRAME, AP_REFINE, tile);
+    gl->glActiveTexture(GL_TEXTURE0 + PILOT_TEXTURE_UNIT);
+    gl->glBindTexture(GL_TEXTURE_2D, pilot_buffer->texture());
+    {
+        ProfileScope scope(profiler, FS_TRACE);
+        plane->draw(gl);
+    }
+    refine.program->release();
+}
+
+void GPURayTracer::accumulate(const RenderSettings &settings, const Camera &camera, const QSize &size) {
+    auto *gl = QOpenGLContext::currentContext()->functions();
+
+    if (!wavefront_enabled) {
+        accumulateTile(settings, camera, size, QRect(QPoint(0, 0), size));
+        return;
+    }
+
+    initAccumulationBuffers(size);
+
+    // Trace a new pass into one buffer, averaging it with the passes from the other one.
+    auto &target = accumulation_buffers[accumulated_frames % 2];
+    auto &history = accumulation_buffers[(accumulated_frames + 1) % 2];
+
+    GLint prev_framebuffer = 0;
+    gl->glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_framebuffer);
+
+    gl->glActiveTexture(GL_TEXTURE0 + HISTORY_TEXTURE_UNIT);
+    gl->glBindTexture(GL_TEXTURE_2D, history->texture());
+    traceWavefront(settings, camera, size, true, accumulated_frames, target.get());
+    gl->glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(prev_framebuffer));
+    accumulated_frames++;
+}
+
+void GPURayTracer::accumulateTile(const RenderSettings &settings, const Camera &camera, const QSize &size,
+                                  const QRect &tile) {
+    auto *gl = QOpenGLContext::currentContext()->functions();
+
+    initAccumulationBuffers(tile.size());
+
+    // Trace a new pass into one buffer, averaging it with the passes from the other one.
+    auto &target = accumulation_buffers[accumulated_frames % 2];
+    auto &history = accumulation_buffers[(accumulated_frames + 1) % 2];
+
+    GLint prev_framebuffer = 0;
+    gl->glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_framebuffer);
+
+    target->bind();
+    auto &variant = bindProgram(settings, camera, size, TP_ACCUMULATE, AP_NONE, tile);
+    gl->glActiveTexture(GL_TEXTURE0 + HISTORY_TEXTURE_UNIT);
+    gl->glBindTexture(GL_TEXTURE_2D, history->texture());
+    variant.program->setUniformValue(variant.uniforms.frame_index, accumulated_frames);
+    {
+        ProfileScope scope(profiler, FS_TRACE);
+        plane->draw(gl);
+    }
+    variant.program->release();
+
+    gl->glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(prev_framebuffer));
+
+    accumulated_frames++;
+}
+
+void GPURayTracer::traceWavefront(const RenderSettings &settings, const Camera &camera, const QSize &size,
+                                  bool accumulate, int frame_index, QOpenGLFramebufferObject *target) {
+    auto *gl = QOpenGLContext::currentContext()->functions();
+
+    {
+        ProfileScope scope(profiler, FS_UNIFORMS);
+        scene_buffers.bind(SCENE_TEXTURE_UNIT);
+    }
+    {
+        ProfileScope scope(profiler, FS_TRACE);
+        wavefront_tracer->trace(settings, camera, size, accumulate, frame_index, scene_buffers);
+        if (target) {
+            target->bind();
+        }
+        wavefront_tracer->resolve(plane.get(), size, accumulate, frame_index);
+    }
+}
+
+void GPURayTracer::resetAccumulation() {
+    accumulated_frames = 0;
+}
+
+int GPURayTracer::getNumOfAccumulatedFrames() const {
+    return accumulated_frames;
+}
+
+GLuint GPURayTracer::getAccumulationTexture() const {
+    if (accumulated_frames == 0) {
+        return 0;
+    }
+    return accumulation_buffers[(accumulated_frames - 1) % 2]->texture();
+}
+
+void GPURayTracer::initAccumulationBuffers(const QSize &size) {
+    if (accumulation_buffers[0] && accumulation_buffers[0]->size() == size) {
+        return;
+    }
+    for (auto &buffer: accumulation_buffers) {
+        buffer = createImageBuffer(size);
+    }
+    resetAccumulation();
+}
+
+void GPURayTracer::initPilotBuffer(const QSize &size) {
+    if (pilot_buffer && pilot_buffer->size() == size) {
+        return;
+    }
+    QOpenGLFramebufferObjectFormat format;
+    format.setAttachment(QOpenGLFramebufferObject::NoAttachment);
+    format.setInternalTextureFormat(GL_RGBA32F);
+    pilot_buffer = std::make_shared<QOpenGLFramebufferObject>(size, format);
+}
+
+void GPURayTracer::initGBuffers(const QSize &size) {
+    if (gbuffers[0].targets && gbuffers[0].targets->size() == size) {
+        return;
+    }
+    QOpenGLFramebufferObjectFormat format;
+    format.setAttachment(QOpenGLFramebufferObject::NoAttachment);
+    format.setInternalTextureFormat(GL_RGBA32F);
+    auto *gl = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_3_Core>();
+    const GLenum draw_buffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    for (auto &gbuffer: gbuffers) {
+        gbuffer.targets = std::make_shared<QOpenGLFramebufferObject>(size, format);
+        gbuffer.targets->addColorAttachment(size, GL_RGBA32F);
+        // Draw buffers are the state of the framebuffer, so they are set once.
+        gbuffer.targets->bind();
+        gl->glDrawBuffers(2, draw_buffers);
+        gbuffer.targets->release();
+        gbuffer.valid = false;
+    }
+}
+
+void GPURayTracer::invalidateGBuffers() {
+    for (auto &gbuffer: gbuffers) {
+        gbuffer.valid = false;
+    }
+}
+
+GPURayTracer::RaytraceProgram* GPURayTracer::bindGBuffer(const RenderSettings &settings, const Camera &camera,
+                                                         const QSize &size) {
+    initGBuffers(size);
+
+    const auto cam_to_world = camera.camToWorld();
+    const auto &current = gbuffers[current_gbuffer];
+    if (current.valid && current.cam_to_world == cam_to_world && current.fov_tangent == camera.fovTangent()) {
+        return nullptr;
+    }
+
+    // The current G-buffer becomes the previous one.
+    current_gbuffer = 1 - current_gbuffer;
+    auto &gbuffer = gbuffers[current_gbuffer];
+    gbuffer.valid = true;
+    gbuffer.cam_to_world = cam_to_world;
+    gbuffer.fov_tangent = camera.fovTangent();
+
+    if (hybridPass(settings, TP_GBUFFER)) {
+        renderVisibility(camera, size, QRect(QPoint(0, 0), size));
+    }
+    gbuffer.targets->bind();
+    return &bindProgram(settings, camera, size, TP_GBUFFER);
+}
+
+void GPURayTracer::initVisibilityBuffer(const QSize &size) {
+    if (visibility_buffer && visibility_buffer->size() == size) {
+        return;
+    }
+    QOpenGLFramebufferObjectFormat format;
+    format.setAttachment(QOpenGLFramebufferObject::NoAttachment);
+    format.setInternalTextureFormat(GL_RG32F);
+    visibility_buffer = std::make_shared<QOpenGLFramebufferObject>(size, format);
+
+    // The depth of the closest sphere is compared in full precision: QOpenGLFramebufferObject
+    // attaches 24-bit renderbuffers only, so the float texture is attached here.
+    visibility_depth = std::make_shared<QOpenGLTexture>(QOpenGLTexture::Target2D);
+    visibility_depth->setFormat(QOpenGLTexture::D32F);
+    visibility_depth->setSize(size.width(), size.height());
+    visibility_depth->setMinMagFilters(QOpenGLTexture::Nearest, QOpenGLTexture::Nearest);
+    visibility_depth->allocateStorage(QOpenGLTexture::Depth, QOpenGLTexture::Float32);
+
+    auto *gl = QOpenGLContext::currentContext()->functions();
+    visibility_buffer->bind();
+    gl->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, visibility_depth->textureId(), 0);
+    visibility_buffer->release();
+}
+
+void GPURayTracer::renderVisibility(const Camera &camera, const QSize &size, const QRect &tile) {
+    auto *gl = QOpenGLContext::currentContext()->versionFunctions<QOpenGLFunctions_3_3_Core>();
+    initVisibilityBuffer(tile.size());
+
+    GLint prev_framebuffer = 0;
+    gl->glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_framebuffer);
+
+    ProfileScope scope(profiler, FS_VISIBILITY);
+    visibility_buffer->bind();
+    gl->glViewport(0, 0, tile.width(), tile.height());
+    const GLfloat background[] = {-1.0f, 0.0f, 0.0f, 0.0f};
+    const GLfloat far_depth = 0.0f;
+    gl->glClearBufferfv(GL_COLOR, 0, background);
+    gl->glClearBufferfv(GL_DEPTH, 0, &far_depth);
+
+    const int num_of_spheres = scene_buffers.getNumOfSpheres();
+    if (num_of_spheres > 0) {
+        // Depth decreases with the distance (see impostor.frag).
+        gl->glEnable(GL_DEPTH_TEST);
+        gl->glDepthFunc(GL_GREATER);
+
+        const auto cam_to_world = camera.camToWorld();
+        impostor_program->bind();
+        scene_buffers.bind(SCENE_TEXTURE_UNIT);
+        impostor_program->setUniformValue(impostor_uniforms.world_to_cam, cam_to_world.inverted());
+        impostor_program->setUniformValue(impostor_uniforms.cam_to_world, cam_to_world);
+        impostor_program->setUniformValue(impostor_uniforms.fov_tangent, camera.fovTangent());
+        impostor_program->setUniformValue(impostor_uniforms.window_size, QVector2D(size.width(), size.height()));
+        impostor_program->setUniformValue(impostor_uniforms.tile_offset, QVector2D(tile.x(), tile.y()));
+        impostor_program->setUniformValue(impostor_uniforms.tile_size, QVector2D(tile.width(), tile.height()));
+
+        impostor_vao->bind();
+        gl->glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, num_of_spheres);
+        impostor_vao->release();
+        impostor_program->release();
+
+        gl->glDepthFunc(GL_LESS);
+        gl->glDisable(GL_DEPTH_TEST);
+    }
+
+    gl->glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(prev_framebuffer));
+}
+
+void GPURayTracer::initDenoiseBuffers(const QSize &size) {
+    if (denoise_buffers[0] && denoise_buffers[0]->size() == size) {
+        return;
+    }
+    for (auto &buffer: denoise_buffers) {
+        buffer = createImageBuffer(size);
+    }
+}
+
+GLuint GPURayTracer::denoise(GLuint texture, const RenderSettings &settings, const Camera &camera, const QSize &size,
+                             int num_of_passes) {
+    if (settings.denoise_iterations <= 0) {
+        return texture;
+    }
+    auto *gl = QOpenGLContext::currentContext()->functions();
+
+    initDenoiseBuffers(size);
+
+    GLint prev_framebuffer = 0;
+    gl->glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_framebuffer);
+
+    // The G-buffer program is bound outside of the denoise stage: bindProgram is a stage of its own.
+    auto *gbuffer_variant = bindGBuffer(settings, camera, size);
+
+    ProfileScope scope(profiler, FS_DENOISE);
+
+    if (gbuffer_variant) {
+        plane->draw(gl);
+        gbuffer_variant->program->release();
+    }
+
+    gl->glViewport(0, 0, size.width(), size.height());
+    denoise_program->bind();
+    const auto gbuffer_textures = gbuffers[current_gbuffer].targets->textures();
+    for (int i = 0; i < 2; i++) {
+        gl->glActiveTexture(GL_TEXTURE0 + GBUFFER_TEXTURE_UNIT + i);
+        gl->glBindTexture(GL_TEXTURE_2D, gbuffer_textures[i]);
+    }
+
+    // Averaged passes have less noise, so smaller color differences are kept as details;
+    // the color sigma is also halved each iteration, as the footprint grows (Dammertz et al.).
+    auto color_sigma = settings.denoise_color_sigma / std::sqrt(static_cast<float>(std::max(num_of_passes, 1)));
+    auto source = texture;
+    for (int i = 0; i < settings.denoise_iterations; i++) {
+        auto &target = denoise_buffers[i % 2];
+        target->bind();
+        gl->glActiveTexture(GL_TEXTURE0 + DENOISE_IMAGE_TEXTURE_UNIT);
+        gl->glBindTexture(GL_TEXTURE_2D, source);
+        denoise_program->setUniformValue(denoise_uniforms.step_size, 1 << i);
+        denoise_program->setUniformValue(denoise_uniforms.color_sigma, color_sigma);
+        plane->draw(gl);
+        source = target->texture();
+        color_sigma *= 0.5f;
+    }
+    denoise_program->release();
+
+    gl->glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(prev_framebuffer));
+
+    return source;
+}
+
+void GPURayTracer::initTemporalBuffers(const QSize &size) {
+    if (temporal_pass && temporal_pass->size() == size) {
+        return;
+    }
+    QOpenGLFramebufferObjectFormat format;
+    format.setAttachment(QOpenGLFramebufferObject::NoAttachment);
+    format.setInternalTextureFormat(GL_RGBA32F);
+    temporal_pass = std::make_shared<QOpenGLFramebufferObject>(size, format);
+    for (auto &buffer: temporal_buffers) {
+        // Reprojected history is also sampled between the pixels.
+        buffer = createImageBuffer(size);
+    }
+    resetTemporal();
+}
+
+void GPURayTracer::renderTemporal(const RenderSettings &settings, const Camera &camera, const QSize &size) {
+    auto *gl = QOpenGLContext::currentContext()->functions();
+
+    initTemporalBuffers(size);
+
+    GLint prev_framebuffer = 0;
+    gl->glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_framebuffer);
+
+    // New pass: the frame index moves the sample positions and the random numbers.
+    if (wavefront_enabled) {
+        traceWavefront(settings, camera, size, false, temporal_frames, temporal_pass.get());
+    } else {
+        temporal_pass->bind();
+        auto &variant = bindProgram(settings, camera, size, TP_TEMPORAL);
+        variant.program->setUniformValue(variant.uniforms.frame_index, temporal_frames);
+        {
+            ProfileScope scope(profiler, FS_TRACE);
+            plane->draw(gl);
+        }
+        variant.program->release();
+    }
+
+    auto *gbuffer_variant = bindGBuffer(settings, camera, size);
+
+    ProfileScope scope(profiler, FS_TEMPORAL);
+
+    if (gbuffer_variant) {
+        plane->draw(gl);
+        gbuffer_variant->program->release();
+    }
+
+    // With the same camera the G-buffer is kept, and the history is reprojected onto itself.
+    const auto &gbuffer = gbuffers[current_gbuffer];
+    const auto &prev_gbuffer = gbuffer_variant ? gbuffers[1 - current_gbuffer] : gbuffer;
+    // The history is valid only if it was blended for the camera of the previous G-buffer.
+    const bool history_valid = temporal_frames > 0 && prev_gbuffer.valid &&
+            prev_gbuffer.cam_to_world == temporal_cam_to_world && prev_gbuffer.fov_tangent == temporal_fov_tangent;
+    temporal_static_frames = (history_valid && !gbuffer_variant) ? temporal_static_frames + 1 : 1;
+
+    auto &target = temporal_buffers[temporal_frames % 2];
+    auto &history = temporal_buffers[(temporal_frames + 1) % 2];
+
+    target->bind();
+    gl->glViewport(0, 0, size.width(), size.height());
+    temporal_program->bind();
+
+    gl->glActiveTexture(GL_TEXTURE0 + TEMPORAL_PASS_TEXTURE_UNIT);
+    gl->glBindTexture(GL_TEXTURE_2D, temporal_pass->texture());
+    gl->glActiveTexture(GL_TEXTURE0 + TEMPORAL_HISTORY_TEXTURE_UNIT);
+    gl->glBindTexture(GL_TEXTURE_2D, history->texture());
+    const auto gbuffer_textures = gbuffer.targets->textures();
+    const auto prev_gbuffer_textures = prev_gbuffer.targets->textures();
+    for (int i = 0; i < 2; i++) {
+        gl->glActiveTexture(GL_TEXTURE0 + GBUFFER_TEXTURE_UNIT + i);
+        gl->glBindTexture(GL_TEXTURE_2D, gbuffer_textures[i]);
+        gl->glActiveTexture(GL_TEXTURE0 + PREV_GBUFFER_TEXTURE_UNIT + i);
+        gl->glBindTexture(GL_TEXTURE_2D, prev_gbuffer_textures[i]);
+    }
+
+    temporal_program->setUniformValue(temporal_uniforms.cam_to_world, gbuffer.cam_to_world);
+    temporal_program->setUniformValue(temporal_uniforms.fov_tangent, gbuffer.fov_tangent);
+    temporal_program->setUniformValue(temporal_uniforms.window_size, QVector2D(size.width(), size.height()));
+    temporal_program->setUniformValue(temporal_uniforms.prev_world_to_cam, prev_gbuffer.cam_to_world.inverted());
+    temporal_program->setUniformValue(temporal_uniforms.prev_fov_tangent, prev_gbuffer.fov_tangent);
+    temporal_program->setUniformValue(temporal_uniforms.history_valid, history_valid);
+
+    plane->draw(gl);
+    temporal_program->release();
+
+    gl->glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(prev_framebuffer));
+
+    temporal_cam_to_world = gbuffer.cam_to_world;
+    temporal_fov_tangent = gbuffer.fov_tangent;
+    temporal_frames++;
+}
+
+void GPURayTracer::resetTemporal() {
+    temporal_frames = 0;
+    temporal_static_frames = 0;
+}
+
+GLuint GPURayTracer::getTemporalTexture() const {
+    if (temporal_frames == 0) {
+        return 0;
+    }
+    return temporal_buffers[(temporal_frames - 1) % 2]->texture();
+}
+
+bool GPURayTracer::temporalConverged() const {
+    return temporal_static_frames > MAX_TEMPORAL_HISTORY;
+}
+
+void GPURayTracer::display(GLuint texture, const QSize &size, bool flip_y) {
+    auto *gl = QOpenGLContext::currentContext()->functions();
+    ProfileScope scope(profiler, FS_DISPLAY);
+
+    gl->glViewport(0, 0, size.width(), size.height());
+
+    display_program->bind();
+
+    gl->glActiveTexture(GL_TEXTURE0);
+    gl->glBindTexture(GL_TEXTURE_2D, texture);
+
+    display_program->setUniformValue(display_uniforms.window_size, QVector2D(size.width(), size.height()));
+    display_program->setUniformValue(display_uniforms.flip_y, flip_y);
+
+    plane->draw(gl);
+
+    display_program->release();
+}
+
+void GPURayTracer::setProfiler(FrameProfiler *profiler) {
+    this->profiler = profiler;
+}
+
+bool GPURayTracer::wavefrontSupported() const {
+    return WavefrontTracer::isSupported(QOpenGLContext::currentContext());
+}
+
+void GPURayTracer::setWavefrontEnabled(bool enabled) {
+    if (enabled && !wavefront_tracer) {
+        auto tracer = std::make_shared<WavefrontTracer>();
+        tracer->init(shaders_dir, scene_buffers, SCENE_TEXTURE_UNIT, HISTORY_TEXTURE_UNIT);
+        wavefront_tracer = tracer;
+    }
+    if (enabled != wavefront_enabled) {
+        wavefront_enabled = enabled;
+        resetAccumulation();
+    }
+}
+
+bool GPURayTracer::wavefrontEnabled() const {
+    return wavefront_enabled;
+}
+
+bool GPURayTracer::animationSupported() const {
+    return SceneAnimator::isSupported(QOpenGLContext::currentContext());
+}
+
+void GPURayTracer::animateScene(const AnimationSettings &settings, float time_step) {
+    if (!scene_animator) {
+        auto animator = std::make_shared<SceneAnimator>();
+        animator->init(shaders_dir, scene_buffers, SCENE_TEXTURE_UNIT);
+        scene_animator = animator;
+    }
+    {
+        ProfileScope scope(profiler, FS_ANIMATION);
+        scene_buffers.bind(SCENE_TEXTURE_UNIT);
+        scene_animator->step(settings, time_step, scene_buffers);
+    }
+    // The spheres moved: the primary hits and the passes are of the old positions.
+    invalidateGBuffers();
+    resetAccumulation();
+}
+
+std::shared_ptr<QOpenGLShaderProgram> GPURayTracer::loadProgram(QString vertex_shader_file, QString fragment_shader_file,
+                                                               const QStringList &defines) {
+    auto prog = std::make_shared<QOpenGLShaderProgram>();
+    // All the programs share the same plane vertex array.
+    prog->bindAttributeLocation("vertex", 0);
+    if (!prog->addShaderFromSourceCode(QOpenGLShader::Vertex, shader_source::load(vertex_shader_file))) {
+        throw std::runtime_error(std::string("Failed to load vertex shaders from ") + vertex_shader_file.toStdString()
+                                 + ":\n" + prog->log().toStdString());
+    }
+    if (!prog->addShaderFromSourceCode(QOpenGLShader::Fragment, shader_source::load(fragment_shader_file, defines))) {
+        throw std::runtime_error(std::string("Failed to load fragment shaders from ") + fragment_shader_file.toStdString()
+                                 + " (" + defines.join(", ").toStdString() + "):\n" + prog->log().toStdString());
+    }
+    if (!prog->link()) {
+        throw std::runtime_error(std::string("Failed to link program:\n") + prog->log().toStdString());
+    }
+    return prog;
+}
@@ -0,0 +1,264 @@
+#pragma once
+
+#include "gl_objects/gl_plane.h"
+#include "gl_objects/gl_scene_buffers.h"
+#include "objects/scene.h"
+#include "objects/camera.h"
+#include "accel/bvh.h"
+#include "render_settings.h"
+#include "profiling/frame_profiler.h"
+#include "gpu/wavefront_tracer.h"
+#include "gpu/scene_animator.h"
+
+#include <QOpenGLShaderProgram>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLTexture>
+#include <QOpenGLVertexArrayObject>
+#include <QMatrix4x4>
+#include <QRect>
+#include <QSize>
+#include <QStringList>
+
+#include <map>
+#include <memory>
+
+/**
+ * Ray tracer running shaders/raytrace.frag on the current OpenGL context.
+ * Does not depend on a window, so it is used by the widget and by offscreen tools.
+ * The shader is compiled into specialized variants (see variantDefines) which are cached
+ * and picked by the render settings, so each configuration runs the smallest kernel.
+ * With OpenGL 4.3 the same image can be traced by WavefrontTracer instead (see setWavefrontEnabled).
+ * In the hybrid mode (see RenderSettings::hybrid) primary visibility of the spheres is rasterized first.
+ * With OpenGL 4.3 the uploaded spheres can also be animated on the GPU (see animateScene).
+ */
+class GPURayTracer {
+public:
+    GPURayTracer();
+
+    // Loads shaders: the context must be current.
+    // Throws std::runtime_error if shaders fail to compile.
+    void init(const QString &shaders_dir = "shaders");
+    bool isInitialized() const;
+
+    int getNumOfCachedPrograms() const;
+
+    // Uploads the scene and its BVHs in world space. Only scene changes need an upload:
+    // navigation moves the camera, which is passed to each render call.
+    void uploadScene(const Scene &scene, const BVH &bvh, const MeshBVH &mesh_bvh);
+    // Uploads a mapped scene file (with the BVHs stored in it).
+    void uploadScene(const MappedScene &scene);
+    // Uploads only what changed since the last upload: for small edits of an uploaded scene.
+    void updateScene(const Scene &scene, const BVH &bvh);
+
+    // Traces the full image into the currently bound framebuffer.
+    // With adaptive sampling (see RenderSettings) a pilot pass goes to an offscreen buffer first;
+    // the wavefront mode always traces all the samples.
+    void render(const RenderSettings &settings, const Camera &camera, const QSize &size);
+
+    // Progressive mode: traces one more pass and averages it with the previous ones.
+    // The result is in the accumulation texture (unclamped RGBA32F).
+    void accumulate(const RenderSettings &settings, const Camera &camera, const QSize &size);
+    void resetAccumulation();
+    int getNumOfAccumulatedFrames() const;
+    GLuint getAccumulationTexture() const;
+
+    // Tiled rendering, for images too large for one framebuffer or one draw: traces the tile of the image
+    // of the size (in pixels from the bottom left corner, it may extend past the image) into the bound framebuffer
+    // of the tile size. The wavefront mode traces whole images, so tiles are always traced by the fragment shader.
+    void renderTile(const RenderSettings &settings, const Camera &camera, const QSize &size, const QRect &tile);
+    // Progressive passes of a tile into the accumulation texture (of the tile size):
+    // reset the accumulation before the first pass of each tile.
+    void accumulateTile(const RenderSettings &settings, const Camera &camera, const QSize &size, const QRect &tile);
+
+    // Temporal mode: traces a pass with new sample positions and blends it with the previous result
+    // reprojected to the camera (see shaders/temporal.frag), so the passes are reused while the camera moves.
+    // History is rejected where the surface or the distance seen through the pixel differs.
+    // The result is in the temporal texture (RGBA32F, alpha is the number of blended passes).
+    void renderTemporal(const RenderSettings &settings, const Camera &camera, const QSize &size);
+    void resetTemporal();
+    GLuint getTemporalTexture() const;
+    // History of all the pixels is full: further passes with the same camera change little.
+    bool temporalConverged() const;
+
+    // Edge-aware denoising (see shaders/denoise.frag) of an image traced with the camera at the size.
+    // num_of_passes is the number of passes averaged in the image: the noise drops with it, so does the filter strength.
+    // Traces the G-buffer of the primary hits first if the camera, the size or the scene changed.
+    // Returns the filtered texture (RGBA32F, valid until the next call); restores the bound framebuffer.
+    GLuint denoise(GLuint texture, const RenderSettings &settings, const Camera &camera, const QSize &size,
+                   int num_of_passes = 1);
+
+    // Draws the texture over the currently bound framebuffer (values are clamped to [0, 1]).
+    void display(GLuint texture, const QSize &size, bool flip_y = false);
+
+    // Stages of rendering are measured by the profiler (if it is set).
+    void setProfiler(FrameProfiler *profiler);
+
+    // Wavefront mode: rays are traced by compute kernels level by level (needs OpenGL 4.3).
+    // The wavefront kernels are compiled on first use; throws std::runtime_error if they fail.
+    bool wavefrontSupported() const;
+    void setWavefrontEnabled(bool enabled);
+    bool wavefrontEnabled() const;
+
+    // Animation: moves the uploaded spheres by the time step (in seconds) on the GPU (see SceneAnimator),
+    // so the next frames trace them in place; the passes traced so far are dropped.
+    // Needs OpenGL 4.3; the kernels are compiled on first use, throws std::runtime_error if they fail.
+    bool animationSupported() const;
+    void animateScene(const AnimationSettings &settings, float time_step);
+
+private:
+    // Uniform locations, looked up once after the program is linked.
+    struct RaytraceUniforms {
+        int num_of_samples, num_of_steps;
+        int frame_index;
+        int num_of_pilot_samples, adaptive_threshold;
+        int num_of_light_sources, num_of_light_samples, num_of_bvh_nodes, num_of_mesh_bvh_nodes;
+        int background_color;
+        int cam_to_world, window_size, camera_fov, fov_tangent;
+        int tile_offset;
+    };
+
+    struct RaytraceProgram {
+        std::shared_ptr<QOpenGLShaderProgram> program;
+        RaytraceUniforms uniforms;
+    };
+
+    std::shared_ptr<QOpenGLShaderProgram> loadProgram(QString vertex_shader_file, QString fragment_shader_file,
+                                                      const QStringList &defines = QStringList());
+
+    void initDisplayUniforms();
+    void initTemporalUniforms();
+    void initImpostorUniforms();
+    void initAccumulationBuffers(const QSize &size);
+    void initPilotBuffer(const QSize &size);
+    void initGBuffers(const QSize &size);
+    void initDenoiseBuffers(const QSize &size);
+    void initTemporalBuffers(const QSize &size);
+    void initVisibilityBuffer(const QSize &size);
+
+    enum TracePass {
+        TP_FRAME = 0,
+        TP_ACCUMULATE = 1, // progressive mode
+        TP_TEMPORAL = 2, // like a frame, but with new sample positions each pass
+        TP_GBUFFER = 3 // primary hits only (see writeGBuffer in raytrace.frag)
+    };
+
+    enum AdaptivePass {
+        AP_NONE = 0,
+        AP_PILOT = 1,
+        AP_REFINE = 2
+    };
+
+    // Primary hits of the pass come from the visibility buffer: only rays through the pixel centers
+    // (single samples and the G-buffer) can use it.
+    bool hybridPass(const RenderSettings &settings, TracePass pass) const;
+
+    // Defines selecting the shader variant for the settings; also used as the cache key.
+    // The G-buffer variant does not shade, so it depends only on the hybrid mode.
+    QStringList variantDefines(const RenderSettings &settings, TracePass pass, AdaptivePass adaptive_pass) const;
+    // Returns the cached variant, compiling it on first use.
+    RaytraceProgram& raytraceProgram(const RenderSettings &settings, TracePass pass,
+                                     AdaptivePass adaptive_pass = AP_NONE);
+
+    // Binds the program variant and sets all the per-frame uniforms.
+    // The viewport is the tile of the image of the size; the whole image without one.
+    RaytraceProgram& bindProgram(const RenderSettings &settings, const Camera &camera, const QSize &size,
+                                 TracePass pass, AdaptivePass adaptive_pass = AP_NONE, const QRect &tile = QRect());
+
+    // If the current G-buffer is not of the camera, makes the other one current and binds it with the G-buffer
+    // program: the caller draws the plane (in its profiler stage) and releases the program.
+    // Returns nullptr if the current G-buffer is kept.
+    RaytraceProgram* bindGBuffer(const RenderSettings &settings, const Camera &camera, const QSize &size);
+    // The scene changed: both G-buffers have to be traced again.
+    void invalidateGBuffers();
+
+    // Hybrid mode: rasterizes the spheres as impostors into the visibility buffer (of the tile size),
+    // the closest sphere and its distance for the ray through the center of each pixel of the tile.
+    // Restores the bound framebuffer.
+    void renderVisibility(const Camera &camera, const QSize &size, const QRect &tile);
+
+    // Pilot pass into the pilot buffer, then refinement into the bound framebuffer.
+    void renderAdaptive(const RenderSettings &settings, const Camera &camera, const QSize &size, const QRect &tile);
+
+    // Traces the image with the wavefront kernels and resolves it into the bound framebuffer.
+    void traceWavefront(const RenderSettings &settings, const Camera &camera, const QSize &size,
+                        bool accumulate, int frame_index, QOpenGLFramebufferObject *target);
+
+private:
+    // Depths up to this one are compiled as constants; deeper tracing uses the generic variant.
+    static const int MAX_SPECIALIZED_NUM_OF_STEPS = 16;
+    // Temporal mode blends in at least this fraction (1 / (N + 1)) of each new pass.
+    static const int MAX_TEMPORAL_HISTORY = 32;
+
+    QString shaders_dir;
+    std::map<QString, RaytraceProgram> raytrace_programs;
+    std::shared_ptr<QOpenGLShaderProgram> display_program;
+
+    struct DisplayUniforms {
+        int window_size, flip_y;
+    } display_uniforms;
+
+    std::shared_ptr<GLPlane> plane;
+
+    GLSceneBuffers scene_buffers;
+
+    bool wavefront_enabled = false;
+    std::shared_ptr<WavefrontTracer> wavefront_tracer;
+
+    std::shared_ptr<SceneAnimator> scene_animator;
+
+    int accumulated_frames = 0;
+    std::shared_ptr<QOpenGLFramebufferObject> accumulation_buffers[2];
+
+    // Mean color and mean squared luminance of the pilot samples (RGBA32F).
+    std::shared_ptr<QOpenGLFramebufferObject> pilot_buffer;
+
+    std::shared_ptr<QOpenGLShaderProgram> denoise_program;
+    std::shared_ptr<QOpenGLShaderProgram> temporal_program;
+
+    struct DenoiseUniforms {
+        int step_size, color_sigma;
+    } denoise_uniforms;
+
+    struct TemporalUniforms {
+        int cam_to_world, fov_tangent, window_size;
+        int prev_world_to_cam, prev_fov_tangent;
+        int history_valid;
+    } temporal_uniforms;
+
+    // Primary hits: (normal, distance) and (diffuse color, surface id), both RGBA32F.
+    // The current one is kept while the camera and the scene stay the same (e.g. through progressive passes),
+    // the previous one is kept for reprojection.
+    struct GBuffer {
+        std::shared_ptr<QOpenGLFramebufferObject> targets;
+        bool valid = false;
+        QMatrix4x4 cam_to_world;
+        float fov_tangent = 0.0f;
+    };
+    GBuffer gbuffers[2];
+    int current_gbuffer = 0;
+
+    // Filter iterations ping-pong between these (RGBA32F).
+    std::shared_ptr<QOpenGLFramebufferObject> denoise_buffers[2];
+
+    // Hybrid mode: (sphere id, distance) per pixel (RG32F) with a float depth buffer to keep the closest sphere.
+    std::shared_ptr<QOpenGLShaderProgram> impostor_program;
+    struct ImpostorUniforms {
+        int world_to_cam, cam_to_world, fov_tangent;
+        int window_size, tile_offset, tile_size;
+    } impostor_uniforms;
+    // Impostors have no vertex attributes, but the core profile needs a vertex array to draw.
+    std::shared_ptr<QOpenGLVertexArrayObject> impostor_vao;
+    std::shared_ptr<QOpenGLFramebufferObject> visibility_buffer;
+    std::shared_ptr<QOpenGLTexture> visibility_depth;
+
+    // Temporal mode: the new pass, and the blended results of this and of the previous frame (RGBA32F).
+    std::shared_ptr<QOpenGLFramebufferObject> temporal_pass;
+    std::shared_ptr<QOpenGLFramebufferObject> temporal_buffers[2];
+    int temporal_frames = 0;
+    // Passes with the same camera: the history is full after MAX_TEMPORAL_HISTORY of them.
+    int temporal_static_frames = 0;
+    QMatrix4x4 temporal_cam_to_world;
+    float temporal_fov_tangent = 0.0f;
+
+    FrameProfiler *profiler = nullptr;
+};
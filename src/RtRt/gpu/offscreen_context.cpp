@@ -0,0 +1,38 @@
+#include "offscreen_context.h"
+
+#include <QOpenGLFunctions>
+
+#include <stdexcept>
+
+OffscreenContext::OffscreenContext() {
+    QSurfaceFormat format;
+    format.setVersion(3, 3);
+    format.setProfile(QSurfaceFormat::CoreProfile);
+
+    gl_context.setFormat(format);
+    if (!gl_context.create()) {
+        throw std::runtime_error("Failed to create OpenGL 3.3 context");
+    }
+
+    surface.setFormat(gl_context.format());
+    surface.create();
+    if (!surface.isValid() || !gl_context.makeCurrent(&surface)) {
+        throw std::runtime_error("Failed to make OpenGL context current on offscreen surface");
+    }
+}
+
+OffscreenContext::~OffscreenContext() {
+    gl_context.doneCurrent();
+}
+
+QOpenGLContext* OffscreenContext::context() {
+    return &gl_context;
+}
+
+QOpenGLFunctions* OffscreenContext::functions() {
+    return gl_context.functions();
+}
+
+QString OffscreenContext::renderer() {
+    return QString(reinterpret_cast<const char*>(functions()->glGetString(GL_RENDERER)));
+}
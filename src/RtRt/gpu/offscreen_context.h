@@ -0,0 +1,28 @@
+#pragma once
+
+#include <QOpenGLContext>
+#include <QOffscreenSurface>
+#include <QString>
+
+/**
+ * OpenGL 3.3 core context made current on an offscreen surface: lets tools render without a window.
+ */
+class OffscreenContext {
+public:
+    // Creates the context and makes it current; throws std::runtime_error on failure.
+    OffscreenContext();
+    ~OffscreenContext();
+
+    OffscreenContext(const OffscreenContext&) = delete;
+    OffscreenContext& operator=(const OffscreenContext&) = delete;
+
+    QOpenGLContext* context();
+    QOpenGLFunctions* functions();
+
+    // GL_RENDERER string, e.g. to tell if Mesa llvmpipe is used.
+    QString renderer();
+
+private:
+    QOpenGLContext gl_context;
+    QOffscreenSurface surface;
+};
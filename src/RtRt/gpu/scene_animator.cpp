@@ -0,0 +1,270 @@
+#include "scene_animator.h"
+#include "compute_kernel.h"
+#include "wavefront_tracer.h"
+
+#include <QOpenGLFunctions_4_3_Core>
+#include <QVector4D>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+// Sizes of the elements in animate.comp (std430 layout).
+const int VELOCITY_SIZE = 16;
+const int SPHERE_SIZE = 16;
+
+// Bounds are the box of the scene grown by this fraction of its largest size on each side.
+const float BOUNDS_MARGIN = 0.25f;
+
+float maxSize(const QVector3D &min, const QVector3D &max) {
+    const auto size = max - min;
+    return std::max(size.x(), std::max(size.y(), size.z()));
+}
+
+}
+
+SceneAnimator::SceneAnimator() {
+}
+
+SceneAnimator::~SceneAnimator() {
+    if (gl && buffers[0] && QOpenGLContext::currentContext()) {
+        gl->glDeleteBuffers(B_NUM_OF_BUFFERS, buffers);
+    }
+}
+
+bool SceneAnimator::isSupported(QOpenGLContext *context) {
+    return WavefrontTracer::isSupported(context);
+}
+
+void SceneAnimator::init(const QString &shaders_dir, GLSceneBuffers &scene_buffers, int scene_unit) {
+    auto *context = QOpenGLContext::currentContext();
+    if (!isSupported(context)) {
+        throw std::runtime_error("Scene animation needs OpenGL 4.3");
+    }
+    gl = context->versionFunctions<QOpenGLFunctions_4_3_Core>();
+    if (!gl || !gl->initializeOpenGLFunctions()) {
+        gl = nullptr;
+        throw std::runtime_error("Failed to resolve OpenGL 4.3 functions");
+    }
+
+    const auto kernel_file = shaders_dir + "/animate.comp";
+    kernels[K_STEP] = compute_kernel::load(kernel_file, "STEP_KERNEL");
+    kernels[K_REFIT] = compute_kernel::load(kernel_file, "REFIT_KERNEL");
+
+    for (auto &kernel: kernels) {
+        kernel->bind();
+        scene_buffers.setSamplers(kernel.get(), scene_unit);
+        kernel->release();
+    }
+
+    const auto &step_kernel = kernels[K_STEP];
+    step_uniforms.num_of_spheres = step_kernel->uniformLocation("numOfSpheres");
+    step_uniforms.num_of_bvh_nodes = step_kernel->uniformLocation("numOfBvhNodes");
+    step_uniforms.time_step = step_kernel->uniformLocation("timeStep");
+    step_uniforms.gravity = step_kernel->uniformLocation("gravity");
+    step_uniforms.restitution = step_kernel->uniformLocation("restitution");
+    step_uniforms.bounds_min = step_kernel->uniformLocation("boundsMin");
+    step_uniforms.bounds_max = step_kernel->uniformLocation("boundsMax");
+
+    refit_uniforms.level_offset = kernels[K_REFIT]->uniformLocation("levelOffset");
+    refit_uniforms.level_size = kernels[K_REFIT]->uniformLocation("levelSize");
+
+    gl->glGenBuffers(B_NUM_OF_BUFFERS, buffers);
+}
+
+bool SceneAnimator::isInitialized() const {
+    return kernels[K_STEP] != nullptr;
+}
+
+void SceneAnimator::sceneReplaced() {
+    num_of_velocities = 0;
+    hierarchy_valid = false;
+    bounds_valid = false;
+    moved = false;
+}
+
+void SceneAnimator::sceneEdited(const GLSceneBuffers &scene_buffers) {
+    hierarchy_valid = false;
+    if (!moved || scene_buffers.getNumOfBvhNodes() == 0) {
+        return;
+    }
+    initHierarchy(scene_buffers);
+    refit(scene_buffers);
+    gl->glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+void SceneAnimator::initHierarchy(const GLSceneBuffers &scene_buffers) {
+    // The structure of the BVH does not change while the spheres move, so it is read back only after uploads.
+    const int num_of_nodes = scene_buffers.getNumOfBvhNodes();
+    std::vector<QVector4D> packed_nodes(2 * num_of_nodes);
+    gl->glBindBuffer(GL_COPY_READ_BUFFER, scene_buffers.getBvhNodeBuffer());
+    gl->glGetBufferSubData(GL_COPY_READ_BUFFER, 0, GLsizeiptr(packed_nodes.size() * sizeof(QVector4D)),
+                           packed_nodes.data());
+    gl->glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+    // Depth of a node is the number of internal nodes whose subtree (up to the skip link) contains it.
+    // Spheres appended after the tree are leaves at depth 0, like the root.
+    std::vector<int> depths(num_of_nodes);
+    std::vector<int> subtree_ends;
+    int max_depth = 0;
+    QVector3D scene_min, scene_max;
+    for (int i = 0; i < num_of_nodes; i++) {
+        while (!subtree_ends.empty() && subtree_ends.back() <= i) {
+            subtree_ends.pop_back();
+        }
+        depths[i] = static_cast<int>(subtree_ends.size());
+        max_depth = std::max(max_depth, depths[i]);
+
+        const auto &node_min = packed_nodes[2 * i];
+        const auto &node_max = packed_nodes[2 * i + 1];
+        if (depths[i] == 0) {
+            scene_min = (i == 0) ? node_min.toVector3D() : QVector3D(std::min(scene_min.x(), node_min.x()),
+                                                                     std::min(scene_min.y(), node_min.y()),
+                                                                     std::min(scene_min.z(), node_min.z()));
+            scene_max = (i == 0) ? node_max.toVector3D() : QVector3D(std::max(scene_max.x(), node_max.x()),
+                                                                     std::max(scene_max.y(), node_max.y()),
+                                                                     std::max(scene_max.z(), node_max.z()));
+        }
+        if (node_max.w() == 0.0f) {
+            subtree_ends.push_back(static_cast<int>(node_min.w()));
+        }
+    }
+
+    // Nodes sorted by depth, the deepest level first.
+    std::vector<int> level_offsets(max_depth + 1, 0);
+    for (int depth: depths) {
+        level_offsets[depth]++;
+    }
+    levels.clear();
+    int offset = 0;
+    for (int depth = max_depth; depth >= 0; depth--) {
+        const int size = level_offsets[depth];
+        levels.emplace_back(offset, size);
+        level_offsets[depth] = offset;
+        offset += size;
+    }
+    std::vector<GLint> order(num_of_nodes);
+    for (int i = 0; i < num_of_nodes; i++) {
+        order[level_offsets[depths[i]]++] = i;
+    }
+    gl->glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[B_REFIT_ORDER]);
+    gl->glBufferData(GL_SHADER_STORAGE_BUFFER, GLsizeiptr(order.size() * sizeof(GLint)), order.data(), GL_STATIC_DRAW);
+    gl->glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    if (!bounds_valid) {
+        const auto margin = BOUNDS_MARGIN * maxSize(scene_min, scene_max);
+        bounds_min = scene_min - QVector3D(margin, margin, margin);
+        bounds_max = scene_max + QVector3D(margin, margin, margin);
+        bounds_valid = true;
+    }
+    hierarchy_valid = true;
+}
+
+void SceneAnimator::initVelocities(const AnimationSettings &settings, int num_of_spheres) {
+    const int num_of_kept = std::min(num_of_velocities, num_of_spheres);
+    if (num_of_spheres > velocity_capacity) {
+        // Both buffers grow; only the current one has to keep its contents.
+        const int capacity = std::max(num_of_spheres, 2 * velocity_capacity);
+        GLuint grown[2] = {0, 0};
+        gl->glGenBuffers(2, grown);
+        for (auto buffer: grown) {
+            gl->glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+            gl->glBufferData(GL_SHADER_STORAGE_BUFFER, GLsizeiptr(capacity) * VELOCITY_SIZE, nullptr, GL_DYNAMIC_COPY);
+        }
+        if (num_of_kept > 0) {
+            gl->glBindBuffer(GL_COPY_READ_BUFFER, buffers[B_VELOCITIES_0 + current_velocities]);
+            gl->glBindBuffer(GL_COPY_WRITE_BUFFER, grown[0]);
+            gl->glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                                    GLsizeiptr(num_of_kept) * VELOCITY_SIZE);
+            gl->glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            gl->glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        }
+        gl->glDeleteBuffers(1, &buffers[B_VELOCITIES_0]);
+        gl->glDeleteBuffers(1, &buffers[B_VELOCITIES_1]);
+        buffers[B_VELOCITIES_0] = grown[0];
+        buffers[B_VELOCITIES_1] = grown[1];
+        current_velocities = 0;
+        velocity_capacity = capacity;
+    }
+
+    if (num_of_spheres > num_of_kept) {
+        std::normal_distribution<float> direction(0.0f, 1.0f);
+        const auto speed = settings.initial_speed * maxSize(bounds_min, bounds_max);
+        std::vector<QVector4D> velocities;
+        velocities.reserve(num_of_spheres - num_of_kept);
+        for (int i = num_of_kept; i < num_of_spheres; i++) {
+            QVector3D velocity {direction(random_engine), direction(random_engine), direction(random_engine)};
+            velocities.push_back(QVector4D(speed * velocity.normalized(), 0.0f));
+        }
+        gl->glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[B_VELOCITIES_0 + current_velocities]);
+        gl->glBufferSubData(GL_SHADER_STORAGE_BUFFER, GLintptr(num_of_kept) * VELOCITY_SIZE,
+                            GLsizeiptr(velocities.size()) * VELOCITY_SIZE, velocities.data());
+        gl->glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+    num_of_velocities = num_of_spheres;
+}
+
+void SceneAnimator::step(const AnimationSettings &settings, float time_step, GLSceneBuffers &scene_buffers) {
+    const int num_of_spheres = scene_buffers.getNumOfSpheres();
+    if (num_of_spheres == 0 || scene_buffers.getNumOfBvhNodes() == 0) {
+        return;
+    }
+    if (!hierarchy_valid) {
+        initHierarchy(scene_buffers);
+    }
+    if (num_of_velocities != num_of_spheres) {
+        initVelocities(settings, num_of_spheres);
+    }
+    if (num_of_spheres > new_spheres_capacity) {
+        new_spheres_capacity = std::max(num_of_spheres, 2 * new_spheres_capacity);
+        gl->glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[B_NEW_SPHERES]);
+        gl->glBufferData(GL_SHADER_STORAGE_BUFFER, GLsizeiptr(new_spheres_capacity) * SPHERE_SIZE, nullptr,
+                         GL_DYNAMIC_COPY);
+        gl->glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    auto &kernel = kernels[K_STEP];
+    kernel->bind();
+    kernel->setUniformValue(step_uniforms.num_of_spheres, num_of_spheres);
+    kernel->setUniformValue(step_uniforms.num_of_bvh_nodes, scene_buffers.getNumOfBvhNodes());
+    kernel->setUniformValue(step_uniforms.time_step, time_step);
+    kernel->setUniformValue(step_uniforms.gravity, settings.gravity);
+    kernel->setUniformValue(step_uniforms.restitution, settings.restitution);
+    kernel->setUniformValue(step_uniforms.bounds_min, bounds_min);
+    kernel->setUniformValue(step_uniforms.bounds_max, bounds_max);
+    gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, buffers[B_VELOCITIES_0 + current_velocities]);
+    gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, buffers[B_VELOCITIES_0 + 1 - current_velocities]);
+    gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, buffers[B_NEW_SPHERES]);
+    gl->glDispatchCompute(compute_kernel::numOfGroups(num_of_spheres), 1, 1);
+    kernel->release();
+    current_velocities = 1 - current_velocities;
+
+    // All the spheres have read the old positions: the new ones replace them in the sphere buffer.
+    gl->glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    gl->glBindBuffer(GL_COPY_READ_BUFFER, buffers[B_NEW_SPHERES]);
+    gl->glBindBuffer(GL_COPY_WRITE_BUFFER, scene_buffers.getSphereBuffer());
+    gl->glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, GLsizeiptr(num_of_spheres) * SPHERE_SIZE);
+    gl->glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    gl->glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    refit(scene_buffers);
+    moved = true;
+    // Tracing reads the nodes through the buffer texture, the next step reads the velocities.
+    gl->glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void SceneAnimator::refit(const GLSceneBuffers &scene_buffers) {
+    auto &kernel = kernels[K_REFIT];
+    kernel->bind();
+    gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, scene_buffers.getBvhNodeBuffer());
+    gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, buffers[B_REFIT_ORDER]);
+    for (const auto &level: levels) {
+        kernel->setUniformValue(refit_uniforms.level_offset, level.first);
+        kernel->setUniformValue(refit_uniforms.level_size, level.second);
+        gl->glDispatchCompute(compute_kernel::numOfGroups(level.second), 1, 1);
+        // Parents read the bounds of their children.
+        gl->glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+    kernel->release();
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "gl_objects/gl_scene_buffers.h"
+
+#include <QOpenGLContext>
+#include <QOpenGLShaderProgram>
+#include <QVector3D>
+
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+
+class QOpenGLFunctions_4_3_Core;
+
+/**
+ * Physics of the animated spheres.
+ */
+struct AnimationSettings {
+    QVector3D gravity {0.0f, -9.81f, 0.0f};
+    // Fraction of the normal speed kept by collisions and bounces.
+    float restitution = 0.8f;
+    // Spheres start in random directions at this speed, in sizes of the bounds per second.
+    float initial_speed = 0.25f;
+};
+
+/**
+ * Moves the spheres of the uploaded scene with shaders/animate.comp (OpenGL 4.3 compute shaders).
+ * Velocities live on the GPU only; each step writes the new positions straight into the sphere buffer
+ * and refits the BVH over them, so the ray tracer reads the moved spheres in place and nothing goes
+ * through the CPU per frame. The scene on the CPU keeps the positions it was uploaded with.
+ * Spheres fall with gravity, collide with each other (found through the BVH) and bounce off the bounds:
+ * the bounding box of the scene when it was uploaded, with a margin. Meshes do not move.
+ * The BVH is refitted, so it gets looser while the spheres mix. Edits of the scene refit or rebuild it
+ * on the CPU, from the positions there; it is then refitted to the moved spheres (see sceneEdited).
+ */
+class SceneAnimator {
+public:
+    SceneAnimator();
+    ~SceneAnimator();
+
+    SceneAnimator(const SceneAnimator&) = delete;
+    SceneAnimator& operator=(const SceneAnimator&) = delete;
+
+    // Compute shaders need OpenGL 4.3 (the same as WavefrontTracer).
+    static bool isSupported(QOpenGLContext *context);
+
+    // Loads the kernels: the context must be current and supported.
+    // Scene buffers are bound to the units from scene_unit (as by GPURayTracer).
+    // Throws std::runtime_error if shaders fail to compile.
+    void init(const QString &shaders_dir, GLSceneBuffers &scene_buffers, int scene_unit);
+    bool isInitialized() const;
+
+    // The scene was replaced: the spheres start again with new velocities and bounds.
+    void sceneReplaced();
+    // The scene was edited: velocities of the kept spheres stay, the BVH may have a new structure.
+    // Its bounds come from the positions on the CPU, so if the spheres have moved, they are refitted
+    // at once, even while the animation is paused. Scene buffers must be bound to their units.
+    void sceneEdited(const GLSceneBuffers &scene_buffers);
+
+    // Advances the spheres by the time step (in seconds). Scene buffers must be bound to their units.
+    void step(const AnimationSettings &settings, float time_step, GLSceneBuffers &scene_buffers);
+
+private:
+    enum Kernel {
+        K_STEP = 0,
+        K_REFIT,
+        K_NUM_OF_KERNELS
+    };
+
+    enum Buffer {
+        B_VELOCITIES_0 = 0,
+        B_VELOCITIES_1,
+        B_NEW_SPHERES,
+        B_REFIT_ORDER,
+        B_NUM_OF_BUFFERS
+    };
+
+    // Levels of the BVH nodes and the bounds, from the nodes as uploaded: once per scene change.
+    void initHierarchy(const GLSceneBuffers &scene_buffers);
+    // Keeps the velocities of the first spheres, the others start at random.
+    void initVelocities(const AnimationSettings &settings, int num_of_spheres);
+    void refit(const GLSceneBuffers &scene_buffers);
+
+private:
+    QOpenGLFunctions_4_3_Core *gl = nullptr;
+
+    std::shared_ptr<QOpenGLShaderProgram> kernels[K_NUM_OF_KERNELS];
+
+    struct StepUniforms {
+        int num_of_spheres, num_of_bvh_nodes;
+        int time_step, gravity, restitution;
+        int bounds_min, bounds_max;
+    } step_uniforms;
+
+    struct RefitUniforms {
+        int level_offset, level_size;
+    } refit_uniforms;
+
+    GLuint buffers[B_NUM_OF_BUFFERS] = {0};
+    // Velocities ping-pong between the two buffers, this one holds the current ones.
+    int current_velocities = 0;
+    int num_of_velocities = 0;
+    int velocity_capacity = 0;
+    int new_spheres_capacity = 0;
+
+    bool hierarchy_valid = false;
+    // Whether the spheres on the GPU have moved away from the uploaded positions.
+    bool moved = false;
+    bool bounds_valid = false;
+    QVector3D bounds_min, bounds_max;
+    // (offset, size) of each level in the refit order, the deepest one first.
+    std::vector<std::pair<int, int>> levels;
+
+    std::mt19937 random_engine;
+};
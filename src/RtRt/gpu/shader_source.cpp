@@ -0,0 +1,60 @@
+#include "shader_source.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QList>
+
+#include <stdexcept>
+
+namespace shader_source {
+
+namespace {
+
+QByteArray readFile(const QString &filename) {
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        throw std::runtime_error("Failed to open " + filename.toStdString());
+    }
+    return file.readAll();
+}
+
+QByteArray expandIncludes(const QString &filename, int depth) {
+    if (depth > 8) {
+        throw std::runtime_error("Too deep includes in " + filename.toStdString());
+    }
+    const auto dir = QFileInfo(filename).dir();
+    QByteArray result;
+    for (const auto &line: readFile(filename).split('\n')) {
+        const auto trimmed = line.trimmed();
+        if (trimmed.startsWith("#include")) {
+            const auto begin = trimmed.indexOf('"');
+            const auto end = trimmed.lastIndexOf('"');
+            if (begin < 0 || end <= begin) {
+                throw std::runtime_error("Bad include in " + filename.toStdString() + ": " + trimmed.toStdString());
+            }
+            const auto name = QString::fromUtf8(trimmed.mid(begin + 1, end - begin - 1));
+            result += expandIncludes(dir.filePath(name), depth + 1);
+        } else {
+            result += line;
+        }
+        result += '\n';
+    }
+    return result;
+}
+
+}
+
+QByteArray load(const QString &filename, const QStringList &defines) {
+    auto source = expandIncludes(filename, 0);
+    // Defines must follow the #version line.
+    QByteArray define_lines;
+    for (const auto &define: defines) {
+        define_lines += "#define " + define.toUtf8() + "\n";
+    }
+    const auto version_end = source.indexOf('\n') + 1;
+    source.insert(version_end, define_lines);
+    return source;
+}
+
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+
+namespace shader_source {
+
+// Reads a shader and prepares it for compilation:
+// lines '#include "name"' are replaced with the file 'name' from the same directory,
+// defines ("NAME VALUE") are inserted after the #version line.
+// Throws std::runtime_error if a file can't be read.
+QByteArray load(const QString &filename, const QStringList &defines = QStringList());
+
+}
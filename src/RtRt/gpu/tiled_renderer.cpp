@@ -0,0 +1,71 @@
+#include "tiled_renderer.h"
+
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+
+#include <algorithm>
+
+TiledRenderer::TiledRenderer(GPURayTracer &tracer, const QSize &tile_size) :
+    tracer(tracer),
+    tile_size(tile_size)
+{
+}
+
+QSize TiledRenderer::getTileSize() const {
+    return tile_size;
+}
+
+void TiledRenderer::renderTile(const RenderSettings &settings, const Camera &camera, const QSize &size,
+                               const QRect &tile, int num_of_passes, std::vector<unsigned char> &rgb) {
+    auto *gl = QOpenGLContext::currentContext()->functions();
+
+    if (!tile_buffer) {
+        tile_buffer = std::make_shared<QOpenGLFramebufferObject>(tile_size);
+    }
+
+    GLint prev_framebuffer = 0;
+    gl->glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_framebuffer);
+
+    // The tracer counts rows from the bottom: the tile is traced down from its top row,
+    // so the rows past the bottom of the image (if any) are at the bottom of the buffer.
+    const QRect traced(tile.x(), size.height() - tile.y() - tile_size.height(), tile_size.width(), tile_size.height());
+    tile_buffer->bind();
+    if (num_of_passes > 1) {
+        tracer.resetAccumulation();
+        for (int i = 0; i < num_of_passes; i++) {
+            tracer.accumulateTile(settings, camera, size, traced);
+        }
+        tracer.display(tracer.getAccumulationTexture(), tile_size);
+    } else {
+        tracer.renderTile(settings, camera, size, traced);
+    }
+
+    rgb.resize(size_t(tile.width()) * tile.height() * 3);
+    gl->glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    gl->glReadPixels(0, tile_size.height() - tile.height(), tile.width(), tile.height(),
+                     GL_RGB, GL_UNSIGNED_BYTE, rgb.data());
+    gl->glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+    gl->glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(prev_framebuffer));
+
+    // Rows are read from the bottom one up.
+    const auto row_size = size_t(tile.width()) * 3;
+    for (int y = 0; y < tile.height() / 2; y++) {
+        std::swap_ranges(rgb.begin() + y * row_size, rgb.begin() + (y + 1) * row_size,
+                         rgb.begin() + (tile.height() - 1 - y) * row_size);
+    }
+}
+
+void TiledRenderer::render(const RenderSettings &settings, const Camera &camera, int num_of_passes,
+                           TiledImageWriter &writer, const ProgressCallback &progress) {
+    const auto size = writer.getSize();
+    const auto tiles = TiledImageWriter::splitIntoTiles(size, tile_size);
+    std::vector<unsigned char> rgb;
+    for (size_t i = 0; i < tiles.size(); i++) {
+        renderTile(settings, camera, size, tiles[i], num_of_passes, rgb);
+        writer.writeTile(tiles[i], rgb.data());
+        if (progress) {
+            progress(static_cast<int>(i + 1), static_cast<int>(tiles.size()), tiles[i]);
+        }
+    }
+}
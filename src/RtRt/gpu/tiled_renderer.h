@@ -0,0 +1,44 @@
+#pragma once
+
+#include "gpu/gpu_ray_tracer.h"
+#include "io/tiled_image_writer.h"
+
+#include <QOpenGLFramebufferObject>
+#include <QRect>
+#include <QSize>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+/**
+ * Renders images of any size (e.g. for print) as a sequence of tiles of a fixed size:
+ * each tile is one draw (or one per progressive pass) into a framebuffer of the tile size,
+ * read back and written to the output file, so the memory and the duration of a draw depend
+ * on the tile size only. Every tile is traced at the full tile size, the pixels past the image are dropped.
+ * The context must be current during all the calls.
+ */
+class TiledRenderer {
+public:
+    // Called after each tile with the number of finished tiles and the tile (in image pixels from the top left).
+    using ProgressCallback = std::function<void(int num_of_finished_tiles, int num_of_tiles, const QRect &tile)>;
+
+public:
+    TiledRenderer(GPURayTracer &tracer, const QSize &tile_size);
+
+    QSize getTileSize() const;
+
+    // Traces the tile of the image (in pixels from the top left corner) averaging the number of passes;
+    // the RGB rows of the tile go to rgb from the top one down.
+    void renderTile(const RenderSettings &settings, const Camera &camera, const QSize &size, const QRect &tile,
+                    int num_of_passes, std::vector<unsigned char> &rgb);
+
+    // Renders the whole image of the writer tile by tile.
+    void render(const RenderSettings &settings, const Camera &camera, int num_of_passes, TiledImageWriter &writer,
+                const ProgressCallback &progress = ProgressCallback());
+
+private:
+    GPURayTracer &tracer;
+    QSize tile_size;
+    std::shared_ptr<QOpenGLFramebufferObject> tile_buffer;
+};
@@ -0,0 +1,268 @@
+#include "wavefront_tracer.h"
+#include "compute_kernel.h"
+#include "shader_source.h"
+#include "util.h"
+
+#include <QOpenGLFunctions_4_3_Core>
+#include <QVector2D>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+// Sizes of the structures in wavefront.comp (std430 layout).
+const int PIXEL_SIZE = 16;
+const int RAY_SIZE = 48;
+const int HIT_SIZE = 16;
+const int COUNTERS_SIZE = 48;
+
+// Offsets of the indirect dispatch arguments in the counters buffer.
+const GLintptr RAYS_DISPATCH_OFFSET = 16;
+const GLintptr SHADOWS_DISPATCH_OFFSET = 32;
+
+struct Counters {
+    GLuint num_of_rays_in, num_of_rays_out;
+    GLuint overflow;
+    GLuint max_num_of_rays;
+};
+
+}
+
+WavefrontTracer::WavefrontTracer() {
+}
+
+WavefrontTracer::~WavefrontTracer() {
+    if (gl && buffers[0] && QOpenGLContext::currentContext()) {
+        gl->glDeleteBuffers(B_NUM_OF_BUFFERS, buffers);
+    }
+}
+
+bool WavefrontTracer::isSupported(QOpenGLContext *context) {
+    if (!context) {
+        return false;
+    }
+    // Drivers usually create the highest version of the requested profile, so 4.3 may be
+    // available even though the application asks for 3.3.
+    const auto format = context->format();
+    const bool has_version = (format.majorVersion() > 4) ||
+            (format.majorVersion() == 4 && format.minorVersion() >= 3);
+    return has_version && !context->isOpenGLES();
+}
+
+void WavefrontTracer::init(const QString &shaders_dir, GLSceneBuffers &scene_buffers,
+                           int scene_unit, int history_unit) {
+    auto *context = QOpenGLContext::currentContext();
+    if (!isSupported(context)) {
+        throw std::runtime_error("Wavefront tracing needs OpenGL 4.3");
+    }
+    gl = context->versionFunctions<QOpenGLFunctions_4_3_Core>();
+    if (!gl || !gl->initializeOpenGLFunctions()) {
+        gl = nullptr;
+        throw std::runtime_error("Failed to resolve OpenGL 4.3 functions");
+    }
+
+    const auto kernel_file = shaders_dir + "/wavefront.comp";
+    kernels[K_GENERATE] = compute_kernel::load(kernel_file, "GENERATE_KERNEL");
+    kernels[K_CLOSEST_HIT] = compute_kernel::load(kernel_file, "CLOSEST_HIT_KERNEL");
+    kernels[K_SHADOW] = compute_kernel::load(kernel_file, "SHADOW_KERNEL");
+    kernels[K_SHADE] = compute_kernel::load(kernel_file, "SHADE_KERNEL");
+    kernels[K_ADVANCE] = compute_kernel::load(kernel_file, "ADVANCE_KERNEL");
+
+    for (auto &kernel: kernels) {
+        kernel->bind();
+        scene_buffers.setSamplers(kernel.get(), scene_unit);
+        kernel->release();
+    }
+
+    const auto vertex_file = shaders_dir + "/raytrace.vert";
+    const auto fragment_file = shaders_dir + "/wavefront_resolve.frag";
+    resolve_program = std::make_shared<QOpenGLShaderProgram>();
+    resolve_program->bindAttributeLocation("vertex", 0);
+    if (!resolve_program->addShaderFromSourceCode(QOpenGLShader::Vertex, shader_source::load(vertex_file)) ||
+        !resolve_program->addShaderFromSourceCode(QOpenGLShader::Fragment, shader_source::load(fragment_file)) ||
+        !resolve_program->link()) {
+        throw std::runtime_error(std::string("Failed to load resolve program from ") + fragment_file.toStdString()
+                                 + ":\n" + resolve_program->log().toStdString());
+    }
+    resolve_program->bind();
+    resolve_program->setUniformValue("history", history_unit);
+    resolve_program->release();
+
+    gl->glGenBuffers(B_NUM_OF_BUFFERS, buffers);
+}
+
+bool WavefrontTracer::isInitialized() const {
+    return resolve_program != nullptr;
+}
+
+void WavefrontTracer::setQueueCapacity(int capacity) {
+    queue_capacity = std::max(capacity, 1);
+    batch_size = 0;
+}
+
+int WavefrontTracer::getQueueCapacity() const {
+    return queue_capacity;
+}
+
+int WavefrontTracer::getMaxNumOfRays() const {
+    return max_num_of_rays;
+}
+
+void WavefrontTracer::initBuffers(const QSize &size) {
+    const int pixels = size.width() * size.height();
+    if (pixels != num_of_pixels) {
+        gl->glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[B_PIXELS]);
+        gl->glBufferData(GL_SHADER_STORAGE_BUFFER, GLsizeiptr(pixels) * PIXEL_SIZE, nullptr, GL_DYNAMIC_COPY);
+        num_of_pixels = pixels;
+    }
+    if (queue_capacity != allocated_capacity) {
+        for (auto buffer: {B_RAYS_0, B_RAYS_1}) {
+            gl->glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[buffer]);
+            gl->glBufferData(GL_SHADER_STORAGE_BUFFER, GLsizeiptr(queue_capacity) * RAY_SIZE, nullptr, GL_DYNAMIC_COPY);
+        }
+        gl->glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[B_HITS]);
+        gl->glBufferData(GL_SHADER_STORAGE_BUFFER, GLsizeiptr(queue_capacity) * HIT_SIZE, nullptr, GL_DYNAMIC_COPY);
+        gl->glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[B_COUNTERS]);
+        gl->glBufferData(GL_SHADER_STORAGE_BUFFER, COUNTERS_SIZE, nullptr, GL_DYNAMIC_COPY);
+        allocated_capacity = queue_capacity;
+    }
+    gl->glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void WavefrontTracer::setSceneUniforms(const RenderSettings &settings, const GLSceneBuffers &scene_buffers) {
+    for (auto &kernel: kernels) {
+        kernel->bind();
+        kernel->setUniformValue("queueCapacity", GLuint(queue_capacity));
+        kernel->setUniformValue("numOfLightSources", scene_buffers.getNumOfLights());
+        kernel->setUniformValue("numOfLightSamples", settings.num_of_light_samples);
+        kernel->setUniformValue("numOfBvhNodes", scene_buffers.getNumOfBvhNodes());
+        kernel->setUniformValue("numOfMeshBvhNodes", scene_buffers.getNumOfMeshBvhNodes());
+        kernel->setUniformValue("backgroundColor", util::colorToVec(settings.background_color));
+    }
+}
+
+void WavefrontTracer::barrier() {
+    gl->glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+}
+
+void WavefrontTracer::trace(const RenderSettings &settings, const Camera &camera, const QSize &size,
+                            bool accumulate, int frame_index, const GLSceneBuffers &scene_buffers) {
+    initBuffers(size);
+    setSceneUniforms(settings, scene_buffers);
+
+    // Samples of a pixel are the same as in raytrace.frag: N random or N x N jittered ones.
+    const bool single_sample = (settings.num_of_samples == 1 && !accumulate);
+    const int samples_per_pixel = single_sample ? 1 : settings.numOfPixelSamples();
+
+    auto &generate = kernels[K_GENERATE];
+    generate->bind();
+    generate->setUniformValue("camToWorld", camera.camToWorld());
+    generate->setUniformValue("windowSize", QVector2D(size.width(), size.height()));
+    generate->setUniformValue("fovTangent", camera.fovTangent());
+    generate->setUniformValue("numOfSamples", settings.num_of_samples);
+    generate->setUniformValue("samplingMode", int(settings.sampling_mode));
+    generate->setUniformValue("singleSample", single_sample);
+    generate->setUniformValue("frameIndex", frame_index);
+    generate->setUniformValue("samplesPerPixel", samples_per_pixel);
+
+    auto &shade = kernels[K_SHADE];
+    shade->bind();
+    shade->setUniformValue("numOfSteps", settings.num_of_steps);
+    shade->setUniformValue("refractionEnabled", settings.transparency_enabled);
+
+    gl->glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[B_PIXELS]);
+    gl->glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_RGBA32UI, GL_RGBA_INTEGER, GL_UNSIGNED_INT, nullptr);
+
+    gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, buffers[B_PIXELS]);
+    gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, buffers[B_HITS]);
+    gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, buffers[B_COUNTERS]);
+    gl->glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, buffers[B_COUNTERS]);
+
+    // Each primary ray spawns at most one ray per level (two with refraction, but most rays
+    // hit opaque surfaces), so a batch of queue capacity samples usually fits; if it does not,
+    // the batch is traced again with half the size, so the image is always complete.
+    const int max_batch_size = std::max(queue_capacity / samples_per_pixel, 1) * samples_per_pixel;
+    if (batch_size <= 0 || batch_size > max_batch_size || batch_size % samples_per_pixel != 0) {
+        batch_size = max_batch_size;
+    }
+
+    const int num_of_samples = size.width() * size.height() * samples_per_pixel;
+    max_num_of_rays = 0;
+    int first_sample = 0;
+    while (first_sample < num_of_samples) {
+        const int num_of_batch_samples = std::min(batch_size, num_of_samples - first_sample);
+
+        gl->glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[B_COUNTERS]);
+        gl->glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+
+        int queue = 0;
+        gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, buffers[B_RAYS_0 + queue]);
+        barrier();
+        generate->bind();
+        generate->setUniformValue("firstSample", GLuint(first_sample));
+        generate->setUniformValue("numOfBatchSamples", GLuint(num_of_batch_samples));
+        gl->glDispatchCompute(compute_kernel::numOfGroups(num_of_batch_samples), 1, 1);
+
+        for (int level = 0; level < settings.num_of_steps; level++) {
+            // Output queue of the previous level becomes the input one.
+            gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, buffers[B_RAYS_0 + queue]);
+            queue = 1 - queue;
+            gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, buffers[B_RAYS_0 + queue]);
+
+            barrier();
+            kernels[K_ADVANCE]->bind();
+            gl->glDispatchCompute(1, 1, 1);
+
+            barrier();
+            kernels[K_CLOSEST_HIT]->bind();
+            gl->glDispatchComputeIndirect(RAYS_DISPATCH_OFFSET);
+
+            barrier();
+            kernels[K_SHADOW]->bind();
+            gl->glDispatchComputeIndirect(SHADOWS_DISPATCH_OFFSET);
+
+            barrier();
+            shade->bind();
+            gl->glDispatchComputeIndirect(RAYS_DISPATCH_OFFSET);
+        }
+
+        barrier();
+        Counters counters;
+        gl->glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[B_COUNTERS]);
+        gl->glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(counters), &counters);
+
+        if (counters.overflow > 0 && num_of_batch_samples > samples_per_pixel) {
+            // Some rays were lost: clear the batch pixels and trace them again in smaller batches.
+            gl->glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[B_PIXELS]);
+            gl->glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_RGBA32UI,
+                                     GLintptr(first_sample / samples_per_pixel) * PIXEL_SIZE,
+                                     GLsizeiptr(num_of_batch_samples / samples_per_pixel) * PIXEL_SIZE,
+                                     GL_RGBA_INTEGER, GL_UNSIGNED_INT, nullptr);
+            batch_size = std::max(batch_size / 2 / samples_per_pixel, 1) * samples_per_pixel;
+            continue;
+        }
+
+        max_num_of_rays = std::max(max_num_of_rays, int(counters.max_num_of_rays));
+        first_sample += num_of_batch_samples;
+    }
+
+    shade->release();
+    gl->glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    gl->glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+    gl->glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void WavefrontTracer::resolve(GLPlane *plane, const QSize &size, bool accumulate, int frame_index) {
+    gl->glViewport(0, 0, size.width(), size.height());
+
+    resolve_program->bind();
+    gl->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, buffers[B_PIXELS]);
+    resolve_program->setUniformValue("windowSize", QVector2D(size.width(), size.height()));
+    resolve_program->setUniformValue("accumulate", accumulate);
+    resolve_program->setUniformValue("frameIndex", frame_index);
+
+    plane->draw(QOpenGLContext::currentContext()->functions());
+
+    resolve_program->release();
+}
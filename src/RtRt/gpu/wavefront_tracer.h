@@ -0,0 +1,93 @@
+#pragma once
+
+#include "gl_objects/gl_plane.h"
+#include "gl_objects/gl_scene_buffers.h"
+#include "objects/camera.h"
+#include "render_settings.h"
+
+#include <QOpenGLContext>
+#include <QOpenGLShaderProgram>
+#include <QSize>
+
+#include <memory>
+
+class QOpenGLFunctions_4_3_Core;
+
+/**
+ * Wavefront ray tracer running shaders/wavefront.comp (OpenGL 4.3 compute shaders).
+ * Instead of tracing the whole ray tree of a pixel in one invocation, rays of each depth level
+ * are kept in a queue and processed by small kernels (generate, closest hit, shadows, shade),
+ * so the invocations of a kernel do the same work and divergence is low.
+ * The result is the same as of raytrace.frag; colors are accumulated in a pixel buffer
+ * and written to the bound framebuffer by resolve().
+ */
+class WavefrontTracer {
+public:
+    WavefrontTracer();
+    ~WavefrontTracer();
+
+    // Compute shaders need OpenGL 4.3.
+    static bool isSupported(QOpenGLContext *context);
+
+    // Loads the kernels: the context must be current and supported.
+    // Texture units are the ones used by GPURayTracer for scene buffers and history.
+    // Throws std::runtime_error if shaders fail to compile.
+    void init(const QString &shaders_dir, GLSceneBuffers &scene_buffers,
+              int scene_unit, int history_unit);
+    bool isInitialized() const;
+
+    // Max number of rays in a queue; pixels are traced in batches which fit into it.
+    void setQueueCapacity(int capacity);
+    int getQueueCapacity() const;
+
+    // Traces all the samples of the image into the pixel buffer (adaptive sampling is not used).
+    // Scene buffers must be bound to their units.
+    void trace(const RenderSettings &settings, const Camera &camera, const QSize &size,
+               bool accumulate, int frame_index, const GLSceneBuffers &scene_buffers);
+
+    // Writes the traced image into the bound framebuffer; in accumulation mode it is averaged
+    // with the history texture (bound to its unit) containing frame_index passes.
+    void resolve(GLPlane *plane, const QSize &size, bool accumulate, int frame_index);
+
+    // Max number of rays in a level of the last traced batch (for statistics).
+    int getMaxNumOfRays() const;
+
+private:
+    enum Kernel {
+        K_GENERATE = 0,
+        K_CLOSEST_HIT,
+        K_SHADOW,
+        K_SHADE,
+        K_ADVANCE,
+        K_NUM_OF_KERNELS
+    };
+
+    enum Buffer {
+        B_PIXELS = 0,
+        B_RAYS_0,
+        B_RAYS_1,
+        B_HITS,
+        B_COUNTERS,
+        B_NUM_OF_BUFFERS
+    };
+
+    void initBuffers(const QSize &size);
+    void setSceneUniforms(const RenderSettings &settings, const GLSceneBuffers &scene_buffers);
+    void barrier();
+
+private:
+    QOpenGLFunctions_4_3_Core *gl = nullptr;
+
+    std::shared_ptr<QOpenGLShaderProgram> kernels[K_NUM_OF_KERNELS];
+    std::shared_ptr<QOpenGLShaderProgram> resolve_program;
+
+    GLuint buffers[B_NUM_OF_BUFFERS] = {0};
+    int num_of_pixels = 0;
+    int allocated_capacity = 0;
+    int queue_capacity = 1 << 20;
+
+    // Batch size (in pixel samples) is halved when the rays overflow the queue
+    // and kept for the next frames.
+    int batch_size = 0;
+    int max_num_of_rays = 0;
+};
@@ -0,0 +1,278 @@
+#include "frame_writer.h"
+
+#include <QFileInfo>
+#include <QDir>
+
+#include <chrono>
+#include <stdexcept>
+
+namespace {
+
+// The writer thread sleeps this long at most when the queue is empty.
+const auto IDLE_WAIT = std::chrono::milliseconds(10);
+
+// Rows of a bottom-up RGBA frame, top row first, as RGB.
+void rgbaRowToRgb(const CapturedFrame &frame, int y, unsigned char *rgb) {
+    const auto *src = frame.pixels->data() + size_t(frame.height - 1 - y) * frame.width * 4;
+    for (int x = 0; x < frame.width; x++) {
+        rgb[3 * x + 0] = src[4 * x + 0];
+        rgb[3 * x + 1] = src[4 * x + 1];
+        rgb[3 * x + 2] = src[4 * x + 2];
+    }
+}
+
+}
+
+FrameWriter::FrameWriter() :
+    queue(MAX_FRAMES_IN_QUEUE),
+    free_buffers(MAX_FRAMES_IN_QUEUE)
+{
+}
+
+FrameWriter::~FrameWriter() {
+    stop();
+}
+
+CaptureFormat FrameWriter::formatOf(const QString &filename) {
+    const auto suffix = QFileInfo(filename).suffix().toLower();
+    if (suffix == "ppm") {
+        return CF_PPM_SEQUENCE;
+    }
+    if (suffix == "y4m") {
+        return CF_Y4M;
+    }
+    return CF_RAW;
+}
+
+void FrameWriter::start(const QString &filename, CaptureFormat format, int frames_per_second) {
+    stop();
+
+    this->filename = filename;
+    this->format = format;
+    this->frames_per_second = frames_per_second;
+    header_written = false;
+
+    if (format == CF_PPM_SEQUENCE) {
+        if (!QFileInfo(filename).absoluteDir().exists()) {
+            throw std::runtime_error("No directory for " + filename.toStdString());
+        }
+    } else {
+        file.reset(new QFile(filename));
+        if (!file->open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            file.reset();
+            throw std::runtime_error("Failed to write " + filename.toStdString());
+        }
+    }
+
+    frames_written = 0;
+    frames_dropped = 0;
+    bytes_written = 0;
+    error.clear();
+    timer.start();
+
+    stopping = false;
+    running = true;
+    thread = std::thread([this]() {
+        run();
+    });
+}
+
+void FrameWriter::stop() {
+    if (!running) {
+        return;
+    }
+    stopping = true;
+    wake_up.notify_one();
+    thread.join();
+    running = false;
+    stopped_ms = timer.elapsed();
+    file.reset();
+}
+
+bool FrameWriter::isRunning() const {
+    return running;
+}
+
+std::shared_ptr<std::vector<unsigned char>> FrameWriter::acquireBuffer(size_t size) {
+    std::shared_ptr<std::vector<unsigned char>> buffer;
+    if (!released_buffers.empty()) {
+        buffer = released_buffers.back();
+        released_buffers.pop_back();
+    } else if (!free_buffers.pop(buffer)) {
+        if (num_of_buffers >= MAX_FRAMES_IN_QUEUE) {
+            return nullptr;
+        }
+        buffer = std::make_shared<std::vector<unsigned char>>();
+        num_of_buffers++;
+    }
+    buffer->resize(size);
+    return buffer;
+}
+
+void FrameWriter::push(const CapturedFrame &frame) {
+    // There are no more buffers than queue slots, so this fails only if a buffer came from elsewhere.
+    if (!queue.push(frame)) {
+        releaseBuffer(frame.pixels);
+        frameDropped();
+        return;
+    }
+    wake_up.notify_one();
+}
+
+void FrameWriter::releaseBuffer(const std::shared_ptr<std::vector<unsigned char>> &buffer) {
+    if (buffer) {
+        released_buffers.push_back(buffer);
+    }
+}
+
+void FrameWriter::frameDropped() {
+    frames_dropped++;
+}
+
+FrameWriter::Stats FrameWriter::getStats() const {
+    Stats stats;
+    stats.frames_written = frames_written;
+    stats.frames_dropped = frames_dropped;
+    const auto elapsed_ms = running ? timer.elapsed() : stopped_ms;
+    if (elapsed_ms > 0) {
+        stats.megabytes_per_second = bytes_written / (1024.0 * 1024.0) / (elapsed_ms * 1e-3);
+    }
+    std::lock_guard<std::mutex> lock(error_mutex);
+    stats.error = error;
+    return stats;
+}
+
+void FrameWriter::run() {
+    CapturedFrame frame;
+    for (;;) {
+        // Frames queued before the stop request are still written.
+        const bool stop_requested = stopping;
+        bool written = false;
+        while (queue.pop(frame)) {
+            write(frame);
+            free_buffers.push(frame.pixels);
+            frame.pixels.reset();
+            written = true;
+        }
+        if (stop_requested) {
+            break;
+        }
+        if (!written) {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake_up.wait_for(lock, IDLE_WAIT);
+        }
+    }
+}
+
+void FrameWriter::write(const CapturedFrame &frame) {
+    {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error.empty()) {
+            frames_dropped++;
+            return;
+        }
+    }
+    // A stream keeps the size of its first frame: frames of other sizes (e.g. after a resize) are dropped.
+    if (format != CF_PPM_SEQUENCE) {
+        if (!header_written) {
+            stream_width = frame.width;
+            stream_height = frame.height;
+        } else if (frame.width != stream_width || frame.height != stream_height) {
+            frames_dropped++;
+            return;
+        }
+    }
+
+    switch (format) {
+    case CF_PPM_SEQUENCE:
+        writePpm(frame);
+        break;
+    case CF_Y4M:
+        writeY4m(frame);
+        break;
+    case CF_RAW:
+        writeRaw(frame);
+        break;
+    }
+    std::lock_guard<std::mutex> lock(error_mutex);
+    if (error.empty()) {
+        frames_written++;
+    } else {
+        frames_dropped++;
+    }
+}
+
+// Files are numbered by the written frames without gaps, as image sequence readers expect.
+void FrameWriter::writePpm(const CapturedFrame &frame) {
+    const QFileInfo info(filename);
+    const auto frame_filename = info.absoluteDir().filePath(
+                QString("%1_%2.ppm").arg(info.completeBaseName()).arg(frames_written.load(), 5, 10, QChar('0')));
+    file.reset(new QFile(frame_filename));
+    if (!file->open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        fail("Failed to write " + frame_filename.toStdString());
+        return;
+    }
+    const auto header = QString("P6\n%1 %2\n255\n").arg(frame.width).arg(frame.height).toLatin1();
+    writeData(header.constData(), header.size());
+
+    row_buffer.resize(size_t(frame.width) * 3);
+    for (int y = 0; y < frame.height; y++) {
+        rgbaRowToRgb(frame, y, row_buffer.data());
+        writeData(reinterpret_cast<const char*>(row_buffer.data()), static_cast<qint64>(row_buffer.size()));
+    }
+    file.reset();
+}
+
+void FrameWriter::writeY4m(const CapturedFrame &frame) {
+    if (!header_written) {
+        const auto header = QString("YUV4MPEG2 W%1 H%2 F%3:1 Ip A1:1 C444\n")
+                .arg(frame.width).arg(frame.height).arg(frames_per_second).toLatin1();
+        writeData(header.constData(), header.size());
+        header_written = true;
+    }
+    writeData("FRAME\n", 6);
+
+    // BT.601 with the video range, which players assume for Y4M.
+    const auto plane_size = size_t(frame.width) * frame.height;
+    row_buffer.resize(3 * plane_size);
+    auto *y_plane = row_buffer.data();
+    auto *u_plane = y_plane + plane_size;
+    auto *v_plane = u_plane + plane_size;
+    for (int y = 0; y < frame.height; y++) {
+        const auto *src = frame.pixels->data() + size_t(frame.height - 1 - y) * frame.width * 4;
+        for (int x = 0; x < frame.width; x++) {
+            const int r = src[4 * x + 0];
+            const int g = src[4 * x + 1];
+            const int b = src[4 * x + 2];
+            const auto i = size_t(y) * frame.width + x;
+            y_plane[i] = static_cast<unsigned char>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+            u_plane[i] = static_cast<unsigned char>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+            v_plane[i] = static_cast<unsigned char>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+        }
+    }
+    writeData(reinterpret_cast<const char*>(row_buffer.data()), static_cast<qint64>(row_buffer.size()));
+}
+
+void FrameWriter::writeRaw(const CapturedFrame &frame) {
+    header_written = true;
+    row_buffer.resize(size_t(frame.width) * 3);
+    for (int y = 0; y < frame.height; y++) {
+        rgbaRowToRgb(frame, y, row_buffer.data());
+        writeData(reinterpret_cast<const char*>(row_buffer.data()), static_cast<qint64>(row_buffer.size()));
+    }
+}
+
+void FrameWriter::writeData(const char *data, qint64 size) {
+    if (!file || file->write(data, size) != size) {
+        fail("Failed to write " + (file ? file->fileName() : filename).toStdString());
+        return;
+    }
+    bytes_written += size;
+}
+
+void FrameWriter::fail(const std::string &message) {
+    std::lock_guard<std::mutex> lock(error_mutex);
+    if (error.empty()) {
+        error = message;
+    }
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "profiling/ring_buffer.h"
+
+#include <QString>
+#include <QFile>
+#include <QElapsedTimer>
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum CaptureFormat : int {
+    CF_PPM_SEQUENCE = 0, // name_00000.ppm, name_00001.ppm, ...
+    CF_Y4M = 1, // one YUV4MPEG2 stream (4:4:4), readable by ffmpeg and most players
+    CF_RAW = 2 // RGB24 frames back to back, top row first
+};
+
+/**
+ * Frame read back from the GPU: RGBA rows from the bottom one up (as glReadPixels returns them).
+ */
+struct CapturedFrame {
+    long long index = 0;
+    int width = 0;
+    int height = 0;
+    std::shared_ptr<std::vector<unsigned char>> pixels;
+};
+
+/**
+ * Streams captured frames to disk on a background thread.
+ * The render thread gets pixel buffers from a small pool and queues them without blocking;
+ * when the writer falls behind and the pool runs out, frames are dropped and counted.
+ */
+class FrameWriter {
+public:
+    struct Stats {
+        long long frames_written = 0;
+        long long frames_dropped = 0;
+        double megabytes_per_second = 0.0; // written to disk since the start
+        std::string error; // the writer stops on the first error
+    };
+
+public:
+    FrameWriter();
+    ~FrameWriter();
+
+    FrameWriter(const FrameWriter&) = delete;
+    FrameWriter& operator=(const FrameWriter&) = delete;
+
+    // The format is chosen by the file extension (.ppm, .y4m, anything else is raw).
+    static CaptureFormat formatOf(const QString &filename);
+
+    // Throws std::runtime_error if the output can't be created.
+    void start(const QString &filename, CaptureFormat format, int frames_per_second = 30);
+    // Writes the queued frames and stops the thread.
+    void stop();
+    bool isRunning() const;
+
+    // Producer side (one thread). Returns a buffer of the given size, or nullptr if all of them are in use:
+    // then the frame should be dropped (see frameDropped).
+    std::shared_ptr<std::vector<unsigned char>> acquireBuffer(size_t size);
+    // Queues the frame; if the queue is full, the frame is dropped.
+    void push(const CapturedFrame &frame);
+    // Gives back an acquired buffer which was not pushed (e.g. the frame failed to read back).
+    void releaseBuffer(const std::shared_ptr<std::vector<unsigned char>> &buffer);
+    void frameDropped();
+
+    Stats getStats() const;
+
+private:
+    void run();
+    void write(const CapturedFrame &frame);
+    void writePpm(const CapturedFrame &frame);
+    void writeY4m(const CapturedFrame &frame);
+    void writeRaw(const CapturedFrame &frame);
+    void writeData(const char *data, qint64 size);
+    void fail(const std::string &message);
+
+private:
+    // Frames in the queue and being written; at 1080p each one takes 8 MB.
+    static const int MAX_FRAMES_IN_QUEUE = 8;
+
+    QString filename;
+    CaptureFormat format = CF_RAW;
+    int frames_per_second = 30;
+
+    // Output of the single file formats, opened by start and used by the writer thread only.
+    std::unique_ptr<QFile> file;
+    bool header_written = false;
+    int stream_width = 0;
+    int stream_height = 0;
+    std::vector<unsigned char> row_buffer;
+
+    RingBuffer<CapturedFrame> queue;
+    // Buffers go back to the producer through this queue once written.
+    RingBuffer<std::shared_ptr<std::vector<unsigned char>>> free_buffers;
+    int num_of_buffers = 0;
+    // Buffers given back by the producer itself; used by the producer thread only.
+    std::vector<std::shared_ptr<std::vector<unsigned char>>> released_buffers;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake_up;
+    std::atomic<bool> running {false};
+    std::atomic<bool> stopping {false};
+
+    std::atomic<long long> frames_written {0};
+    std::atomic<long long> frames_dropped {0};
+    std::atomic<long long> bytes_written {0};
+    QElapsedTimer timer;
+    qint64 stopped_ms = 0;
+    mutable std::mutex error_mutex;
+    std::string error;
+};
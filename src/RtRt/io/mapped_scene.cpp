@@ -0,0 +1,327 @@
+#include "mapped_scene.h"
+#include "objects/scene_packing.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+const char SceneFileHeader::MAGIC[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0'};
+
+namespace {
+
+std::uint64_t sectionSize(const SceneFileHeader &header, SceneFileHeader::Section section) {
+    switch (section) {
+    case SceneFileHeader::S_SPHERES:
+        return std::uint64_t(header.num_of_spheres) * scene_packing::TEXELS_PER_SPHERE * sizeof(QVector4D);
+    case SceneFileHeader::S_SPHERE_MATERIALS:
+        return std::uint64_t(header.num_of_spheres) * sizeof(int);
+    case SceneFileHeader::S_LIGHTS:
+        return std::uint64_t(header.num_of_lights) * scene_packing::TEXELS_PER_LIGHT * sizeof(QVector4D);
+    case SceneFileHeader::S_MATERIALS:
+        return std::uint64_t(header.num_of_materials) * scene_packing::TEXELS_PER_MATERIAL * sizeof(QVector4D);
+    case SceneFileHeader::S_BVH_NODES:
+        return std::uint64_t(header.num_of_bvh_nodes) * 2 * sizeof(QVector4D);
+    case SceneFileHeader::S_BVH_INDICES:
+        return std::uint64_t(header.num_of_bvh_indices) * sizeof(int);
+    case SceneFileHeader::S_MESH_VERTICES:
+        return std::uint64_t(header.num_of_mesh_vertices) * sizeof(QVector4D);
+    case SceneFileHeader::S_MESH_TRIANGLES:
+        return std::uint64_t(header.num_of_mesh_triangles) * scene_packing::INTS_PER_TRIANGLE * sizeof(int);
+    case SceneFileHeader::S_MESH_RANGES:
+        return std::uint64_t(header.num_of_meshes) * scene_packing::INTS_PER_MESH_RANGE * sizeof(int);
+    case SceneFileHeader::S_MESH_BVH_NODES:
+        return std::uint64_t(header.num_of_mesh_bvh_nodes) * 2 * sizeof(QVector4D);
+    case SceneFileHeader::S_MESH_BVH_INDICES:
+        return std::uint64_t(header.num_of_mesh_bvh_indices) * sizeof(int);
+    default:
+        return 0;
+    }
+}
+
+std::uint64_t alignOffset(std::uint64_t offset) {
+    const auto alignment = std::uint64_t(SceneFileHeader::ALIGNMENT);
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+// Checks the links of the nodes and the primitive indices (what = "sphere" or "triangle").
+void validateBVH(const BVH &bvh, int num_of_prims, const std::string &what) {
+    const auto &nodes = bvh.getNodes();
+    const auto num_of_nodes = int(nodes.size());
+    const auto num_of_indices = int(bvh.getIndices().size());
+    for (int i = 0; i < num_of_nodes; i++) {
+        const auto &node = nodes[i];
+        const bool valid = node.isLeaf() ?
+                    (node.first_or_skip >= 0 && node.first_or_skip + node.count <= num_of_indices) :
+                    (node.first_or_skip > i && node.first_or_skip <= num_of_nodes);
+        if (!valid) {
+            throw std::runtime_error("Bad " + what + " BVH node in scene file: " + std::to_string(i));
+        }
+    }
+    for (const auto index: bvh.getIndices()) {
+        if (index < 0 || index >= num_of_prims) {
+            throw std::runtime_error("Bad BVH " + what + " index in scene file: " + std::to_string(index));
+        }
+    }
+}
+
+void writeSection(QFile &file, const void *data, std::uint64_t size, std::uint64_t offset) {
+    if (!file.seek(qint64(offset)) ||
+            (size > 0 && file.write(static_cast<const char*>(data), qint64(size)) != qint64(size))) {
+        throw std::runtime_error("Failed to write " + file.fileName().toStdString());
+    }
+}
+
+}
+
+MappedScene::MappedScene(const QString &filename) :
+    file(filename)
+{
+    const auto name = filename.toStdString();
+    if (!file.open(QIODevice::ReadOnly)) {
+        throw std::runtime_error("Failed to open " + name);
+    }
+    const auto file_size = std::uint64_t(file.size());
+    if (file_size < sizeof(SceneFileHeader)) {
+        throw std::runtime_error("Not a scene file: " + name);
+    }
+    data = file.map(0, file.size());
+    if (!data) {
+        throw std::runtime_error("Failed to map " + name + ": " + file.errorString().toStdString());
+    }
+    header = reinterpret_cast<const SceneFileHeader*>(data);
+    if (std::memcmp(header->magic, SceneFileHeader::MAGIC, sizeof(header->magic)) != 0) {
+        throw std::runtime_error("Not a scene file: " + name);
+    }
+    if (header->byte_order != SceneFileHeader::BYTE_ORDER_MARK) {
+        throw std::runtime_error("Scene file has a different byte order: " + name);
+    }
+    if (header->version != SceneFileHeader::VERSION) {
+        throw std::runtime_error("Unsupported scene file version " + std::to_string(header->version) + ": " + name);
+    }
+    for (int s = 0; s < SceneFileHeader::S_NUM_OF_SECTIONS; s++) {
+        const auto section = static_cast<SceneFileHeader::Section>(s);
+        const auto offset = header->offsets[s];
+        if (offset % SceneFileHeader::ALIGNMENT != 0 || offset < sizeof(SceneFileHeader) ||
+                offset > file_size || sectionSize(*header, section) > file_size - offset) {
+            throw std::runtime_error("Scene file is truncated or corrupted: " + name);
+        }
+    }
+}
+
+MappedScene::~MappedScene() {
+    if (data) {
+        file.unmap(const_cast<uchar*>(data));
+    }
+}
+
+void MappedScene::save(const Scene &scene, const QString &filename) {
+    BVH bvh;
+    bvh.build(scene.objects);
+    MeshBVH mesh_bvh;
+    mesh_bvh.build(scene.meshes);
+
+    const auto spheres = scene_packing::packSpheres(scene.objects);
+    const auto sphere_materials = scene_packing::packSphereMaterials(scene.objects);
+    const auto lights = scene_packing::packLights(scene.lights);
+    const auto materials = scene_packing::packMaterials(scene.materials);
+    const auto bvh_nodes = bvh.packNodes();
+    const auto &bvh_indices = bvh.getIndices();
+    const auto mesh_ranges = scene_packing::packMeshRanges(scene.meshes);
+    const auto mesh_bvh_nodes = mesh_bvh.getBVH().packNodes();
+    const auto &mesh_bvh_indices = mesh_bvh.getBVH().getIndices();
+
+    SceneFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, SceneFileHeader::MAGIC, sizeof(header.magic));
+    header.version = SceneFileHeader::VERSION;
+    header.byte_order = SceneFileHeader::BYTE_ORDER_MARK;
+    header.num_of_spheres = std::uint32_t(scene.objects.size());
+    header.num_of_lights = std::uint32_t(scene.lights.size());
+    header.num_of_materials = std::uint32_t(scene.materials.size());
+    header.num_of_bvh_nodes = std::uint32_t(bvh.getNodes().size());
+    header.num_of_bvh_indices = std::uint32_t(bvh_indices.size());
+    header.num_of_meshes = std::uint32_t(scene.meshes.size());
+    header.num_of_mesh_vertices = std::uint32_t(mesh_bvh.getVertices().size());
+    header.num_of_mesh_triangles = std::uint32_t(mesh_bvh.getNumOfTriangles());
+    header.num_of_mesh_bvh_nodes = std::uint32_t(mesh_bvh.getBVH().getNodes().size());
+    header.num_of_mesh_bvh_indices = std::uint32_t(mesh_bvh_indices.size());
+
+    const void *sections[SceneFileHeader::S_NUM_OF_SECTIONS] = {
+        spheres.data(), sphere_materials.data(), lights.data(), materials.data(), bvh_nodes.data(), bvh_indices.data(),
+        mesh_bvh.getVertices().data(), mesh_bvh.getTriangles().data(), mesh_ranges.data(),
+        mesh_bvh_nodes.data(), mesh_bvh_indices.data()
+    };
+    auto offset = alignOffset(sizeof(header));
+    for (int s = 0; s < SceneFileHeader::S_NUM_OF_SECTIONS; s++) {
+        header.offsets[s] = offset;
+        offset = alignOffset(offset + sectionSize(header, static_cast<SceneFileHeader::Section>(s)));
+    }
+
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        throw std::runtime_error("Failed to write " + filename.toStdString());
+    }
+    writeSection(file, &header, sizeof(header), 0);
+    for (int s = 0; s < SceneFileHeader::S_NUM_OF_SECTIONS; s++) {
+        writeSection(file, sections[s], sectionSize(header, static_cast<SceneFileHeader::Section>(s)), header.offsets[s]);
+    }
+    // Pad the last section, so the file size covers all the offsets.
+    if (!file.resize(qint64(offset))) {
+        throw std::runtime_error("Failed to write " + filename.toStdString());
+    }
+}
+
+int MappedScene::getNumOfSpheres() const {
+    return int(header->num_of_spheres);
+}
+
+int MappedScene::getNumOfLights() const {
+    return int(header->num_of_lights);
+}
+
+int MappedScene::getNumOfMaterials() const {
+    return int(header->num_of_materials);
+}
+
+int MappedScene::getNumOfBvhNodes() const {
+    return int(header->num_of_bvh_nodes);
+}
+
+int MappedScene::getNumOfBvhIndices() const {
+    return int(header->num_of_bvh_indices);
+}
+
+int MappedScene::getNumOfMeshes() const {
+    return int(header->num_of_meshes);
+}
+
+int MappedScene::getNumOfMeshVertices() const {
+    return int(header->num_of_mesh_vertices);
+}
+
+int MappedScene::getNumOfMeshTriangles() const {
+    return int(header->num_of_mesh_triangles);
+}
+
+int MappedScene::getNumOfMeshBvhNodes() const {
+    return int(header->num_of_mesh_bvh_nodes);
+}
+
+int MappedScene::getNumOfMeshBvhIndices() const {
+    return int(header->num_of_mesh_bvh_indices);
+}
+
+const QVector4D* MappedScene::sphereData() const {
+    return section<QVector4D>(SceneFileHeader::S_SPHERES);
+}
+
+const int* MappedScene::sphereMaterials() const {
+    return section<int>(SceneFileHeader::S_SPHERE_MATERIALS);
+}
+
+const QVector4D* MappedScene::lightData() const {
+    return section<QVector4D>(SceneFileHeader::S_LIGHTS);
+}
+
+const QVector4D* MappedScene::materialData() const {
+    return section<QVector4D>(SceneFileHeader::S_MATERIALS);
+}
+
+const QVector4D* MappedScene::bvhNodes() const {
+    return section<QVector4D>(SceneFileHeader::S_BVH_NODES);
+}
+
+const int* MappedScene::bvhIndices() const {
+    return section<int>(SceneFileHeader::S_BVH_INDICES);
+}
+
+const QVector4D* MappedScene::meshVertices() const {
+    return section<QVector4D>(SceneFileHeader::S_MESH_VERTICES);
+}
+
+const int* MappedScene::meshTriangles() const {
+    return section<int>(SceneFileHeader::S_MESH_TRIANGLES);
+}
+
+const int* MappedScene::meshRanges() const {
+    return section<int>(SceneFileHeader::S_MESH_RANGES);
+}
+
+const QVector4D* MappedScene::meshBvhNodes() const {
+    return section<QVector4D>(SceneFileHeader::S_MESH_BVH_NODES);
+}
+
+const int* MappedScene::meshBvhIndices() const {
+    return section<int>(SceneFileHeader::S_MESH_BVH_INDICES);
+}
+
+Scene MappedScene::toScene() const {
+    Scene scene;
+    scene.objects = scene_packing::unpackSpheres(sphereData(), sphereMaterials(), getNumOfSpheres());
+    scene.lights = scene_packing::unpackLights(lightData(), getNumOfLights());
+    scene.materials = scene_packing::unpackMaterials(materialData(), getNumOfMaterials());
+    checkSphereMaterials();
+    // Triangles are checked first, so that the ranges refer to valid data.
+    checkMeshTriangles();
+    const auto *ranges = meshRanges();
+    for (int i = 0; i < getNumOfMeshes(); i++) {
+        const auto *range = ranges + scene_packing::INTS_PER_MESH_RANGE * i;
+        if (range[0] < 0 || range[1] < 0 || range[0] > getNumOfMeshVertices() - range[1] ||
+                range[2] < 0 || range[3] < 0 || range[2] > getNumOfMeshTriangles() - range[3]) {
+            throw std::runtime_error("Bad mesh range in scene file: " + std::to_string(i));
+        }
+    }
+    scene.meshes = scene_packing::unpackMeshes(meshVertices(), meshTriangles(), ranges, getNumOfMeshes());
+    return scene;
+}
+
+BVH MappedScene::toBVH() const {
+    BVH bvh;
+    bvh.unpack(bvhNodes(), getNumOfBvhNodes(), bvhIndices(), getNumOfBvhIndices());
+    validateBVH(bvh, getNumOfSpheres(), "sphere");
+    checkSphereMaterials();
+    return bvh;
+}
+
+MeshBVH MappedScene::toMeshBVH() const {
+    checkMeshTriangles();
+    BVH bvh;
+    bvh.unpack(meshBvhNodes(), getNumOfMeshBvhNodes(), meshBvhIndices(), getNumOfMeshBvhIndices());
+    validateBVH(bvh, getNumOfMeshTriangles(), "triangle");
+
+    const auto *triangles = meshTriangles();
+    MeshBVH mesh_bvh;
+    mesh_bvh.assign(std::vector<QVector4D>(meshVertices(), meshVertices() + getNumOfMeshVertices()),
+                    std::vector<int>(triangles, triangles + getNumOfMeshTriangles() * scene_packing::INTS_PER_TRIANGLE),
+                    std::move(bvh));
+    return mesh_bvh;
+}
+
+void MappedScene::validate() const {
+    toBVH();
+    toMeshBVH();
+}
+
+void MappedScene::checkSphereMaterials() const {
+    const auto *materials = sphereMaterials();
+    for (int i = 0; i < getNumOfSpheres(); i++) {
+        if (materials[i] < 0 || materials[i] >= getNumOfMaterials()) {
+            throw std::runtime_error("Bad material index in scene file: " + std::to_string(materials[i]));
+        }
+    }
+}
+
+void MappedScene::checkMeshTriangles() const {
+    const auto *triangles = meshTriangles();
+    for (int t = 0; t < getNumOfMeshTriangles(); t++) {
+        const auto *triangle = triangles + scene_packing::INTS_PER_TRIANGLE * t;
+        bool valid = (triangle[3] >= 0 && triangle[3] < getNumOfMaterials());
+        for (int v = 0; v < 3; v++) {
+            valid = valid && triangle[v] >= 0 && triangle[v] < getNumOfMeshVertices();
+        }
+        if (!valid) {
+            throw std::runtime_error("Bad mesh triangle in scene file: " + std::to_string(t));
+        }
+    }
+}
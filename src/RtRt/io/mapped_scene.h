@@ -0,0 +1,124 @@
+#pragma once
+
+#include "objects/scene.h"
+#include "accel/bvh.h"
+#include "accel/mesh_bvh.h"
+
+#include <QFile>
+#include <QString>
+#include <QVector4D>
+
+#include <cstdint>
+
+/**
+ * Binary scene file (.rtscene): a header followed by arrays in the layout of the GPU buffers
+ * (see scene_packing) and the packed BVHs of spheres and triangles (see BVH::packNodes), each aligned to 16 bytes.
+ * Numbers are stored in the native (little-endian) byte order.
+ */
+struct SceneFileHeader {
+    enum Section {
+        S_SPHERES = 0,
+        S_SPHERE_MATERIALS,
+        S_LIGHTS,
+        S_MATERIALS,
+        S_BVH_NODES,
+        S_BVH_INDICES,
+        S_MESH_VERTICES,
+        S_MESH_TRIANGLES,
+        S_MESH_RANGES,
+        S_MESH_BVH_NODES,
+        S_MESH_BVH_INDICES,
+        S_NUM_OF_SECTIONS
+    };
+
+    static const char MAGIC[8];
+    static const std::uint32_t VERSION = 2;
+    static const std::uint32_t BYTE_ORDER_MARK = 0x01020304u;
+    static const int ALIGNMENT = 16;
+
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint32_t num_of_spheres;
+    std::uint32_t num_of_lights;
+    std::uint32_t num_of_materials;
+    std::uint32_t num_of_bvh_nodes;
+    std::uint32_t num_of_bvh_indices;
+    std::uint32_t num_of_meshes;
+    std::uint32_t num_of_mesh_vertices;
+    std::uint32_t num_of_mesh_triangles;
+    std::uint32_t num_of_mesh_bvh_nodes;
+    std::uint32_t num_of_mesh_bvh_indices;
+    std::uint32_t reserved;
+    std::uint64_t offsets[S_NUM_OF_SECTIONS]; // from the start of the file
+};
+
+/**
+ * Binary scene file mapped into memory: arrays are used in place, without parsing,
+ * so they can be uploaded to the GPU directly (see GLSceneBuffers::upload).
+ * The pointers are valid while the object exists.
+ */
+class MappedScene {
+public:
+    // Maps the file and checks the header and the section bounds (not the contents).
+    // Throws std::runtime_error if the file can't be mapped or is not a scene file.
+    explicit MappedScene(const QString &filename);
+    ~MappedScene();
+
+    MappedScene(const MappedScene&) = delete;
+    MappedScene& operator=(const MappedScene&) = delete;
+
+    // Writes the scene with BVHs built over its spheres and triangles.
+    // Throws std::runtime_error if the file can't be written.
+    static void save(const Scene &scene, const QString &filename);
+
+    int getNumOfSpheres() const;
+    int getNumOfLights() const;
+    int getNumOfMaterials() const;
+    int getNumOfBvhNodes() const;
+    int getNumOfBvhIndices() const;
+    int getNumOfMeshes() const;
+    int getNumOfMeshVertices() const;
+    int getNumOfMeshTriangles() const;
+    int getNumOfMeshBvhNodes() const;
+    int getNumOfMeshBvhIndices() const;
+
+    const QVector4D* sphereData() const;
+    const int* sphereMaterials() const;
+    const QVector4D* lightData() const;
+    const QVector4D* materialData() const;
+    const QVector4D* bvhNodes() const;
+    const int* bvhIndices() const;
+    const QVector4D* meshVertices() const;
+    const int* meshTriangles() const;
+    const int* meshRanges() const;
+    const QVector4D* meshBvhNodes() const;
+    const int* meshBvhIndices() const;
+
+    // Copies for the code which needs scene objects (the CPU tracer, editing).
+    // Throw std::runtime_error if the contents are inconsistent (e.g. a bad material index).
+    Scene toScene() const;
+    BVH toBVH() const;
+    MeshBVH toMeshBVH() const;
+
+    // Checks the contents which are uploaded as is (indices of materials, vertices and BVH nodes), as toBVH
+    // and toMeshBVH do; call it before the upload if they are not needed.
+    // Throws std::runtime_error if they are inconsistent.
+    void validate() const;
+
+private:
+    // Throws std::runtime_error if a sphere refers to a missing material.
+    void checkSphereMaterials() const;
+    // Throws std::runtime_error if a triangle refers to a missing vertex or material.
+    void checkMeshTriangles() const;
+
+    template <typename T>
+    const T* section(SceneFileHeader::Section s) const {
+        return reinterpret_cast<const T*>(data + header->offsets[s]);
+    }
+
+private:
+    QFile file;
+    const uchar *data = nullptr;
+    const SceneFileHeader *header = nullptr;
+};
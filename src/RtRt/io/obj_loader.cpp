@@ -0,0 +1,102 @@
+#include "obj_loader.h"
+
+#include <QByteArray>
+#include <QFile>
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace obj_loader {
+
+namespace {
+
+bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Next token of the line, empty at the end of the line (no copy: the token refers to the line).
+QByteArray nextToken(const char *&p, const char *end) {
+    while (p < end && isSpace(*p)) {
+        p++;
+    }
+    const char *start = p;
+    while (p < end && !isSpace(*p)) {
+        p++;
+    }
+    return QByteArray::fromRawData(start, int(p - start));
+}
+
+std::runtime_error parseError(const QString &filename, int line, const std::string &message) {
+    return std::runtime_error(filename.toStdString() + ":" + std::to_string(line) + ": " + message);
+}
+
+}
+
+TriangleMesh load(const QString &filename, int material_id) {
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        throw std::runtime_error("Failed to open " + filename.toStdString());
+    }
+    const auto data = file.readAll();
+
+    TriangleMesh mesh;
+    mesh.materialId = material_id;
+    mesh.sourceFile = filename;
+
+    std::vector<int> face;
+    const char *p = data.constData();
+    const char *const end = p + data.size();
+    int line = 0;
+    while (p < end) {
+        const char *line_end = static_cast<const char*>(std::memchr(p, '\n', size_t(end - p)));
+        if (!line_end) {
+            line_end = end;
+        }
+        line++;
+
+        const auto keyword = nextToken(p, line_end);
+        if (keyword == "v") {
+            float coords[3];
+            for (auto &coord: coords) {
+                bool ok = false;
+                coord = nextToken(p, line_end).toFloat(&ok);
+                if (!ok) {
+                    throw parseError(filename, line, "bad vertex");
+                }
+            }
+            mesh.vertices.push_back(QVector3D(coords[0], coords[1], coords[2]));
+        } else if (keyword == "f") {
+            face.clear();
+            for (auto token = nextToken(p, line_end); !token.isEmpty(); token = nextToken(p, line_end)) {
+                // Vertex is 'v', 'v/vt', 'v//vn' or 'v/vt/vn'; negative indices count from the last vertex.
+                const auto slash = token.indexOf('/');
+                bool ok = false;
+                const auto index = (slash < 0 ? token : token.left(slash)).toInt(&ok);
+                if (!ok || index == 0) {
+                    throw parseError(filename, line, "bad face vertex");
+                }
+                face.push_back(index > 0 ? index - 1 : static_cast<int>(mesh.vertices.size()) + index);
+            }
+            if (face.size() < 3) {
+                throw parseError(filename, line, "face has less than 3 vertices");
+            }
+            for (size_t i = 1; i + 1 < face.size(); i++) {
+                mesh.indices.push_back(face[0]);
+                mesh.indices.push_back(face[i]);
+                mesh.indices.push_back(face[i + 1]);
+            }
+        }
+        p = line_end + 1;
+    }
+
+    const auto num_of_vertices = static_cast<int>(mesh.vertices.size());
+    for (const auto index: mesh.indices) {
+        if (index < 0 || index >= num_of_vertices) {
+            throw std::runtime_error("Bad vertex index in " + filename.toStdString() + ": " + std::to_string(index + 1));
+        }
+    }
+    return mesh;
+}
+
+}
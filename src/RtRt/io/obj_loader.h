@@ -0,0 +1,17 @@
+#pragma once
+
+#include "objects/triangle_mesh.h"
+
+#include <QString>
+
+/**
+ * Wavefront OBJ loader: vertex positions ('v') and faces ('f', polygons are split into triangle fans).
+ * Texture coordinates, normals, groups and material libraries are ignored:
+ * the whole mesh gets one material of the scene.
+ */
+namespace obj_loader {
+
+// Throws std::runtime_error if the file can't be read or has a bad format.
+TriangleMesh load(const QString &filename, int material_id);
+
+}
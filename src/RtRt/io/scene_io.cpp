@@ -0,0 +1,202 @@
+#include "scene_io.h"
+#include "mapped_scene.h"
+#include "obj_loader.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+
+#include <stdexcept>
+#include <string>
+
+namespace scene_io {
+
+namespace {
+
+QJsonArray toJson(const QVector3D &vec) {
+    return QJsonArray {vec.x(), vec.y(), vec.z()};
+}
+
+QVector3D vectorFromJson(const QJsonValue &value, const char *name) {
+    const auto array = value.toArray();
+    if (array.size() != 3 || !array[0].isDouble() || !array[1].isDouble() || !array[2].isDouble()) {
+        throw std::runtime_error(std::string("Bad scene file: '") + name + "' must be an array of 3 numbers");
+    }
+    return QVector3D(float(array[0].toDouble()), float(array[1].toDouble()), float(array[2].toDouble()));
+}
+
+double numberFromJson(const QJsonObject &object, const char *name, double default_value) {
+    const auto value = object.value(name);
+    if (value.isUndefined()) {
+        return default_value;
+    }
+    if (!value.isDouble()) {
+        throw std::runtime_error(std::string("Bad scene file: '") + name + "' must be a number");
+    }
+    return value.toDouble();
+}
+
+// Mesh from an OBJ file (relative to the scene file) or with inline vertices and indices.
+TriangleMesh meshFromJson(const QJsonObject &object, const QDir &scene_dir, int material) {
+    if (object.contains("file")) {
+        return obj_loader::load(scene_dir.absoluteFilePath(object.value("file").toString()), material);
+    }
+    TriangleMesh mesh;
+    mesh.materialId = material;
+    for (const auto &vertex: object.value("vertices").toArray()) {
+        mesh.vertices.push_back(vectorFromJson(vertex, "vertices"));
+    }
+    const auto indices = object.value("indices").toArray();
+    if (indices.size() % 3 != 0) {
+        throw std::runtime_error("Bad scene file: number of mesh 'indices' must be a multiple of 3");
+    }
+    for (const auto &index: indices) {
+        const auto value = index.toInt(-1);
+        if (value < 0 || value >= int(mesh.vertices.size())) {
+            throw std::runtime_error("Bad scene file: mesh vertex index " + std::to_string(value) + " is out of range");
+        }
+        mesh.indices.push_back(value);
+    }
+    return mesh;
+}
+
+}
+
+Scene loadJson(const QString &filename) {
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        throw std::runtime_error("Failed to open " + filename.toStdString());
+    }
+    QJsonParseError error;
+    const auto doc = QJsonDocument::fromJson(file.readAll(), &error);
+    if (doc.isNull()) {
+        throw std::runtime_error("Bad scene file " + filename.toStdString() + ": " + error.errorString().toStdString());
+    }
+    const auto root = doc.object();
+
+    Scene scene;
+    for (const auto &value: root.value("materials").toArray()) {
+        const auto object = value.toObject();
+        const Material defaults;
+        Material material {object.contains("diffuse") ? vectorFromJson(object.value("diffuse"), "diffuse") : defaults.diffuse,
+                           object.contains("specular") ? vectorFromJson(object.value("specular"), "specular") : defaults.specular,
+                           float(numberFromJson(object, "shininess", defaults.shininess))};
+        material.makeTransparent(float(numberFromJson(object, "refraction_coeff", defaults.refractionCoeff)),
+                                 float(numberFromJson(object, "refraction_index", defaults.refractionIndex)));
+        scene.addMaterial(material);
+    }
+    for (const auto &value: root.value("spheres").toArray()) {
+        const auto object = value.toObject();
+        const auto material = int(numberFromJson(object, "material", -1));
+        if (material < 0 || material >= int(scene.materials.size())) {
+            throw std::runtime_error("Bad scene file: sphere material index " + std::to_string(material) +
+                                     " is out of range");
+        }
+        scene.addObject(Sphere {vectorFromJson(object.value("position"), "position"),
+                                numberFromJson(object, "radius", 1.0), material});
+    }
+    const auto scene_dir = QFileInfo(filename).absoluteDir();
+    for (const auto &value: root.value("meshes").toArray()) {
+        const auto object = value.toObject();
+        const auto material = int(numberFromJson(object, "material", -1));
+        if (material < 0 || material >= int(scene.materials.size())) {
+            throw std::runtime_error("Bad scene file: mesh material index " + std::to_string(material) +
+                                     " is out of range");
+        }
+        scene.addMesh(meshFromJson(object, scene_dir, material));
+    }
+    for (const auto &value: root.value("lights").toArray()) {
+        const auto object = value.toObject();
+        scene.addLight(LightSource {vectorFromJson(object.value("position"), "position"),
+                                    object.contains("color") ? vectorFromJson(object.value("color"), "color") :
+                                                               QVector3D(1, 1, 1)});
+    }
+    return scene;
+}
+
+void saveJson(const Scene &scene, const QString &filename) {
+    QJsonArray materials;
+    for (const auto &m: scene.materials) {
+        materials.append(QJsonObject {
+            {"diffuse", toJson(m.diffuse)},
+            {"specular", toJson(m.specular)},
+            {"shininess", m.shininess},
+            {"refraction_coeff", m.refractionCoeff},
+            {"refraction_index", m.refractionIndex}
+        });
+    }
+    QJsonArray spheres;
+    for (const auto &s: scene.objects) {
+        spheres.append(QJsonObject {
+            {"position", toJson(s.position)},
+            {"radius", s.radius},
+            {"material", s.materialId}
+        });
+    }
+    // Meshes loaded from OBJ files are referenced, the rest are stored inline.
+    const auto scene_dir = QFileInfo(filename).absoluteDir();
+    QJsonArray meshes;
+    for (const auto &m: scene.meshes) {
+        QJsonObject mesh {{"material", m.materialId}};
+        if (!m.sourceFile.isEmpty()) {
+            mesh["file"] = scene_dir.relativeFilePath(m.sourceFile);
+        } else {
+            QJsonArray vertices, indices;
+            for (const auto &v: m.vertices) {
+                vertices.append(toJson(v));
+            }
+            for (const auto index: m.indices) {
+                indices.append(index);
+            }
+            mesh["vertices"] = vertices;
+            mesh["indices"] = indices;
+        }
+        meshes.append(mesh);
+    }
+    QJsonArray lights;
+    for (const auto &l: scene.lights) {
+        lights.append(QJsonObject {
+            {"position", toJson(l.position)},
+            {"color", toJson(l.color)}
+        });
+    }
+
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+        throw std::runtime_error("Failed to write " + filename.toStdString());
+    }
+    file.write(QJsonDocument(QJsonObject {
+        {"materials", materials},
+        {"spheres", spheres},
+        {"meshes", meshes},
+        {"lights", lights}
+    }).toJson());
+}
+
+bool isBinary(const QString &filename) {
+    return QFileInfo(filename).suffix().toLower() == "rtscene";
+}
+
+bool isSceneFile(const QString &filename) {
+    return isBinary(filename) || QFileInfo(filename).suffix().toLower() == "json";
+}
+
+Scene load(const QString &filename) {
+    if (isBinary(filename)) {
+        return MappedScene(filename).toScene();
+    }
+    return loadJson(filename);
+}
+
+void save(const Scene &scene, const QString &filename) {
+    if (isBinary(filename)) {
+        MappedScene::save(scene, filename);
+    } else {
+        saveJson(scene, filename);
+    }
+}
+
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "objects/scene.h"
+
+#include <QString>
+
+/**
+ * Scene files: JSON (.json) for editing and interchange, binary (.rtscene, see MappedScene) for fast loading.
+ * JSON format:
+ * {
+ *   "materials": [{"diffuse": [r, g, b], "specular": [r, g, b], "shininess": s,
+ *                  "refraction_coeff": c, "refraction_index": n}, ...],
+ *   "spheres": [{"position": [x, y, z], "radius": r, "material": index}, ...],
+ *   "meshes": [{"file": "mesh.obj", "material": index},
+ *              {"vertices": [[x, y, z], ...], "indices": [i0, i1, i2, ...], "material": index}, ...],
+ *   "lights": [{"position": [x, y, z], "color": [r, g, b]}, ...]
+ * }
+ * Missing material fields take the defaults of Material.
+ * OBJ files of meshes are relative to the scene file (see obj_loader); other meshes are stored inline.
+ */
+namespace scene_io {
+
+// Functions throw std::runtime_error if the file can't be read or written or has a bad format.
+Scene loadJson(const QString &filename);
+void saveJson(const Scene &scene, const QString &filename);
+
+// The format is chosen by the file extension.
+bool isBinary(const QString &filename);
+bool isSceneFile(const QString &filename);
+Scene load(const QString &filename);
+void save(const Scene &scene, const QString &filename);
+
+}
@@ -0,0 +1,64 @@
+#include "tiled_image_writer.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+TiledImageWriter::TiledImageWriter() {
+}
+
+TiledImageWriter::~TiledImageWriter() {
+    close();
+}
+
+void TiledImageWriter::open(const QString &filename, const QSize &size) {
+    close();
+
+    file.setFileName(filename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        throw std::runtime_error("Failed to write " + filename.toStdString());
+    }
+    const auto header = QString("P6\n%1 %2\n255\n").arg(size.width()).arg(size.height()).toLatin1();
+    const auto file_size = header.size() + qint64(size.width()) * size.height() * 3;
+    // The pixels are not written here: where the file system allows, they take no space until their tile comes.
+    if (file.write(header) != header.size() || !file.resize(file_size)) {
+        file.close();
+        throw std::runtime_error("Failed to write " + filename.toStdString());
+    }
+    this->size = size;
+    header_size = header.size();
+}
+
+void TiledImageWriter::close() {
+    if (file.isOpen()) {
+        file.close();
+    }
+}
+
+QSize TiledImageWriter::getSize() const {
+    return size;
+}
+
+void TiledImageWriter::writeTile(const QRect &tile, const unsigned char *rgb) {
+    if (!QRect(QPoint(0, 0), size).contains(tile)) {
+        throw std::runtime_error("Tile is outside of the image");
+    }
+    const auto row_size = qint64(tile.width()) * 3;
+    for (int y = 0; y < tile.height(); y++) {
+        const auto offset = header_size + (qint64(tile.y() + y) * size.width() + tile.x()) * 3;
+        const auto *row = reinterpret_cast<const char*>(rgb + y * row_size);
+        if (!file.seek(offset) || file.write(row, row_size) != row_size) {
+            throw std::runtime_error("Failed to write " + file.fileName().toStdString());
+        }
+    }
+}
+
+std::vector<QRect> TiledImageWriter::splitIntoTiles(const QSize &size, const QSize &tile_size) {
+    std::vector<QRect> tiles;
+    for (int y = 0; y < size.height(); y += tile_size.height()) {
+        for (int x = 0; x < size.width(); x += tile_size.width()) {
+            tiles.emplace_back(x, y, std::min(tile_size.width(), size.width() - x),
+                               std::min(tile_size.height(), size.height() - y));
+        }
+    }
+    return tiles;
+}
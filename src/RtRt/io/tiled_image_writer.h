@@ -0,0 +1,40 @@
+#pragma once
+
+#include <QFile>
+#include <QRect>
+#include <QSize>
+#include <QString>
+
+#include <vector>
+
+/**
+ * Binary PPM image written tile by tile: the file gets its full size on open and each tile goes
+ * straight to its rows, so only one tile has to be in memory however large the image is.
+ * Tiles may come in any order (e.g. as workers finish them).
+ */
+class TiledImageWriter {
+public:
+    TiledImageWriter();
+    ~TiledImageWriter();
+
+    TiledImageWriter(const TiledImageWriter&) = delete;
+    TiledImageWriter& operator=(const TiledImageWriter&) = delete;
+
+    // Throws std::runtime_error if the file can't be created.
+    void open(const QString &filename, const QSize &size);
+    void close();
+
+    QSize getSize() const;
+
+    // The tile is in image pixels from the top left corner and must lie inside the image;
+    // its RGB rows go from the top one down. Throws std::runtime_error if the file can't be written.
+    void writeTile(const QRect &tile, const unsigned char *rgb);
+
+    // Tiles of the size covering the image, in rows from the top left one; the last ones in a row or a column are cut.
+    static std::vector<QRect> splitIntoTiles(const QSize &size, const QSize &tile_size);
+
+private:
+    QFile file;
+    QSize size;
+    qint64 header_size = 0;
+};
@@ -9,18 +9,49 @@
 #include <QSettings>
 #include <QSlider>
 #include <QLineEdit>
+#include <QStandardItemModel>
 #include <QSettings>
+#include <QFileInfo>
+#include <QDir>
+#include <QSignalBlocker>
 
+#include "profiling/timing_export.h"
+
+#include <algorithm>
 #include <cmath>
+#include <exception>
 
 namespace {
 
     static const QString MAX_DEPTH = "max-depth";
     static const QString NUM_OF_SAMPLES = "num-of-samples";
     static const QString SAMPLING_MODE = "sampling-mode";
+    static const QString NUM_OF_LIGHT_SAMPLES = "num-of-light-samples";
     static const QString BG_COLOR = "background-color";
     static const QString ENABLE_TRASNSPARENCY = "enable-transparency";
     static const QString SHOW_TOOLBAR = "show-toolbar";
+    static const QString RENDER_BACKEND = "render-backend";
+    static const QString PROGRESSIVE_RENDERING = "progressive-rendering";
+    static const QString TEMPORAL_REPROJECTION = "temporal-reprojection";
+    static const QString ADAPTIVE_SAMPLING = "adaptive-sampling";
+    static const QString HYBRID_VISIBILITY = "hybrid-visibility";
+    static const QString ANIMATE_SPHERES = "animate-spheres";
+    static const QString DENOISE = "denoise";
+    static const QString DENOISE_ITERATIONS = "denoise-iterations";
+    static const QString DENOISE_COLOR_SIGMA = "denoise-color-sigma";
+    static const QString SHOW_FRAME_TIMINGS = "show-frame-timings";
+    static const QString FRAME_TIME_GOVERNOR = "frame-time-governor";
+    static const QString GOVERNOR_TARGET_MS = "governor-target-ms";
+    static const QString SCENE_DIR = "scene-dir";
+
+    static const QString SCENE_FILTER = "Scene (*.json *.rtscene);;JSON (*.json);;Binary scene (*.rtscene)";
+
+    static const QString MESH_FILTER = "Wavefront OBJ (*.obj)";
+
+    static const QString CAPTURE_FILTER = "Y4M video (*.y4m);;PPM sequence (*.ppm);;Raw RGB24 frames (*.raw)";
+
+    // Oldest frames are dropped from the history kept for export.
+    static const size_t MAX_TIMING_HISTORY = 100000;
 
     static QSettings appSettings;
 }
@@ -33,6 +64,7 @@ MainWindow::MainWindow(QWidget *parent) :
 
     gl_widget = ui->openGLWidget;
     connect(gl_widget, &MyOpenGLWidget::initialized, this, &MainWindow::initGlWidget);
+    connect(gl_widget, &MyOpenGLWidget::governorChanged, this, &MainWindow::updateGovernorStatus);
 
     initMenu();
     initStatusbar();
@@ -43,6 +75,8 @@ MainWindow::MainWindow(QWidget *parent) :
 }
 
 MainWindow::~MainWindow() {
+    // Frames in flight are written before the context goes away.
+    gl_widget->stopCapture();
     delete ui;
 }
 
@@ -51,7 +85,23 @@ void MainWindow::initMenu() {
 }
 
 void MainWindow::initStatusbar() {
+    frame_timings = new QLabel(this);
+    ui->statusBar->addWidget(frame_timings);
+    governor_status = new QLabel(this);
+    ui->statusBar->addPermanentWidget(governor_status);
+    governor_status->setVisible(false);
+    capture_status = new QLabel(this);
+    ui->statusBar->addPermanentWidget(capture_status);
+    capture_status->setVisible(false);
     ui->statusBar->setVisible(false);
+
+    frame_timings_timer = new QTimer(this);
+    frame_timings_timer->setInterval(500);
+    connect(frame_timings_timer, &QTimer::timeout, this, &MainWindow::updateFrameTimings);
+
+    capture_status_timer = new QTimer(this);
+    capture_status_timer->setInterval(500);
+    connect(capture_status_timer, &QTimer::timeout, this, &MainWindow::updateCaptureStatus);
 }
 
 void MainWindow::initToolbar() {
@@ -77,25 +127,100 @@ void MainWindow::initToolbar() {
         appSettings.setValue(NUM_OF_SAMPLES, value);
     });
 
+    light_samples = new QSpinBox(this);
+    light_samples->setMinimum(0);
+    light_samples->setMaximum(256);
+    light_samples->setSpecialValueText("All");
+    light_samples->setToolTip("Shadow rays per hit: lights are sampled when there are more of them");
+    light_samples->setValue(gl_widget->getNumOfLightSamples());
+    connect(light_samples, qOverload<int>(&QSpinBox::valueChanged), [this](int value) {
+        gl_widget->setNumOfLightSamples(value);
+        gl_widget->update();
+        appSettings.setValue(NUM_OF_LIGHT_SAMPLES, value);
+    });
+
     sampling_mode = new QComboBox(this);
-    sampling_mode->addItem("Random", MyOpenGLWidget::SamplingMode::SM_RANDOM);
-    sampling_mode->addItem("Multi Jittered", MyOpenGLWidget::SamplingMode::SM_MULTIJITTERED);
+    sampling_mode->addItem("Random", SM_RANDOM);
+    sampling_mode->addItem("Multi Jittered", SM_MULTIJITTERED);
     sampling_mode->setCurrentIndex((int)gl_widget->getSamplingMode());
     connect(sampling_mode, qOverload<int>(&QComboBox::currentIndexChanged), [this](int index) {
-        gl_widget->setSamplingMode(static_cast<MyOpenGLWidget::SamplingMode>(index));
+        gl_widget->setSamplingMode(static_cast<SamplingMode>(index));
         gl_widget->update();
         appSettings.setValue(SAMPLING_MODE, index);
     });
 
+    render_backend = new QComboBox(this);
+    render_backend->addItem("GPU", RB_GPU);
+    render_backend->addItem("CPU", RB_CPU);
+    render_backend->addItem("GPU Wavefront", RB_WAVEFRONT);
+    render_backend->setCurrentIndex((int)gl_widget->getRenderBackend());
+    connect(render_backend, qOverload<int>(&QComboBox::currentIndexChanged), [this](int index) {
+        gl_widget->setRenderBackend(static_cast<RenderBackend>(index));
+        gl_widget->update();
+        appSettings.setValue(RENDER_BACKEND, index);
+    });
+
+    governor_target = new QSpinBox(this);
+    governor_target->setMinimum(1);
+    governor_target->setMaximum(1000);
+    governor_target->setSuffix(" ms");
+    governor_target->setToolTip("Target frame time of the governor");
+    governor_target->setValue(static_cast<int>(gl_widget->getGovernorTarget()));
+    connect(governor_target, qOverload<int>(&QSpinBox::valueChanged), [this](int value) {
+        gl_widget->setGovernorTarget(value);
+        appSettings.setValue(GOVERNOR_TARGET_MS, value);
+    });
+
+    denoise_iterations = new QSpinBox(this);
+    denoise_iterations->setMinimum(1);
+    denoise_iterations->setMaximum(8);
+    denoise_iterations->setToolTip("Denoiser iterations: each one doubles the filter radius");
+    denoise_iterations->setValue(gl_widget->getDenoiseIterations());
+    connect(denoise_iterations, qOverload<int>(&QSpinBox::valueChanged), [this](int value) {
+        gl_widget->setDenoiseIterations(value);
+        gl_widget->update();
+        appSettings.setValue(DENOISE_ITERATIONS, value);
+    });
+
+    denoise_strength = new QDoubleSpinBox(this);
+    denoise_strength->setMinimum(0.01);
+    denoise_strength->setMaximum(2.0);
+    denoise_strength->setSingleStep(0.05);
+    denoise_strength->setToolTip("Color difference the denoiser smooths over: larger values blur more");
+    denoise_strength->setValue(gl_widget->getDenoiseColorSigma());
+    connect(denoise_strength, qOverload<double>(&QDoubleSpinBox::valueChanged), [this](double value) {
+        gl_widget->setDenoiseColorSigma(static_cast<float>(value));
+        gl_widget->update();
+        appSettings.setValue(DENOISE_COLOR_SIGMA, value);
+    });
+
     ui->mainToolBar->addWidget(new QLabel("Max depth: ", this));
     ui->mainToolBar->addWidget(steps);
     ui->mainToolBar->addWidget(new QLabel("Samples: ", this));
     ui->mainToolBar->addWidget(samples);
+    ui->mainToolBar->addWidget(new QLabel("Light samples: ", this));
+    ui->mainToolBar->addWidget(light_samples);
     ui->mainToolBar->addWidget(new QLabel("Sampling: ", this));
     ui->mainToolBar->addWidget(sampling_mode);
+    ui->mainToolBar->addWidget(new QLabel("Backend: ", this));
+    ui->mainToolBar->addWidget(render_backend);
+    ui->mainToolBar->addWidget(new QLabel("Target: ", this));
+    ui->mainToolBar->addWidget(governor_target);
+    ui->mainToolBar->addWidget(new QLabel("Denoise: ", this));
+    ui->mainToolBar->addWidget(denoise_iterations);
+    ui->mainToolBar->addWidget(denoise_strength);
 }
 
 void MainWindow::initGlWidget() {
+    if (!gl_widget->wavefrontSupported()) {
+        auto *model = qobject_cast<QStandardItemModel*>(render_backend->model());
+        model->item(RB_WAVEFRONT)->setEnabled(false);
+        render_backend->setItemData(RB_WAVEFRONT, "Needs OpenGL 4.3", Qt::ToolTipRole);
+    }
+    if (!gl_widget->animationSupported()) {
+        ui->actionAnimate_Spheres->setEnabled(false);
+        ui->actionAnimate_Spheres->setToolTip("Needs OpenGL 4.3");
+    }
     initSettings();
 }
 
@@ -106,15 +231,54 @@ void MainWindow::initSettings() {
     if (appSettings.contains(ENABLE_TRASNSPARENCY)) {
         ui->actionEnable_Transparency->setChecked(appSettings.value(ENABLE_TRASNSPARENCY).toBool());
     }
+    if (appSettings.contains(PROGRESSIVE_RENDERING)) {
+        ui->actionProgressive_Rendering->setChecked(appSettings.value(PROGRESSIVE_RENDERING).toBool());
+    }
+    if (appSettings.contains(TEMPORAL_REPROJECTION)) {
+        ui->actionTemporal_Reprojection->setChecked(appSettings.value(TEMPORAL_REPROJECTION).toBool());
+    }
+    if (appSettings.contains(ADAPTIVE_SAMPLING)) {
+        ui->actionAdaptive_Sampling->setChecked(appSettings.value(ADAPTIVE_SAMPLING).toBool());
+    }
+    if (appSettings.contains(HYBRID_VISIBILITY)) {
+        ui->actionHybrid_Visibility->setChecked(appSettings.value(HYBRID_VISIBILITY).toBool());
+    }
+    if (appSettings.contains(ANIMATE_SPHERES) && ui->actionAnimate_Spheres->isEnabled()) {
+        ui->actionAnimate_Spheres->setChecked(appSettings.value(ANIMATE_SPHERES).toBool());
+    }
+    if (appSettings.contains(DENOISE)) {
+        ui->actionDenoise->setChecked(appSettings.value(DENOISE).toBool());
+    }
+    if (appSettings.contains(DENOISE_ITERATIONS)) {
+        denoise_iterations->setValue(appSettings.value(DENOISE_ITERATIONS).toInt());
+    }
+    if (appSettings.contains(DENOISE_COLOR_SIGMA)) {
+        denoise_strength->setValue(appSettings.value(DENOISE_COLOR_SIGMA).toDouble());
+    }
+    if (appSettings.contains(SHOW_FRAME_TIMINGS)) {
+        ui->actionShow_Frame_Timings->setChecked(appSettings.value(SHOW_FRAME_TIMINGS).toBool());
+    }
+    if (appSettings.contains(GOVERNOR_TARGET_MS)) {
+        governor_target->setValue(appSettings.value(GOVERNOR_TARGET_MS).toInt());
+    }
+    if (appSettings.contains(FRAME_TIME_GOVERNOR)) {
+        ui->actionFrame_Time_Governor->setChecked(appSettings.value(FRAME_TIME_GOVERNOR).toBool());
+    }
     if (appSettings.contains(MAX_DEPTH)) {
         steps->setValue(appSettings.value(MAX_DEPTH).toInt());
     }
     if (appSettings.contains(NUM_OF_SAMPLES)) {
         samples->setValue(appSettings.value(NUM_OF_SAMPLES).toInt());
     }
+    if (appSettings.contains(NUM_OF_LIGHT_SAMPLES)) {
+        light_samples->setValue(appSettings.value(NUM_OF_LIGHT_SAMPLES).toInt());
+    }
     if (appSettings.contains(SAMPLING_MODE)) {
         sampling_mode->setCurrentIndex(appSettings.value(SAMPLING_MODE).toInt());
     }
+    if (appSettings.contains(RENDER_BACKEND)) {
+        render_backend->setCurrentIndex(appSettings.value(RENDER_BACKEND).toInt());
+    }
     if (appSettings.contains(BG_COLOR)) {
         gl_widget->setBackgroundColor(appSettings.value(BG_COLOR).value<QColor>());
         gl_widget->update();
@@ -140,9 +304,58 @@ void MainWindow::showError(QString message) {
     QMessageBox::critical(this, "Error", message);
 }
 
+void MainWindow::on_actionOpen_Scene_triggered() {
+    const auto filename = QFileDialog::getOpenFileName(this, "Open Scene", appSettings.value(SCENE_DIR).toString(),
+                                                       SCENE_FILTER);
+    if (filename.isEmpty()) {
+        return;
+    }
+    appSettings.setValue(SCENE_DIR, QFileInfo(filename).absolutePath());
+    try {
+        gl_widget->loadScene(filename);
+        gl_widget->update();
+        setWindowTitle(QString("%1 - %2").arg(default_title).arg(QFileInfo(filename).fileName()));
+    }
+    catch (const std::exception &e) {
+        showError(e.what());
+    }
+}
+
+void MainWindow::on_actionSave_Scene_triggered() {
+    const auto dir = QDir(appSettings.value(SCENE_DIR).toString());
+    const auto filename = QFileDialog::getSaveFileName(this, "Save Scene", dir.filePath("scene.json"), SCENE_FILTER);
+    if (filename.isEmpty()) {
+        return;
+    }
+    appSettings.setValue(SCENE_DIR, QFileInfo(filename).absolutePath());
+    try {
+        gl_widget->saveScene(filename);
+    }
+    catch (const std::exception &e) {
+        showError(e.what());
+    }
+}
+
+void MainWindow::on_actionImport_Mesh_triggered() {
+    const auto filename = QFileDialog::getOpenFileName(this, "Import Mesh", appSettings.value(SCENE_DIR).toString(),
+                                                       MESH_FILTER);
+    if (filename.isEmpty()) {
+        return;
+    }
+    appSettings.setValue(SCENE_DIR, QFileInfo(filename).absolutePath());
+    try {
+        gl_widget->importMesh(filename);
+        gl_widget->update();
+    }
+    catch (const std::exception &e) {
+        showError(e.what());
+    }
+}
+
 void MainWindow::on_actionRandom_Scene_triggered() {
     gl_widget->randomScene();
     gl_widget->update();
+    setWindowTitle(default_title);
 }
 
 void MainWindow::on_actionBackground_Color_triggered() {
@@ -159,11 +372,17 @@ void MainWindow::on_actionBackground_Color_triggered() {
 void MainWindow::on_actionClear_Scene_triggered() {
     gl_widget->clearScene();
     gl_widget->update();
+    setWindowTitle(default_title);
 }
 
 void MainWindow::on_actionAdd_Random_Object_triggered() {
-    gl_widget->addRandomObject();
-    gl_widget->update();
+    try {
+        gl_widget->addRandomObject();
+        gl_widget->update();
+    }
+    catch (const std::exception &e) {
+        showError(e.what());
+    }
 }
 
 void MainWindow::on_actionShow_Toolbar_toggled(bool show) {
@@ -176,3 +395,210 @@ void MainWindow::on_actionEnable_Transparency_toggled(bool enabled) {
     gl_widget->update();
     appSettings.setValue(ENABLE_TRASNSPARENCY, enabled);
 }
+
+void MainWindow::on_actionProgressive_Rendering_toggled(bool enabled) {
+    gl_widget->enableProgressive(enabled);
+    gl_widget->update();
+    appSettings.setValue(PROGRESSIVE_RENDERING, enabled);
+}
+
+void MainWindow::on_actionTemporal_Reprojection_toggled(bool enabled) {
+    gl_widget->enableTemporal(enabled);
+    gl_widget->update();
+    appSettings.setValue(TEMPORAL_REPROJECTION, enabled);
+}
+
+void MainWindow::on_actionAdaptive_Sampling_toggled(bool enabled) {
+    gl_widget->enableAdaptiveSampling(enabled);
+    gl_widget->update();
+    appSettings.setValue(ADAPTIVE_SAMPLING, enabled);
+}
+
+void MainWindow::on_actionHybrid_Visibility_toggled(bool enabled) {
+    gl_widget->enableHybrid(enabled);
+    gl_widget->update();
+    appSettings.setValue(HYBRID_VISIBILITY, enabled);
+}
+
+void MainWindow::on_actionAnimate_Spheres_toggled(bool enabled) {
+    gl_widget->enableAnimation(enabled);
+    gl_widget->update();
+    appSettings.setValue(ANIMATE_SPHERES, enabled);
+}
+
+void MainWindow::on_actionDenoise_toggled(bool enabled) {
+    gl_widget->enableDenoise(enabled);
+    gl_widget->update();
+    appSettings.setValue(DENOISE, enabled);
+}
+
+void MainWindow::updateStatusbarVisibility() {
+    ui->statusBar->setVisible(ui->actionShow_Frame_Timings->isChecked() ||
+                              ui->actionFrame_Time_Governor->isChecked() ||
+                              ui->actionCapture_Frames->isChecked());
+}
+
+void MainWindow::on_actionShow_Frame_Timings_toggled(bool show) {
+    updateStatusbarVisibility();
+    frame_timings->setVisible(show);
+    gl_widget->enableProfiling(show);
+    if (show) {
+        frame_timings->setText("Waiting for frames...");
+        frame_timings_timer->start();
+    } else {
+        frame_timings_timer->stop();
+        updateFrameTimings();
+    }
+    gl_widget->update();
+    appSettings.setValue(SHOW_FRAME_TIMINGS, show);
+}
+
+void MainWindow::updateFrameTimings() {
+    FrameTiming average;
+    int num_of_frames = 0;
+    FrameTiming timing;
+    while (gl_widget->popFrameTiming(timing)) {
+        timing_history.push_back(timing);
+        average.frame_ms += timing.frame_ms;
+        average.swap_ms += timing.swap_ms;
+        for (int stage = 0; stage < FS_NUM_OF_STAGES; stage++) {
+            average.cpu_ms[stage] += timing.cpu_ms[stage];
+            average.gpu_ms[stage] += timing.gpu_ms[stage];
+        }
+        num_of_frames++;
+    }
+    if (timing_history.size() > MAX_TIMING_HISTORY) {
+        timing_history.erase(timing_history.begin(), timing_history.end() - MAX_TIMING_HISTORY);
+    }
+    if (num_of_frames == 0) {
+        return;
+    }
+
+    // GPU times are negative when timer queries are not supported: show CPU times then.
+    const bool has_gpu_times = (average.gpu_ms[FS_TRACE] >= 0.0);
+    const auto &stage_ms = (has_gpu_times ? average.gpu_ms : average.cpu_ms);
+    QString text = QString("Frame: %1 ms, swap: %2 ms | %3:")
+            .arg(average.frame_ms / num_of_frames, 0, 'f', 2)
+            .arg(average.swap_ms / num_of_frames, 0, 'f', 2)
+            .arg(has_gpu_times ? "GPU" : "CPU");
+    for (int stage = 0; stage < FS_NUM_OF_STAGES; stage++) {
+        text += QString(" %1 %2 ms")
+                .arg(frameStageName(static_cast<FrameStage>(stage)))
+                .arg(stage_ms[stage] / num_of_frames, 0, 'f', 2);
+    }
+    frame_timings->setText(text);
+}
+
+void MainWindow::on_actionExport_Frame_Timings_triggered() {
+    updateFrameTimings();
+    if (timing_history.empty()) {
+        showError("No frame timings: enable Settings / Show Frame Timings first.");
+        return;
+    }
+    const auto filename = QFileDialog::getSaveFileName(this, "Export Frame Timings", "frame_timings.csv",
+                                                       "CSV (*.csv);;JSON (*.json)");
+    if (filename.isEmpty()) {
+        return;
+    }
+    try {
+        if (filename.endsWith(".json", Qt::CaseInsensitive)) {
+            timing_export::saveJson(timing_history, filename);
+        } else {
+            timing_export::saveCsv(timing_history, filename);
+        }
+    }
+    catch (const std::exception &e) {
+        showError(e.what());
+    }
+}
+
+void MainWindow::on_actionFrame_Time_Governor_toggled(bool enabled) {
+    gl_widget->enableGovernor(enabled);
+    governor_status->setVisible(enabled);
+    updateStatusbarVisibility();
+    updateGovernorStatus();
+    appSettings.setValue(FRAME_TIME_GOVERNOR, enabled);
+}
+
+void MainWindow::updateGovernorStatus() {
+    if (!gl_widget->governorEnabled()) {
+        governor_status->clear();
+        return;
+    }
+    const auto governor = gl_widget->getGovernor();
+    const auto &state = governor->getState();
+    const auto capped = [](int cap, int requested) {
+        return (cap > 0 ? std::min(cap, requested) : requested);
+    };
+    governor_status->setText(QString("Governor: scale %1%, depth %2, samples %3")
+                             .arg(std::lround(state.render_scale * 100.0f))
+                             .arg(capped(state.max_num_of_steps, gl_widget->getIterationLimit()))
+                             .arg(capped(state.max_num_of_samples, gl_widget->getNumOfSamples())));
+}
+
+void MainWindow::on_actionExport_Governor_Log_triggered() {
+    const auto governor = gl_widget->getGovernor();
+    const auto &decisions = governor->getDecisions();
+    if (decisions.empty()) {
+        showError("No governor decisions: enable Settings / Frame Time Governor first.");
+        return;
+    }
+    const auto filename = QFileDialog::getSaveFileName(this, "Export Governor Log", "governor_log.csv",
+                                                       "CSV (*.csv)");
+    if (filename.isEmpty()) {
+        return;
+    }
+    try {
+        timing_export::saveDecisionsCsv(decisions, filename);
+    }
+    catch (const std::exception &e) {
+        showError(e.what());
+    }
+}
+
+void MainWindow::on_actionCapture_Frames_toggled(bool enabled) {
+    if (!enabled) {
+        // The status of the finished capture stays visible.
+        gl_widget->stopCapture();
+        capture_status_timer->stop();
+        updateCaptureStatus();
+        return;
+    }
+    const auto uncheck = [this]() {
+        QSignalBlocker blocker(ui->actionCapture_Frames);
+        ui->actionCapture_Frames->setChecked(false);
+    };
+    const auto dir = QDir(appSettings.value(SCENE_DIR).toString());
+    const auto filename = QFileDialog::getSaveFileName(this, "Capture Frames", dir.filePath("capture.y4m"),
+                                                       CAPTURE_FILTER);
+    if (filename.isEmpty()) {
+        uncheck();
+        return;
+    }
+    try {
+        gl_widget->startCapture(filename);
+    }
+    catch (const std::exception &e) {
+        uncheck();
+        showError(e.what());
+        return;
+    }
+    capture_status->setText("Capturing...");
+    capture_status->setVisible(true);
+    updateStatusbarVisibility();
+    capture_status_timer->start();
+    gl_widget->update();
+}
+
+void MainWindow::updateCaptureStatus() {
+    const auto stats = gl_widget->getCaptureStats();
+    auto text = QString("%1: %2 frames, %3 dropped, %4 MB/s")
+            .arg(gl_widget->captureActive() ? "Capturing" : "Captured")
+            .arg(stats.frames_written)
+            .arg(stats.frames_dropped)
+            .arg(stats.megabytes_per_second, 0, 'f', 1);
+    if (!stats.error.empty()) {
+        text += QString(" | %1").arg(QString::fromStdString(stats.error));
+    }
+    capture_status->setText(text);
+}
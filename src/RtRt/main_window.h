@@ -6,7 +6,11 @@
 #include <QLabel>
 #include <QSlider>
 #include <QSpinBox>
+#include <QDoubleSpinBox>
 #include <QComboBox>
+#include <QTimer>
+
+#include "profiling/frame_profiler.h"
 
 #include <vector>
 #include <memory>
@@ -34,6 +38,12 @@ private slots:
 
     void on_actionExit_triggered();
 
+    void on_actionOpen_Scene_triggered();
+
+    void on_actionSave_Scene_triggered();
+
+    void on_actionImport_Mesh_triggered();
+
     void on_actionRandom_Scene_triggered();
 
     void on_actionBackground_Color_triggered();
@@ -46,6 +56,34 @@ private slots:
 
     void on_actionEnable_Transparency_toggled(bool enabled);
 
+    void on_actionProgressive_Rendering_toggled(bool enabled);
+
+    void on_actionTemporal_Reprojection_toggled(bool enabled);
+
+    void on_actionAdaptive_Sampling_toggled(bool enabled);
+
+    void on_actionHybrid_Visibility_toggled(bool enabled);
+
+    void on_actionAnimate_Spheres_toggled(bool enabled);
+
+    void on_actionDenoise_toggled(bool enabled);
+
+    void on_actionShow_Frame_Timings_toggled(bool show);
+
+    void on_actionExport_Frame_Timings_triggered();
+
+    void on_actionFrame_Time_Governor_toggled(bool enabled);
+
+    void on_actionExport_Governor_Log_triggered();
+
+    void on_actionCapture_Frames_toggled(bool enabled);
+
+    void updateFrameTimings();
+
+    void updateGovernorStatus();
+
+    void updateCaptureStatus();
+
 private:
     void initMenu();
     void initStatusbar();
@@ -55,6 +93,7 @@ private:
     void resetSettings();
 
     void showError(QString message);
+    void updateStatusbarVisibility();
 
 private:
     Ui::MainWindow *ui;
@@ -63,6 +102,20 @@ private:
 
     QSpinBox *steps;
     QSpinBox *samples;
+    QSpinBox *light_samples;
     QComboBox *sampling_mode;
+    QComboBox *render_backend;
+    QSpinBox *governor_target;
+    QSpinBox *denoise_iterations;
+    QDoubleSpinBox *denoise_strength;
+
+    QLabel *frame_timings;
+    QTimer *frame_timings_timer;
+    std::vector<FrameTiming> timing_history;
+
+    QLabel *governor_status;
+
+    QLabel *capture_status;
+    QTimer *capture_status_timer;
 };
 
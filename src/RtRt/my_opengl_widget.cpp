@@ -1,318 +1,419 @@
 #include "my_opengl_widget.h"
 #include "util.h"
+#include "objects/scenes.h"
+#include "io/scene_io.h"
+#include "io/obj_loader.h"
+#include "gpu/wavefront_tracer.h"
+#include "gpu/scene_animator.h"
 
 #include <QOpenGLContext>
-#include <QOpenGLFunctions>
-#include <QOpenGLShaderProgram>
+#include <QOpenGLFunctions_3_3_Core>
 #include <QMouseEvent>
 #include <QMessageBox>
 
-#include <cmath>
+#include <algorithm>
 #include <exception>
-#include <random>
-
-namespace {
-
-Scene defaultScene() {
-    QVector3D red {1, 0.3, 0.3};
-    QVector3D blue {0.3, 0.3, 1};
-    QVector3D green {0.3, 1, 0.3};
-    QVector3D white {0.8, 0.8, 0.8};
-    QVector3D yellow {1, 1, 0.3};
-    QVector3D purple {1, 0.3, 1};
-
-    Scene scene;
-
-    auto redMat = scene.addMaterial(Material {red * 0.4, red * 0.6, 250});
-    auto blueMat = scene.addMaterial(Material {blue * 0.4, blue * 0.6, 50});
-    auto greenMat = scene.addMaterial(Material {green * 0.8, green * 0.2, 10});
-    auto whiteMat = scene.addMaterial(Material {white * 0.9, white * 0.1, 50});
-    auto yellowMat = scene.addMaterial(Material {yellow * 0.1,yellow * 0.9, 500});
-    auto purpleMat = scene.addMaterial(Material {purple * 0.6, purple * 0.4, 30});    
-
-    scene.getMaterial(blueMat).makeTransparent(0.9, 1.03);
-    scene.getMaterial(redMat).makeTransparent(0.6, 0.8);
-
-    scene.addObject(Sphere {{0, 2, 1}, 1.5, blueMat});
-    scene.addObject(Sphere {{1, -2, 4}, 2, redMat});
-    scene.addObject(Sphere {{0, -2, -3}, 1, greenMat});
-    scene.addObject(Sphere {{1.5, 0.5, -2}, 1, whiteMat});
-    scene.addObject(Sphere {{-2, 1, 5}, 0.7, yellowMat});
-    scene.addObject(Sphere {{-2.2, 0, 2}, 1, whiteMat});
-    scene.addObject(Sphere {{1, 1, 4}, 0.7, purpleMat});
-
-    scene.addLight(LightSource {{-15, 15, -15}, {1.0, 1.0, 1.0}});
-    scene.addLight(LightSource {{1, 1, 0}, {0.2, 0.2, 1.0}});
-    scene.addLight(LightSource {{0, -10, 6}, {1.0, 0.2, 0.2}});
-    return scene;
-}
-
-void addRandomObject(Scene &scene, float max_pos = 5.0f, float min_rad = 0.2f, float max_rad = 1.5f) {
-    std::random_device rd;
-    std::mt19937 re(rd());
-    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
-    std::normal_distribution<float> normDist(0.5, 0.5);
-    QVector3D pos {2 * max_pos * dist(re) - max_pos,
-                   2 * max_pos * dist(re) - max_pos,
-                   2 * max_pos * dist(re) - max_pos};
-    double radius {(max_rad - min_rad) * dist(re) + min_rad};
-    QVector3D diffuse {dist(re), dist(re), dist(re)};
-    //QVector3D specular {dist(re), dist(re), dist(re)};
-    const auto diffCoeff = dist(re);
-    const auto specCoeff = 1.0f - diffCoeff;
-    auto material = scene.addMaterial(Material {diffuse * diffCoeff, diffuse * specCoeff, dist(re) * 1000});
-    scene.getMaterial(material).makeTransparent(normDist(re), 1.5f - normDist(re));
-    scene.addObject(Sphere {pos, radius, material});
-}
-
-Scene randomScene(int num_of_objects) {
-    Scene scene;    
-    for (int i = 0; i < num_of_objects; i++) {
-        addRandomObject(scene);
-    }
-    scene.addLight(LightSource {{-15, 15, -15}, {1.0, 1.0, 1.0}});
-    scene.addLight(LightSource {{1, 1, 0}, {0.2, 0.2, 1.0}});
-    scene.addLight(LightSource {{0, -10, 6}, {1.0, 0.2, 0.2}});
-    return scene;
-}
-
-}
 
 MyOpenGLWidget::MyOpenGLWidget(QWidget *parent) :
     QOpenGLWidget(parent),
-    jitter(QOpenGLTexture::Target2D),
-    randoms(QOpenGLTexture::Target1D)
+    random_engine(std::random_device()())
 {
     QSurfaceFormat format;
     format.setDepthBufferSize(24);
     format.setStencilBufferSize(8);
+    format.setVersion(3, 3);
     format.setProfile(QSurfaceFormat::CoreProfile);    
     format.setSamples(1);
     setFormat(format);
 }
 
+MyOpenGLWidget::~MyOpenGLWidget() {
+    makeCurrent();
+    frame_capture.stop();
+    if (present_framebuffer) {
+        context()->versionFunctions<QOpenGLFunctions_3_3_Core>()->glDeleteFramebuffers(1, &present_framebuffer);
+    }
+    doneCurrent();
+    // Stops presenting first: the render thread releases the frames when it is stopped.
+    render_thread.reset();
+}
+
 void MyOpenGLWidget::initializeGL() {
-    auto *gl = context()->functions();
+    auto *gl = context()->versionFunctions<QOpenGLFunctions_3_3_Core>();
+    gl->initializeOpenGLFunctions();
 
     gl->glDisable(GL_MULTISAMPLE);
     gl->glDisable(GL_DEPTH_TEST);
+    gl->glGenFramebuffers(1, &present_framebuffer);
+
+    // The render context shares the format, so it supports the same backends.
+    wavefront_supported = WavefrontTracer::isSupported(context());
+    animation_supported = SceneAnimator::isSupported(context());
+
+    render_thread.reset(new RenderThread(context(), "shaders"));
+    // Signals come from the render thread, so they are queued to the GUI thread.
+    connect(render_thread.get(), &RenderThread::frameReady, this, [this]() {
+        update();
+    });
+    connect(render_thread.get(), &RenderThread::governorChanged, this, &MyOpenGLWidget::governorChanged);
+    connect(render_thread.get(), &RenderThread::warning, this, [this](const QString &title, const QString &message) {
+        QMessageBox::warning(this, title, message);
+    });
 
     initScene();
     initView();
-    initTextures();
-
-    program = loadProgram("shaders/raytrace.vert", "shaders/raytrace.frag");
-
-    plane = std::make_shared<GLPlane>(); // plane is in NDC already
-    plane->attachVertices(program.get(), "vertex");
+    render_thread->start();
 
     emit initialized();
 }
 
 void MyOpenGLWidget::initScene() {
-    scene = defaultScene();
+    scene = scenes::defaultScene();
+    mapped_scene.reset();
+    sceneReplaced();
 }
 
-void MyOpenGLWidget::initView() {
-    model_matrix.setToIdentity();
-
-    view_matrix.setToIdentity();
-    view_matrix.lookAt(eye, QVector3D(0.0f, 0.0f, 0.0f), QVector3D(0.0f, 1.0f, 0.0f));
+void MyOpenGLWidget::sceneReplaced() {
+    scene_replaced = true;
+    stateChanged();
+}
 
-    projection_matrix.setToIdentity();
-    const auto aspect = float(width()) / float(height());
-    projection_matrix.perspective(cameraFOV, aspect, 0.001f, 100.0f);
-}
-
-std::vector<QVector2D> jitter2D(int size) {
-    std::vector<QVector2D> jitter;
-    std::random_device rd;
-    std::mt19937 mt(rd());
-    std::uniform_real_distribution<GLfloat> dist(0.0f, 1.0f);
-    for (int i = 0; i < size; i++)
-    for (int j = 0; j < size; j++) {
-        float x = (i + dist(mt)) / size;
-        float y = (j + dist(mt)) / size;
-        jitter.push_back(QVector2D(x, y));
+void MyOpenGLWidget::stateChanged(bool reset_passes) {
+    state_version++;
+    if (reset_passes) {
+        accumulation_version++;
     }
-    return jitter;
+    publishState();
 }
 
-std::vector<float> randoms1D(int size) {
-    std::vector<float> randoms;
-    std::random_device rd;
-    std::mt19937 mt(rd());
-    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
-    for (int i = 0; i < size; i++) {
-        randoms.push_back(dist(mt));
+void MyOpenGLWidget::publishState() {
+    if (!render_thread) {
+        // Published once the render thread is started.
+        return;
     }
-    return randoms;
+    auto state = std::make_shared<RenderState>();
+    state->version = state_version;
+    state->accumulation_version = accumulation_version;
+    state->settings = settings;
+    state->backend = render_backend;
+    state->progressive = progressive_enabled;
+    state->temporal = temporal_enabled;
+    state->governor = governor_enabled;
+    state->governor_target_ms = governor_target_ms;
+    state->profiling = profiling_requested;
+    state->animation = animation_enabled;
+    state->camera = camera.orbit(rotation_y_angle, rotation_x_angle);
+    state->size = size();
+    state->scene = sceneSnapshot();
+    render_thread->publish(state);
 }
 
-void MyOpenGLWidget::initTextures() {
-    jitter_size = 256;
-    jitter.setSize(jitter_size, jitter_size);
-    jitter.setMinMagFilters(QOpenGLTexture::Nearest, QOpenGLTexture::Nearest);
-    jitter.setWrapMode(QOpenGLTexture::Repeat);
-    jitter.setFormat(QOpenGLTexture::RG32F);
-    jitter.allocateStorage();
-    const auto jitter_data = jitter2D(jitter_size);
-    jitter.setData(QOpenGLTexture::RG, QOpenGLTexture::Float32, jitter_data.data());
+std::shared_ptr<const SceneSnapshot> MyOpenGLWidget::sceneSnapshot() {
+    if (scene_snapshot && !scene_replaced && !scene.hasChanges()) {
+        return scene_snapshot;
+    }
+    scene_version++;
+    if (scene_replaced) {
+        // The render thread uploads the whole scene: earlier edits do not matter.
+        replaced_version = scene_version;
+        scene_deltas.clear();
+        scene.resetChanges();
+        // Shared by the snapshots until the next replacement; a mapped file is rendered without objects.
+        replaced_scene = mapped_scene ? nullptr : std::make_shared<Scene>(scene);
+    } else {
+        scene_deltas.push_back({scene_version, std::make_shared<Scene::Edit>(scene.getEdit())});
+        scene.resetChanges();
+        const auto applied_version = render_thread->getAppliedSceneVersion();
+        while (!scene_deltas.empty() && scene_deltas.front().version <= applied_version) {
+            scene_deltas.pop_front();
+        }
+    }
+    scene_replaced = false;
+
+    auto snapshot = std::make_shared<SceneSnapshot>();
+    snapshot->scene = replaced_scene;
+    snapshot->mapped_scene = mapped_scene;
+    snapshot->edits.assign(scene_deltas.begin(), scene_deltas.end());
+    snapshot->version = scene_version;
+    snapshot->replaced_version = replaced_version;
+    scene_snapshot = snapshot;
+    return scene_snapshot;
+}
 
-    randoms_size = 4096;
-    randoms.setSize(randoms_size);
-    randoms.setMinMagFilters(QOpenGLTexture::Nearest, QOpenGLTexture::Nearest);
-    randoms.setWrapMode(QOpenGLTexture::Repeat);
-    randoms.setFormat(QOpenGLTexture::R32F);
-    randoms.allocateStorage();
-    const auto randoms_data = randoms1D(randoms_size);
-    randoms.setData(QOpenGLTexture::Red, QOpenGLTexture::Float32, randoms_data.data());
+void MyOpenGLWidget::initView() {
+    projection_matrix.setToIdentity();
+    const auto aspect = float(width()) / float(height());
+    projection_matrix.perspective(camera.fov, aspect, 0.001f, 100.0f);
 }
 
 void MyOpenGLWidget::setBackgroundColor(QColor color) {
-    background_color = color;
+    settings.background_color = color;
+    stateChanged();
 }
 
 QColor MyOpenGLWidget::getBackgroundColor() const {
-    return background_color;
+    return settings.background_color;
 }
 
 void MyOpenGLWidget::setIterationLimit(int limit) {
-    num_of_steps = limit;
+    settings.num_of_steps = limit;
+    stateChanged();
 }
 
 int MyOpenGLWidget::getIterationLimit() const {
-    return num_of_steps;
+    return settings.num_of_steps;
 }
 
 void MyOpenGLWidget::setNumOfSamples(int num) {
-    num_of_samples = num;
+    settings.num_of_samples = num;
+    stateChanged();
 }
 
 int MyOpenGLWidget::getNumOfSamples() const {
-    return num_of_samples;
+    return settings.num_of_samples;
+}
+
+void MyOpenGLWidget::setNumOfLightSamples(int num) {
+    settings.num_of_light_samples = num;
+    stateChanged();
 }
 
-void MyOpenGLWidget::setSamplingMode(MyOpenGLWidget::SamplingMode mode) {
-    sampling_mode = mode;
+int MyOpenGLWidget::getNumOfLightSamples() const {
+    return settings.num_of_light_samples;
 }
 
-MyOpenGLWidget::SamplingMode MyOpenGLWidget::getSamplingMode() const {
-    return sampling_mode;
+void MyOpenGLWidget::setSamplingMode(SamplingMode mode) {
+    settings.sampling_mode = mode;
+    stateChanged();
+}
+
+SamplingMode MyOpenGLWidget::getSamplingMode() const {
+    return settings.sampling_mode;
 }
 
 void MyOpenGLWidget::enableTransparency(bool enabled) {
-    transparency_enabled = enabled;
+    settings.transparency_enabled = enabled;
+    stateChanged();
 }
 
 bool MyOpenGLWidget::transparencyEnabled() const {
-    return transparency_enabled;
+    return settings.transparency_enabled;
 }
 
-void MyOpenGLWidget::resizeGL(int width, int height) {
-    auto *gl = context()->functions();
+void MyOpenGLWidget::enableAdaptiveSampling(bool enabled) {
+    settings.adaptive_sampling = enabled;
+    stateChanged();
+}
 
-    gl->glViewport(0, 0, width, height);
+bool MyOpenGLWidget::adaptiveSamplingEnabled() const {
+    return settings.adaptive_sampling;
+}
 
-    initView();
+void MyOpenGLWidget::enableHybrid(bool enabled) {
+    settings.hybrid = enabled;
+    stateChanged();
 }
 
-void MyOpenGLWidget::paintGL() {
-    auto *gl = context()->functions();
+bool MyOpenGLWidget::hybridEnabled() const {
+    return settings.hybrid;
+}
 
-    const auto bg_color = util::colorToVec(background_color);
-    gl->glClearColor(bg_color.x(), bg_color.y(), bg_color.z(), 1.0f);
-    gl->glClear(GL_COLOR_BUFFER_BIT);
+// Denoising filters the traced image, so the accumulated passes are kept.
+void MyOpenGLWidget::enableDenoise(bool enabled) {
+    settings.denoise = enabled;
+    stateChanged(false);
+}
 
-    if (!program) {
-        return;
-    }    
+bool MyOpenGLWidget::denoiseEnabled() const {
+    return settings.denoise;
+}
 
-    QMatrix4x4 rotate;
-    rotate.rotate(rotation_y_angle, QVector3D(0.0f, 1.0f, 0.0f));
-    rotate.rotate(rotation_x_angle, QVector3D(1.0f, 0.0f, 0.0f));
+void MyOpenGLWidget::setDenoiseIterations(int iterations) {
+    settings.denoise_iterations = iterations;
+    stateChanged(false);
+}
 
-    auto model_m = rotate * model_matrix;
+int MyOpenGLWidget::getDenoiseIterations() const {
+    return settings.denoise_iterations;
+}
 
-    program->bind();
+void MyOpenGLWidget::setDenoiseColorSigma(float sigma) {
+    settings.denoise_color_sigma = sigma;
+    stateChanged(false);
+}
 
-    gl->glActiveTexture(GL_TEXTURE0);
-    program->setUniformValue(program->uniformLocation("jitter"), 0);
-    jitter.bind();
+float MyOpenGLWidget::getDenoiseColorSigma() const {
+    return settings.denoise_color_sigma;
+}
 
-    gl->glActiveTexture(GL_TEXTURE1);
-    program->setUniformValue(program->uniformLocation("randoms"), 1);
-    randoms.bind();
+void MyOpenGLWidget::setRenderBackend(RenderBackend backend) {
+    // The render thread switches the tracer and falls back to the fragment shader if the kernels fail.
+    render_backend = backend;
+    stateChanged();
+}
 
-    program->setUniformValue(program->uniformLocation("jitterSize"), jitter_size);
-    program->setUniformValue(program->uniformLocation("randomsSize"), randoms_size);
+RenderBackend MyOpenGLWidget::getRenderBackend() const {
+    return render_backend;
+}
 
-    program->setUniformValue(program->uniformLocation("numOfSamples"), num_of_samples);
-    program->setUniformValue(program->uniformLocation("samplingMode"), int(sampling_mode));
-    program->setUniformValue(program->uniformLocation("numOfSteps"), num_of_steps);    
-    program->setUniformValue(program->uniformLocation("refractionEnabled"), transparency_enabled);
+bool MyOpenGLWidget::wavefrontSupported() const {
+    return wavefront_supported;
+}
 
-    const auto num_of_spheres = static_cast<int>(scene.objects.size());
-    program->setUniformValue(program->uniformLocation("numOfSpheres"), num_of_spheres);
-    int cnt = 0;
-    for (const auto &s: scene.objects) {
-        program->setUniformValue(program->uniformLocation(QString("spheres[%1].position").arg(cnt)), model_m * s.position);
-        program->setUniformValue(program->uniformLocation(QString("spheres[%1].radius").arg(cnt)), static_cast<GLfloat>(s.radius));
-        program->setUniformValue(program->uniformLocation(QString("spheres[%1].materialId").arg(cnt)), s.materialId);
-        cnt++;
-    }
+void MyOpenGLWidget::enableProgressive(bool enabled) {
+    progressive_enabled = enabled;
+    stateChanged();
+}
+
+bool MyOpenGLWidget::progressiveEnabled() const {
+    return progressive_enabled;
+}
+
+int MyOpenGLWidget::getNumOfAccumulatedFrames() const {
+    return render_thread ? render_thread->getNumOfAccumulatedFrames() : 0;
+}
+
+void MyOpenGLWidget::enableTemporal(bool enabled) {
+    // The render thread starts a new history.
+    temporal_enabled = enabled;
+    stateChanged(false);
+}
 
-    cnt = 0;
-    const auto num_of_lights = static_cast<int>(scene.lights.size());
-    program->setUniformValue(program->uniformLocation("numOfLightSources"), num_of_lights);
-    for (const auto &l: scene.lights) {
-        program->setUniformValue(program->uniformLocation(QString("lightSources[%1].position").arg(cnt)), model_m * l.position);
-        program->setUniformValue(program->uniformLocation(QString("lightSources[%1].color").arg(cnt)), l.color);
-        cnt++;
+bool MyOpenGLWidget::temporalEnabled() const {
+    return temporal_enabled;
+}
+
+// Pausing keeps the spheres where they are, so the passes traced so far are kept.
+void MyOpenGLWidget::enableAnimation(bool enabled) {
+    animation_enabled = enabled;
+    stateChanged(false);
+}
+
+bool MyOpenGLWidget::animationEnabled() const {
+    return animation_enabled;
+}
+
+bool MyOpenGLWidget::animationSupported() const {
+    return animation_supported;
+}
+
+void MyOpenGLWidget::startCapture(const QString &filename) {
+    makeCurrent();
+    try {
+        frame_capture.start(filename, FrameWriter::formatOf(filename));
+    }
+    catch (...) {
+        doneCurrent();
+        throw;
     }
+    doneCurrent();
+}
 
-    cnt = 0;
-    for (const auto &m: scene.materials) {
-        program->setUniformValue(program->uniformLocation(QString("materials[%1].diffuse").arg(cnt)), m.diffuse);
-        program->setUniformValue(program->uniformLocation(QString("materials[%1].specular").arg(cnt)), m.specular);
-        program->setUniformValue(program->uniformLocation(QString("materials[%1].shininess").arg(cnt)), m.shininess);
-        program->setUniformValue(program->uniformLocation(QString("materials[%1].refractionCoeff").arg(cnt)), m.refractionCoeff);
-        program->setUniformValue(program->uniformLocation(QString("materials[%1].refractionIndex").arg(cnt)), m.refractionIndex);
-        cnt++;
+void MyOpenGLWidget::stopCapture() {
+    if (!frame_capture.isActive()) {
+        return;
     }
+    makeCurrent();
+    frame_capture.stop();
+    doneCurrent();
+}
+
+bool MyOpenGLWidget::captureActive() const {
+    return frame_capture.isActive();
+}
 
-    program->setUniformValue(program->uniformLocation("backgroundColor"), util::colorToVec(background_color));
+FrameWriter::Stats MyOpenGLWidget::getCaptureStats() const {
+    return frame_capture.getStats();
+}
 
-    program->setUniformValue(program->uniformLocation("camToWorld"), view_matrix.inverted());
-    program->setUniformValue(program->uniformLocation("windowSize"), QVector2D(width(), height()));
-    program->setUniformValue(program->uniformLocation("cameraFOV"), cameraFOV);
-    const float PI = 3.141592653589793;
-    program->setUniformValue(program->uniformLocation("fovTangent"), std::tan(cameraFOV * PI / 360.0f));
+void MyOpenGLWidget::enableProfiling(bool enabled) {
+    profiling_requested = enabled;
+    stateChanged(false);
+}
 
-    plane->draw(gl);
+bool MyOpenGLWidget::profilingEnabled() const {
+    return profiling_requested;
+}
 
-    program->release();
+bool MyOpenGLWidget::popFrameTiming(FrameTiming &timing) {
+    return render_thread && render_thread->popFrameTiming(timing);
 }
 
-std::shared_ptr<QOpenGLShaderProgram> MyOpenGLWidget::loadProgram(QString vertex_shader_file, QString fragment_shader_file) {
-    auto prog = std::make_shared<QOpenGLShaderProgram>();
-    if (!prog->addShaderFromSourceFile(QOpenGLShader::Vertex, QString(vertex_shader_file))) {
-        throw std::runtime_error(std::string("Failed to load vertex shaders from ") + vertex_shader_file.toStdString()
-                                 + ":\n" + prog->log().toStdString());
+void MyOpenGLWidget::enableGovernor(bool enabled) {
+    // The render thread resets the governor and reports it with governorChanged.
+    governor_enabled = enabled;
+    stateChanged();
+}
+
+bool MyOpenGLWidget::governorEnabled() const {
+    return governor_enabled;
+}
+
+void MyOpenGLWidget::setGovernorTarget(double ms) {
+    governor_target_ms = std::max(ms, 1.0);
+    stateChanged(false);
+}
+
+double MyOpenGLWidget::getGovernorTarget() const {
+    return governor_target_ms;
+}
+
+std::shared_ptr<const FrameGovernor> MyOpenGLWidget::getGovernor() const {
+    return render_thread ? render_thread->getGovernor() : std::make_shared<FrameGovernor>();
+}
+
+void MyOpenGLWidget::resizeGL(int width, int height) {
+    Q_UNUSED(width);
+    Q_UNUSED(height);
+    initView();
+    stateChanged();
+}
+
+void MyOpenGLWidget::paintGL() {
+    auto *gl = context()->versionFunctions<QOpenGLFunctions_3_3_Core>();
+
+    const auto bg_color = util::colorToVec(settings.background_color);
+    gl->glClearColor(bg_color.x(), bg_color.y(), bg_color.z(), 1.0f);
+    gl->glClear(GL_COLOR_BUFFER_BIT);
+
+    auto *frame = (render_thread ? render_thread->takeFrame() : nullptr);
+    if (!frame) {
+        return;
     }
-    if (!prog->addShaderFromSourceFile(QOpenGLShader::Fragment, QString(fragment_shader_file))) {
-        throw std::runtime_error(std::string("Failed to load fragment shaders from ") + fragment_shader_file.toStdString()
-                                 + ":\n" + prog->log().toStdString());
+    presentFrame(*frame);
+
+    if (frame_capture.isActive()) {
+        frame_capture.capture(defaultFramebufferObject(), size());
     }
-    if (!prog->link()) {
-        throw std::runtime_error(std::string("Failed to link program:\n") + prog->log().toStdString());
+}
+
+void MyOpenGLWidget::presentFrame(RenderThread::Frame &frame) {
+    auto *gl = context()->versionFunctions<QOpenGLFunctions_3_3_Core>();
+
+    // The GPU waits for the render thread's commands; this thread does not.
+    gl->glWaitSync(frame.rendered, 0, GL_TIMEOUT_IGNORED);
+
+    const auto frame_size = frame.buffer->size();
+    gl->glBindFramebuffer(GL_READ_FRAMEBUFFER, present_framebuffer);
+    gl->glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, frame.buffer->texture(), 0);
+    gl->glBindFramebuffer(GL_DRAW_FRAMEBUFFER, defaultFramebufferObject());
+    // The frame may be of the previous size while the window is resized.
+    gl->glBlitFramebuffer(0, 0, frame_size.width(), frame_size.height(), 0, 0, width(), height(),
+                          GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    gl->glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+    gl->glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebufferObject());
+
+    // The render thread draws into the frame again only after the blit.
+    if (frame.presented) {
+        gl->glDeleteSync(frame.presented);
     }
-    return prog;
+    frame.presented = gl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    gl->glFlush();
 }
 
 void MyOpenGLWidget::onTimer() {
     rotation_y_angle += 1.0f;
-    update();
+    stateChanged();
 }
 
 void MyOpenGLWidget::mousePressEvent(QMouseEvent *event) {
@@ -323,24 +424,73 @@ void MyOpenGLWidget::mouseMoveEvent(QMouseEvent *event) {
     rotation_y_angle += float(event->pos().x() - mouse_pos.x());
     rotation_x_angle += float(event->pos().y() - mouse_pos.y());
     mouse_pos = event->pos();
-    update();
+    stateChanged();
 }
 
 void MyOpenGLWidget::wheelEvent(QWheelEvent *event) {
     const auto coeff = (event->angleDelta().y() > 0 ? 0.5f : -0.5f);
-    eye += coeff * QVector3D(1, 1, 1);
+    camera.eye += coeff * QVector3D(1, 1, 1);
     initView();
-    update();
+    stateChanged();
 }
 
 void MyOpenGLWidget::randomScene() {
-    scene = ::randomScene(32);    
+    scene = scenes::randomScene(32, random_engine);
+    mapped_scene.reset();
+    sceneReplaced();
 }
 
 void MyOpenGLWidget::clearScene() {
     scene.clear();
+    mapped_scene.reset();
+    sceneReplaced();
 }
 
 void MyOpenGLWidget::addRandomObject() {
-    ::addRandomObject(scene);
+    unpackScene();
+    scenes::addRandomObject(scene, random_engine);
+    // The new sphere and material are appended to the uploaded scene.
+    stateChanged();
+}
+
+void MyOpenGLWidget::loadScene(const QString &filename) {
+    if (scene_io::isBinary(filename)) {
+        auto mapped = std::make_shared<RestoredScene>();
+        mapped->file = std::make_shared<MappedScene>(filename);
+        // The BVHs and material indices are checked here, so that a corrupt file is rejected before it replaces the scene.
+        mapped->bvh = std::make_shared<BVH>(mapped->file->toBVH());
+        mapped->mesh_bvh = std::make_shared<MeshBVH>(mapped->file->toMeshBVH());
+        // Scene objects are unpacked only when they are edited (see unpackScene).
+        scene = Scene();
+        scene_unpacked = false;
+        mapped_scene = mapped;
+    } else {
+        scene = scene_io::loadJson(filename);
+        mapped_scene.reset();
+    }
+    sceneReplaced();
+}
+
+void MyOpenGLWidget::saveScene(const QString &filename) const {
+    if (mapped_scene && !scene_unpacked) {
+        scene_io::save(mapped_scene->file->toScene(), filename);
+    } else {
+        scene_io::save(scene, filename);
+    }
+}
+
+void MyOpenGLWidget::unpackScene() {
+    if (mapped_scene && !scene_unpacked) {
+        scene = mapped_scene->file->toScene();
+        scene_unpacked = true;
+    }
+}
+
+void MyOpenGLWidget::importMesh(const QString &filename) {
+    unpackScene();
+    auto mesh = obj_loader::load(filename, static_cast<int>(scene.materials.size()));
+    scene.addMaterial(Material());
+    scene.addMesh(mesh);
+    mapped_scene.reset();
+    sceneReplaced();
 }
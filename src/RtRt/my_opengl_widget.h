@@ -1,29 +1,31 @@
 #pragma once
 
-#include "gl_objects/gl_plane.h"
 #include "objects/scene.h"
+#include "objects/camera.h"
+#include "gpu/frame_capture.h"
+#include "render_settings.h"
+#include "render_thread.h"
+#include "profiling/frame_profiler.h"
+#include "profiling/frame_governor.h"
+#include "io/mapped_scene.h"
 
 #include <QOpenGLWidget>
-#include <QOpenGLVertexArrayObject>
-#include <QOpenGLBuffer>
 #include <QMatrix4x4>
-#include <QOpenGLTexture>
-#include <QOpenGLShaderProgram>
 #include <QTimer>
+#include <deque>
 #include <memory>
+#include <random>
 
+/**
+ * Shows the frames of RenderThread: the widget only keeps the state, publishes it as snapshots
+ * when it changes and presents the newest finished frame, so a long frame never blocks the GUI.
+ */
 class MyOpenGLWidget : public QOpenGLWidget {
     Q_OBJECT
 
-
-public:
-    enum SamplingMode : int {
-        SM_RANDOM = 0,
-        SM_MULTIJITTERED = 1
-    };
-
 public:
     explicit MyOpenGLWidget(QWidget *parent=nullptr);
+    ~MyOpenGLWidget() override;
 
     void setBackgroundColor(QColor color);
     QColor getBackgroundColor() const;
@@ -37,15 +39,87 @@ public:
     void setSamplingMode(SamplingMode mode);
     SamplingMode getSamplingMode() const;
 
+    // Shadow rays per hit when there are more lights (see RenderSettings), 0 shades all the lights.
+    void setNumOfLightSamples(int num);
+    int getNumOfLightSamples() const;
+
     void enableTransparency(bool enabled);
     bool transparencyEnabled() const;
 
+    void setRenderBackend(RenderBackend backend);
+    RenderBackend getRenderBackend() const;
+    // Wavefront backend needs OpenGL 4.3 (available after initialization).
+    bool wavefrontSupported() const;
+
+    // Adaptive sampling: extra samples are traced only for noisy pixels (see RenderSettings).
+    void enableAdaptiveSampling(bool enabled);
+    bool adaptiveSamplingEnabled() const;
+
+    // Hybrid mode: primary visibility of the spheres is rasterized (see RenderSettings).
+    void enableHybrid(bool enabled);
+    bool hybridEnabled() const;
+
+    // Edge-aware denoising of the GPU image (see RenderSettings); the CPU image is shown as traced.
+    void enableDenoise(bool enabled);
+    bool denoiseEnabled() const;
+    void setDenoiseIterations(int iterations);
+    int getDenoiseIterations() const;
+    void setDenoiseColorSigma(float sigma);
+    float getDenoiseColorSigma() const;
+
+    // Progressive mode: while nothing changes, each frame adds a pass to the running average.
+    void enableProgressive(bool enabled);
+    bool progressiveEnabled() const;
+    int getNumOfAccumulatedFrames() const;
+
+    // Temporal mode: each frame traces a pass with new samples and blends it with the previous frame
+    // reprojected to the moved camera (see GPURayTracer::renderTemporal). Takes over the progressive mode.
+    void enableTemporal(bool enabled);
+    bool temporalEnabled() const;
+
+    // Animation: the spheres move on the GPU (see SceneAnimator) and frames are rendered continuously.
+    // The scene itself keeps its positions. Needs OpenGL 4.3 (available after initialization).
+    void enableAnimation(bool enabled);
+    bool animationEnabled() const;
+    bool animationSupported() const;
+
+    // Frame timings are collected while profiling is enabled.
+    void enableProfiling(bool enabled);
+    bool profilingEnabled() const;
+    bool popFrameTiming(FrameTiming &timing);
+
+    // Frame time governor: lowers internal resolution (then samples and depth) to keep frames
+    // near the target time and restores them when there is headroom; see FrameGovernor.
+    void enableGovernor(bool enabled);
+    bool governorEnabled() const;
+    void setGovernorTarget(double ms);
+    double getGovernorTarget() const;
+    // Copy of the governor of the render thread, made when it last changed.
+    std::shared_ptr<const FrameGovernor> getGovernor() const;
+
+    // Capture: each presented frame is read back asynchronously and written to the file on a background thread
+    // (see FrameCapture); the format is chosen by the extension. Throws std::runtime_error on errors.
+    void startCapture(const QString &filename);
+    void stopCapture();
+    bool captureActive() const;
+    FrameWriter::Stats getCaptureStats() const;
+
     void randomScene();
     void clearScene();
+    // Throws std::runtime_error if the objects of a mapped scene file are inconsistent (see MappedScene::toScene).
     void addRandomObject();
 
+    // Scene files: .json or .rtscene (see scene_io); throw std::runtime_error on errors.
+    // Binary files are mapped and uploaded to the GPU with their BVH as is; the scene objects are unpacked
+    // from them only to be edited or saved.
+    void loadScene(const QString &filename);
+    void saveScene(const QString &filename) const;
+    // Adds a mesh from an OBJ file with a new material; throws std::runtime_error on errors.
+    void importMesh(const QString &filename);
+
 signals:
     void initialized();
+    void governorChanged();
 
 protected:
     virtual void initializeGL() override;
@@ -58,40 +132,65 @@ protected:
     void wheelEvent(QWheelEvent *event) override;
 
 private:
-    std::shared_ptr<QOpenGLShaderProgram> loadProgram(QString vertex_shader_file, QString fragment_shader_file);
-
     void initScene();
     void initView();
-    void initTextures();
+
+    // Publishes the new state for the render thread; the passes traced so far are dropped unless
+    // the change only affects how they are shown (e.g. denoising).
+    void stateChanged(bool reset_passes = true);
+    // Scene was replaced as a whole (not just edited, see Scene::getChanges).
+    void sceneReplaced();
+    void publishState();
+    std::shared_ptr<const SceneSnapshot> sceneSnapshot();
+    // Unpacks the scene objects of the mapped file, before they are edited.
+    void unpackScene();
+    void presentFrame(RenderThread::Frame &frame);
 
     void onTimer();
 
 private:
-    std::shared_ptr<QOpenGLShaderProgram> program;
-
-    QMatrix4x4 model_matrix, view_matrix, projection_matrix;
-    QVector3D eye = QVector3D(-10.0f, 0.0f, -10.0f);
-    float cameraFOV = 45.0f;
+    QMatrix4x4 projection_matrix;
+    Camera camera;
 
+    // Mouse rotation orbits the camera (see Camera::orbit): the scene on the GPU is not touched.
     float rotation_y_angle {0.0f}, rotation_x_angle {0.0f};
 
     QPoint mouse_pos {0, 0};
 
-    QColor background_color {0, 0, 0};
-
-    std::shared_ptr<GLPlane> plane;
-
     Scene scene;
-
-    int num_of_steps = 5;
-    int num_of_samples = 1;
-    SamplingMode sampling_mode = SM_RANDOM;
-
-    QOpenGLTexture jitter;
-    int jitter_size = 1;
-
-    QOpenGLTexture randoms;
-    int randoms_size= 1;
-
-    bool transparency_enabled = false;
+    // Mapped file the scene was loaded from, until the scene is replaced.
+    std::shared_ptr<const RestoredScene> mapped_scene;
+    // Whether the scene holds the objects of the mapped file (see unpackScene).
+    bool scene_unpacked = true;
+    std::mt19937 random_engine;
+
+    // The scene as last replaced, and the published edits the render thread may not have applied yet:
+    // they go with the next snapshot, so it applies all of them even if it skipped some snapshots.
+    std::shared_ptr<const Scene> replaced_scene;
+    std::deque<SceneDelta> scene_deltas;
+    std::shared_ptr<const SceneSnapshot> scene_snapshot;
+    long long scene_version = 0;
+    long long replaced_version = 0;
+    bool scene_replaced = true;
+
+    RenderSettings settings;
+    RenderBackend render_backend = RB_GPU;
+    bool wavefront_supported = false;
+
+    bool progressive_enabled = false;
+    bool temporal_enabled = false;
+    bool animation_enabled = false;
+    bool animation_supported = false;
+    bool profiling_requested = false;
+    bool governor_enabled = false;
+    double governor_target_ms = 16.0;
+
+    long long state_version = 0;
+    long long accumulation_version = 0;
+
+    std::unique_ptr<RenderThread> render_thread;
+    // Reads the texture of the presented frame (framebuffers are not shared between contexts).
+    GLuint present_framebuffer = 0;
+
+    FrameCapture frame_capture;
 };
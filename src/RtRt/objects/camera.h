@@ -0,0 +1,48 @@
+#pragma once
+
+#include <QVector3D>
+#include <QMatrix4x4>
+
+#include <cmath>
+
+class Camera {
+public:
+    Camera() {}
+    Camera(const QVector3D &eye, const QVector3D &center, const QVector3D &up, float fov = 45.0f) :
+        eye(eye), center(center), up(up), fov(fov) {
+    }
+
+    QMatrix4x4 viewMatrix() const {
+        QMatrix4x4 view;
+        view.lookAt(eye, center, up);
+        return view;
+    }
+
+    QMatrix4x4 camToWorld() const {
+        return viewMatrix().inverted();
+    }
+
+    // Camera moved around the center so that the scene looks rotated by the angles (in degrees)
+    // around the y axis and then the x axis; the scene itself stays in place.
+    Camera orbit(float y_angle, float x_angle) const {
+        QMatrix4x4 rotation;
+        rotation.rotate(-x_angle, QVector3D(1.0f, 0.0f, 0.0f));
+        rotation.rotate(-y_angle, QVector3D(0.0f, 1.0f, 0.0f));
+        Camera result = *this;
+        result.eye = center + rotation.mapVector(eye - center);
+        result.up = rotation.mapVector(up);
+        return result;
+    }
+
+    // Tangent of the half of the vertical field of view.
+    float fovTangent() const {
+        const float PI = 3.141592653589793f;
+        return std::tan(fov * PI / 360.0f);
+    }
+
+public:
+    QVector3D eye {-10.0f, 0.0f, -10.0f};
+    QVector3D center {0.0f, 0.0f, 0.0f};
+    QVector3D up {0.0f, 1.0f, 0.0f};
+    float fov {45.0f}; // vertical, in degrees
+};
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+/**
+ * Range [begin, end) of array elements.
+ */
+struct DirtyRange {
+    int begin {0};
+    int end {0};
+
+    bool empty() const {
+        return begin >= end;
+    }
+
+    int size() const {
+        return empty() ? 0 : end - begin;
+    }
+};
+
+/**
+ * Changed array elements as sorted disjoint ranges, so that only they are uploaded to the GPU.
+ * Separate changes stay apart (an edit of the first element and an append upload two elements),
+ * overlapping and adjacent ones are merged. Past MAX_RANGES, the two nearest ranges are merged,
+ * which bounds the number of uploads.
+ */
+class DirtyRanges {
+public:
+    static const int MAX_RANGES = 16;
+
+    bool empty() const {
+        return ranges.empty();
+    }
+
+    // Number of the covered elements.
+    int size() const {
+        int num = 0;
+        for (const auto &range: ranges) {
+            num += range.size();
+        }
+        return num;
+    }
+
+    std::vector<DirtyRange>::const_iterator begin() const {
+        return ranges.begin();
+    }
+
+    std::vector<DirtyRange>::const_iterator end() const {
+        return ranges.end();
+    }
+
+    void add(int first, int last) {
+        if (first >= last) {
+            return;
+        }
+        // The first range which may touch the new one, then all the ones it touches are merged into it.
+        auto it = std::lower_bound(ranges.begin(), ranges.end(), first, [](const DirtyRange &range, int index) {
+            return range.end < index;
+        });
+        while (it != ranges.end() && it->begin <= last) {
+            first = std::min(first, it->begin);
+            last = std::max(last, it->end);
+            it = ranges.erase(it);
+        }
+        ranges.insert(it, DirtyRange {first, last});
+        if (static_cast<int>(ranges.size()) > MAX_RANGES) {
+            mergeNearest();
+        }
+    }
+
+    void add(int index) {
+        add(index, index + 1);
+    }
+
+    void add(const DirtyRanges &other) {
+        for (const auto &range: other.ranges) {
+            add(range.begin, range.end);
+        }
+    }
+
+    void clear() {
+        ranges.clear();
+    }
+
+private:
+    void mergeNearest() {
+        size_t nearest = 0;
+        for (size_t i = 1; i + 1 < ranges.size(); i++) {
+            if (ranges[i + 1].begin - ranges[i].end < ranges[nearest + 1].begin - ranges[nearest].end) {
+                nearest = i;
+            }
+        }
+        ranges[nearest].end = ranges[nearest + 1].end;
+        ranges.erase(ranges.begin() + nearest + 1);
+    }
+
+private:
+    std::vector<DirtyRange> ranges;
+};
@@ -1,42 +1,152 @@
 #pragma once
 
 #include "sphere.h"
+#include "triangle_mesh.h"
 #include "light_source.h"
 #include "material.h"
+#include "dirty_range.h"
 
+#include <algorithm>
 #include <vector>
 
 class Scene {
+public:
+    // Elements changed since the last resetChanges(), so that renderers update only them.
+    // Removals are not tracked: the whole scene is uploaded again after clear().
+    struct Changes {
+        DirtyRanges objects;
+        DirtyRanges lights;
+        DirtyRanges materials;
+    };
+
+    // The changes with the new values of the changed elements, in the order of their ranges:
+    // replays them on a copy of the scene (e.g. the render thread's one) without copying the rest.
+    struct Edit {
+        Changes changes;
+        std::vector<Sphere> objects;
+        std::vector<LightSource> lights;
+        std::vector<Material> materials;
+    };
+
 public:
     Scene() {}
 
     void addObject(const Sphere &s) {
         objects.push_back(s);
+        changes.objects.add(static_cast<int>(objects.size()) - 1);
+    }
+
+    void setObject(int index, const Sphere &s) {
+        objects[index] = s;
+        changes.objects.add(index);
+    }
+
+    void addMesh(const TriangleMesh &m) {
+        meshes.push_back(m);
+    }
+
+    int getNumOfTriangles() const {
+        int num = 0;
+        for (const auto &m: meshes) {
+            num += m.getNumOfTriangles();
+        }
+        return num;
     }
 
     void addLight(const LightSource &l) {
         lights.push_back(l);
+        changes.lights.add(static_cast<int>(lights.size()) - 1);
     }
 
     int addMaterial(const Material &material) {
         materials.push_back(material);
-        return static_cast<int>(materials.size()) - 1;
+        const auto index = static_cast<int>(materials.size()) - 1;
+        changes.materials.add(index);
+        return index;
     }
 
-    Material& getMaterial(int matIndex) {
+    const Material& getMaterial(int matIndex) const {
         return materials[matIndex];
     }
 
-    const Material& getMaterial(int matIndex) const {
+    // The material is modified through the reference, so it is marked as changed.
+    Material& editMaterial(int matIndex) {
+        changes.materials.add(matIndex);
         return materials[matIndex];
     }
 
     void clear() {
         objects.clear();
+        meshes.clear();
+        resetChanges();
+    }
+
+    const Changes& getChanges() const {
+        return changes;
+    }
+
+    bool hasChanges() const {
+        return !changes.objects.empty() || !changes.lights.empty() || !changes.materials.empty();
+    }
+
+    // Marks more elements as changed, e.g. the changes of an earlier copy not uploaded yet.
+    void addChanges(const Changes &other) {
+        changes.objects.add(other.objects);
+        changes.lights.add(other.lights);
+        changes.materials.add(other.materials);
+    }
+
+    void resetChanges() {
+        changes = Changes();
+    }
+
+    // Elements changed since the last resetChanges().
+    Edit getEdit() const {
+        Edit edit;
+        edit.changes = changes;
+        edit.objects = changedElements(objects, changes.objects);
+        edit.lights = changedElements(lights, changes.lights);
+        edit.materials = changedElements(materials, changes.materials);
+        return edit;
+    }
+
+    // Applies an edit of the same scene (appended elements included) and marks its elements as changed.
+    void applyEdit(const Edit &edit) {
+        applyElements(objects, edit.changes.objects, edit.objects);
+        applyElements(lights, edit.changes.lights, edit.lights);
+        applyElements(materials, edit.changes.materials, edit.materials);
+        addChanges(edit.changes);
     }
 
 public:
     std::vector<Sphere> objects;
+    std::vector<TriangleMesh> meshes;
     std::vector<LightSource> lights;
     std::vector<Material> materials;
+
+private:
+    template <typename T>
+    static std::vector<T> changedElements(const std::vector<T> &elems, const DirtyRanges &ranges) {
+        std::vector<T> changed;
+        changed.reserve(ranges.size());
+        for (const auto &range: ranges) {
+            changed.insert(changed.end(), elems.begin() + range.begin, elems.begin() + range.end);
+        }
+        return changed;
+    }
+
+    template <typename T>
+    static void applyElements(std::vector<T> &elems, const DirtyRanges &ranges, const std::vector<T> &changed) {
+        auto value = changed.begin();
+        for (const auto &range: ranges) {
+            if (static_cast<int>(elems.size()) < range.end) {
+                elems.resize(range.end);
+            }
+            std::copy(value, value + range.size(), elems.begin() + range.begin);
+            value += range.size();
+        }
+    }
+
+private:
+    Changes changes;
 };
@@ -0,0 +1,150 @@
+#include "scene_packing.h"
+
+namespace scene_packing {
+
+std::vector<QVector4D> packSpheres(const std::vector<Sphere> &spheres) {
+    std::vector<QVector4D> texels;
+    texels.reserve(spheres.size());
+    for (const auto &s: spheres) {
+        texels.push_back(QVector4D(s.position, static_cast<float>(s.radius)));
+    }
+    return texels;
+}
+
+std::vector<int> packSphereMaterials(const std::vector<Sphere> &spheres) {
+    std::vector<int> texels;
+    texels.reserve(spheres.size());
+    for (const auto &s: spheres) {
+        texels.push_back(s.materialId);
+    }
+    return texels;
+}
+
+std::vector<QVector4D> packLights(const std::vector<LightSource> &lights) {
+    std::vector<QVector4D> texels;
+    texels.reserve(TEXELS_PER_LIGHT * lights.size());
+    for (const auto &l: lights) {
+        texels.push_back(QVector4D(l.position, 0.0f));
+        texels.push_back(QVector4D(l.color, 0.0f));
+    }
+    return texels;
+}
+
+std::vector<QVector4D> packMaterials(const std::vector<Material> &materials) {
+    std::vector<QVector4D> texels;
+    texels.reserve(TEXELS_PER_MATERIAL * materials.size());
+    for (const auto &m: materials) {
+        texels.push_back(QVector4D(m.diffuse, m.shininess));
+        texels.push_back(QVector4D(m.specular, m.refractionCoeff));
+        texels.push_back(QVector4D(m.refractionIndex, 0.0f, 0.0f, 0.0f));
+    }
+    return texels;
+}
+
+std::vector<QVector4D> packMeshVertices(const std::vector<TriangleMesh> &meshes) {
+    size_t num_of_vertices = 0;
+    for (const auto &m: meshes) {
+        num_of_vertices += m.vertices.size();
+    }
+    std::vector<QVector4D> texels;
+    texels.reserve(num_of_vertices);
+    for (const auto &m: meshes) {
+        for (const auto &v: m.vertices) {
+            texels.push_back(QVector4D(v, 0.0f));
+        }
+    }
+    return texels;
+}
+
+std::vector<int> packMeshTriangles(const std::vector<TriangleMesh> &meshes) {
+    size_t num_of_triangles = 0;
+    for (const auto &m: meshes) {
+        num_of_triangles += m.getNumOfTriangles();
+    }
+    std::vector<int> texels;
+    texels.reserve(INTS_PER_TRIANGLE * num_of_triangles);
+    int first_vertex = 0;
+    for (const auto &m: meshes) {
+        for (int t = 0; t < m.getNumOfTriangles(); t++) {
+            texels.push_back(first_vertex + m.indices[3 * t]);
+            texels.push_back(first_vertex + m.indices[3 * t + 1]);
+            texels.push_back(first_vertex + m.indices[3 * t + 2]);
+            texels.push_back(m.materialId);
+        }
+        first_vertex += static_cast<int>(m.vertices.size());
+    }
+    return texels;
+}
+
+std::vector<int> packMeshRanges(const std::vector<TriangleMesh> &meshes) {
+    std::vector<int> ranges;
+    ranges.reserve(INTS_PER_MESH_RANGE * meshes.size());
+    int first_vertex = 0, first_triangle = 0;
+    for (const auto &m: meshes) {
+        ranges.push_back(first_vertex);
+        ranges.push_back(static_cast<int>(m.vertices.size()));
+        ranges.push_back(first_triangle);
+        ranges.push_back(m.getNumOfTriangles());
+        first_vertex += static_cast<int>(m.vertices.size());
+        first_triangle += m.getNumOfTriangles();
+    }
+    return ranges;
+}
+
+std::vector<Sphere> unpackSpheres(const QVector4D *texels, const int *materials, int num_of_spheres) {
+    std::vector<Sphere> spheres;
+    spheres.reserve(num_of_spheres);
+    for (int i = 0; i < num_of_spheres; i++) {
+        spheres.push_back(Sphere {texels[i].toVector3D(), texels[i].w(), materials[i]});
+    }
+    return spheres;
+}
+
+std::vector<LightSource> unpackLights(const QVector4D *texels, int num_of_lights) {
+    std::vector<LightSource> lights;
+    lights.reserve(num_of_lights);
+    for (int i = 0; i < num_of_lights; i++) {
+        const auto *light = texels + TEXELS_PER_LIGHT * i;
+        lights.push_back(LightSource {light[0].toVector3D(), light[1].toVector3D()});
+    }
+    return lights;
+}
+
+std::vector<Material> unpackMaterials(const QVector4D *texels, int num_of_materials) {
+    std::vector<Material> materials;
+    materials.reserve(num_of_materials);
+    for (int i = 0; i < num_of_materials; i++) {
+        const auto *material = texels + TEXELS_PER_MATERIAL * i;
+        Material m {material[0].toVector3D(), material[1].toVector3D(), material[0].w()};
+        m.makeTransparent(material[1].w(), material[2].x());
+        materials.push_back(m);
+    }
+    return materials;
+}
+
+std::vector<TriangleMesh> unpackMeshes(const QVector4D *vertices, const int *triangles, const int *ranges, int num_of_meshes) {
+    std::vector<TriangleMesh> meshes(num_of_meshes);
+    for (int i = 0; i < num_of_meshes; i++) {
+        const auto *range = ranges + INTS_PER_MESH_RANGE * i;
+        const auto first_vertex = range[0], num_of_vertices = range[1];
+        const auto first_triangle = range[2], num_of_triangles = range[3];
+        auto &m = meshes[i];
+        m.vertices.reserve(num_of_vertices);
+        for (int v = 0; v < num_of_vertices; v++) {
+            m.vertices.push_back(vertices[first_vertex + v].toVector3D());
+        }
+        m.indices.reserve(3 * num_of_triangles);
+        for (int t = 0; t < num_of_triangles; t++) {
+            const auto *triangle = triangles + INTS_PER_TRIANGLE * (first_triangle + t);
+            m.indices.push_back(triangle[0] - first_vertex);
+            m.indices.push_back(triangle[1] - first_vertex);
+            m.indices.push_back(triangle[2] - first_vertex);
+        }
+        if (num_of_triangles > 0) {
+            m.materialId = triangles[INTS_PER_TRIANGLE * first_triangle + 3];
+        }
+    }
+    return meshes;
+}
+
+}
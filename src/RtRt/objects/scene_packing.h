@@ -0,0 +1,41 @@
+#pragma once
+
+#include "scene.h"
+
+#include <QVector4D>
+
+#include <vector>
+
+/**
+ * Scene arrays in the layout read by the shaders (see GLSceneBuffers):
+ * spheres - (position, radius) per sphere, sphere materials - material index per sphere,
+ * lights - (position, 0), (color, 0) per light,
+ * materials - (diffuse, shininess), (specular, refraction coeff), (refraction index, 0, 0, 0) per material,
+ * mesh vertices - (position, 0) per vertex of all the meshes,
+ * mesh triangles - (v0, v1, v2, material index) per triangle, indices are into the mesh vertices of all the meshes,
+ * mesh ranges - (first vertex, number of vertices, first triangle, number of triangles) per mesh.
+ * Binary scene files store the arrays in the same layout, so they are uploaded as is.
+ */
+namespace scene_packing {
+
+const int TEXELS_PER_SPHERE = 1;
+const int TEXELS_PER_LIGHT = 2;
+const int TEXELS_PER_MATERIAL = 3;
+const int INTS_PER_TRIANGLE = 4;
+const int INTS_PER_MESH_RANGE = 4;
+
+std::vector<QVector4D> packSpheres(const std::vector<Sphere> &spheres);
+std::vector<int> packSphereMaterials(const std::vector<Sphere> &spheres);
+std::vector<QVector4D> packLights(const std::vector<LightSource> &lights);
+std::vector<QVector4D> packMaterials(const std::vector<Material> &materials);
+std::vector<QVector4D> packMeshVertices(const std::vector<TriangleMesh> &meshes);
+std::vector<int> packMeshTriangles(const std::vector<TriangleMesh> &meshes);
+std::vector<int> packMeshRanges(const std::vector<TriangleMesh> &meshes);
+
+// Reverse of packing: the arrays hold the given number of elements.
+std::vector<Sphere> unpackSpheres(const QVector4D *texels, const int *materials, int num_of_spheres);
+std::vector<LightSource> unpackLights(const QVector4D *texels, int num_of_lights);
+std::vector<Material> unpackMaterials(const QVector4D *texels, int num_of_materials);
+std::vector<TriangleMesh> unpackMeshes(const QVector4D *vertices, const int *triangles, const int *ranges, int num_of_meshes);
+
+}
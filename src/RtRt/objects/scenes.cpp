@@ -0,0 +1,115 @@
+#include "scenes.h"
+#include "io/scene_io.h"
+
+#include <QStringList>
+
+#include <stdexcept>
+
+namespace scenes {
+
+namespace {
+
+void addDefaultLights(Scene &scene) {
+    scene.addLight(LightSource {{-15, 15, -15}, {1.0, 1.0, 1.0}});
+    scene.addLight(LightSource {{1, 1, 0}, {0.2, 0.2, 1.0}});
+    scene.addLight(LightSource {{0, -10, 6}, {1.0, 0.2, 0.2}});
+}
+
+void addRandomLights(Scene &scene, int num_of_lights, std::mt19937 &re, float max_pos) {
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    // About as bright in total as the three default lights.
+    const auto power = 3.0f / num_of_lights;
+    for (int i = 0; i < num_of_lights; i++) {
+        QVector3D pos {2 * max_pos * dist(re) - max_pos,
+                       2 * max_pos * dist(re) - max_pos,
+                       2 * max_pos * dist(re) - max_pos};
+        QVector3D color {dist(re), dist(re), dist(re)};
+        scene.addLight(LightSource {pos, color * power});
+    }
+}
+
+}
+
+Scene defaultScene() {
+    QVector3D red {1, 0.3, 0.3};
+    QVector3D blue {0.3, 0.3, 1};
+    QVector3D green {0.3, 1, 0.3};
+    QVector3D white {0.8, 0.8, 0.8};
+    QVector3D yellow {1, 1, 0.3};
+    QVector3D purple {1, 0.3, 1};
+
+    Scene scene;
+
+    auto redMat = scene.addMaterial(Material {red * 0.4, red * 0.6, 250});
+    auto blueMat = scene.addMaterial(Material {blue * 0.4, blue * 0.6, 50});
+    auto greenMat = scene.addMaterial(Material {green * 0.8, green * 0.2, 10});
+    auto whiteMat = scene.addMaterial(Material {white * 0.9, white * 0.1, 50});
+    auto yellowMat = scene.addMaterial(Material {yellow * 0.1,yellow * 0.9, 500});
+    auto purpleMat = scene.addMaterial(Material {purple * 0.6, purple * 0.4, 30});    
+
+    scene.editMaterial(blueMat).makeTransparent(0.9, 1.03);
+    scene.editMaterial(redMat).makeTransparent(0.6, 0.8);
+
+    scene.addObject(Sphere {{0, 2, 1}, 1.5, blueMat});
+    scene.addObject(Sphere {{1, -2, 4}, 2, redMat});
+    scene.addObject(Sphere {{0, -2, -3}, 1, greenMat});
+    scene.addObject(Sphere {{1.5, 0.5, -2}, 1, whiteMat});
+    scene.addObject(Sphere {{-2, 1, 5}, 0.7, yellowMat});
+    scene.addObject(Sphere {{-2.2, 0, 2}, 1, whiteMat});
+    scene.addObject(Sphere {{1, 1, 4}, 0.7, purpleMat});
+
+    addDefaultLights(scene);
+    return scene;
+}
+
+void addRandomObject(Scene &scene, std::mt19937 &re, float max_pos, float min_rad, float max_rad) {
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    std::normal_distribution<float> normDist(0.5, 0.5);
+    QVector3D pos {2 * max_pos * dist(re) - max_pos,
+                   2 * max_pos * dist(re) - max_pos,
+                   2 * max_pos * dist(re) - max_pos};
+    double radius {(max_rad - min_rad) * dist(re) + min_rad};
+    QVector3D diffuse {dist(re), dist(re), dist(re)};
+    //QVector3D specular {dist(re), dist(re), dist(re)};
+    const auto diffCoeff = dist(re);
+    const auto specCoeff = 1.0f - diffCoeff;
+    auto material = scene.addMaterial(Material {diffuse * diffCoeff, diffuse * specCoeff, dist(re) * 1000});
+    scene.editMaterial(material).makeTransparent(normDist(re), 1.5f - normDist(re));
+    scene.addObject(Sphere {pos, radius, material});
+}
+
+Scene randomScene(int num_of_objects, std::mt19937 &re, float max_pos, int num_of_lights) {
+    Scene scene;    
+    for (int i = 0; i < num_of_objects; i++) {
+        addRandomObject(scene, re, max_pos);
+    }
+    if (num_of_lights > 0) {
+        addRandomLights(scene, num_of_lights, re, 3 * max_pos);
+    } else {
+        addDefaultLights(scene);
+    }
+    return scene;
+}
+
+Scene fromSpec(const QString &spec) {
+    if (spec == "default") {
+        return defaultScene();
+    }
+    if (scene_io::isSceneFile(spec)) {
+        return scene_io::load(spec);
+    }
+    const auto parts = spec.split(':');
+    if (parts.size() >= 2 && parts.size() <= 4 && parts[0] == "random") {
+        bool num_ok = false, seed_ok = true, lights_ok = true;
+        const auto num_of_objects = parts[1].toInt(&num_ok);
+        const auto seed = (parts.size() >= 3 ? parts[2].toUInt(&seed_ok) : 0u);
+        const auto num_of_lights = (parts.size() == 4 ? parts[3].toInt(&lights_ok) : 0);
+        if (num_ok && seed_ok && lights_ok && num_of_objects >= 0 && num_of_lights >= 0) {
+            std::mt19937 re(seed);
+            return randomScene(num_of_objects, re, 5.0f, num_of_lights);
+        }
+    }
+    throw std::runtime_error("Bad scene spec: " + spec.toStdString());
+}
+
+}
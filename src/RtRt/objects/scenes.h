@@ -0,0 +1,25 @@
+#pragma once
+
+#include "scene.h"
+
+#include <QString>
+
+#include <random>
+
+namespace scenes {
+
+Scene defaultScene();
+
+void addRandomObject(Scene &scene, std::mt19937 &re,
+                     float max_pos = 5.0f, float min_rad = 0.2f, float max_rad = 1.5f);
+
+// The same generator seed gives the same scene.
+// With a number of lights, random lights of the same total power replace the default ones.
+Scene randomScene(int num_of_objects, std::mt19937 &re, float max_pos = 5.0f, int num_of_lights = 0);
+
+// Scene from a text spec: 'default', 'random:N[:seed[:lights]]' (seed is 0 by default)
+// or a scene file (.json or .rtscene, see scene_io).
+// Throws std::runtime_error for a bad spec or file.
+Scene fromSpec(const QString &spec);
+
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <QVector3D>
+#include <QString>
+
+#include <vector>
+
+class TriangleMesh {
+public:
+    TriangleMesh() {}
+    TriangleMesh(const std::vector<QVector3D> &vertices, const std::vector<int> &indices, int matId) :
+        vertices(vertices), indices(indices), materialId(matId) {
+    }
+
+    int getNumOfTriangles() const {
+        return static_cast<int>(indices.size()) / 3;
+    }
+
+public:
+    std::vector<QVector3D> vertices;
+    // Three vertex indices per triangle, counter-clockwise when looking at the front face.
+    std::vector<int> indices;
+    int materialId {0};
+    // File the mesh was loaded from (empty if it was built in code).
+    QString sourceFile;
+};
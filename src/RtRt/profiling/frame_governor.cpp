@@ -0,0 +1,168 @@
+#include "frame_governor.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+float roundDownToStep(float value, float step) {
+    return std::floor(value / step + 1e-3f) * step;
+}
+
+}
+
+constexpr float FrameGovernor::MIN_RENDER_SCALE;
+constexpr float FrameGovernor::RENDER_SCALE_STEP;
+constexpr double FrameGovernor::DEGRADE_RATIO;
+constexpr double FrameGovernor::UPGRADE_RATIO;
+
+void FrameGovernor::setTargetFrameTime(double ms) {
+    target_ms = std::max(ms, 1.0);
+    measured_ms.clear();
+}
+
+double FrameGovernor::getTargetFrameTime() const {
+    return target_ms;
+}
+
+void FrameGovernor::reset() {
+    state = GovernorState();
+    measured_ms.clear();
+    settle_frame = -1;
+}
+
+double FrameGovernor::frameWorkTime(const FrameTiming &timing) {
+    double gpu_ms = 0.0;
+    for (int stage = 0; stage < FS_NUM_OF_STAGES; stage++) {
+        gpu_ms += std::max(timing.gpu_ms[stage], 0.0);
+    }
+    return std::max(timing.frame_ms, gpu_ms);
+}
+
+bool FrameGovernor::update(const FrameTiming &timing, const RenderSettings &requested) {
+    if (timing.frame <= settle_frame) {
+        return false;
+    }
+    measured_ms.push_back(frameWorkTime(timing));
+    if (measured_ms.size() < NUM_OF_MEASURED_FRAMES) {
+        return false;
+    }
+    while (measured_ms.size() > NUM_OF_MEASURED_FRAMES) {
+        measured_ms.pop_front();
+    }
+
+    // Median is not thrown off by a single hitch.
+    std::vector<double> sorted(measured_ms.begin(), measured_ms.end());
+    std::sort(sorted.begin(), sorted.end());
+    const auto frame_ms = sorted[sorted.size() / 2];
+
+    bool changed = false;
+    QString action;
+    if (frame_ms > target_ms * DEGRADE_RATIO) {
+        changed = degrade(frame_ms, requested);
+        action = "degrade";
+    } else if (frame_ms < target_ms * UPGRADE_RATIO) {
+        changed = upgrade(frame_ms, requested);
+        action = "restore";
+    }
+    if (!changed) {
+        return false;
+    }
+    measured_ms.clear();
+    settle_frame = timing.frame + NUM_OF_FRAMES_IN_FLIGHT;
+    record(timing, frame_ms, action, requested);
+    return true;
+}
+
+bool FrameGovernor::degrade(double frame_ms, const RenderSettings &requested) {
+    if (state.render_scale > MIN_RENDER_SCALE) {
+        // Cost is proportional to the number of pixels.
+        const auto scale = roundDownToStep(state.render_scale * float(std::sqrt(target_ms / frame_ms)), RENDER_SCALE_STEP);
+        state.render_scale = std::max(MIN_RENDER_SCALE, std::min(scale, state.render_scale - RENDER_SCALE_STEP));
+        return true;
+    }
+    const auto current = apply(requested);
+    if (current.num_of_samples > 1) {
+        state.max_num_of_samples = current.num_of_samples / 2;
+        return true;
+    }
+    if (current.num_of_steps > 1) {
+        state.max_num_of_steps = current.num_of_steps / 2;
+        return true;
+    }
+    return false;
+}
+
+bool FrameGovernor::upgrade(double frame_ms, const RenderSettings &requested) {
+    if (state.max_num_of_steps > 0) {
+        state.max_num_of_steps *= 2;
+        if (state.max_num_of_steps >= requested.num_of_steps) {
+            state.max_num_of_steps = 0;
+        }
+        return true;
+    }
+    if (state.max_num_of_samples > 0) {
+        state.max_num_of_samples *= 2;
+        if (state.max_num_of_samples >= requested.num_of_samples) {
+            state.max_num_of_samples = 0;
+        }
+        return true;
+    }
+    if (state.render_scale < 1.0f) {
+        auto scale = roundDownToStep(state.render_scale * float(std::sqrt(0.9 * target_ms / frame_ms)), RENDER_SCALE_STEP);
+        if (scale <= state.render_scale) {
+            // One step up, if it is expected to fit into the target.
+            scale = state.render_scale + RENDER_SCALE_STEP;
+            const auto ratio = scale / state.render_scale;
+            if (frame_ms * ratio * ratio > 0.95 * target_ms) {
+                return false;
+            }
+        }
+        state.render_scale = std::min(scale, 1.0f);
+        return true;
+    }
+    return false;
+}
+
+void FrameGovernor::record(const FrameTiming &timing, double frame_ms, const QString &action,
+                           const RenderSettings &requested) {
+    const auto current = apply(requested);
+    GovernorDecision decision;
+    decision.frame = timing.frame;
+    decision.frame_ms = frame_ms;
+    decision.action = action;
+    decision.render_scale = state.render_scale;
+    decision.num_of_steps = current.num_of_steps;
+    decision.num_of_samples = current.num_of_samples;
+    if (decisions.size() >= MAX_NUM_OF_DECISIONS) {
+        decisions.erase(decisions.begin());
+    }
+    decisions.push_back(decision);
+}
+
+const GovernorState& FrameGovernor::getState() const {
+    return state;
+}
+
+RenderSettings FrameGovernor::apply(const RenderSettings &requested) const {
+    auto settings = requested;
+    if (state.max_num_of_steps > 0) {
+        settings.num_of_steps = std::min(settings.num_of_steps, state.max_num_of_steps);
+    }
+    if (state.max_num_of_samples > 0) {
+        settings.num_of_samples = std::min(settings.num_of_samples, state.max_num_of_samples);
+    }
+    return settings;
+}
+
+QSize FrameGovernor::renderSize(const QSize &window_size) const {
+    if (state.render_scale >= 1.0f) {
+        return window_size;
+    }
+    return QSize(std::max(1, int(std::lround(window_size.width() * state.render_scale))),
+                 std::max(1, int(std::lround(window_size.height() * state.render_scale))));
+}
+
+const std::vector<GovernorDecision>& FrameGovernor::getDecisions() const {
+    return decisions;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "frame_profiler.h"
+#include "render_settings.h"
+
+#include <QSize>
+#include <QString>
+
+#include <deque>
+#include <vector>
+
+/**
+ * Quality the governor currently allows: internal resolution scale and caps on depth and samples
+ * (a cap of 0 means the requested value is used as is).
+ */
+struct GovernorState {
+    float render_scale = 1.0f;
+    int max_num_of_steps = 0;
+    int max_num_of_samples = 0;
+};
+
+/**
+ * A change made by the governor and the frame time which caused it.
+ */
+struct GovernorDecision {
+    long long frame = 0;
+    double frame_ms = 0.0; // average over the measured frames
+    QString action;
+    float render_scale = 1.0f;
+    int num_of_steps = 0; // effective values after the change
+    int num_of_samples = 0;
+};
+
+/**
+ * Keeps frame time near the target by trading quality for speed.
+ * When frames are too slow, the internal resolution is lowered first (the image is upscaled on display),
+ * then samples and then depth are reduced; when there is enough headroom, quality is restored
+ * in the reverse order. A few frames are measured after each change before the next one.
+ */
+class FrameGovernor {
+public:
+    FrameGovernor() {}
+
+    void setTargetFrameTime(double ms);
+    double getTargetFrameTime() const;
+
+    // Forgets measurements and restores full quality.
+    void reset();
+
+    // Takes the measured timing of a frame rendered with the requested settings.
+    // Returns true if the state has changed.
+    bool update(const FrameTiming &timing, const RenderSettings &requested);
+
+    const GovernorState& getState() const;
+    // Requested settings with the caps applied.
+    RenderSettings apply(const RenderSettings &requested) const;
+    // Size of the internal image for the window size.
+    QSize renderSize(const QSize &window_size) const;
+
+    const std::vector<GovernorDecision>& getDecisions() const;
+
+    // Time the frame took: the longest of CPU and GPU time.
+    static double frameWorkTime(const FrameTiming &timing);
+
+private:
+    bool degrade(double frame_ms, const RenderSettings &requested);
+    bool upgrade(double frame_ms, const RenderSettings &requested);
+    void record(const FrameTiming &timing, double frame_ms, const QString &action, const RenderSettings &requested);
+
+private:
+    static const int NUM_OF_MEASURED_FRAMES = 4;
+    // Timings arrive a few frames late: frames already in flight still use the old state.
+    static const int NUM_OF_FRAMES_IN_FLIGHT = 4;
+    static const size_t MAX_NUM_OF_DECISIONS = 10000;
+
+    constexpr static float MIN_RENDER_SCALE = 0.25f;
+    constexpr static float RENDER_SCALE_STEP = 0.05f;
+
+    // Hysteresis: slower frames degrade quality, faster ones restore it.
+    constexpr static double DEGRADE_RATIO = 1.15;
+    constexpr static double UPGRADE_RATIO = 0.7;
+
+    double target_ms = 16.0;
+    GovernorState state;
+    std::deque<double> measured_ms;
+    long long settle_frame = -1;
+    std::vector<GovernorDecision> decisions;
+};
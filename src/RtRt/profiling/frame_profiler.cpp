@@ -0,0 +1,186 @@
+#include "frame_profiler.h"
+
+const char* frameStageName(FrameStage stage) {
+    switch (stage) {
+    case FS_SCENE_UPLOAD: return "scene_upload";
+    case FS_UNIFORMS: return "uniforms";
+    case FS_TRACE: return "trace";
+    case FS_DISPLAY: return "display";
+    case FS_DENOISE: return "denoise";
+    case FS_TEMPORAL: return "temporal";
+    case FS_VISIBILITY: return "visibility";
+    case FS_ANIMATION: return "animation";
+    default: return "unknown";
+    }
+}
+
+FrameProfiler::FrameProfiler() :
+    finished(4096)
+{
+}
+
+void FrameProfiler::init() {
+    gpu_queries = true;
+    for (auto &frame_slot: slots) {
+        for (auto &queries: frame_slot.queries) {
+            queries.clear();
+            std::unique_ptr<QOpenGLTimerQuery> query(new QOpenGLTimerQuery());
+            if (!query->create()) {
+                gpu_queries = false;
+            }
+            queries.push_back(std::move(query));
+        }
+    }
+}
+
+void FrameProfiler::setEnabled(bool enabled) {
+    if (enabled && !this->enabled) {
+        // Frames left from the previous run are dropped.
+        for (auto &frame_slot: slots) {
+            frame_slot.pending = false;
+        }
+        oldest_pending_frame = current_frame;
+    }
+    this->enabled = enabled;
+}
+
+bool FrameProfiler::isEnabled() const {
+    return enabled;
+}
+
+FrameProfiler::FrameSlot& FrameProfiler::slot(long long frame) {
+    return slots[static_cast<size_t>(frame % MAX_FRAMES_IN_FLIGHT)];
+}
+
+void FrameProfiler::beginFrame() {
+    if (!enabled) {
+        return;
+    }
+    collect(false);
+    // All the slots are in flight: wait for the oldest frame to free its slot.
+    if (slot(current_frame).pending) {
+        collect(true);
+    }
+
+    auto &frame_slot = slot(current_frame);
+    frame_slot.timing = FrameTiming();
+    frame_slot.timing.frame = current_frame;
+    for (int stage = 0; stage < FS_NUM_OF_STAGES; stage++) {
+        frame_slot.num_of_runs[stage] = 0;
+        stage_open[stage] = false;
+    }
+    frame_slot.pending = true;
+
+    in_frame = true;
+    frame_timer.start();
+}
+
+void FrameProfiler::endFrame() {
+    if (!in_frame) {
+        return;
+    }
+    slot(current_frame).timing.frame_ms = frame_timer.nsecsElapsed() * 1e-6;
+    in_frame = false;
+    current_frame++;
+    swap_timer.start();
+}
+
+void FrameProfiler::beginStage(FrameStage stage) {
+    if (!in_frame) {
+        return;
+    }
+    auto &frame_slot = slot(current_frame);
+    const int run = frame_slot.num_of_runs[stage]++;
+    if (gpu_queries) {
+        auto &queries = frame_slot.queries[stage];
+        if (run == static_cast<int>(queries.size())) {
+            std::unique_ptr<QOpenGLTimerQuery> query(new QOpenGLTimerQuery());
+            if (query->create()) {
+                queries.push_back(std::move(query));
+            } else {
+                gpu_queries = false;
+            }
+        }
+        if (gpu_queries) {
+            queries[run]->begin();
+        }
+    }
+    stage_open[stage] = true;
+    stage_start_ns[stage] = frame_timer.nsecsElapsed();
+}
+
+void FrameProfiler::endStage(FrameStage stage) {
+    if (!in_frame || !stage_open[stage]) {
+        return;
+    }
+    stage_open[stage] = false;
+    auto &frame_slot = slot(current_frame);
+    frame_slot.timing.cpu_ms[stage] += (frame_timer.nsecsElapsed() - stage_start_ns[stage]) * 1e-6;
+    if (gpu_queries) {
+        frame_slot.queries[stage][frame_slot.num_of_runs[stage] - 1]->end();
+    }
+}
+
+void FrameProfiler::frameSwapped() {
+    if (!enabled || current_frame == 0 || in_frame) {
+        return;
+    }
+    auto &frame_slot = slot(current_frame - 1);
+    if (frame_slot.pending && frame_slot.timing.frame == current_frame - 1) {
+        frame_slot.timing.swap_ms = swap_timer.nsecsElapsed() * 1e-6;
+    }
+}
+
+bool FrameProfiler::popTiming(FrameTiming &timing) {
+    return finished.pop(timing);
+}
+
+void FrameProfiler::setFrameCallback(std::function<void(const FrameTiming&)> callback) {
+    frame_callback = callback;
+}
+
+bool FrameProfiler::isReady(const FrameSlot &slot) const {
+    if (!gpu_queries) {
+        return true;
+    }
+    for (int stage = 0; stage < FS_NUM_OF_STAGES; stage++) {
+        for (int run = 0; run < slot.num_of_runs[stage]; run++) {
+            if (!slot.queries[stage][run]->isResultAvailable()) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void FrameProfiler::finish(FrameSlot &slot) {
+    for (int stage = 0; stage < FS_NUM_OF_STAGES; stage++) {
+        if (!gpu_queries) {
+            slot.timing.gpu_ms[stage] = -1.0;
+        } else {
+            for (int run = 0; run < slot.num_of_runs[stage]; run++) {
+                slot.timing.gpu_ms[stage] += slot.queries[stage][run]->waitForResult() * 1e-6;
+            }
+        }
+    }
+    if (frame_callback) {
+        frame_callback(slot.timing);
+    }
+    // If the consumer falls behind, timings are dropped rather than blocking the frame.
+    finished.push(slot.timing);
+    slot.pending = false;
+}
+
+void FrameProfiler::collect(bool wait) {
+    while (oldest_pending_frame < current_frame) {
+        auto &frame_slot = slot(oldest_pending_frame);
+        if (frame_slot.pending) {
+            if (!wait && !isReady(frame_slot)) {
+                return;
+            }
+            finish(frame_slot);
+            wait = false;
+        }
+        oldest_pending_frame++;
+    }
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "ring_buffer.h"
+
+#include <QOpenGLTimerQuery>
+#include <QElapsedTimer>
+
+#include <array>
+#include <functional>
+#include <memory>
+#include <vector>
+
+enum FrameStage : int {
+    FS_SCENE_UPLOAD = 0,
+    FS_UNIFORMS = 1,
+    FS_TRACE = 2,
+    FS_DISPLAY = 3,
+    FS_DENOISE = 4,
+    FS_TEMPORAL = 5,
+    FS_VISIBILITY = 6,
+    FS_ANIMATION = 7,
+    FS_NUM_OF_STAGES = 8
+};
+
+const char* frameStageName(FrameStage stage);
+
+/**
+ * Timings of one frame, in milliseconds.
+ */
+struct FrameTiming {
+    long long frame = 0;
+    double frame_ms = 0.0; // CPU time of the whole paint
+    double swap_ms = 0.0; // from the end of the paint until the frame is finished on the GPU
+    double cpu_ms[FS_NUM_OF_STAGES] = {};
+    double gpu_ms[FS_NUM_OF_STAGES] = {}; // negative if GPU timer queries are not available
+};
+
+/**
+ * Measures CPU and GPU (GL_TIME_ELAPSED queries) time of frame stages.
+ * Query results are read a few frames later to not stall the pipeline,
+ * then finished timings are pushed into a lock-free queue for a consumer.
+ */
+class FrameProfiler {
+public:
+    FrameProfiler();
+
+    // Creates timer queries: the context must be current.
+    // If queries are not supported, only CPU timings are collected.
+    void init();
+
+    void setEnabled(bool enabled);
+    bool isEnabled() const;
+
+    void beginFrame();
+    void endFrame();
+
+    // Stages must not overlap (GPU timer queries can't be nested). A stage may run more than once in a frame:
+    // its times are added up.
+    void beginStage(FrameStage stage);
+    void endStage(FrameStage stage);
+
+    // Called when the last frame has been finished on the GPU.
+    void frameSwapped();
+
+    // Consumer side: may be called from another thread.
+    bool popTiming(FrameTiming &timing);
+
+    // Called on the rendering thread for each finished frame (before it is queued),
+    // so the renderer can react to its own timings without a consumer.
+    void setFrameCallback(std::function<void(const FrameTiming&)> callback);
+
+private:
+    struct FrameSlot {
+        FrameTiming timing;
+        // One query for each run of the stage in the frame, created when a frame first needs it.
+        std::vector<std::unique_ptr<QOpenGLTimerQuery>> queries[FS_NUM_OF_STAGES];
+        int num_of_runs[FS_NUM_OF_STAGES];
+        bool pending = false;
+    };
+
+    // Reads results of finished frames in order; waits for the oldest one if 'wait' is set.
+    void collect(bool wait);
+    bool isReady(const FrameSlot &slot) const;
+    void finish(FrameSlot &slot);
+
+    FrameSlot& slot(long long frame);
+
+private:
+    static const int MAX_FRAMES_IN_FLIGHT = 4;
+
+    bool enabled = false;
+    bool gpu_queries = false;
+    bool in_frame = false;
+
+    long long current_frame = 0;
+    long long oldest_pending_frame = 0;
+
+    std::array<FrameSlot, MAX_FRAMES_IN_FLIGHT> slots;
+
+    QElapsedTimer frame_timer;
+    qint64 stage_start_ns[FS_NUM_OF_STAGES];
+    bool stage_open[FS_NUM_OF_STAGES];
+    QElapsedTimer swap_timer;
+
+    RingBuffer<FrameTiming> finished;
+    std::function<void(const FrameTiming&)> frame_callback;
+};
+
+/**
+ * Measures a stage while in scope; does nothing if there is no profiler.
+ */
+class ProfileScope {
+public:
+    ProfileScope(FrameProfiler *profiler, FrameStage stage) :
+        profiler(profiler), stage(stage) {
+        if (profiler) {
+            profiler->beginStage(stage);
+        }
+    }
+
+    ~ProfileScope() {
+        if (profiler) {
+            profiler->endStage(stage);
+        }
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    FrameProfiler *profiler;
+    FrameStage stage;
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+/**
+ * Lock-free bounded queue for one producer thread and one consumer thread.
+ * The producer never blocks: when the queue is full, the new item is dropped.
+ */
+template <typename T>
+class RingBuffer {
+public:
+    explicit RingBuffer(size_t capacity) :
+        items(capacity + 1) {
+    }
+
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    // Producer side. Returns false if the queue is full.
+    bool push(const T &item) {
+        const auto tail = write_index.load(std::memory_order_relaxed);
+        const auto next = increment(tail);
+        if (next == read_index.load(std::memory_order_acquire)) {
+            return false;
+        }
+        items[tail] = item;
+        write_index.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Returns false if the queue is empty.
+    bool pop(T &item) {
+        const auto head = read_index.load(std::memory_order_relaxed);
+        if (head == write_index.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = items[head];
+        read_index.store(increment(head), std::memory_order_release);
+        return true;
+    }
+
+    size_t capacity() const {
+        return items.size() - 1;
+    }
+
+private:
+    size_t increment(size_t index) const {
+        return (index + 1) % items.size();
+    }
+
+private:
+    // One slot is always kept free to tell a full queue from an empty one.
+    std::vector<T> items;
+    std::atomic<size_t> read_index {0};
+    std::atomic<size_t> write_index {0};
+};
@@ -0,0 +1,79 @@
+#include "timing_export.h"
+
+#include <QFile>
+#include <QTextStream>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+
+#include <stdexcept>
+
+namespace timing_export {
+
+namespace {
+
+void openForWriting(QFile &file) {
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+        throw std::runtime_error("Failed to write " + file.fileName().toStdString());
+    }
+}
+
+}
+
+void saveCsv(const std::vector<FrameTiming> &timings, const QString &filename) {
+    QFile file(filename);
+    openForWriting(file);
+    QTextStream out(&file);
+
+    out << "frame,frame_ms,swap_ms";
+    for (int stage = 0; stage < FS_NUM_OF_STAGES; stage++) {
+        const auto name = frameStageName(static_cast<FrameStage>(stage));
+        out << "," << name << "_cpu_ms," << name << "_gpu_ms";
+    }
+    out << "\n";
+
+    for (const auto &timing: timings) {
+        out << timing.frame << "," << timing.frame_ms << "," << timing.swap_ms;
+        for (int stage = 0; stage < FS_NUM_OF_STAGES; stage++) {
+            out << "," << timing.cpu_ms[stage] << "," << timing.gpu_ms[stage];
+        }
+        out << "\n";
+    }
+}
+
+void saveJson(const std::vector<FrameTiming> &timings, const QString &filename) {
+    QJsonArray frames;
+    for (const auto &timing: timings) {
+        QJsonObject cpu, gpu;
+        for (int stage = 0; stage < FS_NUM_OF_STAGES; stage++) {
+            const auto name = frameStageName(static_cast<FrameStage>(stage));
+            cpu[name] = timing.cpu_ms[stage];
+            gpu[name] = timing.gpu_ms[stage];
+        }
+        frames.append(QJsonObject {
+            {"frame", timing.frame},
+            {"frame_ms", timing.frame_ms},
+            {"swap_ms", timing.swap_ms},
+            {"cpu_ms", cpu},
+            {"gpu_ms", gpu}
+        });
+    }
+
+    QFile file(filename);
+    openForWriting(file);
+    file.write(QJsonDocument(QJsonObject {{"frames", frames}}).toJson());
+}
+
+void saveDecisionsCsv(const std::vector<GovernorDecision> &decisions, const QString &filename) {
+    QFile file(filename);
+    openForWriting(file);
+    QTextStream out(&file);
+
+    out << "frame,frame_ms,action,render_scale,num_of_steps,num_of_samples\n";
+    for (const auto &decision: decisions) {
+        out << decision.frame << "," << decision.frame_ms << "," << decision.action << ","
+            << decision.render_scale << "," << decision.num_of_steps << "," << decision.num_of_samples << "\n";
+    }
+}
+
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "frame_profiler.h"
+#include "frame_governor.h"
+
+#include <QString>
+
+#include <vector>
+
+namespace timing_export {
+
+// One row per frame, CPU and GPU columns for each stage.
+// Throw std::runtime_error if the file can't be written.
+void saveCsv(const std::vector<FrameTiming> &timings, const QString &filename);
+void saveJson(const std::vector<FrameTiming> &timings, const QString &filename);
+
+// One row per change made by the frame time governor.
+void saveDecisionsCsv(const std::vector<GovernorDecision> &decisions, const QString &filename);
+
+}
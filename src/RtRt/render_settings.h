@@ -0,0 +1,60 @@
+#pragma once
+
+#include <QColor>
+
+#include <algorithm>
+
+enum SamplingMode : int {
+    SM_RANDOM = 0,
+    SM_MULTIJITTERED = 1
+};
+
+enum RenderBackend : int {
+    RB_GPU = 0,
+    RB_CPU = 1,
+    RB_WAVEFRONT = 2 // GPU compute kernels, needs OpenGL 4.3
+};
+
+/**
+ * Tracing parameters shared by all the render backends.
+ */
+struct RenderSettings {
+    int num_of_steps = 5;
+    int num_of_samples = 1;
+    SamplingMode sampling_mode = SM_RANDOM;
+    bool transparency_enabled = false;
+    // Shadow rays per hit: with more lights than this, lights are picked at random from the light tree
+    // (see LightTree) in proportion to their estimated contribution. 0 shades all the lights.
+    int num_of_light_samples = 8;
+    QColor background_color {0, 0, 0};
+
+    // Adaptive sampling: a pilot pass traces a quarter of the samples of each pixel,
+    // the rest is traced only where the estimated error of the pixel luminance is above the threshold.
+    bool adaptive_sampling = false;
+    float adaptive_threshold = 0.002f; // about half a step of 8-bit output
+
+    // Edge-aware denoising of the GPU image: a-trous iterations guided by the normals, distances
+    // and surfaces of the primary hits (see GPURayTracer::denoise). Each iteration doubles the radius.
+    bool denoise = false;
+    int denoise_iterations = 4;
+    float denoise_color_sigma = 0.3f; // color difference at which neighbours mostly stop contributing
+
+    // Hybrid rendering on the GPU: the spheres are rasterized as impostors first and the primary rays start
+    // from the closest one instead of traversing the BVH. Only rays through the pixel centers can use it
+    // (one sample per frame, and the G-buffer); the image is the same.
+    bool hybrid = false;
+
+    // Samples per pixel: N random or N x N multi-jittered ones.
+    int numOfPixelSamples() const {
+        return sampling_mode == SM_MULTIJITTERED ? num_of_samples * num_of_samples : num_of_samples;
+    }
+
+    int numOfPilotSamples() const {
+        return std::min(std::max(numOfPixelSamples() / 4, 2), numOfPixelSamples());
+    }
+
+    // Adaptive sampling takes effect only when the pilot pass leaves samples to skip.
+    bool adaptiveSamplingActive() const {
+        return adaptive_sampling && numOfPilotSamples() < numOfPixelSamples();
+    }
+};
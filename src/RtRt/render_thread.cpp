@@ -0,0 +1,504 @@
+#include "render_thread.h"
+#include "util.h"
+
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+
+namespace {
+
+// Longer frames slow the animation down rather than let the spheres jump through each other (seconds).
+const float MAX_ANIMATION_STEP = 0.05f;
+
+}
+
+RenderThread::RenderThread(QOpenGLContext *share_context, const QString &shaders_dir) :
+    shaders_dir(shaders_dir),
+    gl_context(new QOpenGLContext()),
+    surface(new QOffscreenSurface()),
+    governor_snapshot(std::make_shared<FrameGovernor>()),
+    mesh_bvh(std::make_shared<MeshBVH>())
+{
+    gl_context->setFormat(share_context->format());
+    gl_context->setShareContext(share_context);
+    if (!gl_context->create()) {
+        throw std::runtime_error("Failed to create the rendering context");
+    }
+    // The surface must be created on the GUI thread; the context is made current on the render thread.
+    surface->setFormat(gl_context->format());
+    surface->create();
+    gl_context->moveToThread(this);
+}
+
+RenderThread::~RenderThread() {
+    stop();
+}
+
+void RenderThread::publish(const std::shared_ptr<const RenderState> &state) {
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        published_state = state;
+    }
+    wake_up.notify_one();
+}
+
+RenderThread::Frame* RenderThread::takeFrame() {
+    if (ready_frame.load(std::memory_order_acquire) & NEW_FRAME) {
+        front_frame = ready_frame.exchange(front_frame, std::memory_order_acq_rel) & FRAME_INDEX_MASK;
+    }
+    auto &frame = frames[front_frame];
+    return frame.buffer ? &frame : nullptr;
+}
+
+void RenderThread::stop() {
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        stopping = true;
+    }
+    wake_up.notify_one();
+    wait();
+    // The context is back on this thread, which no longer presents the frames.
+    if (gl && gl_context->makeCurrent(surface.get())) {
+        releaseFrames();
+        gl_context->doneCurrent();
+    }
+}
+
+long long RenderThread::getAppliedSceneVersion() const {
+    return applied_scene_version.load();
+}
+
+int RenderThread::getNumOfAccumulatedFrames() const {
+    return accumulated_frames.load();
+}
+
+bool RenderThread::popFrameTiming(FrameTiming &timing) {
+    return profiler.popTiming(timing);
+}
+
+std::shared_ptr<const FrameGovernor> RenderThread::getGovernor() const {
+    std::lock_guard<std::mutex> lock(governor_mutex);
+    return governor_snapshot;
+}
+
+void RenderThread::run() {
+    gl_context->makeCurrent(surface.get());
+    try {
+        init();
+        renderLoop();
+    }
+    catch (const std::exception &e) {
+        emit warning("Rendering", e.what());
+    }
+    release();
+    gl_context->doneCurrent();
+    // The frames are released in stop(), when the GUI thread no longer presents them.
+    gl_context->moveToThread(thread());
+}
+
+void RenderThread::renderLoop() {
+    long long rendered_version = -1;
+    // A state which failed to render is not rendered again, until a new one is published.
+    long long failed_version = -1;
+    while (true) {
+        std::shared_ptr<const RenderState> state;
+        {
+            std::unique_lock<std::mutex> lock(wake_mutex);
+            // Sleeps while the image can't get any better.
+            wake_up.wait(lock, [&]() {
+                return stopping || (published_state && (published_state->version != rendered_version ||
+                                                        (rendered_version != failed_version &&
+                                                         (redraw || needsMorePasses(*current_state)))));
+            });
+            if (stopping) {
+                return;
+            }
+            state = published_state;
+        }
+        rendered_version = state->version;
+        redraw = false;
+        try {
+            if (state != current_state) {
+                apply(*state);
+                current_state = state;
+            }
+            renderFrame(*state);
+        }
+        catch (const std::exception &e) {
+            // E.g. a variant failing to compile: the thread keeps running, the next state may render.
+            current_state = state;
+            failed_version = state->version;
+            emit warning("Rendering", e.what());
+        }
+    }
+}
+
+void RenderThread::init() {
+    gl = gl_context->versionFunctions<QOpenGLFunctions_3_3_Core>();
+    if (!gl || !gl->initializeOpenGLFunctions()) {
+        throw std::runtime_error("OpenGL 3.3 is not available");
+    }
+    gl->glDisable(GL_MULTISAMPLE);
+    gl->glDisable(GL_DEPTH_TEST);
+
+    gpu_tracer.reset(new GPURayTracer());
+    gpu_tracer->init(shaders_dir);
+    gpu_tracer->setProfiler(&profiler);
+    profiler.init();
+    profiler.setFrameCallback([this](const FrameTiming &timing) {
+        onFrameTiming(timing);
+    });
+    wavefront_supported = gpu_tracer->wavefrontSupported();
+    animation_supported = gpu_tracer->animationSupported();
+}
+
+void RenderThread::release() {
+    scaled_buffer.reset();
+    cpu_texture.reset();
+    gpu_tracer.reset();
+}
+
+void RenderThread::releaseFrames() {
+    for (auto &frame: frames) {
+        if (frame.rendered) {
+            gl->glDeleteSync(frame.rendered);
+            frame.rendered = nullptr;
+        }
+        if (frame.presented) {
+            gl->glDeleteSync(frame.presented);
+            frame.presented = nullptr;
+        }
+        frame.buffer.reset();
+    }
+}
+
+void RenderThread::apply(const RenderState &state) {
+    const auto *previous = current_state.get();
+    if (!previous || state.backend != previous->backend) {
+        enableWavefront(state.backend == RB_WAVEFRONT);
+    }
+    if (!previous || state.accumulation_version != previous->accumulation_version) {
+        gpu_tracer->resetAccumulation();
+    }
+    if (previous && state.temporal != previous->temporal) {
+        gpu_tracer->resetTemporal();
+    }
+    if (state.animation && (!previous || !previous->animation)) {
+        // Time spent paused does not count.
+        animation_clock.start();
+    }
+    if (!previous || state.governor_target_ms != previous->governor_target_ms) {
+        governor.setTargetFrameTime(state.governor_target_ms);
+    }
+    if (!previous || state.governor != previous->governor) {
+        governor.reset();
+        publishGovernor();
+    }
+    // The governor needs timings too.
+    profiler.setEnabled(state.profiling || state.governor);
+}
+
+void RenderThread::updateScene(const SceneSnapshot &snapshot) {
+    if (snapshot.replaced_version != replaced_version) {
+        replaced_scene = snapshot.scene;
+        mapped_scene = snapshot.mapped_scene;
+        edited_scene.reset();
+        replaced_version = snapshot.replaced_version;
+        edited_version = snapshot.replaced_version;
+        upload_needed = true;
+    }
+    bool edited = false;
+    for (const auto &delta: snapshot.edits) {
+        if (delta.version > edited_version) {
+            editedScene().applyEdit(*delta.edit);
+            edited_version = delta.version;
+            edited = true;
+        }
+    }
+    try {
+        if (upload_needed) {
+            uploadScene();
+        } else if (edited) {
+            // Edits refit or extend the BVH in place, and only the changed ranges are uploaded.
+            const auto &scene = *edited_scene;
+            if (restored_bvh) {
+                bvh = *restored_bvh;
+                bvh.resetChanges();
+                restored_bvh.reset();
+            }
+            bvh.update(scene.objects, scene.getChanges().objects);
+            gpu_tracer->updateScene(scene, bvh);
+        }
+    }
+    catch (...) {
+        // Nothing is traced until the next snapshot, which uploads the whole scene again.
+        restored_bvh.reset();
+        bvh.clear();
+        mesh_bvh = std::make_shared<MeshBVH>();
+        upload_needed = true;
+        throw;
+    }
+    if (edited_scene) {
+        edited_scene->resetChanges();
+    }
+    bvh.resetChanges();
+    applied_scene_version.store(snapshot.version);
+}
+
+void RenderThread::uploadScene() {
+    if (mapped_scene && !edited_scene) {
+        // BVHs were restored from the file when it was loaded; the CPU tracer and later edits need them too.
+        restored_bvh = mapped_scene->bvh;
+        mesh_bvh = mapped_scene->mesh_bvh;
+        bvh.clear();
+        gpu_tracer->uploadScene(*mapped_scene->file);
+    } else {
+        const auto &scene = sceneObjects();
+        restored_bvh.reset();
+        bvh.build(scene.objects);
+        auto built_mesh_bvh = std::make_shared<MeshBVH>();
+        built_mesh_bvh->build(scene.meshes);
+        mesh_bvh = built_mesh_bvh;
+        gpu_tracer->uploadScene(scene, bvh, *mesh_bvh);
+    }
+    upload_needed = false;
+}
+
+void RenderThread::enableWavefront(bool enabled) {
+    // Falls back to the fragment shader if compute kernels are not available.
+    try {
+        gpu_tracer->setWavefrontEnabled(enabled && wavefront_supported);
+    }
+    catch (const std::exception &e) {
+        gpu_tracer->setWavefrontEnabled(false);
+        emit warning("Wavefront", e.what());
+    }
+}
+
+void RenderThread::animate(const RenderState &state) {
+    const auto time_step = std::min(animation_clock.restart() * 1e-3f, MAX_ANIMATION_STEP);
+    try {
+        gpu_tracer->animateScene(state.animation_settings, time_step);
+    }
+    catch (const std::exception &e) {
+        animation_supported = false;
+        emit warning("Animation", e.what());
+    }
+}
+
+bool RenderThread::needsMorePasses(const RenderState &state) const {
+    if (state.backend == RB_CPU) {
+        return false;
+    }
+    if (state.animation && animation_supported) {
+        return true;
+    }
+    if (state.temporal) {
+        // Until the history is full.
+        return !gpu_tracer->temporalConverged();
+    }
+    return state.progressive && gpu_tracer->getNumOfAccumulatedFrames() < max_accumulated_frames;
+}
+
+void RenderThread::renderFrame(const RenderState &state) {
+    if (state.size.isEmpty()) {
+        return;
+    }
+    profiler.beginFrame();
+    try {
+        renderFrameStages(state);
+    }
+    catch (...) {
+        profiler.endFrame();
+        throw;
+    }
+    profiler.endFrame();
+    finishFrame();
+}
+
+void RenderThread::renderFrameStages(const RenderState &state) {
+    if (state.scene != current_scene) {
+        // A snapshot which fails to upload is skipped (see updateScene), not uploaded again each frame.
+        current_scene = state.scene;
+        ProfileScope scope(&profiler, FS_SCENE_UPLOAD);
+        updateScene(*state.scene);
+    }
+    if (state.animation && animation_supported && state.backend != RB_CPU) {
+        animate(state);
+    }
+
+    auto &frame = frames[back_frame];
+    initFrameBuffer(frame, state.size);
+    frame.buffer->bind();
+    gl->glViewport(0, 0, state.size.width(), state.size.height());
+    const auto bg_color = util::colorToVec(state.settings.background_color);
+    gl->glClearColor(bg_color.x(), bg_color.y(), bg_color.z(), 1.0f);
+    gl->glClear(GL_COLOR_BUFFER_BIT);
+
+    if (state.backend == RB_CPU) {
+        paintCPU(state);
+    } else {
+        paintGPU(state, *frame.buffer);
+    }
+    accumulated_frames.store(gpu_tracer->getNumOfAccumulatedFrames());
+}
+
+void RenderThread::paintGPU(const RenderState &state, QOpenGLFramebufferObject &target) {
+    const auto render_settings = renderSettings(state);
+    const auto render_size = renderSize(state);
+    const auto &view_camera = state.camera;
+
+    if (state.temporal) {
+        gpu_tracer->renderTemporal(render_settings, view_camera, render_size);
+        auto texture = gpu_tracer->getTemporalTexture();
+        if (render_settings.denoise) {
+            texture = gpu_tracer->denoise(texture, render_settings, view_camera, render_size);
+        }
+        gpu_tracer->display(texture, state.size);
+        return;
+    }
+
+    if (!state.progressive) {
+        // The denoiser needs the image in a texture, even at the full size.
+        if (render_size == state.size && !render_settings.denoise) {
+            gpu_tracer->render(render_settings, view_camera, state.size);
+            return;
+        }
+        initScaledBuffer(render_size);
+        scaled_buffer->bind();
+        gpu_tracer->render(render_settings, view_camera, render_size);
+        auto texture = scaled_buffer->texture();
+        if (render_settings.denoise) {
+            texture = gpu_tracer->denoise(texture, render_settings, view_camera, render_size);
+        }
+        target.bind();
+        gpu_tracer->display(texture, state.size);
+        return;
+    }
+
+    gpu_tracer->accumulate(render_settings, view_camera, render_size);
+    auto texture = gpu_tracer->getAccumulationTexture();
+    if (render_settings.denoise) {
+        texture = gpu_tracer->denoise(texture, render_settings, view_camera, render_size,
+                                      gpu_tracer->getNumOfAccumulatedFrames());
+    }
+    gpu_tracer->display(texture, state.size);
+}
+
+void RenderThread::paintCPU(const RenderState &state) {
+    {
+        ProfileScope scope(&profiler, FS_TRACE);
+
+        const auto render_size = renderSize(state);
+        if (cpu_image.size() != render_size) {
+            cpu_image = QImage(render_size, QImage::Format_RGBA8888);
+        }
+        cpu_tracer.render(sceneObjects(), sphereBVH(), *mesh_bvh, renderSettings(state), state.camera.camToWorld(),
+                          state.camera.fovTangent(), cpu_image);
+
+        if (!cpu_texture || cpu_texture->width() != cpu_image.width() || cpu_texture->height() != cpu_image.height()) {
+            cpu_texture = std::make_shared<QOpenGLTexture>(QOpenGLTexture::Target2D);
+            cpu_texture->setSize(cpu_image.width(), cpu_image.height());
+            cpu_texture->setMinMagFilters(QOpenGLTexture::Linear, QOpenGLTexture::Linear);
+            cpu_texture->setWrapMode(QOpenGLTexture::ClampToEdge);
+            cpu_texture->setFormat(QOpenGLTexture::RGBA8_UNorm);
+            cpu_texture->allocateStorage();
+        }
+        cpu_texture->setData(QOpenGLTexture::RGBA, QOpenGLTexture::UInt8, cpu_image.constBits());
+    }
+
+    gpu_tracer->display(cpu_texture->textureId(), state.size, true);
+}
+
+const Scene& RenderThread::sceneObjects() {
+    if (!edited_scene && replaced_scene) {
+        return *replaced_scene;
+    }
+    return editedScene();
+}
+
+Scene& RenderThread::editedScene() {
+    if (!edited_scene) {
+        edited_scene = replaced_scene ? std::make_shared<Scene>(*replaced_scene) :
+                                        std::make_shared<Scene>(mapped_scene->file->toScene());
+    }
+    return *edited_scene;
+}
+
+const BVH& RenderThread::sphereBVH() const {
+    return restored_bvh ? *restored_bvh : bvh;
+}
+
+void RenderThread::finishFrame() {
+    auto &frame = frames[back_frame];
+    frame.rendered = gl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // Frames are paced by the GPU: the next one is not queued until this one is done.
+    gl->glClientWaitSync(frame.rendered, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+    profiler.frameSwapped();
+
+    const auto previous = ready_frame.exchange(back_frame | NEW_FRAME, std::memory_order_acq_rel);
+    back_frame = previous & FRAME_INDEX_MASK;
+
+    // The frame we got back is either one the GUI thread has presented, or our previous one it skipped.
+    auto &next = frames[back_frame];
+    if (next.presented) {
+        gl->glWaitSync(next.presented, 0, GL_TIMEOUT_IGNORED);
+        gl->glDeleteSync(next.presented);
+        next.presented = nullptr;
+    }
+    if (next.rendered) {
+        gl->glDeleteSync(next.rendered);
+        next.rendered = nullptr;
+    }
+    // A skipped frame means the GUI thread has not painted since the last notification.
+    if (!(previous & NEW_FRAME)) {
+        emit frameReady();
+    }
+}
+
+void RenderThread::initFrameBuffer(Frame &frame, const QSize &size) {
+    if (frame.buffer && frame.buffer->size() == size) {
+        return;
+    }
+    QOpenGLFramebufferObjectFormat format;
+    format.setAttachment(QOpenGLFramebufferObject::NoAttachment);
+    frame.buffer = std::make_shared<QOpenGLFramebufferObject>(size, format);
+}
+
+void RenderThread::initScaledBuffer(const QSize &size) {
+    if (scaled_buffer && scaled_buffer->size() == size) {
+        return;
+    }
+    QOpenGLFramebufferObjectFormat format;
+    format.setAttachment(QOpenGLFramebufferObject::NoAttachment);
+    scaled_buffer = std::make_shared<QOpenGLFramebufferObject>(size, format);
+    // Upscaled on display.
+    gl->glBindTexture(GL_TEXTURE_2D, scaled_buffer->texture());
+    gl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    gl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    gl->glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void RenderThread::onFrameTiming(const FrameTiming &timing) {
+    if (current_state && current_state->governor && governor.update(timing, current_state->settings)) {
+        gpu_tracer->resetAccumulation();
+        redraw = true;
+        publishGovernor();
+    }
+}
+
+void RenderThread::publishGovernor() {
+    {
+        std::lock_guard<std::mutex> lock(governor_mutex);
+        governor_snapshot = std::make_shared<FrameGovernor>(governor);
+    }
+    emit governorChanged();
+}
+
+RenderSettings RenderThread::renderSettings(const RenderState &state) const {
+    return state.governor ? governor.apply(state.settings) : state.settings;
+}
+
+QSize RenderThread::renderSize(const RenderState &state) const {
+    return state.governor ? governor.renderSize(state.size) : state.size;
+}
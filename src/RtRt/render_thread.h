@@ -0,0 +1,243 @@
+#pragma once
+
+#include "objects/scene.h"
+#include "objects/camera.h"
+#include "accel/bvh.h"
+#include "accel/mesh_bvh.h"
+#include "cpu/cpu_ray_tracer.h"
+#include "gpu/gpu_ray_tracer.h"
+#include "render_settings.h"
+#include "profiling/frame_profiler.h"
+#include "profiling/frame_governor.h"
+#include "io/mapped_scene.h"
+
+#include <QThread>
+#include <QOpenGLContext>
+#include <QOffscreenSurface>
+#include <QOpenGLFunctions_3_3_Core>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLTexture>
+#include <QElapsedTimer>
+#include <QImage>
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
+/**
+ * Binary scene file with its BVHs, restored and checked on the GUI thread when it is loaded,
+ * so that a corrupt file is rejected before it reaches the render thread.
+ */
+struct RestoredScene {
+    std::shared_ptr<const MappedScene> file;
+    std::shared_ptr<const BVH> bvh;
+    std::shared_ptr<const MeshBVH> mesh_bvh;
+};
+
+/**
+ * Edit of the scene published with the given version.
+ */
+struct SceneDelta {
+    long long version;
+    std::shared_ptr<const Scene::Edit> edit;
+};
+
+/**
+ * Scene as handed to the render thread: the scene as it was last replaced, shared by all the snapshots
+ * until the next replacement, and the edits since then which the render thread may not have applied yet.
+ * The render thread replays the edits it has not applied on its own copy (see Scene::applyEdit),
+ * so it uploads all of them even if it skipped some snapshots, and an edit costs only the changed elements.
+ */
+struct SceneSnapshot {
+    // Not set for a mapped file: the render thread unpacks the objects only if the CPU tracer or edits need them.
+    std::shared_ptr<const Scene> scene;
+    // File the scene was loaded from: its BVHs are restored, not built.
+    std::shared_ptr<const RestoredScene> mapped_scene;
+    // In the order of the versions.
+    std::vector<SceneDelta> edits;
+    long long version = 0;
+    long long replaced_version = 0; // version of the last replacement: older snapshots are of another scene
+};
+
+/**
+ * Everything the render thread needs for a frame. Published by the GUI thread as a whole and never modified,
+ * so the render thread reads it without locks.
+ */
+struct RenderState {
+    long long version = 0;
+    // Changes when the passes traced so far (progressive mode) no longer apply.
+    long long accumulation_version = 0;
+
+    RenderSettings settings;
+    RenderBackend backend = RB_GPU;
+    bool progressive = false;
+    bool temporal = false;
+    bool governor = false;
+    double governor_target_ms = 16.0;
+    bool profiling = false;
+    // Spheres move on the GPU while it is set (GPU backends only, see GPURayTracer::animateScene).
+    bool animation = false;
+    AnimationSettings animation_settings;
+
+    Camera camera; // with the mouse rotation applied
+    QSize size;
+    std::shared_ptr<const SceneSnapshot> scene;
+};
+
+/**
+ * Renders on its own thread with its own context (sharing objects with the widget's one), so a long frame
+ * does not block the GUI. The GUI thread publishes the state as immutable snapshots; the render thread
+ * renders the latest one into one of three framebuffers, which are exchanged lock-free with the GUI thread:
+ * the GUI presents the newest finished frame while the next one is rendered.
+ * While nothing changes, the thread keeps refining the image (progressive and temporal modes), then sleeps;
+ * while the scene is animated, it renders continuously.
+ */
+class RenderThread : public QThread {
+    Q_OBJECT
+
+public:
+    // Rendered frame. The buffer is created and drawn by the render thread; the GUI thread reads its texture
+    // while it owns the frame (see takeFrame). Fences are shared between the contexts.
+    struct Frame {
+        std::shared_ptr<QOpenGLFramebufferObject> buffer;
+        GLsync rendered = nullptr; // set by the render thread when the frame is drawn
+        GLsync presented = nullptr; // set by the GUI thread when it has read the frame
+    };
+
+public:
+    // Creates the context sharing objects with the given one; call on the GUI thread.
+    // Throws std::runtime_error if the context can't be created.
+    explicit RenderThread(QOpenGLContext *share_context, const QString &shaders_dir = "shaders");
+    ~RenderThread() override;
+
+    // GUI thread: the state the next frames are rendered with.
+    void publish(const std::shared_ptr<const RenderState> &state);
+    // GUI thread: the newest finished frame, or the one taken last time if there is no newer one;
+    // nullptr before the first frame. The GUI thread owns it until the next call.
+    Frame* takeFrame();
+    // Stops and waits for the thread, then releases the frames: the GUI thread must no longer present them.
+    void stop();
+
+    // May be called from any thread.
+    long long getAppliedSceneVersion() const;
+    int getNumOfAccumulatedFrames() const;
+    bool popFrameTiming(FrameTiming &timing);
+    // Copy of the governor made when it last changed.
+    std::shared_ptr<const FrameGovernor> getGovernor() const;
+
+signals:
+    void frameReady();
+    void governorChanged();
+    // Failures which do not stop rendering, e.g. the wavefront kernels or a variant failing to compile:
+    // the state is skipped and the next one is rendered.
+    void warning(const QString &title, const QString &message);
+
+protected:
+    void run() override;
+
+private:
+    void init();
+    // Renders the published states until stopped.
+    void renderLoop();
+    // Releases the objects of the render thread; the frames are released by stop().
+    void release();
+    void releaseFrames();
+    // Switches modes for the new state (the scene is uploaded in the frame, to be profiled).
+    void apply(const RenderState &state);
+    // Uploads the whole scene if it was replaced, only the changes if it was edited.
+    void updateScene(const SceneSnapshot &snapshot);
+    void uploadScene();
+    void enableWavefront(bool enabled);
+    // Moves the spheres by the time since the last step.
+    void animate(const RenderState &state);
+
+    // Exceptions end the frame, which is not presented.
+    void renderFrame(const RenderState &state);
+    void renderFrameStages(const RenderState &state);
+    void paintGPU(const RenderState &state, QOpenGLFramebufferObject &target);
+    void paintCPU(const RenderState &state);
+    // Objects of the uploaded scene.
+    const Scene& sceneObjects();
+    // The same, copied (or unpacked from the mapped file) the first time they are edited or needed by the CPU tracer.
+    Scene& editedScene();
+    const BVH& sphereBVH() const;
+    // Hands the drawn frame to the GUI thread and takes a free one.
+    void finishFrame();
+    void initFrameBuffer(Frame &frame, const QSize &size);
+    void initScaledBuffer(const QSize &size);
+    // Progressive and temporal modes refine a static image over more frames; animation needs new frames.
+    bool needsMorePasses(const RenderState &state) const;
+
+    void onFrameTiming(const FrameTiming &timing);
+    void publishGovernor();
+    // Settings and image size the governor allows (the requested ones if it is disabled).
+    RenderSettings renderSettings(const RenderState &state) const;
+    QSize renderSize(const RenderState &state) const;
+
+private:
+    // Flag of the exchanged frame index: the frame has not been taken by the GUI thread yet.
+    static const int NEW_FRAME = 4;
+    static const int FRAME_INDEX_MASK = 3;
+
+    QString shaders_dir;
+    std::unique_ptr<QOpenGLContext> gl_context;
+    std::unique_ptr<QOffscreenSurface> surface;
+
+    // The mutex guards only the pointer swap and the wakeup, never the rendering.
+    std::mutex wake_mutex;
+    std::condition_variable wake_up;
+    std::shared_ptr<const RenderState> published_state;
+    bool stopping = false;
+
+    // Triple buffering: the render thread owns the back frame, the GUI thread the front one,
+    // and the third one is exchanged through ready_frame without locks.
+    std::array<Frame, 3> frames;
+    int back_frame = 0;
+    int front_frame = 2;
+    std::atomic<int> ready_frame {1};
+
+    std::atomic<long long> applied_scene_version {0};
+    std::atomic<int> accumulated_frames {0};
+    mutable std::mutex governor_mutex;
+    std::shared_ptr<const FrameGovernor> governor_snapshot;
+
+    // Render thread only, from here on.
+    QOpenGLFunctions_3_3_Core *gl = nullptr;
+    std::shared_ptr<const RenderState> current_state;
+    std::shared_ptr<const SceneSnapshot> current_scene;
+    long long replaced_version = -1;
+    // Version of the last edit applied to the objects.
+    long long edited_version = -1;
+    // The whole scene is uploaded again, e.g. after an upload failed.
+    bool upload_needed = false;
+    // A frame is rendered even if the state is the same, e.g. after the governor has changed.
+    bool redraw = false;
+
+    // BVHs of the uploaded scene. Restored ones are shared with the snapshot; the BVH of the spheres
+    // is copied only when the scene is edited.
+    std::shared_ptr<const BVH> restored_bvh;
+    BVH bvh;
+    std::shared_ptr<const MeshBVH> mesh_bvh;
+    // Objects of the uploaded scene: shared with the snapshot that replaced it, copied at the first edit.
+    std::shared_ptr<const Scene> replaced_scene;
+    std::shared_ptr<const RestoredScene> mapped_scene;
+    std::shared_ptr<Scene> edited_scene;
+
+    std::unique_ptr<GPURayTracer> gpu_tracer;
+    bool wavefront_supported = false;
+    int max_accumulated_frames = 1024;
+
+    bool animation_supported = false;
+    QElapsedTimer animation_clock;
+
+    FrameProfiler profiler;
+    FrameGovernor governor;
+    // Image traced at the reduced resolution, upscaled on display.
+    std::shared_ptr<QOpenGLFramebufferObject> scaled_buffer;
+
+    CPURayTracer cpu_tracer;
+    QImage cpu_image;
+    std::shared_ptr<QOpenGLTexture> cpu_texture;
+};
@@ -0,0 +1,21 @@
+// Primary rays of the pixels, shared by raytrace.frag and impostor.frag so that both see the same ray
+// through each pixel (and the rasterized visibility matches the traced one).
+
+uniform mat4 camToWorld;
+uniform vec2 windowSize; // size of the whole image
+// Tiled rendering: the framebuffer holds a tile of the image, placed at this offset.
+// Rays go through the image pixels, the buffers of the pass (history, pilot samples) are of the tile.
+uniform vec2 tileOffset = vec2(0);
+uniform float fovTangent;
+
+// Center of the pixel in the image.
+vec2 imageCoord() {
+    return gl_FragCoord.xy + tileOffset;
+}
+
+vec3 primaryRay(vec2 fragCoord, float aspect, vec3 viewPoint) {
+    float px = (2 * (fragCoord.x + 0.5) / windowSize.x - 1) * fovTangent * aspect;
+    float py = (2 * (fragCoord.y + 0.5) / windowSize.y - 1) * fovTangent;
+    vec3 posWorld = vec4(camToWorld * vec4(px, py, -1, 1)).xyz;
+    return normalize(posWorld - viewPoint);
+}
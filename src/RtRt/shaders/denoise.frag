@@ -0,0 +1,55 @@
+#version 330
+
+// One iteration of the edge-avoiding a-trous filter (Dammertz et al., 2010).
+// A 5x5 B3-spline kernel is spread with holes of stepSize pixels; GPURayTracer runs it
+// with steps 1, 2, 4, ... so the footprint doubles each iteration at a constant cost.
+// Weights of the neighbours drop across edges of the G-buffer written by raytrace.frag (GBUFFER):
+// different surfaces and diffuse colors never mix, normals and distances must agree, and so must the colors,
+// so that the remaining detail (shadows, reflections) is kept.
+
+uniform sampler2D image;
+uniform sampler2D normalDepth; // (normal, distance from the eye)
+uniform sampler2D albedoId; // (diffuse color, surface id)
+uniform int stepSize = 1;
+uniform float colorSigma = 0.3;
+uniform float normalPower = 64.0;
+uniform float depthSigma = 0.02; // relative to the distance of the pixel
+
+out vec4 fragColor;
+
+const float kernel[3] = float[3](3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0);
+
+void main()
+{
+    ivec2 size = textureSize(image, 0);
+    ivec2 coord = ivec2(gl_FragCoord.xy);
+    vec4 centerColor = texelFetch(image, coord, 0);
+    vec4 centerGeometry = texelFetch(normalDepth, coord, 0);
+    vec4 centerAlbedo = texelFetch(albedoId, coord, 0);
+
+    float colorScale = 1.0 / max(colorSigma * colorSigma, 1e-8);
+    float depthScale = 1.0 / max(depthSigma * abs(centerGeometry.w), 1e-4);
+
+    vec3 sum = vec3(0.0);
+    float weightSum = 0.0;
+    for (int dy = -2; dy <= 2; dy++)
+    for (int dx = -2; dx <= 2; dx++) {
+        ivec2 neighbour = clamp(coord + ivec2(dx, dy) * stepSize, ivec2(0), size - 1);
+        vec4 albedo = texelFetch(albedoId, neighbour, 0);
+        if (albedo.w != centerAlbedo.w || any(notEqual(albedo.rgb, centerAlbedo.rgb))) {
+            continue;
+        }
+        vec3 color = texelFetch(image, neighbour, 0).rgb;
+        vec4 geometry = texelFetch(normalDepth, neighbour, 0);
+
+        vec3 colorDifference = color - centerColor.rgb;
+        float weight = kernel[abs(dx)] * kernel[abs(dy)];
+        weight *= exp(-dot(colorDifference, colorDifference) * colorScale);
+        weight *= pow(max(dot(geometry.xyz, centerGeometry.xyz), 0.0), normalPower);
+        weight *= exp(-abs(geometry.w - centerGeometry.w) * depthScale);
+        sum += weight * color;
+        weightSum += weight;
+    }
+    // The background has no normal, so its pixels are kept as they are.
+    fragColor = vec4(weightSum > 0.0 ? sum / weightSum : centerColor.rgb, centerColor.a);
+}
@@ -0,0 +1,16 @@
+#version 330
+
+uniform sampler2D image;
+uniform vec2 windowSize;
+uniform bool flipY = false;
+
+out vec4 fragColor;
+
+void main()
+{
+    vec2 coord = gl_FragCoord.xy / windowSize;
+    if (flipY) {
+        coord.y = 1.0 - coord.y; // image rows go from top to bottom
+    }
+    fragColor = vec4(clamp(texture(image, coord).rgb, vec3(0), vec3(1)), 1.0f);
+}
@@ -0,0 +1,28 @@
+#version 330
+
+// Hybrid mode: writes the sphere of the impostor (see impostor.vert) and its distance where the ray
+// through the pixel hits it. The depth test keeps the closest sphere: the depth decreases with the distance,
+// so the test is GL_GREATER on a float depth buffer cleared to 0.
+
+#include "sampler.glsl"
+#include "scene.glsl"
+#include "camera.glsl"
+
+flat in int sphereId;
+
+// (sphere id, distance); cleared to -1 for the background.
+layout(location = 0) out vec2 visibility;
+
+void main()
+{
+    float aspect = windowSize.x / windowSize.y;
+    vec3 viewPoint = vec4(camToWorld * vec4(0, 0, 0, 1)).xyz;
+    vec3 ray = primaryRay(imageCoord(), aspect, viewPoint);
+    // The same test as the ray tracer, so the rasterized hits are the traced ones.
+    float distance;
+    if (!intersectSphere(texelFetch(sphereData, sphereId), viewPoint, ray, distance)) {
+        discard;
+    }
+    visibility = vec2(float(sphereId), distance);
+    gl_FragDepth = 1.0 / (1.0 + distance);
+}
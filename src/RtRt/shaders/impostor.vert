@@ -0,0 +1,56 @@
+#version 330
+
+// Hybrid mode: each sphere is drawn as a quad (instance per sphere, 4 vertices as a triangle strip)
+// covering its silhouette; impostor.frag intersects the ray of each covered pixel with the sphere.
+
+uniform samplerBuffer sphereData; // (position, radius) per sphere, as in scene.glsl
+
+uniform mat4 worldToCam;
+uniform float fovTangent;
+uniform vec2 windowSize; // size of the whole image
+// The viewport holds the tile of the image at this offset (see camera.glsl).
+uniform vec2 tileOffset = vec2(0);
+uniform vec2 tileSize;
+
+flat out int sphereId;
+
+// Points closer to the eye are clipped.
+const float nearPlane = 1e-3;
+
+// Camera space to clip space of the tile: the projection of the primary rays with an infinite far plane.
+vec4 project(vec3 p) {
+    float aspect = windowSize.x / windowSize.y;
+    vec4 clip = vec4(p.x / (fovTangent * aspect), p.y / fovTangent, -p.z - 2.0 * nearPlane, -p.z);
+    // The ray of a pixel goes through its corner rather than its center (see primaryRay): half a pixel back.
+    clip.xy -= clip.w / windowSize;
+    // Clip coordinates of the image, then of the tile.
+    clip.xy = (clip.xy * windowSize + clip.w * (windowSize - 2.0 * tileOffset - tileSize)) / tileSize;
+    return clip;
+}
+
+void main()
+{
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+    sphereId = gl_InstanceID;
+
+    vec4 sphere = texelFetch(sphereData, gl_InstanceID);
+    vec3 center = (worldToCam * vec4(sphere.xyz, 1.0)).xyz;
+    float radius = sphere.w;
+    float distance = length(center);
+
+    // The eye is inside the sphere (or nearly): it may cover any pixel.
+    if (distance <= radius + 2.0 * nearPlane) {
+        gl_Position = vec4(corner, 0.0, 1.0);
+        return;
+    }
+
+    // Rays hitting the sphere lie in the cone tangent to it, which crosses the plane through the center
+    // (facing the eye) in a circle: the quad in this plane around the circle covers the sphere.
+    vec3 axis = center / distance;
+    vec3 up = (abs(axis.y) < 0.99) ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0);
+    vec3 right = normalize(cross(up, axis));
+    up = cross(axis, right);
+    // Slightly larger, so that rounding does not lose the pixels grazing the sphere.
+    float halfSize = 1.01 * radius * distance / sqrt(distance * distance - radius * radius);
+    gl_Position = project(center + halfSize * (corner.x * right + corner.y * up));
+}
@@ -1,142 +1,118 @@
 #version 330
 
-struct Sphere {
-    vec3 position;
-    float radius;
-    int materialId;
-};
+// Compile-time specialization: GPURayTracer inserts these defines after #version
+// and caches a program per combination. Defaults below keep the shader compilable as is.
+// REFRACTION_ENABLED - trace refracted rays (needs the ray stack) or reflections only,
+// SAMPLING_MODE - 0 is random (low-discrepancy, see sampler.glsl), 1 is multi-jittered,
+// SINGLE_SAMPLE - one ray through the pixel center (no sampling loop),
+// ACCUMULATE - average with the previous passes (progressive mode),
+// NUM_OF_STEPS - fixed tracing depth; if not defined, the depth is a uniform,
+// ADAPTIVE - adaptive sampling: 1 is the pilot pass, 2 is the refinement pass (0 is off),
+// GBUFFER - no shading: writes the primary hit of each pixel for the denoiser (see writeGBuffer),
+// HYBRID - primary hits of the spheres come from the rasterized visibility buffer (see getPrimaryIntersection);
+// only for rays through the pixel centers.
+#ifndef REFRACTION_ENABLED
+#define REFRACTION_ENABLED 1
+#endif
+#ifndef SAMPLING_MODE
+#define SAMPLING_MODE 0
+#endif
+#ifndef SINGLE_SAMPLE
+#define SINGLE_SAMPLE 0
+#endif
+#ifndef ACCUMULATE
+#define ACCUMULATE 0
+#endif
+#ifndef ADAPTIVE
+#define ADAPTIVE 0
+#endif
+#ifndef GBUFFER
+#define GBUFFER 0
+#endif
+#ifndef HYBRID
+#define HYBRID 0
+#endif
+
+#include "sampler.glsl"
+#include "scene.glsl"
+#include "camera.glsl"
+
+#ifdef NUM_OF_STEPS
+const int numOfSteps = NUM_OF_STEPS;
+#else
+uniform int numOfSteps = 1;
+#endif
 
-struct LightSource {
-    vec3 position;
+struct IntersectionInfo {
+    int objectId;
     vec3 color;
-};
-
-struct Material {
-    vec3 diffuse;
-    vec3 specular;
-    float shininess;
+    vec3 intersectionPoint;
+    vec3 reflectedRay;
+    vec3 refractedRay;
     float refractionCoeff;
-    float refractionIndex;
 };
 
-uniform Sphere spheres[256];
-uniform LightSource lightSources[256];
-uniform Material materials[256];
-
-uniform int numOfSpheres;
-uniform int numOfLightSources;
-
-uniform vec3 ambientLight = vec3(0.05);
-
-uniform int numOfSteps = 1;
-
-uniform vec3 backgroundColor = vec3(0.0);
-
-bool intersectSphere(Sphere sphere, vec3 startPoint, vec3 ray, out float intersectionDistance) {
-    vec3 v = startPoint - sphere.position;
-    float d = dot(v, ray);
-    float discriminant = d * d - (dot(v, v) - sphere.radius * sphere.radius);
-    if (discriminant < 0) {
-        return false;
-    }
-
-    float sq = sqrt(discriminant);
-    float t1 = -d + sq;
-    float t2 = -d - sq;
-
-    float t = 0;
-    float epsilon = 1e-3;
-    if (t1 < epsilon) {
-        if (t2 < epsilon) {
-            return false;
-        }
-        else {
-            t = t2;
-        }
-    } else if (t2 < epsilon) {
-        t = t1;
-    } else {
-        t = (t1 > t2) ? t2 : t1;
-    }
-
-    intersectionDistance = t;
-    return true;
-}
-
-int getIntersection(vec3 startPoint, vec3 ray, out vec3 closestIntersectionPoint) {
-    int closestObject = -1;
-    float minDistance = 1e+8;
-    for (int i = 0; i < numOfSpheres; i++) {
-        float intersectionDistance;
-        if (intersectSphere(spheres[i], startPoint, ray, intersectionDistance)) {
-            if (intersectionDistance < minDistance) {
-                closestObject = i;               
-                minDistance = intersectionDistance;
-            }
-        }
-    }
+#if HYBRID
+// Sphere id (-1 for the background) and hit distance of the ray through each pixel center,
+// rasterized by impostor.frag for the pixels of the pass.
+uniform sampler2D visibility;
+
+// The closest sphere is known, so the ray is only tested against the triangles closer than it:
+// the same hit as getIntersection, without traversing the sphere BVH.
+int getPrimaryIntersection(vec3 startPoint, vec3 ray, out vec3 closestIntersectionPoint) {
+    vec2 visible = texelFetch(visibility, ivec2(gl_FragCoord.xy), 0).xy;
+    int closestObject = int(visible.x);
+    float minDistance = (closestObject == -1) ? 1e+8 : visible.y;
+    intersectMeshes(startPoint, ray, 1.0 / ray, closestObject, minDistance);
     if (closestObject != -1) {
         closestIntersectionPoint = startPoint + minDistance * ray;
     }
     return closestObject;
 }
+#endif
 
-vec3 shade(Material mat, vec3 lightColor, vec3 normal, vec3 reflected, vec3 toLight, vec3 toViewer) {
-    float diffuseCoeff = max(dot(toLight, normal), 0.0);
-    float specularCoeff = 0.0;
-    if (diffuseCoeff > 0.0 && mat.shininess > 0.0) {
-        specularCoeff = pow(max(dot(reflected, toViewer), 0.0), mat.shininess);
+// The primary ray is the one from the eye through the pixel center (hybrid mode takes its hit from the visibility buffer).
+int findIntersection(vec3 point, vec3 ray, bool primary, out vec3 intersectionPoint) {
+#if HYBRID
+    if (primary) {
+        return getPrimaryIntersection(point, ray, intersectionPoint);
     }
-    return (mat.diffuse * diffuseCoeff + mat.specular * specularCoeff) * lightColor;
+#endif
+    return getIntersection(point, ray, intersectionPoint);
 }
 
-struct IntersectionInfo {
-    int sphereId;
-    vec3 color;
-    vec3 intersectionPoint;
-    vec3 reflectedRay;
-    vec3 refractedRay;
-    float refractionCoeff;
-};
-
-bool getColorAtIntersection(vec3 point, vec3 ray, out IntersectionInfo info) {
+bool getColorAtIntersection(vec3 point, vec3 ray, bool primary, out IntersectionInfo info) {
     vec3 color = vec3(0.0);
     vec3 intersectionPoint;
     // Find an object we a looking at
-    int closestObject = getIntersection(point, ray, intersectionPoint);
+    int closestObject = findIntersection(point, ray, primary, intersectionPoint);
     if (closestObject == -1) {
-        info.sphereId = closestObject;
+        info.objectId = closestObject;
         info.color = backgroundColor;
         return false;
     }
 
-    Sphere sphere = spheres[closestObject];
-    Material material = materials[sphere.materialId];
+    Material material = getMaterial(getObjectMaterial(closestObject));
     //return closestSphere.color;
 
-    vec3 normal = normalize(intersectionPoint - sphere.position);
+    vec3 normal = getShadingNormal(closestObject, intersectionPoint, ray, material);
     vec3 toViewer = -ray;
     float cosThetaI = dot(normal, toViewer);
     vec3 reflectedRay = normalize(2 * cosThetaI * normal - toViewer);
 
-    // Add illumination from each light.
-    for (int i = 0; i < numOfLightSources; i++) {
+    // Add illumination from each light (or from the lights sampled from the light tree).
+    int numOfShadowRays = getNumOfShadowRays();
+    for (int i = 0; i < numOfShadowRays; i++) {
         // Check if the point on the object is illuminated by this light (not obscured by an obstacle).
-        vec3 toLight = lightSources[i].position - intersectionPoint;
+        float lightWeight;
+        LightSource light = getShadowRayLight(i, intersectionPoint, lightWeight);
+        vec3 toLight = light.position - intersectionPoint;
         float distanceToLight = length(toLight);
         toLight = normalize(toLight);
-        vec3 intersectionLightPoint;
-        int obstacle = getIntersection(intersectionPoint, toLight, intersectionLightPoint);
-        if (obstacle != -1) {
-            // Check if the light is closer then the intersected object.
-            float distanceToObstacle = length(intersectionLightPoint - intersectionPoint);
-            if (distanceToObstacle > distanceToLight) {
-                obstacle = -1;
-            }
-        }
-        if (obstacle == -1) {
+        // Any obstacle closer than the light will do, as in the wavefront shadow kernel.
+        if (!isOccluded(intersectionPoint, toLight, distanceToLight)) {
             // Apply coefficients of the body color to the intensity of the light source.
-            color += shade(material, lightSources[i].color, normal, reflectedRay, toLight, toViewer);
+            color += lightWeight * shade(material, light.color, normal, reflectedRay, toLight, toViewer);
         }
     }
 
@@ -164,7 +140,7 @@ bool getColorAtIntersection(vec3 point, vec3 ray, out IntersectionInfo info) {
         }
     }
 
-    info.sphereId = closestObject;
+    info.objectId = closestObject;
     info.intersectionPoint = intersectionPoint;
     info.color = color;
     info.reflectedRay = reflectedRay;
@@ -174,6 +150,7 @@ bool getColorAtIntersection(vec3 point, vec3 ray, out IntersectionInfo info) {
     return true;
 }
 
+#if REFRACTION_ENABLED
 const int PRIMARY_RAY = 0;
 const int REFLECTION_RAY = 1;
 const int REFRACTION_RAY = 2;
@@ -188,7 +165,13 @@ struct State {
     bool shootRay;
 };
 
+// Each level of depth keeps at most two states on the stack (parent and pending sibling),
+// so a fixed depth needs a much smaller stack.
+#if defined(NUM_OF_STEPS) && (2 * NUM_OF_STEPS + 2 < 1024)
+const int maxStackSize = 2 * NUM_OF_STEPS + 2;
+#else
 const int maxStackSize = 1024;
+#endif
 int currStackSize = 0;
 State stack[maxStackSize];
 
@@ -227,7 +210,7 @@ vec3 getIlluminationFull(vec3 point, vec3 ray) {
             continue;
         }
         IntersectionInfo info;
-        bool hasIntersection = getColorAtIntersection(curr.point, curr.ray, info);
+        bool hasIntersection = getColorAtIntersection(curr.point, curr.ray, curr.depth == 1, info);
         // Add parent task.
         State state = curr;
         state.color = info.color;
@@ -245,7 +228,7 @@ vec3 getIlluminationFull(vec3 point, vec3 ray) {
             // Reflected ray.
             float reflectionCoeff = 1.0 - info.refractionCoeff;
             if (reflectionCoeff > 1e-3) {
-                vec3 reflMult = reflectionCoeff * materials[spheres[info.sphereId].materialId].specular;
+                vec3 reflMult = reflectionCoeff * getMaterial(getObjectMaterial(info.objectId)).specular;
                 newState.ray = info.reflectedRay;
                 newState.coeff = reflMult;
                 push(newState);
@@ -260,7 +243,7 @@ vec3 getIlluminationFull(vec3 point, vec3 ray) {
     }
     return finalColor;
 }
-
+#else
 vec3 getIlluminationReflectionOnly(vec3 point, vec3 ray) {
     vec3 totalColor = vec3(0.0);
     vec3 currPoint = point;
@@ -270,7 +253,7 @@ vec3 getIlluminationReflectionOnly(vec3 point, vec3 ray) {
     bool stop = false;
     for (int n = 0; n < numOfSteps && !stop; n++) {
         IntersectionInfo info;
-        bool hasIntersection = getColorAtIntersection(currPoint, currRay, info);
+        bool hasIntersection = getColorAtIntersection(currPoint, currRay, n == 0, info);
         if (!hasIntersection) {
             totalColor += currMult * info.color;
             stop = true;
@@ -278,77 +261,165 @@ vec3 getIlluminationReflectionOnly(vec3 point, vec3 ray) {
             totalColor += currMult * info.color;
             currPoint = info.intersectionPoint;
             currRay = info.reflectedRay;
-            currMult *= materials[spheres[info.sphereId].materialId].specular;
+            currMult *= getMaterial(getObjectMaterial(info.objectId)).specular;
         }
     }
     return totalColor;
 }
+#endif
 
-uniform mat4 camToWorld;
-uniform vec2 windowSize;
 uniform float cameraFOV;
-uniform float fovTangent;
 
-uniform sampler2D jitter;
-uniform int jitterSize;
+uniform int numOfSamples = 1;
 
-uniform sampler1D randoms;
-uniform int randomsSize;
+// Progressive mode: the pass is averaged with the previous passes stored in history.
+uniform sampler2D history;
+uniform int frameIndex = 0; // number of passes in history (temporal mode: passes so far, for new samples)
 
-uniform int numOfSamples = 1;
-uniform int samplingMode = 0;
-uniform bool refractionEnabled = true;
+// Adaptive sampling: the pilot pass traces the first samples of each pixel and stores
+// their mean color and mean squared luminance. The refinement pass traces the rest of the samples
+// only where the error estimated from these moments is above the threshold.
+uniform sampler2D pilotSamples;
+uniform int numOfPilotSamples = 4;
+uniform float adaptiveThreshold = 0.002;
 
-out vec4 fragColor;
+layout(location = 0) out vec4 fragColor;
 
-int currRand = 0;
+vec3 shoot(vec2 fragCoord, float aspect, vec3 viewPoint) {
+    // Sample positions differ, so they seed the random numbers of the sample.
+    seedRandom(floatBitsToUint(fragCoord.x) ^ hashUint(floatBitsToUint(fragCoord.y) ^ hashUint(uint(frameIndex))));
+    vec3 ray = primaryRay(fragCoord, aspect, viewPoint);
+#if REFRACTION_ENABLED
+    return getIlluminationFull(viewPoint, ray);
+#else
+    return getIlluminationReflectionOnly(viewPoint, ray);
+#endif
+}
 
-void seed(int seed) {
-    currRand = seed;
+int numOfPixelSamples() {
+#if SAMPLING_MODE == 0
+    return numOfSamples;
+#else
+    return numOfSamples * numOfSamples;
+#endif
 }
 
-float rand() {
-    float value = texture(randoms, float(currRand) / float(randomsSize)).r;
-    currRand++;
-    return value;
+// Offset of the sample k inside the pixel.
+vec2 pixelSampleOffset(uvec2 scramble, int k) {
+    vec2 offset = sampleOffset(scramble, frameIndex * numOfPixelSamples() + k);
+#if SAMPLING_MODE != 0
+    // Cells are visited along diagonals, so any first N samples cover all rows and columns.
+    int i = k % numOfSamples;
+    int j = (k / numOfSamples + i) % numOfSamples;
+    offset = (vec2(i, j) + offset) / numOfSamples;
+#endif
+    return offset;
 }
 
-vec3 shoot(vec2 fragCoord, float aspect, vec3 viewPoint) {
-    float px = (2 * (fragCoord.x + 0.5) / windowSize.x - 1) * fovTangent * aspect;
-    float py = (2 * (fragCoord.y + 0.5) / windowSize.y - 1) * fovTangent;
-    vec3 posWorld = vec4(camToWorld * vec4(px, py, -1, 1)).xyz;
-    vec3 ray = normalize(posWorld - viewPoint);
-    vec3 color = refractionEnabled ?
-                getIlluminationFull(viewPoint, ray) :
-                getIlluminationReflectionOnly(viewPoint, ray);
-    return color;
+// Sum of colors of the samples from first to last (exclusive).
+vec3 traceSamples(uvec2 scramble, int first, int last, float aspect, vec3 viewPoint) {
+    vec3 sum = vec3(0);
+    for (int k = first; k < last; k++) {
+        sum += shoot(imageCoord() - vec2(0.5) + pixelSampleOffset(scramble, k), aspect, viewPoint);
+    }
+    return sum;
+}
+
+float luminance(vec3 color) {
+    return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+#if ADAPTIVE == 2
+// Estimated error of the pilot mean: the largest one around the pixel, so that
+// edges missed by the pilot samples of the pixel are caught by its neighbours.
+float pilotError() {
+    ivec2 size = textureSize(pilotSamples, 0);
+    ivec2 coord = ivec2(gl_FragCoord.xy);
+    float maxVariance = 0.0;
+    for (int dy = -1; dy <= 1; dy++)
+    for (int dx = -1; dx <= 1; dx++) {
+        vec4 moments = texelFetch(pilotSamples, clamp(coord + ivec2(dx, dy), ivec2(0), size - 1), 0);
+        float mean = luminance(moments.rgb);
+        maxVariance = max(maxVariance, moments.a - mean * mean);
+    }
+    // Unbiased sample variance, then the variance of the mean.
+    float variance = maxVariance * numOfPilotSamples / max(numOfPilotSamples - 1, 1);
+    return sqrt(max(variance, 0.0) / numOfPilotSamples);
 }
+#endif
+
+#if GBUFFER
+// Second target of the G-buffer, the first one is fragColor.
+layout(location = 1) out vec4 albedoId;
+
+// Primary hit through the same point as a single sample: (shading normal, distance from the eye)
+// and (diffuse color, surface id). The id is the sphere index; triangles of a mesh share one surface,
+// identified by the material (-2 - material index). Distance and id are -1 for the background.
+void writeGBuffer(float aspect, vec3 viewPoint) {
+    vec3 ray = primaryRay(imageCoord(), aspect, viewPoint);
+    vec3 point;
+    int objectId = findIntersection(viewPoint, ray, true, point);
+    if (objectId == -1) {
+        fragColor = vec4(0.0, 0.0, 0.0, -1.0);
+        albedoId = vec4(backgroundColor, -1.0);
+        return;
+    }
+    int materialIndex = getObjectMaterial(objectId);
+    Material material = getMaterial(materialIndex);
+    vec3 normal = getShadingNormal(objectId, point, ray, material);
+    int surfaceId = isTriangle(objectId) ? -2 - materialIndex : objectId;
+    fragColor = vec4(normal, length(point - viewPoint));
+    albedoId = vec4(material.diffuse, float(surfaceId));
+}
+#endif
 
 void main()
 {
     float aspect = windowSize.x / windowSize.y; // assuming width > height
     vec3 viewPoint = vec4(camToWorld * vec4(0, 0, 0, 1)).xyz;
+#if GBUFFER
+    writeGBuffer(aspect, viewPoint);
+    return;
+#endif
+#if HYBRID
+    // Background seen through the pixel: nothing to trace.
+    if (numOfMeshBvhNodes == 0 && texelFetch(visibility, ivec2(gl_FragCoord.xy), 0).x < 0.0) {
+        fragColor = vec4(clamp(backgroundColor, vec3(0), vec3(1)), 1.0f);
+        return;
+    }
+#endif
     vec3 color = vec3(0);
-    if (numOfSamples == 1) {
-        color = shoot(gl_FragCoord.xy, aspect, viewPoint);
-    } else {
-        seed(int(gl_FragCoord.x * windowSize.y + gl_FragCoord.y));
-        if (samplingMode == 0) {
-            for (int i = 0; i < numOfSamples; i++) {
-                float dx = rand();
-                float dy = rand();
-                color += shoot(gl_FragCoord.xy - vec2(0.5) + vec2(dx, dy), aspect, viewPoint);
-            }
-            color /= numOfSamples;
-        } else {
-            for (int i = 0; i < numOfSamples; i++)
-            for (int j = 0; j < numOfSamples; j++) {
-                float dx = (i + rand()) / numOfSamples;
-                float dy = (j + rand()) / numOfSamples;
-                color += shoot(gl_FragCoord.xy - vec2(0.5) + vec2(dx, dy), aspect, viewPoint);
-            }
-            color /= (numOfSamples * numOfSamples);
-        }       
+#if SINGLE_SAMPLE
+    color = shoot(imageCoord(), aspect, viewPoint);
+#else
+    uvec2 scramble = pixelScramble(ivec2(imageCoord()));
+#if ADAPTIVE == 1
+    float sumOfSquares = 0.0;
+    for (int k = 0; k < numOfPilotSamples; k++) {
+        vec3 sampleColor = shoot(imageCoord() - vec2(0.5) + pixelSampleOffset(scramble, k), aspect, viewPoint);
+        color += sampleColor;
+        sumOfSquares += luminance(sampleColor) * luminance(sampleColor);
+    }
+    fragColor = vec4(color / numOfPilotSamples, sumOfSquares / numOfPilotSamples);
+    return;
+#elif ADAPTIVE == 2
+    color = texelFetch(pilotSamples, ivec2(gl_FragCoord.xy), 0).rgb;
+    if (pilotError() > adaptiveThreshold) {
+        color = (color * numOfPilotSamples +
+                 traceSamples(scramble, numOfPilotSamples, numOfPixelSamples(), aspect, viewPoint)) / numOfPixelSamples();
+    }
+#else
+    color = traceSamples(scramble, 0, numOfPixelSamples(), aspect, viewPoint) / numOfPixelSamples();
+#endif
+#endif
+#if ACCUMULATE
+    // Keep the unclamped running average, it is clamped on display.
+    if (frameIndex > 0) {
+        vec3 prevColor = texelFetch(history, ivec2(gl_FragCoord.xy), 0).rgb;
+        color = (prevColor * frameIndex + color) / (frameIndex + 1);
     }
-    fragColor = vec4(clamp(color, vec3(0), vec3(1)), 1.0f);    
+    fragColor = vec4(color, 1.0f);
+#else
+    fragColor = vec4(clamp(color, vec3(0), vec3(1)), 1.0f);
+#endif
 }
@@ -0,0 +1,40 @@
+// Sample offsets inside a pixel, computed without textures (CPURayTracer has the same functions).
+// Offsets follow the R2 low-discrepancy sequence; each pixel shifts the sequence by a hashed
+// value (Cranley-Patterson rotation), so neighbouring pixels are not correlated.
+// Passes of progressive rendering continue the sequence of the pixel instead of restarting it.
+// Arithmetic is done in 32-bit fixed point, so wrapping around is the fractional part.
+
+// Integer hash (lowbias32 by C. Wellons).
+uint hashUint(uint x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+uvec2 pixelScramble(ivec2 pixel) {
+    uint h = hashUint(uint(pixel.x) ^ hashUint(uint(pixel.y)));
+    return uvec2(h, hashUint(h));
+}
+
+// Point of the R2 sequence: 2^32 / g and 2^32 / g^2, g is the plastic number.
+vec2 sampleOffset(uvec2 scramble, int index) {
+    uvec2 value = scramble + uint(index) * uvec2(0xc13fa9a9u, 0x91e10da6u);
+    // The top 24 bits are exact in a float.
+    return vec2(value >> 8u) * (1.0 / 16777216.0);
+}
+
+// Random numbers for choices along a path (e.g. picking a light, see scene.glsl):
+// a hash chain seeded per sample, the same in CPURayTracer.
+uint randomState = 0u;
+
+void seedRandom(uint seed) {
+    randomState = hashUint(seed);
+}
+
+float nextRandom() {
+    randomState = hashUint(randomState + 0x9e3779b9u);
+    return float(randomState >> 8u) * (1.0 / 16777216.0);
+}
@@ -0,0 +1,395 @@
+// Scene data, ray-object intersection and shading shared by the ray tracing shaders.
+// Included by GPURayTracer's shader loader (see shader_source.h); the including shader sets #version
+// and includes sampler.glsl first (light sampling uses its random numbers).
+
+struct Sphere {
+    vec3 position;
+    float radius;
+    int materialId;
+};
+
+struct LightSource {
+    vec3 position;
+    vec3 color;
+};
+
+struct Material {
+    vec3 diffuse;
+    vec3 specular;
+    float shininess;
+    float refractionCoeff;
+    float refractionIndex;
+};
+
+// Scene data is stored in buffer textures:
+// sphereData - (position, radius) per sphere,
+// sphereMaterials - material index per sphere,
+// lightData - (position, 0), (color, 0) per light,
+// materialData - (diffuse, shininess), (specular, refractionCoeff), (refractionIndex, 0, 0, 0) per material.
+uniform samplerBuffer sphereData;
+uniform isamplerBuffer sphereMaterials;
+uniform samplerBuffer lightData;
+uniform samplerBuffer materialData;
+
+uniform int numOfLightSources;
+
+// Light tree (see LightTree): (min, power), (max, link) per node, link is the second child
+// of an internal node or -1 - light index for a leaf.
+uniform samplerBuffer lightTree;
+// Shadow rays per hit: with more lights than this, lights are picked at random from the light tree.
+// 0 shades all the lights.
+uniform int numOfLightSamples = 0;
+
+Sphere getSphere(int index) {
+    vec4 data = texelFetch(sphereData, index);
+    Sphere sphere;
+    sphere.position = data.xyz;
+    sphere.radius = data.w;
+    sphere.materialId = texelFetch(sphereMaterials, index).r;
+    return sphere;
+}
+
+LightSource getLightSource(int index) {
+    LightSource light;
+    light.position = texelFetch(lightData, 2 * index).xyz;
+    light.color = texelFetch(lightData, 2 * index + 1).xyz;
+    return light;
+}
+
+float lightImportance(int node, vec3 point) {
+    vec4 nodeMin = texelFetch(lightTree, 2 * node);
+    vec3 nodeMax = texelFetch(lightTree, 2 * node + 1).xyz;
+    vec3 halfSize = 0.5 * (nodeMax - nodeMin.xyz);
+    vec3 toCenter = point - 0.5 * (nodeMin.xyz + nodeMax);
+    return nodeMin.w / max(max(dot(toCenter, toCenter), dot(halfSize, halfSize)), 1e-6);
+}
+
+// Picks a light going down the tree, each child with probability proportional to its importance.
+int sampleLightTree(vec3 point, out float probability) {
+    int node = 0;
+    probability = 1.0;
+    while (true) {
+        int link = int(texelFetch(lightTree, 2 * node + 1).w);
+        if (link < 0) {
+            return -1 - link;
+        }
+        float first = lightImportance(node + 1, point);
+        float second = lightImportance(link, point);
+        float firstProbability = (first + second > 0.0) ? first / (first + second) : 0.5;
+        if (nextRandom() < firstProbability) {
+            probability *= firstProbability;
+            node = node + 1;
+        } else {
+            probability *= 1.0 - firstProbability;
+            node = link;
+        }
+    }
+    return -1;
+}
+
+int getNumOfShadowRays() {
+    return (numOfLightSamples > 0 && numOfLightSources > numOfLightSamples) ? numOfLightSamples : numOfLightSources;
+}
+
+// Light of the shadow ray and the weight of its contribution: each light has weight 1
+// when all of them are shaded, a sampled one is divided by its probability and the number of samples.
+LightSource getShadowRayLight(int index, vec3 point, out float weight) {
+    if (getNumOfShadowRays() == numOfLightSources) {
+        weight = 1.0;
+        return getLightSource(index);
+    }
+    float probability;
+    int light = sampleLightTree(point, probability);
+    weight = 1.0 / (probability * float(numOfLightSamples));
+    return getLightSource(light);
+}
+
+Material getMaterial(int index) {
+    vec4 data0 = texelFetch(materialData, 3 * index);
+    vec4 data1 = texelFetch(materialData, 3 * index + 1);
+    vec4 data2 = texelFetch(materialData, 3 * index + 2);
+    Material material;
+    material.diffuse = data0.xyz;
+    material.shininess = data0.w;
+    material.specular = data1.xyz;
+    material.refractionCoeff = data1.w;
+    material.refractionIndex = data2.x;
+    return material;
+}
+
+uniform vec3 ambientLight = vec3(0.05);
+
+
+uniform vec3 backgroundColor = vec3(0.0);
+
+// Sphere is (position, radius).
+bool intersectSphere(vec4 sphere, vec3 startPoint, vec3 ray, out float intersectionDistance) {
+    vec3 v = startPoint - sphere.xyz;
+    float d = dot(v, ray);
+    float discriminant = d * d - (dot(v, v) - sphere.w * sphere.w);
+    if (discriminant < 0) {
+        return false;
+    }
+
+    float sq = sqrt(discriminant);
+    float t1 = -d + sq;
+    float t2 = -d - sq;
+
+    float t = 0;
+    float epsilon = 1e-3;
+    if (t1 < epsilon) {
+        if (t2 < epsilon) {
+            return false;
+        }
+        else {
+            t = t2;
+        }
+    } else if (t2 < epsilon) {
+        t = t1;
+    } else {
+        t = (t1 > t2) ? t2 : t1;
+    }
+
+    intersectionDistance = t;
+    return true;
+}
+
+// BVH nodes: two texels per node, (min, first primitive or skip link), (max, number of primitives).
+uniform samplerBuffer bvhNodes;
+// Indices of spheres referenced by BVH leaves.
+uniform isamplerBuffer bvhIndices;
+uniform int numOfBvhNodes = 0;
+
+// Triangle meshes have their own BVH (the same node layout):
+// meshVertices - (position, 0) per vertex of all the meshes,
+// meshTriangles - (v0, v1, v2, material index) per triangle,
+// meshBvhIndices - indices of triangles referenced by the mesh BVH leaves.
+uniform samplerBuffer meshVertices;
+uniform isamplerBuffer meshTriangles;
+uniform samplerBuffer meshBvhNodes;
+uniform isamplerBuffer meshBvhIndices;
+uniform int numOfMeshBvhNodes = 0;
+
+// Object ids: -1 is no object, spheres are 0, 1, ..., triangle t is -2 - t.
+bool isTriangle(int objectId) {
+    return objectId < -1;
+}
+
+int triangleIndex(int objectId) {
+    return -2 - objectId;
+}
+
+int getObjectMaterial(int objectId) {
+    if (isTriangle(objectId)) {
+        return texelFetch(meshTriangles, triangleIndex(objectId)).w;
+    }
+    return texelFetch(sphereMaterials, objectId).r;
+}
+
+// Outward normal for spheres, the front face normal for triangles (counter-clockwise vertices).
+vec3 getObjectNormal(int objectId, vec3 point) {
+    if (isTriangle(objectId)) {
+        ivec4 triangle = texelFetch(meshTriangles, triangleIndex(objectId));
+        vec3 v0 = texelFetch(meshVertices, triangle.x).xyz;
+        vec3 v1 = texelFetch(meshVertices, triangle.y).xyz;
+        vec3 v2 = texelFetch(meshVertices, triangle.z).xyz;
+        return normalize(cross(v1 - v0, v2 - v0));
+    }
+    return normalize(point - texelFetch(sphereData, objectId).xyz);
+}
+
+// Normal at the hit of the ray: triangles of open meshes are seen from both sides, so opaque ones
+// face the viewer; refractive ones keep the front face normal to tell entering from leaving.
+vec3 getShadingNormal(int objectId, vec3 point, vec3 ray, Material material) {
+    vec3 normal = getObjectNormal(objectId, point);
+    if (isTriangle(objectId) && material.refractionCoeff <= 0.0 && dot(normal, ray) > 0.0) {
+        normal = -normal;
+    }
+    return normal;
+}
+
+bool intersectBox(vec3 boxMin, vec3 boxMax, vec3 startPoint, vec3 invRay, float maxDistance) {
+    vec3 t0 = (boxMin - startPoint) * invRay;
+    vec3 t1 = (boxMax - startPoint) * invRay;
+    vec3 tNear = min(t0, t1);
+    vec3 tFar = max(t0, t1);
+    float tMin = max(max(tNear.x, tNear.y), tNear.z);
+    float tMax = min(min(tFar.x, tFar.y), tFar.z);
+    return tMax >= max(tMin, 0.0) && tMin < maxDistance;
+}
+
+// Ray prepared for the watertight ray-triangle test (Woop, Benthin, Wald, "Watertight Ray/Triangle Intersection"):
+// vertices are translated to the ray origin and sheared, so that the ray goes along the z axis,
+// and the test is done with 2D edge functions. Edges shared by triangles get the same sign,
+// so rays can't slip between the triangles of a mesh.
+struct TriangleRay {
+    vec3 origin;
+    ivec3 axes; // kx, ky, kz: kz is the largest component of the direction
+    vec3 shear; // Sx, Sy, Sz
+};
+
+TriangleRay makeTriangleRay(vec3 origin, vec3 ray) {
+    vec3 absRay = abs(ray);
+    int kz = (absRay.x > absRay.y) ? (absRay.x > absRay.z ? 0 : 2) : (absRay.y > absRay.z ? 1 : 2);
+    int kx = (kz + 1) % 3;
+    int ky = (kx + 1) % 3;
+    // Keep the winding of the triangles.
+    if (ray[kz] < 0.0) {
+        int k = kx;
+        kx = ky;
+        ky = k;
+    }
+    TriangleRay r;
+    r.origin = origin;
+    r.axes = ivec3(kx, ky, kz);
+    r.shear = vec3(ray[kx] / ray[kz], ray[ky] / ray[kz], 1.0 / ray[kz]);
+    return r;
+}
+
+// Both faces are hit; the distance is along the (unit) ray.
+bool intersectTriangle(TriangleRay r, int triangle, out float intersectionDistance) {
+    ivec4 vertices = texelFetch(meshTriangles, triangle);
+    vec3 a = texelFetch(meshVertices, vertices.x).xyz - r.origin;
+    vec3 b = texelFetch(meshVertices, vertices.y).xyz - r.origin;
+    vec3 c = texelFetch(meshVertices, vertices.z).xyz - r.origin;
+    vec3 az = vec3(a[r.axes.z], b[r.axes.z], c[r.axes.z]);
+    vec3 ax = vec3(a[r.axes.x], b[r.axes.x], c[r.axes.x]) - r.shear.x * az;
+    vec3 ay = vec3(a[r.axes.y], b[r.axes.y], c[r.axes.y]) - r.shear.y * az;
+    // Edge functions (scaled barycentric coordinates).
+    float u = ax.z * ay.y - ay.z * ax.y;
+    float v = ax.x * ay.z - ay.x * ax.z;
+    float w = ax.y * ay.x - ay.y * ax.x;
+    if ((u < 0.0 || v < 0.0 || w < 0.0) && (u > 0.0 || v > 0.0 || w > 0.0)) {
+        return false;
+    }
+    float det = u + v + w;
+    if (det == 0.0) {
+        return false;
+    }
+    float t = dot(vec3(u, v, w), r.shear.z * az) / det;
+    if (t < 1e-3) {
+        return false;
+    }
+    intersectionDistance = t;
+    return true;
+}
+
+// Closest triangle hit closer than minDistance.
+void intersectMeshes(vec3 startPoint, vec3 ray, vec3 invRay, inout int closestObject, inout float minDistance) {
+    TriangleRay triangleRay = makeTriangleRay(startPoint, ray);
+    int node = 0;
+    while (node < numOfMeshBvhNodes) {
+        vec4 nodeMin = texelFetch(meshBvhNodes, 2 * node);
+        vec4 nodeMax = texelFetch(meshBvhNodes, 2 * node + 1);
+        int count = int(nodeMax.w);
+        if (!intersectBox(nodeMin.xyz, nodeMax.xyz, startPoint, invRay, minDistance)) {
+            node = (count > 0) ? node + 1 : int(nodeMin.w);
+            continue;
+        }
+        int first = int(nodeMin.w);
+        for (int i = first; i < first + count; i++) {
+            int triangle = texelFetch(meshBvhIndices, i).r;
+            float intersectionDistance;
+            if (intersectTriangle(triangleRay, triangle, intersectionDistance) && intersectionDistance < minDistance) {
+                closestObject = -2 - triangle;
+                minDistance = intersectionDistance;
+            }
+        }
+        node++;
+    }
+}
+
+bool isMeshOccluded(vec3 startPoint, vec3 ray, vec3 invRay, float maxDistance) {
+    TriangleRay triangleRay = makeTriangleRay(startPoint, ray);
+    int node = 0;
+    while (node < numOfMeshBvhNodes) {
+        vec4 nodeMin = texelFetch(meshBvhNodes, 2 * node);
+        vec4 nodeMax = texelFetch(meshBvhNodes, 2 * node + 1);
+        int count = int(nodeMax.w);
+        if (!intersectBox(nodeMin.xyz, nodeMax.xyz, startPoint, invRay, maxDistance)) {
+            node = (count > 0) ? node + 1 : int(nodeMin.w);
+            continue;
+        }
+        int first = int(nodeMin.w);
+        for (int i = first; i < first + count; i++) {
+            float intersectionDistance;
+            if (intersectTriangle(triangleRay, texelFetch(meshBvhIndices, i).r, intersectionDistance) &&
+                    intersectionDistance <= maxDistance) {
+                return true;
+            }
+        }
+        node++;
+    }
+    return false;
+}
+
+int getIntersection(vec3 startPoint, vec3 ray, out vec3 closestIntersectionPoint) {
+    int closestObject = -1;
+    float minDistance = 1e+8;
+    vec3 invRay = 1.0 / ray;
+    // Stackless traversal: next node on hit, skip link on miss.
+    int node = 0;
+    while (node < numOfBvhNodes) {
+        vec4 nodeMin = texelFetch(bvhNodes, 2 * node);
+        vec4 nodeMax = texelFetch(bvhNodes, 2 * node + 1);
+        int count = int(nodeMax.w);
+        if (!intersectBox(nodeMin.xyz, nodeMax.xyz, startPoint, invRay, minDistance)) {
+            node = (count > 0) ? node + 1 : int(nodeMin.w);
+            continue;
+        }
+        int first = int(nodeMin.w);
+        for (int i = first; i < first + count; i++) {
+            int sphereId = texelFetch(bvhIndices, i).r;
+            float intersectionDistance;
+            if (intersectSphere(texelFetch(sphereData, sphereId), startPoint, ray, intersectionDistance)) {
+                if (intersectionDistance < minDistance) {
+                    closestObject = sphereId;
+                    minDistance = intersectionDistance;
+                }
+            }
+        }
+        node++;
+    }
+    // The closest sphere limits the mesh traversal.
+    intersectMeshes(startPoint, ray, invRay, closestObject, minDistance);
+    if (closestObject != -1) {
+        closestIntersectionPoint = startPoint + minDistance * ray;
+    }
+    return closestObject;
+}
+
+// Any hit closer than maxDistance: the same test as comparing the closest hit with the distance,
+// but stops at the first hit found.
+bool isOccluded(vec3 startPoint, vec3 ray, float maxDistance) {
+    vec3 invRay = 1.0 / ray;
+    int node = 0;
+    while (node < numOfBvhNodes) {
+        vec4 nodeMin = texelFetch(bvhNodes, 2 * node);
+        vec4 nodeMax = texelFetch(bvhNodes, 2 * node + 1);
+        int count = int(nodeMax.w);
+        if (!intersectBox(nodeMin.xyz, nodeMax.xyz, startPoint, invRay, maxDistance)) {
+            node = (count > 0) ? node + 1 : int(nodeMin.w);
+            continue;
+        }
+        int first = int(nodeMin.w);
+        for (int i = first; i < first + count; i++) {
+            int sphereId = texelFetch(bvhIndices, i).r;
+            float intersectionDistance;
+            if (intersectSphere(texelFetch(sphereData, sphereId), startPoint, ray, intersectionDistance) &&
+                    intersectionDistance <= maxDistance) {
+                return true;
+            }
+        }
+        node++;
+    }
+    return isMeshOccluded(startPoint, ray, invRay, maxDistance);
+}
+
+vec3 shade(Material mat, vec3 lightColor, vec3 normal, vec3 reflected, vec3 toLight, vec3 toViewer) {
+    float diffuseCoeff = max(dot(toLight, normal), 0.0);
+    float specularCoeff = 0.0;
+    if (diffuseCoeff > 0.0 && mat.shininess > 0.0) {
+        specularCoeff = pow(max(dot(reflected, toViewer), 0.0), mat.shininess);
+    }
+    return (mat.diffuse * diffuseCoeff + mat.specular * specularCoeff) * lightColor;
+}
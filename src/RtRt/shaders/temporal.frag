@@ -0,0 +1,87 @@
+#version 330
+
+// Temporal reprojection: blends a new pass with the previous result, so that the passes
+// traced while the camera moves are reused instead of being thrown away.
+// The point seen through the pixel is rebuilt from the G-buffer (see raytrace.frag, GBUFFER)
+// and projected with the previous camera; the history there is kept only if the previous G-buffer
+// saw the same surface at the same distance. The kept history is clamped to the colors of the new pass
+// around the pixel, so that shading which changed with the view (reflections) does not leave trails.
+// The result is (color, number of blended passes).
+
+uniform sampler2D pass;
+uniform sampler2D history;
+uniform sampler2D normalDepth; // (normal, distance from the eye)
+uniform sampler2D albedoId; // (diffuse color, surface id)
+uniform sampler2D prevNormalDepth;
+uniform sampler2D prevAlbedoId;
+
+uniform mat4 camToWorld;
+uniform float fovTangent;
+uniform vec2 windowSize;
+uniform mat4 prevWorldToCam;
+uniform float prevFovTangent;
+
+uniform bool historyValid = false;
+uniform int maxHistory = 32;
+
+// Distances seen from the previous camera may differ by this fraction.
+const float depthTolerance = 0.02;
+
+out vec4 fragColor;
+
+void main()
+{
+    ivec2 size = textureSize(pass, 0);
+    ivec2 coord = ivec2(gl_FragCoord.xy);
+    vec3 color = texelFetch(pass, coord, 0).rgb;
+    if (!historyValid) {
+        fragColor = vec4(color, 1.0);
+        return;
+    }
+
+    // The same ray as the G-buffer one (see primaryRay in raytrace.frag).
+    float aspect = windowSize.x / windowSize.y;
+    vec3 viewPoint = vec4(camToWorld * vec4(0, 0, 0, 1)).xyz;
+    float px = (2 * (gl_FragCoord.x + 0.5) / windowSize.x - 1) * fovTangent * aspect;
+    float py = (2 * (gl_FragCoord.y + 0.5) / windowSize.y - 1) * fovTangent;
+    vec3 ray = normalize(vec4(camToWorld * vec4(px, py, -1, 1)).xyz - viewPoint);
+
+    float hitDistance = texelFetch(normalDepth, coord, 0).w;
+    float surfaceId = texelFetch(albedoId, coord, 0).w;
+    // The background is at infinity: only the direction is projected.
+    vec4 point = (hitDistance < 0.0) ? vec4(ray, 0.0) : vec4(viewPoint + hitDistance * ray, 1.0);
+
+    vec4 prevPoint = prevWorldToCam * point;
+    bool accepted = prevPoint.z < 0.0;
+    // Inverse of the primary ray mapping with the previous camera: the pixel coordinates the ray went through.
+    vec2 prevFragCoord = (prevPoint.xy / (-prevPoint.z) / (prevFovTangent * vec2(aspect, 1.0)) + 1.0)
+            * windowSize / 2.0 - 0.5;
+    ivec2 prevCoord = ivec2(floor(prevFragCoord));
+    accepted = accepted && all(greaterThanEqual(prevCoord, ivec2(0))) && all(lessThan(prevCoord, size));
+
+    if (accepted) {
+        accepted = texelFetch(prevAlbedoId, prevCoord, 0).w == surfaceId;
+        if (hitDistance >= 0.0) {
+            float prevDistance = texelFetch(prevNormalDepth, prevCoord, 0).w;
+            accepted = accepted && abs(prevDistance - length(prevPoint.xyz)) <= depthTolerance * prevDistance;
+        }
+    }
+    if (!accepted) {
+        fragColor = vec4(color, 1.0);
+        return;
+    }
+
+    vec3 minColor = color;
+    vec3 maxColor = color;
+    for (int dy = -1; dy <= 1; dy++)
+    for (int dx = -1; dx <= 1; dx++) {
+        vec3 neighbour = texelFetch(pass, clamp(coord + ivec2(dx, dy), ivec2(0), size - 1), 0).rgb;
+        minColor = min(minColor, neighbour);
+        maxColor = max(maxColor, neighbour);
+    }
+
+    vec4 prev = texture(history, prevFragCoord / windowSize);
+    vec3 prevColor = clamp(prev.rgb, minColor, maxColor);
+    float numOfPasses = min(prev.a, float(maxHistory));
+    fragColor = vec4(mix(prevColor, color, 1.0 / (numOfPasses + 1.0)), numOfPasses + 1.0);
+}
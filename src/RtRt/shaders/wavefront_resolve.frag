@@ -0,0 +1,34 @@
+#version 430
+
+// Converts colors accumulated by the wavefront kernels (fixed point, see wavefront.comp)
+// into the image, averaging with the previous passes in progressive mode like raytrace.frag.
+
+const float COLOR_SCALE = 65536.0;
+
+layout(std430, binding = 0) buffer Pixels {
+    uvec4 pixels[];
+};
+
+uniform vec2 windowSize;
+
+uniform bool accumulate = false;
+uniform sampler2D history;
+uniform int frameIndex = 0; // number of passes in history
+
+out vec4 fragColor;
+
+void main()
+{
+    ivec2 coord = ivec2(gl_FragCoord.xy);
+    vec3 color = vec3(pixels[coord.y * int(windowSize.x) + coord.x].rgb) / COLOR_SCALE;
+    if (accumulate) {
+        // Keep the unclamped running average, it is clamped on display.
+        if (frameIndex > 0) {
+            vec3 prevColor = texelFetch(history, coord, 0).rgb;
+            color = (prevColor * frameIndex + color) / (frameIndex + 1);
+        }
+        fragColor = vec4(color, 1.0f);
+    } else {
+        fragColor = vec4(clamp(color, vec3(0), vec3(1)), 1.0f);
+    }
+}
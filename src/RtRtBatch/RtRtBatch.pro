@@ -0,0 +1,28 @@
+# Command line renderer: renders a scene offscreen (no window) and writes the image to a file.
+# Can also split the image into tiles rendered by worker processes over TCP (--listen, --worker).
+
+QT += core gui network
+CONFIG += c++14 console
+CONFIG -= app_bundle
+
+TARGET = RtRtBatch
+TEMPLATE = app
+
+# Next to the interactive application, so the same 'shaders' directory is found.
+DESTDIR = $$PWD/../RtRt
+
+QMAKE_LFLAGS += -no-pie
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+include(../RtRt/core.pri)
+
+SOURCES += main.cpp \
+    tile_coordinator.cpp \
+    tile_protocol.cpp \
+    tile_worker.cpp
+
+HEADERS += \
+    tile_coordinator.h \
+    tile_protocol.h \
+    tile_worker.h
@@ -0,0 +1,480 @@
+#include "gpu/gpu_ray_tracer.h"
+#include "gpu/offscreen_context.h"
+#include "gpu/tiled_renderer.h"
+#include "cpu/cpu_ray_tracer.h"
+#include "accel/bvh.h"
+#include "objects/scenes.h"
+#include "io/scene_io.h"
+#include "io/mapped_scene.h"
+#include "io/tiled_image_writer.h"
+#include "objects/camera.h"
+#include "render_settings.h"
+#include "tile_coordinator.h"
+#include "tile_worker.h"
+
+#include <QGuiApplication>
+#include <QCommandLineParser>
+#include <QOpenGLFunctions>
+#include <QOpenGLFramebufferObject>
+#include <QElapsedTimer>
+#include <QImage>
+#include <QFileInfo>
+#include <QDir>
+#include <QProcess>
+#include <QTemporaryFile>
+
+#include <cstdio>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+
+namespace {
+
+// Tiles of distributed rendering, unless set: small enough to balance the work, large enough to keep the workers busy.
+const int DEFAULT_DISTRIBUTED_TILE_SIZE = 256;
+
+struct BatchOptions {
+    QSize size {800, 800};
+    RenderSettings settings;
+    RenderBackend backend = RB_GPU;
+    int num_of_passes = 1;
+    int tile_size = 0; // 0: the image is rendered at once
+    // Distributed rendering: the coordinator listens on the port (-1: renders by itself)
+    // and may start workers on this host; a worker connects to the coordinator at host:port.
+    int listen_port = -1;
+    int num_of_local_workers = 0;
+    QString coordinator;
+    QString scene = "default";
+    QString save_scene;
+    Camera camera;
+    QString shaders_dir = "shaders";
+    QString output = "image.png";
+};
+
+QVector3D parseVector(const QString &str) {
+    const auto parts = str.split(',');
+    bool ok[3] = {false, false, false};
+    if (parts.size() == 3) {
+        const QVector3D vec(parts[0].toFloat(&ok[0]), parts[1].toFloat(&ok[1]), parts[2].toFloat(&ok[2]));
+        if (ok[0] && ok[1] && ok[2]) {
+            return vec;
+        }
+    }
+    throw std::runtime_error("Bad vector (expected x,y,z): " + str.toStdString());
+}
+
+int parseInt(const QString &str, int min_value, const char *name) {
+    bool ok = false;
+    const auto value = str.toInt(&ok);
+    if (!ok || value < min_value) {
+        throw std::runtime_error(std::string("Bad value of ") + name + ": " + str.toStdString());
+    }
+    return value;
+}
+
+BatchOptions parseOptions(const QCoreApplication &app) {
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Renders a scene offscreen and writes the image to a file.\n"
+        "Runs without a display: use QT_QPA_PLATFORM=offscreen (or xvfb-run),\n"
+        "LIBGL_ALWAYS_SOFTWARE=1 selects Mesa llvmpipe when there is no GPU.");
+    parser.addHelpOption();
+
+    const QCommandLineOption width_opt("width", "Image width.", "pixels", "800");
+    const QCommandLineOption height_opt("height", "Image height.", "pixels", "800");
+    const QCommandLineOption samples_opt("samples", "Number of samples per pixel.", "num", "1");
+    const QCommandLineOption depth_opt("depth", "Ray tracing depth (iteration limit).", "num", "5");
+    const QCommandLineOption light_samples_opt("light-samples", "Shadow rays per hit: with more lights, lights are "
+                                               "sampled from the light tree (0 shades all the lights).", "num", "8");
+    const QCommandLineOption sampling_opt("sampling", "Sampling mode: random or jittered.", "mode", "random");
+    const QCommandLineOption transparency_opt("transparency", "Enable transparency.");
+    const QCommandLineOption adaptive_opt("adaptive", "Adaptive sampling: trace all the samples only for noisy pixels.");
+    const QCommandLineOption adaptive_threshold_opt("adaptive-threshold", "Error of the pixel luminance above which "
+                                                    "all the samples are traced.", "error", "0.002");
+    const QCommandLineOption hybrid_opt("hybrid", "Rasterize the primary visibility of the spheres "
+                                        "(single-sample GPU frames).");
+    const QCommandLineOption background_opt("background", "Background color.", "color", "#000000");
+    const QCommandLineOption passes_opt("passes", "Number of progressive passes to average (GPU only).", "num", "1");
+    const QCommandLineOption tile_opt("tile", "Render in tiles of this size and write them straight to the output (.ppm): "
+                                      "for images too large to render at once (gpu backend only).", "pixels");
+    const QCommandLineOption listen_opt("listen", "Coordinate distributed rendering: hand the tiles to the workers "
+                                        "connecting to the port (0 picks a free one).", "port");
+    const QCommandLineOption local_workers_opt("local-workers", "Workers to start on this host (with --listen).", "num", "0");
+    const QCommandLineOption worker_opt("worker", "Run as a worker of the coordinator at host:port: the image options "
+                                        "come from the coordinator.", "host:port");
+    const QCommandLineOption backend_opt("backend", "Render backend: gpu, wavefront (compute shaders, OpenGL 4.3) or cpu.", "backend", "gpu");
+    const QCommandLineOption scene_opt("scene", "Scene: default, random:N[:seed[:lights]] or a scene file (.json or .rtscene).", "scene", "default");
+    const QCommandLineOption save_scene_opt("save-scene", "Also write the scene to a file (.json or .rtscene).", "file");
+    const QCommandLineOption eye_opt("eye", "Camera position.", "x,y,z", "-10,0,-10");
+    const QCommandLineOption center_opt("center", "Point the camera looks at.", "x,y,z", "0,0,0");
+    const QCommandLineOption up_opt("up", "Camera up direction.", "x,y,z", "0,1,0");
+    const QCommandLineOption fov_opt("fov", "Vertical field of view in degrees.", "degrees", "45");
+    const QCommandLineOption shaders_opt("shaders", "Directory with shaders.", "dir", "shaders");
+    const QCommandLineOption output_opt({"o", "output"}, "Output file (.png or .ppm).", "file", "image.png");
+
+    parser.addOptions({width_opt, height_opt, samples_opt, depth_opt, light_samples_opt, sampling_opt, transparency_opt,
+                       adaptive_opt, adaptive_threshold_opt, hybrid_opt, background_opt, passes_opt, tile_opt, listen_opt, local_workers_opt, worker_opt, backend_opt, scene_opt, save_scene_opt, eye_opt, center_opt, up_opt,
+                       fov_opt, shaders_opt, output_opt});
+    parser.process(app);
+
+    BatchOptions opts;
+    opts.size = QSize(parseInt(parser.value(width_opt), 1, "width"),
+                      parseInt(parser.value(height_opt), 1, "height"));
+    opts.settings.num_of_samples = parseInt(parser.value(samples_opt), 1, "samples");
+    opts.settings.num_of_steps = parseInt(parser.value(depth_opt), 1, "depth");
+    opts.settings.num_of_light_samples = parseInt(parser.value(light_samples_opt), 0, "light-samples");
+
+    const auto sampling = parser.value(sampling_opt);
+    if (sampling == "random") {
+        opts.settings.sampling_mode = SM_RANDOM;
+    } else if (sampling == "jittered") {
+        opts.settings.sampling_mode = SM_MULTIJITTERED;
+    } else {
+        throw std::runtime_error("Unknown sampling mode: " + sampling.toStdString());
+    }
+
+    opts.settings.transparency_enabled = parser.isSet(transparency_opt);
+    opts.settings.adaptive_sampling = parser.isSet(adaptive_opt);
+    bool threshold_ok = false;
+    opts.settings.adaptive_threshold = parser.value(adaptive_threshold_opt).toFloat(&threshold_ok);
+    if (!threshold_ok || opts.settings.adaptive_threshold < 0.0f) {
+        throw std::runtime_error("Bad value of --adaptive-threshold");
+    }
+    opts.settings.hybrid = parser.isSet(hybrid_opt);
+
+    opts.settings.background_color = QColor(parser.value(background_opt));
+    if (!opts.settings.background_color.isValid()) {
+        throw std::runtime_error("Bad background color: " + parser.value(background_opt).toStdString());
+    }
+
+    opts.num_of_passes = parseInt(parser.value(passes_opt), 1, "passes");
+
+    const auto backend = parser.value(backend_opt);
+    if (backend == "gpu") {
+        opts.backend = RB_GPU;
+    } else if (backend == "wavefront") {
+        opts.backend = RB_WAVEFRONT;
+    } else if (backend == "cpu") {
+        opts.backend = RB_CPU;
+    } else {
+        throw std::runtime_error("Unknown backend: " + backend.toStdString());
+    }
+    if (opts.backend == RB_CPU && opts.num_of_passes > 1) {
+        throw std::runtime_error("Progressive passes are supported by the GPU backend only");
+    }
+    if (parser.isSet(tile_opt)) {
+        opts.tile_size = parseInt(parser.value(tile_opt), 1, "tile");
+    }
+    if (parser.isSet(listen_opt)) {
+        opts.listen_port = parseInt(parser.value(listen_opt), 0, "listen");
+        if (opts.listen_port > 65535) {
+            throw std::runtime_error("Bad value of listen: " + parser.value(listen_opt).toStdString());
+        }
+        opts.num_of_local_workers = parseInt(parser.value(local_workers_opt), 0, "local-workers");
+        if (opts.tile_size == 0) {
+            opts.tile_size = DEFAULT_DISTRIBUTED_TILE_SIZE;
+        }
+    }
+    // Tiles are traced by the fragment path (see GPURayTracer::renderTile).
+    if (opts.tile_size > 0 && opts.backend != RB_GPU) {
+        throw std::runtime_error("Tiled rendering is supported by the GPU backend only");
+    }
+    opts.coordinator = parser.value(worker_opt);
+    if (!opts.coordinator.isEmpty() && opts.backend != RB_GPU) {
+        throw std::runtime_error("Workers render with the gpu backend only");
+    }
+
+    opts.scene = parser.value(scene_opt);
+    opts.save_scene = parser.value(save_scene_opt);
+    if (!opts.save_scene.isEmpty() && !scene_io::isSceneFile(opts.save_scene)) {
+        throw std::runtime_error("Scene file must be .json or .rtscene: " + opts.save_scene.toStdString());
+    }
+    opts.camera = Camera(parseVector(parser.value(eye_opt)),
+                         parseVector(parser.value(center_opt)),
+                         parseVector(parser.value(up_opt)),
+                         parser.value(fov_opt).toFloat());
+    opts.shaders_dir = parser.value(shaders_opt);
+    opts.output = parser.value(output_opt);
+    if (opts.tile_size > 0 && QFileInfo(opts.output).suffix().toLower() != "ppm") {
+        throw std::runtime_error("Tiles are written to a .ppm file");
+    }
+    return opts;
+}
+
+double elapsedMs(const QElapsedTimer &timer) {
+    return timer.nsecsElapsed() * 1e-6;
+}
+
+// Tiles are traced, read back and written one by one: nothing of the image size is allocated.
+void renderTiles(const BatchOptions &opts, GPURayTracer &gpu_tracer) {
+    QElapsedTimer timer;
+    timer.start();
+
+    TiledImageWriter writer;
+    writer.open(opts.output, opts.size);
+    TiledRenderer renderer(gpu_tracer, QSize(opts.tile_size, opts.tile_size));
+
+    QElapsedTimer tile_timer;
+    tile_timer.start();
+    renderer.render(opts.settings, opts.camera, opts.num_of_passes, writer,
+                    [&](int num_of_finished_tiles, int num_of_tiles, const QRect &tile) {
+        std::printf("Tile %d/%d (%d,%d %dx%d): %.2f ms\n", num_of_finished_tiles, num_of_tiles,
+                    tile.x(), tile.y(), tile.width(), tile.height(), elapsedMs(tile_timer));
+        std::fflush(stdout);
+        tile_timer.restart();
+    });
+    writer.close();
+
+    const auto render_ms = elapsedMs(timer);
+    const auto num_of_pixels = double(opts.size.width()) * opts.size.height();
+    std::printf("Render: %.2f ms (%dx%d tiles, %d pass(es), %.2f Mpixel samples/s)\n", render_ms,
+                opts.tile_size, opts.tile_size, opts.num_of_passes,
+                num_of_pixels * opts.settings.num_of_samples * opts.num_of_passes / (render_ms * 1e3));
+    std::printf("Write: %s\n", opts.output.toLocal8Bit().constData());
+}
+
+// Workers get the scene as the contents of a binary scene file, which they map as is.
+QByteArray sceneFileData(const BatchOptions &opts) {
+    QTemporaryFile temp_file(QDir::tempPath() + "/RtRtScene-XXXXXX.rtscene");
+    auto filename = opts.scene;
+    if (scene_io::isBinary(opts.scene)) {
+        if (!opts.save_scene.isEmpty()) {
+            scene_io::save(MappedScene(opts.scene).toScene(), opts.save_scene);
+        }
+    } else {
+        const auto scene = scenes::fromSpec(opts.scene);
+        if (!opts.save_scene.isEmpty()) {
+            scene_io::save(scene, opts.save_scene);
+        }
+        if (!temp_file.open()) {
+            throw std::runtime_error("Failed to write " + temp_file.fileName().toStdString());
+        }
+        filename = temp_file.fileName();
+        MappedScene::save(scene, filename);
+    }
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        throw std::runtime_error("Failed to read " + filename.toStdString());
+    }
+    return file.readAll();
+}
+
+int runCoordinator(const BatchOptions &opts) {
+    QElapsedTimer timer;
+    timer.start();
+
+    tile_protocol::Job job;
+    job.size = opts.size;
+    job.tile_size = QSize(opts.tile_size, opts.tile_size);
+    job.settings = opts.settings;
+    job.camera = opts.camera;
+    job.num_of_passes = opts.num_of_passes;
+    job.scene = sceneFileData(opts);
+    std::printf("Scene: %.2f MB, %.2f ms\n", job.scene.size() / (1024.0 * 1024.0), elapsedMs(timer));
+
+    TiledImageWriter writer;
+    writer.open(opts.output, opts.size);
+    TileCoordinator coordinator(job, writer);
+    const auto port = coordinator.listen(quint16(opts.listen_port));
+    std::printf("Listening on port %d\n", port);
+    std::fflush(stdout);
+
+    // Local workers run this tool in the worker mode; if all of them exit, nobody is left to render.
+    int num_of_exited_workers = 0;
+    const auto worker_exited = [&]() {
+        if (++num_of_exited_workers == opts.num_of_local_workers) {
+            coordinator.abort("All the local workers exited");
+        }
+    };
+    std::vector<std::unique_ptr<QProcess>> local_workers;
+    for (int i = 0; i < opts.num_of_local_workers; i++) {
+        local_workers.emplace_back(new QProcess());
+        auto *process = local_workers.back().get();
+        process->setProcessChannelMode(QProcess::ForwardedChannels);
+        QObject::connect(process, static_cast<void(QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
+                         worker_exited);
+        // A worker which fails to start never finishes.
+        QObject::connect(process, &QProcess::errorOccurred, [&, process](QProcess::ProcessError error) {
+            if (error == QProcess::FailedToStart) {
+                std::fprintf(stderr, "Local worker failed to start: %s\n",
+                             process->errorString().toLocal8Bit().constData());
+                worker_exited();
+            }
+        });
+        process->start(QCoreApplication::applicationFilePath(),
+                       {"--worker", QString("127.0.0.1:%1").arg(port), "--shaders", opts.shaders_dir});
+    }
+
+    timer.restart();
+    coordinator.run([&](int num_of_finished_tiles, int num_of_tiles, const QRect &tile) {
+        std::printf("Tile %d/%d (%d,%d %dx%d): %.2f ms\n", num_of_finished_tiles, num_of_tiles,
+                    tile.x(), tile.y(), tile.width(), tile.height(), elapsedMs(timer));
+        std::fflush(stdout);
+    });
+    writer.close();
+
+    const auto render_ms = elapsedMs(timer);
+    const auto num_of_pixels = double(opts.size.width()) * opts.size.height();
+    std::printf("Render: %.2f ms (%dx%d tiles, %d pass(es), %.2f Mpixel samples/s)\n", render_ms,
+                opts.tile_size, opts.tile_size, opts.num_of_passes,
+                num_of_pixels * opts.settings.num_of_samples * opts.num_of_passes / (render_ms * 1e3));
+    for (const auto &stats: coordinator.getWorkerStats()) {
+        std::printf("Worker %s: %d tiles, %d traced again elsewhere first, %.2f ms tracing\n",
+                    stats.address.toLocal8Bit().constData(), stats.num_of_tiles, stats.num_of_wasted_tiles,
+                    stats.render_ms);
+    }
+    std::printf("Write: %s\n", opts.output.toLocal8Bit().constData());
+
+    for (auto &process: local_workers) {
+        process->disconnect();
+        process->waitForFinished();
+    }
+    return 0;
+}
+
+int runWorker(const BatchOptions &opts) {
+    const auto parts = opts.coordinator.split(':');
+    if (parts.size() != 2) {
+        throw std::runtime_error("Bad coordinator address (expected host:port): " + opts.coordinator.toStdString());
+    }
+    const auto port = parseInt(parts[1], 1, "worker port");
+    TileWorker worker(opts.shaders_dir);
+    worker.run(parts[0], quint16(port));
+    std::printf("Worker: %d tiles\n", worker.getNumOfRenderedTiles());
+    return 0;
+}
+
+int run(const BatchOptions &opts) {
+    OffscreenContext context;
+    auto *gl = context.functions();
+    std::printf("Renderer: %s\n", context.renderer().toLocal8Bit().constData());
+
+    QElapsedTimer timer;
+
+    timer.start();
+    Scene scene;
+    BVH bvh;
+    MeshBVH mesh_bvh;
+    // Binary scene files are mapped and go to the GPU as is; scene objects are needed for the CPU only.
+    std::shared_ptr<MappedScene> mapped_scene;
+    if (scene_io::isBinary(opts.scene)) {
+        mapped_scene = std::make_shared<MappedScene>(opts.scene);
+        if (opts.backend == RB_CPU || !opts.save_scene.isEmpty()) {
+            scene = mapped_scene->toScene();
+            bvh = mapped_scene->toBVH();
+            mesh_bvh = mapped_scene->toMeshBVH();
+        } else {
+            mapped_scene->validate();
+        }
+        std::printf("Scene: %d objects, %d triangles, %d lights, %d BVH nodes, %.2f ms (mapped)\n",
+                    mapped_scene->getNumOfSpheres(), mapped_scene->getNumOfMeshTriangles(), mapped_scene->getNumOfLights(),
+                    mapped_scene->getNumOfBvhNodes() + mapped_scene->getNumOfMeshBvhNodes(), elapsedMs(timer));
+    } else {
+        scene = scenes::fromSpec(opts.scene);
+        bvh.build(scene.objects);
+        mesh_bvh.build(scene.meshes);
+        std::printf("Scene: %d objects, %d triangles, %d lights, %d BVH nodes, %.2f ms\n",
+                    int(scene.objects.size()), mesh_bvh.getNumOfTriangles(), int(scene.lights.size()),
+                    int(bvh.getNodes().size() + mesh_bvh.getBVH().getNodes().size()), elapsedMs(timer));
+    }
+
+    if (!opts.save_scene.isEmpty()) {
+        timer.restart();
+        scene_io::save(scene, opts.save_scene);
+        std::printf("Saved scene: %.2f ms (%s)\n", elapsedMs(timer), opts.save_scene.toLocal8Bit().constData());
+    }
+
+    timer.restart();
+    GPURayTracer gpu_tracer;
+    gpu_tracer.init(opts.shaders_dir);
+    if (mapped_scene) {
+        gpu_tracer.uploadScene(*mapped_scene);
+    } else {
+        gpu_tracer.uploadScene(scene, bvh, mesh_bvh);
+    }
+    if (opts.backend == RB_WAVEFRONT) {
+        if (!gpu_tracer.wavefrontSupported()) {
+            throw std::runtime_error("Wavefront backend needs OpenGL 4.3");
+        }
+        gpu_tracer.setWavefrontEnabled(true);
+    }
+    gl->glFinish();
+    std::printf("Setup: %.2f ms\n", elapsedMs(timer));
+
+    if (opts.tile_size > 0) {
+        renderTiles(opts, gpu_tracer);
+        return 0;
+    }
+
+    QImage image;
+    double render_ms = 0.0;
+    double readback_ms = 0.0;
+
+    if (opts.backend == RB_CPU) {
+        CPURayTracer cpu_tracer;
+        image = QImage(opts.size, QImage::Format_RGBA8888);
+        timer.restart();
+        cpu_tracer.render(scene, bvh, mesh_bvh, opts.settings, opts.camera.camToWorld(), opts.camera.fovTangent(), image);
+        render_ms = elapsedMs(timer);
+        std::printf("Samples: %.2f per pixel\n",
+                    double(cpu_tracer.getNumOfTracedSamples()) / (double(opts.size.width()) * opts.size.height()));
+    } else {
+        QOpenGLFramebufferObject fbo(opts.size);
+        fbo.bind();
+
+        timer.restart();
+        if (opts.num_of_passes > 1) {
+            for (int i = 0; i < opts.num_of_passes; i++) {
+                gpu_tracer.accumulate(opts.settings, opts.camera, opts.size);
+            }
+            gpu_tracer.display(gpu_tracer.getAccumulationTexture(), opts.size);
+        } else {
+            gpu_tracer.render(opts.settings, opts.camera, opts.size);
+        }
+        gl->glFinish();
+        render_ms = elapsedMs(timer);
+
+        timer.restart();
+        image = fbo.toImage();
+        readback_ms = elapsedMs(timer);
+
+        fbo.release();
+    }
+
+    const auto num_of_pixels = double(opts.size.width()) * opts.size.height();
+    std::printf("Render: %.2f ms (%d pass(es), %.2f Mpixel samples/s)\n", render_ms, opts.num_of_passes,
+                num_of_pixels * opts.settings.num_of_samples * opts.num_of_passes / (render_ms * 1e3));
+    std::printf("Readback: %.2f ms\n", readback_ms);
+
+    timer.restart();
+    const auto suffix = QFileInfo(opts.output).suffix().toLower();
+    const char *file_format = (suffix == "ppm" ? "PPM" : "PNG");
+    if (!image.convertToFormat(QImage::Format_RGB888).save(opts.output, file_format)) {
+        throw std::runtime_error("Failed to write " + opts.output.toStdString());
+    }
+    std::printf("Write: %.2f ms (%s)\n", elapsedMs(timer), opts.output.toLocal8Bit().constData());
+
+    return 0;
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    QGuiApplication app(argc, argv);
+    QCoreApplication::setApplicationName("RtRtBatch");
+
+    try {
+        const auto opts = parseOptions(app);
+        if (!opts.coordinator.isEmpty()) {
+            return runWorker(opts);
+        }
+        if (opts.listen_port >= 0) {
+            return runCoordinator(opts);
+        }
+        return run(opts);
+    }
+    catch (const std::exception &e) {
+        std::fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+}
@@ -0,0 +1,215 @@
+#include "tile_coordinator.h"
+
+#include <QHostAddress>
+
+#include <algorithm>
+#include <cstdio>
+#include <exception>
+#include <stdexcept>
+
+TileCoordinator::TileCoordinator(const tile_protocol::Job &job, TiledImageWriter &writer) :
+    job(job),
+    framed_job(tile_protocol::frame(tile_protocol::encode(job))),
+    writer(writer),
+    tiles(TiledImageWriter::splitIntoTiles(job.size, job.tile_size)),
+    progress(tiles.size())
+{
+    for (int i = 0; i < int(tiles.size()); i++) {
+        queue.push_back(i);
+    }
+    QObject::connect(&server, &QTcpServer::newConnection, &server, [this]() {
+        onConnection();
+    });
+}
+
+TileCoordinator::~TileCoordinator() {
+    for (auto &worker: workers) {
+        worker->socket->disconnect();
+        worker->socket->abort();
+        delete worker->socket;
+    }
+}
+
+quint16 TileCoordinator::listen(quint16 port) {
+    if (!server.listen(QHostAddress::Any, port)) {
+        throw std::runtime_error("Failed to listen on port " + std::to_string(port) + ": " +
+                                 server.errorString().toStdString());
+    }
+    return server.serverPort();
+}
+
+void TileCoordinator::run(const TiledRenderer::ProgressCallback &progress) {
+    progress_callback = progress;
+    timer.start();
+    if (num_of_finished_tiles < int(tiles.size()) && error.empty()) {
+        loop.exec();
+    }
+    server.close();
+    // Workers finish when the coordinator disconnects; the copies of tiles still traced are not needed.
+    for (auto &worker: workers) {
+        worker->socket->disconnect();
+        worker->socket->abort();
+    }
+    if (!error.empty()) {
+        throw std::runtime_error(error);
+    }
+}
+
+void TileCoordinator::abort(const std::string &message) {
+    fail(message);
+}
+
+std::vector<TileCoordinator::WorkerStats> TileCoordinator::getWorkerStats() const {
+    auto stats = finished_workers;
+    for (const auto &worker: workers) {
+        stats.push_back(worker->stats);
+    }
+    return stats;
+}
+
+void TileCoordinator::onConnection() {
+    while (auto *socket = server.nextPendingConnection()) {
+        workers.emplace_back(new Worker());
+        auto *worker = workers.back().get();
+        worker->socket = socket;
+        worker->stats.address = QString("%1:%2").arg(socket->peerAddress().toString()).arg(socket->peerPort());
+        // Tiles are small messages which should go out at once.
+        socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+
+        QObject::connect(socket, &QTcpSocket::readyRead, socket, [this, worker]() {
+            onData(worker);
+        });
+        QObject::connect(socket, &QTcpSocket::disconnected, socket, [this, worker]() {
+            onDisconnected(worker);
+        });
+
+        socket->write(framed_job);
+        assignTiles(worker);
+    }
+}
+
+void TileCoordinator::onData(Worker *worker) {
+    worker->received += worker->socket->readAll();
+    try {
+        QByteArray message;
+        while (tile_protocol::takeMessage(worker->received, message)) {
+            onResult(worker, tile_protocol::decodeResult(message));
+        }
+    }
+    catch (const std::exception &e) {
+        std::fprintf(stderr, "Worker %s: %s\n", worker->stats.address.toLocal8Bit().constData(), e.what());
+        onDisconnected(worker);
+    }
+}
+
+void TileCoordinator::onResult(Worker *worker, const tile_protocol::TileResult &result) {
+    const auto index = result.tile.index;
+    auto it = std::find(worker->tiles_in_flight.begin(), worker->tiles_in_flight.end(), index);
+    if (it == worker->tiles_in_flight.end() || result.tile.rect != tiles[index]) {
+        throw std::runtime_error("Result of a tile which was not sent");
+    }
+    worker->tiles_in_flight.erase(it);
+    auto &tile = progress[index];
+    tile.num_of_copies--;
+    worker->stats.render_ms += result.render_ms;
+
+    if (tile.state == TS_DONE) {
+        worker->stats.num_of_wasted_tiles++;
+    } else {
+        try {
+            writer.writeTile(tiles[index], reinterpret_cast<const unsigned char*>(result.rgb.constData()));
+        }
+        catch (const std::exception &e) {
+            fail(e.what());
+            return;
+        }
+        tile.state = TS_DONE;
+        worker->stats.num_of_tiles++;
+        num_of_finished_tiles++;
+        if (progress_callback) {
+            progress_callback(num_of_finished_tiles, int(tiles.size()), tiles[index]);
+        }
+        if (num_of_finished_tiles == int(tiles.size())) {
+            loop.quit();
+            return;
+        }
+    }
+    assignTiles(worker);
+}
+
+void TileCoordinator::onDisconnected(Worker *worker) {
+    // Tiles nobody else is tracing go to the front of the queue, so they are not the last ones to finish.
+    for (auto index: worker->tiles_in_flight) {
+        auto &tile = progress[index];
+        tile.num_of_copies--;
+        if (tile.state == TS_IN_FLIGHT && tile.num_of_copies == 0) {
+            tile.state = TS_QUEUED;
+            queue.push_front(index);
+        }
+    }
+    worker->tiles_in_flight.clear();
+
+    worker->socket->disconnect();
+    worker->socket->abort();
+    worker->socket->deleteLater();
+    finished_workers.push_back(worker->stats);
+    workers.erase(std::find_if(workers.begin(), workers.end(), [worker](const std::unique_ptr<Worker> &w) {
+        return w.get() == worker;
+    }));
+
+    for (auto &other: workers) {
+        assignTiles(other.get());
+    }
+}
+
+void TileCoordinator::assignTiles(Worker *worker) {
+    while (int(worker->tiles_in_flight.size()) < MAX_TILES_IN_FLIGHT) {
+        const auto index = nextTile(worker);
+        if (index < 0) {
+            return;
+        }
+        auto &tile = progress[index];
+        if (tile.state == TS_QUEUED) {
+            tile.state = TS_IN_FLIGHT;
+            tile.sent_ms = timer.elapsed();
+        }
+        tile.num_of_copies++;
+        worker->tiles_in_flight.push_back(index);
+
+        tile_protocol::Tile message;
+        message.index = index;
+        message.rect = tiles[index];
+        worker->socket->write(tile_protocol::frame(tile_protocol::encode(message)));
+    }
+}
+
+int TileCoordinator::nextTile(const Worker *worker) {
+    while (!queue.empty()) {
+        const auto index = queue.front();
+        queue.pop_front();
+        // A requeued tile may have been finished by another copy meanwhile.
+        if (progress[index].state == TS_QUEUED) {
+            return index;
+        }
+    }
+    // Only idle workers take copies, so the copies do not slow down the tiles they are tracing.
+    if (!worker->tiles_in_flight.empty()) {
+        return -1;
+    }
+    int oldest = -1;
+    for (int i = 0; i < int(tiles.size()); i++) {
+        const auto &tile = progress[i];
+        if (tile.state == TS_IN_FLIGHT && tile.num_of_copies < MAX_COPIES_OF_TILE &&
+                (oldest < 0 || tile.sent_ms < progress[oldest].sent_ms)) {
+            oldest = i;
+        }
+    }
+    return oldest;
+}
+
+void TileCoordinator::fail(const std::string &message) {
+    if (error.empty()) {
+        error = message;
+    }
+    loop.quit();
+}
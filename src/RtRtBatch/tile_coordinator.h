@@ -0,0 +1,105 @@
+#pragma once
+
+#include "tile_protocol.h"
+#include "gpu/tiled_renderer.h"
+#include "io/tiled_image_writer.h"
+
+#include <QEventLoop>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QElapsedTimer>
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Coordinator of distributed rendering: splits the image into tiles and hands them to the workers
+ * (see TileWorker) connected over TCP, writing the returned tiles as they come.
+ * Work is pulled: each worker has at most a couple of tiles in flight and gets the next one when it returns one,
+ * so faster workers take more tiles. When no tiles are left to hand out, idle workers also trace the tiles
+ * still in flight on others, and the first result wins: a slow or stuck worker does not hold up the image.
+ * Tiles of a worker that disconnects go back to the queue.
+ */
+class TileCoordinator {
+public:
+    struct WorkerStats {
+        QString address;
+        int num_of_tiles = 0; // results written
+        int num_of_wasted_tiles = 0; // results that came after another worker's one
+        double render_ms = 0.0;
+    };
+
+public:
+    TileCoordinator(const tile_protocol::Job &job, TiledImageWriter &writer);
+    ~TileCoordinator();
+
+    TileCoordinator(const TileCoordinator&) = delete;
+    TileCoordinator& operator=(const TileCoordinator&) = delete;
+
+    // Starts accepting workers; port 0 picks a free one. Returns the port; throws std::runtime_error on failure.
+    quint16 listen(quint16 port);
+
+    // Runs the event loop until all the tiles are written (workers may connect at any time).
+    // Throws std::runtime_error if the image can't be written or the rendering was aborted.
+    void run(const TiledRenderer::ProgressCallback &progress = TiledRenderer::ProgressCallback());
+    // Makes run throw with the message, e.g. when no worker is left to connect.
+    void abort(const std::string &message);
+
+    std::vector<WorkerStats> getWorkerStats() const;
+
+private:
+    struct Worker {
+        QTcpSocket *socket = nullptr;
+        QByteArray received;
+        std::vector<int> tiles_in_flight;
+        WorkerStats stats;
+    };
+
+    enum TileState {
+        TS_QUEUED = 0,
+        TS_IN_FLIGHT = 1,
+        TS_DONE = 2
+    };
+
+    struct TileProgress {
+        TileState state = TS_QUEUED;
+        int num_of_copies = 0; // workers tracing the tile now
+        qint64 sent_ms = 0; // when it was first sent
+    };
+
+    void onConnection();
+    void onData(Worker *worker);
+    void onDisconnected(Worker *worker);
+    void onResult(Worker *worker, const tile_protocol::TileResult &result);
+    // Sends tiles to the worker until it has enough of them in flight.
+    void assignTiles(Worker *worker);
+    // Next tile for a worker: a queued one, or a copy of the oldest one in flight elsewhere; -1 if there is none.
+    int nextTile(const Worker *worker);
+    void fail(const std::string &message);
+
+private:
+    // One tile is traced while the next one is on the way.
+    static const int MAX_TILES_IN_FLIGHT = 2;
+    // Tiles traced by more workers at once than this are not copied again.
+    static const int MAX_COPIES_OF_TILE = 2;
+
+    tile_protocol::Job job;
+    QByteArray framed_job;
+    TiledImageWriter &writer;
+
+    std::vector<QRect> tiles;
+    std::vector<TileProgress> progress;
+    std::deque<int> queue;
+    int num_of_finished_tiles = 0;
+
+    QTcpServer server;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<WorkerStats> finished_workers;
+
+    QEventLoop loop;
+    QElapsedTimer timer;
+    TiledRenderer::ProgressCallback progress_callback;
+    std::string error;
+};
@@ -0,0 +1,187 @@
+#include "tile_protocol.h"
+
+#include <QDataStream>
+#include <QtEndian>
+
+#include <stdexcept>
+#include <string>
+
+namespace tile_protocol {
+
+namespace {
+
+const auto STREAM_VERSION = QDataStream::Qt_5_0;
+// Larger messages are taken for garbage: a tile of 4096 x 4096 pixels is 48 MB.
+const quint32 MAX_MESSAGE_SIZE = 1u << 30;
+
+QDataStream& operator<<(QDataStream &out, const RenderSettings &settings) {
+    return out << qint32(settings.num_of_steps) << qint32(settings.num_of_samples) << qint32(settings.sampling_mode)
+               << settings.transparency_enabled << qint32(settings.num_of_light_samples) << settings.background_color
+               << settings.adaptive_sampling << settings.adaptive_threshold << settings.hybrid;
+}
+
+QDataStream& operator>>(QDataStream &in, RenderSettings &settings) {
+    qint32 num_of_steps = 0, num_of_samples = 0, sampling_mode = 0, num_of_light_samples = 0;
+    in >> num_of_steps >> num_of_samples >> sampling_mode >> settings.transparency_enabled >> num_of_light_samples
+       >> settings.background_color >> settings.adaptive_sampling >> settings.adaptive_threshold >> settings.hybrid;
+    settings.num_of_steps = num_of_steps;
+    settings.num_of_samples = num_of_samples;
+    settings.sampling_mode = static_cast<SamplingMode>(sampling_mode);
+    settings.num_of_light_samples = num_of_light_samples;
+    return in;
+}
+
+QDataStream& operator<<(QDataStream &out, const Camera &camera) {
+    return out << camera.eye << camera.center << camera.up << camera.fov;
+}
+
+QDataStream& operator>>(QDataStream &in, Camera &camera) {
+    return in >> camera.eye >> camera.center >> camera.up >> camera.fov;
+}
+
+QDataStream& operator<<(QDataStream &out, const Tile &tile) {
+    return out << qint32(tile.index) << tile.rect;
+}
+
+QDataStream& operator>>(QDataStream &in, Tile &tile) {
+    qint32 index = 0;
+    in >> index >> tile.rect;
+    tile.index = index;
+    return in;
+}
+
+// Writes the type of the message; the fields follow.
+class MessageWriter {
+public:
+    explicit MessageWriter(MessageType type) :
+        stream(&message, QIODevice::WriteOnly)
+    {
+        stream.setVersion(STREAM_VERSION);
+        stream << quint8(type);
+    }
+
+    QDataStream& out() {
+        return stream;
+    }
+
+    QByteArray data() const {
+        return message;
+    }
+
+private:
+    QByteArray message;
+    QDataStream stream;
+};
+
+// Checks the type of the message and reads the fields after it.
+class MessageReader {
+public:
+    MessageReader(const QByteArray &message, MessageType type) :
+        stream(message)
+    {
+        stream.setVersion(STREAM_VERSION);
+        if (typeOf(message) != type) {
+            throw std::runtime_error("Unexpected message");
+        }
+        stream.skipRawData(1);
+    }
+
+    QDataStream& in() {
+        return stream;
+    }
+
+    void check() const {
+        if (stream.status() != QDataStream::Ok) {
+            throw std::runtime_error("Malformed message");
+        }
+    }
+
+private:
+    QDataStream stream;
+};
+
+}
+
+QByteArray encode(const Job &job) {
+    MessageWriter writer(MT_JOB);
+    writer.out() << PROTOCOL_VERSION << job.size << job.tile_size << job.settings << job.camera
+                 << qint32(job.num_of_passes) << job.scene;
+    return writer.data();
+}
+
+QByteArray encode(const Tile &tile) {
+    MessageWriter writer(MT_TILE);
+    writer.out() << tile;
+    return writer.data();
+}
+
+QByteArray encode(const TileResult &result) {
+    MessageWriter writer(MT_RESULT);
+    writer.out() << result.tile << result.rgb << result.render_ms;
+    return writer.data();
+}
+
+MessageType typeOf(const QByteArray &message) {
+    if (message.isEmpty() || quint8(message[0]) > MT_RESULT) {
+        throw std::runtime_error("Unknown message");
+    }
+    return static_cast<MessageType>(quint8(message[0]));
+}
+
+Job decodeJob(const QByteArray &message) {
+    MessageReader reader(message, MT_JOB);
+    quint32 version = 0;
+    reader.in() >> version;
+    if (version != PROTOCOL_VERSION) {
+        throw std::runtime_error("Protocol version " + std::to_string(version) + " is not supported");
+    }
+    Job job;
+    qint32 num_of_passes = 0;
+    reader.in() >> job.size >> job.tile_size >> job.settings >> job.camera >> num_of_passes >> job.scene;
+    reader.check();
+    job.num_of_passes = num_of_passes;
+    return job;
+}
+
+Tile decodeTile(const QByteArray &message) {
+    MessageReader reader(message, MT_TILE);
+    Tile tile;
+    reader.in() >> tile;
+    reader.check();
+    return tile;
+}
+
+TileResult decodeResult(const QByteArray &message) {
+    MessageReader reader(message, MT_RESULT);
+    TileResult result;
+    reader.in() >> result.tile >> result.rgb >> result.render_ms;
+    reader.check();
+    if (result.rgb.size() != result.tile.rect.width() * result.tile.rect.height() * 3) {
+        throw std::runtime_error("Malformed message");
+    }
+    return result;
+}
+
+QByteArray frame(const QByteArray &message) {
+    QByteArray framed(4, '\0');
+    qToBigEndian(quint32(message.size()), reinterpret_cast<uchar*>(framed.data()));
+    return framed + message;
+}
+
+bool takeMessage(QByteArray &received, QByteArray &message) {
+    if (received.size() < 4) {
+        return false;
+    }
+    const auto size = qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(received.constData()));
+    if (size > MAX_MESSAGE_SIZE) {
+        throw std::runtime_error("Malformed message");
+    }
+    if (quint32(received.size()) - 4 < size) {
+        return false;
+    }
+    message = received.mid(4, int(size));
+    received.remove(0, 4 + int(size));
+    return true;
+}
+
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "objects/camera.h"
+#include "render_settings.h"
+
+#include <QByteArray>
+#include <QRect>
+#include <QSize>
+
+/**
+ * Messages between the coordinator and the workers of distributed rendering (see TileCoordinator, TileWorker).
+ * Each message is its length (32 bits, big-endian) followed by a QDataStream of its type and fields.
+ * The coordinator sends the job once, then tiles; the worker answers each tile with its pixels.
+ */
+namespace tile_protocol {
+
+// Workers of another version are refused.
+const quint32 PROTOCOL_VERSION = 2;
+
+enum MessageType : quint8 {
+    MT_JOB = 0, // coordinator: what to render
+    MT_TILE = 1, // coordinator: render the tile
+    MT_RESULT = 2 // worker: pixels of the tile
+};
+
+struct Job {
+    QSize size; // of the whole image
+    QSize tile_size;
+    RenderSettings settings;
+    Camera camera;
+    int num_of_passes = 1;
+    QByteArray scene; // contents of a binary scene file (.rtscene, see MappedScene)
+};
+
+// Tile of the image in pixels from the top left corner, numbered in rows from the top left one.
+struct Tile {
+    int index = 0;
+    QRect rect;
+};
+
+struct TileResult {
+    Tile tile;
+    QByteArray rgb; // rows from the top one down
+    double render_ms = 0.0;
+};
+
+QByteArray encode(const Job &job);
+QByteArray encode(const Tile &tile);
+QByteArray encode(const TileResult &result);
+
+// Decoding functions throw std::runtime_error if the message is not of the type or is malformed.
+MessageType typeOf(const QByteArray &message);
+Job decodeJob(const QByteArray &message);
+Tile decodeTile(const QByteArray &message);
+TileResult decodeResult(const QByteArray &message);
+
+// Prefixes the message with its length.
+QByteArray frame(const QByteArray &message);
+// Takes the first complete message out of the received bytes; returns false if it has not arrived in full yet.
+bool takeMessage(QByteArray &received, QByteArray &message);
+
+}
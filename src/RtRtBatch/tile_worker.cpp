@@ -0,0 +1,89 @@
+#include "tile_worker.h"
+
+#include "gpu/gpu_ray_tracer.h"
+#include "gpu/offscreen_context.h"
+#include "gpu/tiled_renderer.h"
+#include "io/mapped_scene.h"
+
+#include <QDir>
+#include <QElapsedTimer>
+#include <QTemporaryFile>
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+const int CONNECT_TIMEOUT_MS = 10000;
+
+}
+
+TileWorker::TileWorker(const QString &shaders_dir) :
+    shaders_dir(shaders_dir)
+{
+}
+
+void TileWorker::run(const QString &host, quint16 port) {
+    socket.connectToHost(host, port);
+    if (!socket.waitForConnected(CONNECT_TIMEOUT_MS)) {
+        throw std::runtime_error("Failed to connect to " + host.toStdString() + ":" + std::to_string(port) + ": " +
+                                 socket.errorString().toStdString());
+    }
+    socket.setSocketOption(QAbstractSocket::LowDelayOption, 1);
+
+    QByteArray message;
+    if (!receive(message)) {
+        return;
+    }
+    const auto job = tile_protocol::decodeJob(message);
+
+    // The scene comes as a binary scene file, which is mapped and uploaded as is.
+    QTemporaryFile scene_file(QDir::tempPath() + "/RtRtWorker-XXXXXX.rtscene");
+    if (!scene_file.open() || scene_file.write(job.scene) != job.scene.size() || !scene_file.flush()) {
+        throw std::runtime_error("Failed to write the scene to " + scene_file.fileName().toStdString());
+    }
+    MappedScene scene(scene_file.fileName());
+    scene.validate();
+
+    OffscreenContext context;
+    GPURayTracer gpu_tracer;
+    gpu_tracer.init(shaders_dir);
+    gpu_tracer.uploadScene(scene);
+    TiledRenderer renderer(gpu_tracer, job.tile_size);
+
+    std::vector<unsigned char> rgb;
+    QElapsedTimer timer;
+    while (receive(message)) {
+        tile_protocol::TileResult result;
+        result.tile = tile_protocol::decodeTile(message);
+
+        timer.start();
+        renderer.renderTile(job.settings, job.camera, job.size, result.tile.rect, job.num_of_passes, rgb);
+        result.render_ms = timer.nsecsElapsed() * 1e-6;
+        result.rgb = QByteArray(reinterpret_cast<const char*>(rgb.data()), int(rgb.size()));
+
+        socket.write(tile_protocol::frame(tile_protocol::encode(result)));
+        while (socket.bytesToWrite() > 0 && socket.waitForBytesWritten(-1)) {
+        }
+        num_of_rendered_tiles++;
+    }
+}
+
+int TileWorker::getNumOfRenderedTiles() const {
+    return num_of_rendered_tiles;
+}
+
+bool TileWorker::receive(QByteArray &message) {
+    while (!tile_protocol::takeMessage(received, message)) {
+        if (!socket.waitForReadyRead(-1)) {
+            if (socket.state() == QAbstractSocket::ConnectedState) {
+                throw std::runtime_error("Connection to the coordinator failed: " + socket.errorString().toStdString());
+            }
+            return false;
+        }
+        received += socket.readAll();
+    }
+    return true;
+}
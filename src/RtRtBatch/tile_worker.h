@@ -0,0 +1,31 @@
+#pragma once
+
+#include "tile_protocol.h"
+
+#include <QString>
+#include <QTcpSocket>
+
+/**
+ * Worker of distributed rendering: connects to the coordinator (see TileCoordinator), loads the scene
+ * of the job and traces the tiles it is sent offscreen with GPURayTracer, one at a time, until the coordinator
+ * disconnects. Tiles are traced exactly as by TiledRenderer, so the image does not depend on the workers.
+ */
+class TileWorker {
+public:
+    explicit TileWorker(const QString &shaders_dir);
+
+    // Returns when the coordinator disconnects; throws std::runtime_error on errors.
+    void run(const QString &host, quint16 port);
+
+    int getNumOfRenderedTiles() const;
+
+private:
+    // Waits for the next message; returns false if the coordinator disconnected.
+    bool receive(QByteArray &message);
+
+private:
+    QString shaders_dir;
+    QTcpSocket socket;
+    QByteArray received;
+    int num_of_rendered_tiles = 0;
+};
@@ -0,0 +1,19 @@
+# Benchmark: renders a fixed matrix of cases offscreen and writes frame time statistics as JSON.
+
+QT += core gui
+CONFIG += c++14 console
+CONFIG -= app_bundle
+
+TARGET = RtRtBench
+TEMPLATE = app
+
+# Next to the interactive application, so the same 'shaders' directory is found.
+DESTDIR = $$PWD/../RtRt
+
+QMAKE_LFLAGS += -no-pie
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+include(../RtRt/core.pri)
+
+SOURCES += main.cpp
@@ -0,0 +1,355 @@
+#include "gpu/gpu_ray_tracer.h"
+#include "gpu/offscreen_context.h"
+#include "accel/bvh.h"
+#include "objects/scenes.h"
+#include "objects/camera.h"
+#include "render_settings.h"
+
+#include <QGuiApplication>
+#include <QCommandLineParser>
+#include <QOpenGLFunctions>
+#include <QOpenGLFramebufferObject>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QFile>
+#include <QMap>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <exception>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+struct BenchOptions {
+    QSize size {512, 512};
+    int num_of_frames = 20;
+    int num_of_warmup_frames = 3;
+    bool quick = false;
+    bool fragment = true;  // raytrace.frag
+    bool wavefront = false; // compute kernels
+    QString shaders_dir = "shaders";
+    QString output = "bench.json";
+    QString baseline;
+    double threshold = 10.0; // percent
+};
+
+// One cell of the benchmark matrix.
+struct BenchCase {
+    QString scene;
+    RenderSettings settings;
+    bool wavefront = false;
+
+    // Identifies the case when comparing with a baseline.
+    QString key() const {
+        return QString("%1%2/depth=%3/samples=%4/%5/%6")
+                .arg(wavefront ? "wavefront/" : "")
+                .arg(scene)
+                .arg(settings.num_of_steps)
+                .arg(settings.num_of_samples)
+                .arg(settings.sampling_mode == SM_MULTIJITTERED ? "jittered" : "random")
+                .arg(settings.transparency_enabled ? "transparent" : "opaque");
+    }
+};
+
+struct Stats {
+    double min, mean, p50, p90, p99, max;
+};
+
+// Nearest-rank percentiles.
+Stats computeStats(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    const auto percentile = [&values](double p) {
+        const auto rank = static_cast<size_t>(std::ceil(p / 100.0 * values.size()));
+        return values[std::max<size_t>(rank, 1) - 1];
+    };
+    double sum = 0.0;
+    for (const auto v: values) {
+        sum += v;
+    }
+    return Stats {values.front(), sum / values.size(), percentile(50), percentile(90), percentile(99), values.back()};
+}
+
+QJsonObject statsToJson(const Stats &stats) {
+    return QJsonObject {
+        {"min", stats.min}, {"mean", stats.mean},
+        {"p50", stats.p50}, {"p90", stats.p90}, {"p99", stats.p99},
+        {"max", stats.max}
+    };
+}
+
+// Fixed seeds keep random scenes the same from run to run.
+QStringList benchScenes(bool quick) {
+    if (quick) {
+        return {"default", "random:1000:1"};
+    }
+    return {"default", "random:1000:1", "random:10000:1", "random:30000:1", "random:1000:1:4096"};
+}
+
+std::vector<BenchCase> benchCases(const QString &scene, bool quick, bool wavefront) {
+    const std::vector<int> depths = (quick ? std::vector<int> {1, 5} : std::vector<int> {1, 5, 10});
+    const std::vector<int> samples = {1, 4};
+    std::vector<BenchCase> cases;
+    for (const auto depth: depths)
+    for (const auto num_of_samples: samples)
+    for (const auto mode: {SM_RANDOM, SM_MULTIJITTERED})
+    for (const auto transparency: {false, true}) {
+        BenchCase bench_case;
+        bench_case.scene = scene;
+        bench_case.wavefront = wavefront;
+        bench_case.settings.num_of_steps = depth;
+        bench_case.settings.num_of_samples = num_of_samples;
+        bench_case.settings.sampling_mode = mode;
+        bench_case.settings.transparency_enabled = transparency;
+        cases.push_back(bench_case);
+    }
+    return cases;
+}
+
+double elapsedMs(const QElapsedTimer &timer) {
+    return timer.nsecsElapsed() * 1e-6;
+}
+
+BenchOptions parseOptions(const QCoreApplication &app) {
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Renders a fixed matrix of scenes and settings offscreen and reports frame times as JSON.\n"
+        "Runs without a display: use QT_QPA_PLATFORM=offscreen (or xvfb-run),\n"
+        "LIBGL_ALWAYS_SOFTWARE=1 selects Mesa llvmpipe when there is no GPU.");
+    parser.addHelpOption();
+
+    const QCommandLineOption width_opt("width", "Image width.", "pixels", "512");
+    const QCommandLineOption height_opt("height", "Image height.", "pixels", "512");
+    const QCommandLineOption frames_opt("frames", "Number of measured frames per case.", "num", "20");
+    const QCommandLineOption warmup_opt("warmup", "Number of frames rendered before measuring.", "num", "3");
+    const QCommandLineOption quick_opt("quick", "Run a reduced matrix (small scenes, depth up to 5).");
+    const QCommandLineOption pipeline_opt("pipeline", "GPU pipeline: fragment, wavefront (OpenGL 4.3) or both.",
+                                          "pipeline", "fragment");
+    const QCommandLineOption shaders_opt("shaders", "Directory with shaders.", "dir", "shaders");
+    const QCommandLineOption output_opt({"o", "output"}, "Output JSON file.", "file", "bench.json");
+    const QCommandLineOption baseline_opt("baseline", "Baseline JSON file to compare with.", "file");
+    const QCommandLineOption threshold_opt("threshold", "Median frame time increase treated as a regression.", "percent", "10");
+
+    parser.addOptions({width_opt, height_opt, frames_opt, warmup_opt, quick_opt, pipeline_opt, shaders_opt,
+                       output_opt, baseline_opt, threshold_opt});
+    parser.process(app);
+
+    const auto toInt = [&parser](const QCommandLineOption &opt, int min_value) {
+        bool ok = false;
+        const auto value = parser.value(opt).toInt(&ok);
+        if (!ok || value < min_value) {
+            throw std::runtime_error("Bad value of --" + opt.names().last().toStdString());
+        }
+        return value;
+    };
+
+    BenchOptions opts;
+    opts.size = QSize(toInt(width_opt, 1), toInt(height_opt, 1));
+    opts.num_of_frames = toInt(frames_opt, 1);
+    opts.num_of_warmup_frames = toInt(warmup_opt, 0);
+    opts.quick = parser.isSet(quick_opt);
+    const auto pipeline = parser.value(pipeline_opt);
+    if (pipeline != "fragment" && pipeline != "wavefront" && pipeline != "both") {
+        throw std::runtime_error("Unknown pipeline: " + pipeline.toStdString());
+    }
+    opts.fragment = (pipeline != "wavefront");
+    opts.wavefront = (pipeline != "fragment");
+    opts.shaders_dir = parser.value(shaders_opt);
+    opts.output = parser.value(output_opt);
+    opts.baseline = parser.value(baseline_opt);
+    opts.threshold = parser.value(threshold_opt).toDouble();
+    return opts;
+}
+
+QJsonObject loadJson(const QString &filename) {
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        throw std::runtime_error("Failed to open " + filename.toStdString());
+    }
+    QJsonParseError error;
+    const auto doc = QJsonDocument::fromJson(file.readAll(), &error);
+    if (doc.isNull() || !doc.isObject()) {
+        throw std::runtime_error("Failed to parse " + filename.toStdString() + ": " + error.errorString().toStdString());
+    }
+    return doc.object();
+}
+
+// Compares median frame times case by case; returns the number of regressions.
+int compareWithBaseline(const QJsonObject &results, const QJsonObject &baseline, double threshold) {
+    if (results["renderer"] != baseline["renderer"] || results["width"] != baseline["width"]
+            || results["height"] != baseline["height"]) {
+        std::printf("Warning: baseline was measured with a different renderer or image size\n");
+    }
+
+    QMap<QString, double> baseline_p50;
+    for (const auto &value: baseline["cases"].toArray()) {
+        const auto bench_case = value.toObject();
+        baseline_p50[bench_case["key"].toString()] = bench_case["frame_ms"].toObject()["p50"].toDouble();
+    }
+
+    int num_of_regressions = 0;
+    int num_of_compared = 0;
+    for (const auto &value: results["cases"].toArray()) {
+        const auto bench_case = value.toObject();
+        const auto key = bench_case["key"].toString();
+        if (!baseline_p50.contains(key) || baseline_p50[key] <= 0.0) {
+            continue;
+        }
+        num_of_compared++;
+        const auto p50 = bench_case["frame_ms"].toObject()["p50"].toDouble();
+        const auto change = (p50 / baseline_p50[key] - 1.0) * 100.0;
+        if (change > threshold) {
+            num_of_regressions++;
+            std::printf("REGRESSION %s: %.3f ms -> %.3f ms (%+.1f%%)\n",
+                        key.toLocal8Bit().constData(), baseline_p50[key], p50, change);
+        } else if (change < -threshold) {
+            std::printf("improvement %s: %.3f ms -> %.3f ms (%+.1f%%)\n",
+                        key.toLocal8Bit().constData(), baseline_p50[key], p50, change);
+        }
+    }
+    std::printf("Compared %d case(s) with baseline: %d regression(s) over %.1f%%\n",
+                num_of_compared, num_of_regressions, threshold);
+    return num_of_regressions;
+}
+
+int run(const BenchOptions &opts) {
+    OffscreenContext context;
+    auto *gl = context.functions();
+    const auto renderer = context.renderer();
+    std::printf("Renderer: %s\n", renderer.toLocal8Bit().constData());
+
+    GPURayTracer gpu_tracer;
+    gpu_tracer.init(opts.shaders_dir);
+    if (opts.wavefront && !gpu_tracer.wavefrontSupported()) {
+        throw std::runtime_error("Wavefront pipeline needs OpenGL 4.3");
+    }
+
+    QOpenGLFramebufferObject fbo(opts.size);
+    fbo.bind();
+
+    const Camera camera;
+    const auto num_of_pixels = double(opts.size.width()) * opts.size.height();
+
+    QJsonArray scenes_json;
+    QJsonArray cases_json;
+
+    for (const auto &scene_spec: benchScenes(opts.quick)) {
+        // CPU-side setup cost: generating the scene, building the BVH and uploading both.
+        QElapsedTimer timer;
+        timer.start();
+        const auto scene = scenes::fromSpec(scene_spec);
+        const auto generate_ms = elapsedMs(timer);
+
+        timer.restart();
+        BVH bvh;
+        bvh.build(scene.objects);
+        MeshBVH mesh_bvh;
+        mesh_bvh.build(scene.meshes);
+        const auto build_ms = elapsedMs(timer);
+
+        timer.restart();
+        gpu_tracer.uploadScene(scene, bvh, mesh_bvh);
+        gl->glFinish();
+        const auto upload_ms = elapsedMs(timer);
+
+        std::printf("Scene %s: %d objects, generate %.2f ms, BVH %.2f ms, upload %.2f ms\n",
+                    scene_spec.toLocal8Bit().constData(), int(scene.objects.size()),
+                    generate_ms, build_ms, upload_ms);
+
+        scenes_json.append(QJsonObject {
+            {"scene", scene_spec},
+            {"objects", int(scene.objects.size())},
+            {"bvh_nodes", int(bvh.getNodes().size())},
+            {"generate_ms", generate_ms},
+            {"bvh_build_ms", build_ms},
+            {"upload_ms", upload_ms}
+        });
+
+        std::vector<BenchCase> cases;
+        for (const auto wavefront: {false, true}) {
+            if (wavefront ? opts.wavefront : opts.fragment) {
+                const auto pipeline_cases = benchCases(scene_spec, opts.quick, wavefront);
+                cases.insert(cases.end(), pipeline_cases.begin(), pipeline_cases.end());
+            }
+        }
+
+        for (const auto &bench_case: cases) {
+            gpu_tracer.setWavefrontEnabled(bench_case.wavefront);
+            for (int i = 0; i < opts.num_of_warmup_frames; i++) {
+                gpu_tracer.render(bench_case.settings, camera, opts.size);
+            }
+            gl->glFinish();
+
+            std::vector<double> frame_ms;
+            for (int i = 0; i < opts.num_of_frames; i++) {
+                timer.restart();
+                gpu_tracer.render(bench_case.settings, camera, opts.size);
+                gl->glFinish();
+                frame_ms.push_back(elapsedMs(timer));
+            }
+
+            const auto stats = computeStats(frame_ms);
+            // Only primary rays are counted: secondary rays depend on the scene and are not tracked.
+            const auto rays_per_second = num_of_pixels * bench_case.settings.num_of_samples / (stats.p50 * 1e-3);
+
+            std::printf("  %-60s p50 %8.3f ms  p99 %8.3f ms  %8.2f Mrays/s\n",
+                        bench_case.key().toLocal8Bit().constData(), stats.p50, stats.p99, rays_per_second * 1e-6);
+
+            cases_json.append(QJsonObject {
+                {"key", bench_case.key()},
+                {"scene", scene_spec},
+                {"pipeline", bench_case.wavefront ? "wavefront" : "fragment"},
+                {"depth", bench_case.settings.num_of_steps},
+                {"samples", bench_case.settings.num_of_samples},
+                {"sampling", bench_case.settings.sampling_mode == SM_MULTIJITTERED ? "jittered" : "random"},
+                {"transparency", bench_case.settings.transparency_enabled},
+                {"frame_ms", statsToJson(stats)},
+                {"primary_rays_per_second", rays_per_second}
+            });
+        }
+    }
+
+    fbo.release();
+
+    const QJsonObject results {
+        {"renderer", renderer},
+        {"width", opts.size.width()},
+        {"height", opts.size.height()},
+        {"frames", opts.num_of_frames},
+        {"warmup_frames", opts.num_of_warmup_frames},
+        {"scenes", scenes_json},
+        {"cases", cases_json}
+    };
+
+    QFile file(opts.output);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        throw std::runtime_error("Failed to write " + opts.output.toStdString());
+    }
+    file.write(QJsonDocument(results).toJson());
+    std::printf("Results: %s\n", opts.output.toLocal8Bit().constData());
+
+    if (!opts.baseline.isEmpty()) {
+        const auto num_of_regressions = compareWithBaseline(results, loadJson(opts.baseline), opts.threshold);
+        return (num_of_regressions > 0 ? 2 : 0);
+    }
+    return 0;
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    QGuiApplication app(argc, argv);
+    QCoreApplication::setApplicationName("RtRtBench");
+
+    try {
+        return run(parseOptions(app));
+    }
+    catch (const std::exception &e) {
+        std::fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+}
@@ -0,0 +1,7 @@
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    RtRt \
+    RtRtBatch \
+    RtRtBench \
+    tests
@@ -0,0 +1,12 @@
+QT += core gui testlib
+CONFIG += c++14 console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_bvh
+TEMPLATE = app
+
+QMAKE_LFLAGS += -no-pie
+
+include(../../RtRt/core.pri)
+
+SOURCES += tst_bvh.cpp
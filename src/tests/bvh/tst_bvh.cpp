@@ -0,0 +1,290 @@
+#include "accel/bvh.h"
+#include "objects/scene.h"
+
+#include <QtTest>
+
+#include <random>
+#include <set>
+#include <vector>
+
+namespace {
+
+Sphere randomSphere(std::mt19937 &re) {
+    std::uniform_real_distribution<float> position(-10.0f, 10.0f);
+    std::uniform_real_distribution<float> radius(0.1f, 0.5f);
+    return Sphere {{position(re), position(re), position(re)}, radius(re), 0};
+}
+
+Scene randomScene(int num_of_spheres, std::mt19937 &re) {
+    Scene scene;
+    scene.addMaterial(Material());
+    for (int i = 0; i < num_of_spheres; i++) {
+        scene.addObject(randomSphere(re));
+    }
+    scene.resetChanges();
+    return scene;
+}
+
+bool contains(const BVH::Node &node, const Sphere &sphere) {
+    const auto r = static_cast<float>(sphere.radius);
+    for (int axis = 0; axis < 3; axis++) {
+        if (sphere.position[axis] - r < node.min[axis] || sphere.position[axis] + r > node.max[axis]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Stackless traversal (as in the shaders) into the nodes containing the sphere: reaches its leaf
+// only if all the nodes above it contain the sphere too.
+bool findsSphere(const BVH &bvh, const std::vector<Sphere> &spheres, int sphere_id) {
+    const auto &nodes = bvh.getNodes();
+    const auto &indices = bvh.getIndices();
+    const auto &sphere = spheres[sphere_id];
+    int node = 0;
+    while (node < static_cast<int>(nodes.size())) {
+        if (!contains(nodes[node], sphere)) {
+            node = nodes[node].skip(node);
+            continue;
+        }
+        if (nodes[node].isLeaf()) {
+            for (int i = nodes[node].first_or_skip; i < nodes[node].first_or_skip + nodes[node].count; i++) {
+                if (indices[i] == sphere_id) {
+                    return true;
+                }
+            }
+        }
+        node++;
+    }
+    return false;
+}
+
+bool findsEverySphere(const BVH &bvh, const std::vector<Sphere> &spheres) {
+    for (int i = 0; i < static_cast<int>(spheres.size()); i++) {
+        if (!findsSphere(bvh, spheres, i)) {
+            qWarning("Sphere %d is not found", i);
+            return false;
+        }
+    }
+    return true;
+}
+
+int leafOf(const BVH &bvh, int sphere_id) {
+    const auto &nodes = bvh.getNodes();
+    const auto &indices = bvh.getIndices();
+    for (int node = 0; node < static_cast<int>(nodes.size()); node++) {
+        if (nodes[node].isLeaf()) {
+            for (int i = nodes[node].first_or_skip; i < nodes[node].first_or_skip + nodes[node].count; i++) {
+                if (indices[i] == sphere_id) {
+                    return node;
+                }
+            }
+        }
+    }
+    return -1;
+}
+
+// The leaf and the internal nodes whose subtree contains it.
+std::set<int> pathTo(const BVH &bvh, int leaf) {
+    const auto &nodes = bvh.getNodes();
+    std::set<int> path {leaf};
+    for (int node = 0; node < leaf; node++) {
+        if (!nodes[node].isLeaf() && leaf < nodes[node].first_or_skip) {
+            path.insert(node);
+        }
+    }
+    return path;
+}
+
+std::set<int> elements(const DirtyRanges &ranges) {
+    std::set<int> result;
+    for (const auto &range: ranges) {
+        for (int i = range.begin; i < range.end; i++) {
+            result.insert(i);
+        }
+    }
+    return result;
+}
+
+std::set<int> interval(int begin, int end) {
+    std::set<int> result;
+    for (int i = begin; i < end; i++) {
+        result.insert(i);
+    }
+    return result;
+}
+
+bool sameNode(const BVH::Node &a, const BVH::Node &b) {
+    return a.min == b.min && a.max == b.max && a.first_or_skip == b.first_or_skip && a.count == b.count;
+}
+
+}
+
+class TestBvh : public QObject {
+    Q_OBJECT
+
+private slots:
+    void buildFindsEverySphere();
+    void refitFindsMovedSpheres();
+    void refitMarksOnlyThePathToTheLeaf();
+    void appendFindsNewSpheres();
+    void rebuildsAfterTooManyAppendedLeaves();
+    void editAndAppendMarkOnlyTheirNodes();
+    void removalRebuilds();
+};
+
+void TestBvh::buildFindsEverySphere() {
+    std::mt19937 re(1);
+    const auto scene = randomScene(300, re);
+    BVH bvh;
+    bvh.build(scene.objects);
+    QVERIFY(findsEverySphere(bvh, scene.objects));
+    QCOMPARE(elements(bvh.getChanges().nodes), interval(0, int(bvh.getNodes().size())));
+    QCOMPARE(elements(bvh.getChanges().indices), interval(0, 300));
+}
+
+void TestBvh::refitFindsMovedSpheres() {
+    std::mt19937 re(2);
+    auto scene = randomScene(300, re);
+    BVH bvh;
+    bvh.build(scene.objects);
+    const auto num_of_nodes = bvh.getNodes().size();
+
+    // Far enough to leave their leaves.
+    for (int i = 0; i < 300; i += 30) {
+        auto sphere = scene.objects[i];
+        sphere.position = -sphere.position + QVector3D(5.0f, 0.0f, 0.0f);
+        scene.setObject(i, sphere);
+    }
+    bvh.resetChanges();
+    bvh.update(scene.objects, scene.getChanges().objects);
+
+    QCOMPARE(bvh.getNodes().size(), num_of_nodes);
+    QVERIFY(bvh.getChanges().indices.empty());
+    QVERIFY(findsEverySphere(bvh, scene.objects));
+}
+
+void TestBvh::refitMarksOnlyThePathToTheLeaf() {
+    std::mt19937 re(3);
+    auto scene = randomScene(64, re);
+    BVH bvh;
+    bvh.build(scene.objects);
+    const auto nodes_before = bvh.getNodes();
+
+    const int moved = 17;
+    auto sphere = scene.objects[moved];
+    sphere.position += QVector3D(0.5f, 0.5f, 0.5f);
+    scene.setObject(moved, sphere);
+    bvh.resetChanges();
+    bvh.update(scene.objects, scene.getChanges().objects);
+
+    const auto path = pathTo(bvh, leafOf(bvh, moved));
+    QVERIFY(int(path.size()) <= DirtyRanges::MAX_RANGES);
+    QCOMPARE(elements(bvh.getChanges().nodes), path);
+    for (int i = 0; i < static_cast<int>(nodes_before.size()); i++) {
+        if (!path.count(i)) {
+            QVERIFY(sameNode(bvh.getNodes()[i], nodes_before[i]));
+        }
+    }
+    QVERIFY(findsEverySphere(bvh, scene.objects));
+}
+
+void TestBvh::appendFindsNewSpheres() {
+    std::mt19937 re(4);
+    auto scene = randomScene(100, re);
+    BVH bvh;
+    bvh.build(scene.objects);
+    const auto tree = bvh.getNodes();
+
+    for (int i = 0; i < 10; i++) {
+        scene.addObject(randomSphere(re));
+    }
+    bvh.resetChanges();
+    bvh.update(scene.objects, scene.getChanges().objects);
+
+    // The tree is kept, the new spheres are in leaves after it.
+    QVERIFY(bvh.getNodes().size() > tree.size());
+    for (int i = 0; i < static_cast<int>(tree.size()); i++) {
+        QVERIFY(sameNode(bvh.getNodes()[i], tree[i]));
+    }
+    QCOMPARE(elements(bvh.getChanges().nodes), interval(int(tree.size()), int(bvh.getNodes().size())));
+    QCOMPARE(elements(bvh.getChanges().indices), interval(100, 110));
+    QVERIFY(findsEverySphere(bvh, scene.objects));
+}
+
+void TestBvh::rebuildsAfterTooManyAppendedLeaves() {
+    // With one sphere per leaf, each appended sphere gets a leaf of its own.
+    const int max_appended_leaves = 16;
+    std::mt19937 re(5);
+    auto scene = randomScene(50, re);
+    BVH bvh;
+    bvh.setMaxLeafSize(1);
+    bvh.build(scene.objects);
+    const auto tree_size = static_cast<int>(bvh.getNodes().size());
+
+    for (int i = 1; i <= max_appended_leaves; i++) {
+        scene.resetChanges();
+        scene.addObject(randomSphere(re));
+        bvh.resetChanges();
+        bvh.update(scene.objects, scene.getChanges().objects);
+        QCOMPARE(int(bvh.getNodes().size()), tree_size + i);
+        QCOMPARE(elements(bvh.getChanges().nodes), interval(tree_size + i - 1, tree_size + i));
+    }
+    QVERIFY(findsEverySphere(bvh, scene.objects));
+
+    scene.resetChanges();
+    scene.addObject(randomSphere(re));
+    bvh.resetChanges();
+    bvh.update(scene.objects, scene.getChanges().objects);
+
+    BVH rebuilt;
+    rebuilt.setMaxLeafSize(1);
+    rebuilt.build(scene.objects);
+    QCOMPARE(bvh.getNodes().size(), rebuilt.getNodes().size());
+    QCOMPARE(elements(bvh.getChanges().nodes), interval(0, int(bvh.getNodes().size())));
+    QCOMPARE(elements(bvh.getChanges().indices), interval(0, int(scene.objects.size())));
+    QVERIFY(findsEverySphere(bvh, scene.objects));
+}
+
+void TestBvh::editAndAppendMarkOnlyTheirNodes() {
+    std::mt19937 re(6);
+    auto scene = randomScene(64, re);
+    BVH bvh;
+    bvh.build(scene.objects);
+    const auto num_of_nodes = static_cast<int>(bvh.getNodes().size());
+
+    auto sphere = scene.objects[0];
+    sphere.position += QVector3D(0.25f, 0.0f, 0.0f);
+    scene.setObject(0, sphere);
+    scene.addObject(randomSphere(re));
+    QCOMPARE(elements(scene.getChanges().objects), (std::set<int> {0, 64}));
+
+    bvh.resetChanges();
+    bvh.update(scene.objects, scene.getChanges().objects);
+
+    auto expected = pathTo(bvh, leafOf(bvh, 0));
+    expected.insert(num_of_nodes);
+    QCOMPARE(leafOf(bvh, 64), num_of_nodes);
+    QCOMPARE(elements(bvh.getChanges().nodes), expected);
+    QCOMPARE(elements(bvh.getChanges().indices), interval(64, 65));
+    QVERIFY(findsEverySphere(bvh, scene.objects));
+}
+
+void TestBvh::removalRebuilds() {
+    std::mt19937 re(7);
+    auto scene = randomScene(40, re);
+    BVH bvh;
+    bvh.build(scene.objects);
+
+    scene.objects.resize(30);
+    bvh.resetChanges();
+    bvh.update(scene.objects, DirtyRanges());
+
+    QCOMPARE(int(bvh.getIndices().size()), 30);
+    QCOMPARE(elements(bvh.getChanges().indices), interval(0, 30));
+    QVERIFY(findsEverySphere(bvh, scene.objects));
+}
+
+QTEST_APPLESS_MAIN(TestBvh)
+
+#include "tst_bvh.moc"
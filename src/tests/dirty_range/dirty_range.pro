@@ -0,0 +1,10 @@
+QT += core testlib
+CONFIG += c++14 console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_dirty_range
+TEMPLATE = app
+
+INCLUDEPATH += ../../RtRt
+
+SOURCES += tst_dirty_range.cpp
@@ -0,0 +1,107 @@
+#include "objects/dirty_range.h"
+
+#include <QtTest>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace {
+
+std::vector<std::pair<int, int>> toPairs(const DirtyRanges &ranges) {
+    std::vector<std::pair<int, int>> pairs;
+    for (const auto &range: ranges) {
+        pairs.emplace_back(range.begin, range.end);
+    }
+    return pairs;
+}
+
+}
+
+class TestDirtyRange : public QObject {
+    Q_OBJECT
+
+private slots:
+    void emptyRangesAreIgnored();
+    void disjointRangesStayApart();
+    void touchingRangesAreMerged();
+    void rangeCoveringOthersReplacesThem();
+    void nearestRangesAreMergedPastTheLimit();
+    void addsOtherRanges();
+};
+
+void TestDirtyRange::emptyRangesAreIgnored() {
+    DirtyRanges ranges;
+    ranges.add(5, 5);
+    ranges.add(7, 3);
+    QVERIFY(ranges.empty());
+    QCOMPARE(ranges.size(), 0);
+}
+
+void TestDirtyRange::disjointRangesStayApart() {
+    // An edit of the first element and an append at the end.
+    DirtyRanges ranges;
+    ranges.add(1000);
+    ranges.add(0);
+    ranges.add(500, 502);
+    const std::vector<std::pair<int, int>> expected {{0, 1}, {500, 502}, {1000, 1001}};
+    QVERIFY(toPairs(ranges) == expected);
+    QCOMPARE(ranges.size(), 4);
+}
+
+void TestDirtyRange::touchingRangesAreMerged() {
+    DirtyRanges ranges;
+    ranges.add(0, 2);
+    ranges.add(4, 6);
+    // Adjacent to the first one, overlapping the second one.
+    ranges.add(2, 5);
+    const std::vector<std::pair<int, int>> expected {{0, 6}};
+    QVERIFY(toPairs(ranges) == expected);
+
+    ranges.add(6);
+    QVERIFY(toPairs(ranges) == (std::vector<std::pair<int, int>> {{0, 7}}));
+}
+
+void TestDirtyRange::rangeCoveringOthersReplacesThem() {
+    DirtyRanges ranges;
+    ranges.add(2);
+    ranges.add(4);
+    ranges.add(8);
+    ranges.add(20);
+    ranges.add(1, 10);
+    const std::vector<std::pair<int, int>> expected {{1, 10}, {20, 21}};
+    QVERIFY(toPairs(ranges) == expected);
+}
+
+void TestDirtyRange::nearestRangesAreMergedPastTheLimit() {
+    DirtyRanges ranges;
+    for (int i = 0; i < DirtyRanges::MAX_RANGES; i++) {
+        ranges.add(10 * i);
+    }
+    QCOMPARE(int(toPairs(ranges).size()), DirtyRanges::MAX_RANGES);
+
+    // The gap between 50 and 52 is the smallest one.
+    ranges.add(52);
+    const auto pairs = toPairs(ranges);
+    QCOMPARE(int(pairs.size()), DirtyRanges::MAX_RANGES);
+    QVERIFY(std::find(pairs.begin(), pairs.end(), std::make_pair(50, 53)) != pairs.end());
+    QCOMPARE(pairs.front(), std::make_pair(0, 1));
+    QCOMPARE(pairs.back(), std::make_pair(10 * (DirtyRanges::MAX_RANGES - 1), 10 * (DirtyRanges::MAX_RANGES - 1) + 1));
+}
+
+void TestDirtyRange::addsOtherRanges() {
+    DirtyRanges ranges, other;
+    ranges.add(0);
+    other.add(1);
+    other.add(10, 12);
+    ranges.add(other);
+    const std::vector<std::pair<int, int>> expected {{0, 2}, {10, 12}};
+    QVERIFY(toPairs(ranges) == expected);
+
+    ranges.clear();
+    QVERIFY(ranges.empty());
+}
+
+QTEST_APPLESS_MAIN(TestDirtyRange)
+
+#include "tst_dirty_range.moc"
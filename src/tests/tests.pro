@@ -0,0 +1,8 @@
+# Unit tests (QtTest): run each one, or all of them with 'make check'.
+
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    bvh \
+    dirty_range \
+    tile_protocol
@@ -0,0 +1,17 @@
+QT += core gui testlib
+CONFIG += c++14 console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_tile_protocol
+TEMPLATE = app
+
+QMAKE_LFLAGS += -no-pie
+
+include(../../RtRt/core.pri)
+
+INCLUDEPATH += ../../RtRtBatch
+
+SOURCES += tst_tile_protocol.cpp \
+    ../../RtRtBatch/tile_protocol.cpp
+
+HEADERS += ../../RtRtBatch/tile_protocol.h
@@ -0,0 +1,126 @@
+#include "tile_protocol.h"
+
+#include <QtTest>
+
+#include <stdexcept>
+
+using namespace tile_protocol;
+
+namespace {
+
+TileResult sampleResult() {
+    TileResult result;
+    result.tile.index = 3;
+    result.tile.rect = QRect(64, 32, 4, 2);
+    result.rgb = QByteArray(4 * 2 * 3, '\x7f');
+    result.rgb[0] = '\x01';
+    result.render_ms = 12.5;
+    return result;
+}
+
+}
+
+class TestTileProtocol : public QObject {
+    Q_OBJECT
+
+private slots:
+    void lengthIsNotTakenInParts();
+    void partialFrameIsTakenWhenComplete();
+    void framesAreTakenInOrder();
+    void oversizeLengthThrows();
+    void resultRoundTrip();
+    void resultOfWrongSizeThrows();
+    void truncatedResultThrows();
+    void otherMessageIsNotAResult();
+};
+
+void TestTileProtocol::lengthIsNotTakenInParts() {
+    QByteArray received = frame(encode(Tile {1, QRect(0, 0, 8, 8)})).left(3);
+    QByteArray message;
+    QVERIFY(!takeMessage(received, message));
+    QCOMPARE(received.size(), 3);
+    QVERIFY(message.isEmpty());
+}
+
+void TestTileProtocol::partialFrameIsTakenWhenComplete() {
+    const auto result = sampleResult();
+    const auto framed = frame(encode(result));
+    QByteArray received, message;
+    for (int i = 0; i + 1 < framed.size(); i++) {
+        received.append(framed[i]);
+        QVERIFY(!takeMessage(received, message));
+        QCOMPARE(received.size(), i + 1);
+    }
+    received.append(framed[framed.size() - 1]);
+    QVERIFY(takeMessage(received, message));
+    QVERIFY(received.isEmpty());
+    QCOMPARE(message, encode(result));
+}
+
+void TestTileProtocol::framesAreTakenInOrder() {
+    const auto first = encode(Tile {0, QRect(0, 0, 16, 16)});
+    const auto second = encode(sampleResult());
+    // The next message has begun to arrive too.
+    QByteArray received = frame(first) + frame(second) + frame(first).left(2);
+    QByteArray message;
+
+    QVERIFY(takeMessage(received, message));
+    QCOMPARE(message, first);
+    QVERIFY(takeMessage(received, message));
+    QCOMPARE(message, second);
+    QVERIFY(!takeMessage(received, message));
+    QCOMPARE(received.size(), 2);
+}
+
+void TestTileProtocol::oversizeLengthThrows() {
+    QByteArray received("\xff\xff\xff\xff", 4);
+    QByteArray message;
+    QVERIFY_EXCEPTION_THROWN(takeMessage(received, message), std::runtime_error);
+
+    // Rejected by its length alone, before the message arrives.
+    received = QByteArray("\x40\x00\x00\x01", 4);
+    QVERIFY_EXCEPTION_THROWN(takeMessage(received, message), std::runtime_error);
+}
+
+void TestTileProtocol::resultRoundTrip() {
+    const auto result = sampleResult();
+    const auto message = encode(result);
+    QCOMPARE(typeOf(message), MT_RESULT);
+
+    const auto decoded = decodeResult(message);
+    QCOMPARE(decoded.tile.index, result.tile.index);
+    QCOMPARE(decoded.tile.rect, result.tile.rect);
+    QCOMPARE(decoded.rgb, result.rgb);
+    QCOMPARE(decoded.render_ms, result.render_ms);
+}
+
+void TestTileProtocol::resultOfWrongSizeThrows() {
+    auto result = sampleResult();
+    result.rgb.chop(1);
+    QVERIFY_EXCEPTION_THROWN(decodeResult(encode(result)), std::runtime_error);
+
+    result = sampleResult();
+    result.tile.rect.setWidth(5);
+    QVERIFY_EXCEPTION_THROWN(decodeResult(encode(result)), std::runtime_error);
+}
+
+void TestTileProtocol::truncatedResultThrows() {
+    const auto message = encode(sampleResult());
+    for (int size: {1, 5, message.size() / 2, message.size() - 1}) {
+        QVERIFY_EXCEPTION_THROWN(decodeResult(message.left(size)), std::runtime_error);
+    }
+    QVERIFY_EXCEPTION_THROWN(decodeResult(QByteArray()), std::runtime_error);
+}
+
+void TestTileProtocol::otherMessageIsNotAResult() {
+    QVERIFY_EXCEPTION_THROWN(decodeResult(encode(Tile {2, QRect(0, 0, 4, 2)})), std::runtime_error);
+
+    QByteArray unknown = encode(sampleResult());
+    unknown[0] = char(MT_RESULT + 1);
+    QVERIFY_EXCEPTION_THROWN(typeOf(unknown), std::runtime_error);
+    QVERIFY_EXCEPTION_THROWN(decodeResult(unknown), std::runtime_error);
+}
+
+QTEST_APPLESS_MAIN(TestTileProtocol)
+
+#include "tst_tile_protocol.moc"